@@ -381,6 +381,107 @@ class VNSAuthStatus(LTMessage):
         return 'AUTH_STATUS: ' + ' auth_ok=%s msg=%s' % (str(self.auth_ok), self.msg)
 VNS_MESSAGES.append(VNSAuthStatus)
 
+class VNSCaps(LTMessage):
+    """Capability offer (server) or acceptance (client).  The server sends it
+    after VNSHardwareInfo; a client that knows it answers with the subset it
+    will use.  Old clients ignore it, so nothing is used until they answer."""
+    PACKET_BATCH = 0x00000001
+
+    @staticmethod
+    def get_type():
+        return 1024
+
+    def __init__(self, caps):
+        LTMessage.__init__(self)
+        self.caps = int(caps)
+
+    def length(self):
+        return VNSCaps.SIZE
+
+    FORMAT = '> I'
+    SIZE = struct.calcsize(FORMAT)
+
+    def pack(self):
+        return struct.pack(VNSCaps.FORMAT, self.caps)
+
+    @staticmethod
+    def unpack(body):
+        t = struct.unpack(VNSCaps.FORMAT, body[:VNSCaps.SIZE])
+        return VNSCaps(t[0])
+
+    def __str__(self):
+        return 'CAPS: 0x%08x' % self.caps
+VNS_MESSAGES.append(VNSCaps)
+
+class VNSPacketBatch(LTMessage):
+    """Several VNSPackets in one message, only sent to a peer that agreed to
+    VNSCaps.PACKET_BATCH."""
+    @staticmethod
+    def get_type():
+        return 2048
+
+    MAX_LEN = 64 * 1024  # whole message, header included
+
+    def __init__(self, packets):
+        """packets is a list of (intf_name, ethernet_frame) tuples"""
+        LTMessage.__init__(self)
+        self.packets = packets
+
+    def length(self):
+        return VNSPacketBatch.HEADER_SIZE + \
+               sum(VNSPacketBatch.ENTRY_SIZE + len(frame) for _, frame in self.packets)
+
+    HEADER_FORMAT = '> I'
+    HEADER_SIZE = struct.calcsize(HEADER_FORMAT)
+    ENTRY_FORMAT = '> 16s I'
+    ENTRY_SIZE = struct.calcsize(ENTRY_FORMAT)
+
+    def pack(self):
+        parts = [struct.pack(VNSPacketBatch.HEADER_FORMAT, len(self.packets))]
+        for intf_name, frame in self.packets:
+            parts.append(struct.pack(VNSPacketBatch.ENTRY_FORMAT, intf_name, len(frame)))
+            parts.append(frame)
+        return ''.join(parts)
+
+    @staticmethod
+    def unpack(body):
+        count = struct.unpack(VNSPacketBatch.HEADER_FORMAT, body[:VNSPacketBatch.HEADER_SIZE])[0]
+        off = VNSPacketBatch.HEADER_SIZE
+        packets = []
+        for i in xrange(count):
+            end = off + VNSPacketBatch.ENTRY_SIZE
+            if end > len(body):
+                raise VNSProtocolException('truncated packet batch entry %d' % i)
+            intf_name, flen = struct.unpack(VNSPacketBatch.ENTRY_FORMAT, body[off:end])
+            if end + flen > len(body):
+                raise VNSProtocolException('truncated packet batch frame %d' % i)
+            packets.append((strip_null_chars(intf_name), body[end:end+flen]))
+            off = end + flen
+        return VNSPacketBatch(packets)
+
+    @staticmethod
+    def get_batches(packets):
+        """Split a list of (intf_name, ethernet_frame) into VNSPacketBatch
+        messages that each fit in MAX_LEN."""
+        msgs = []
+        cur = []
+        size = 8 + VNSPacketBatch.HEADER_SIZE
+        for intf_name, frame in packets:
+            need = VNSPacketBatch.ENTRY_SIZE + len(frame)
+            if cur and size + need > VNSPacketBatch.MAX_LEN:
+                msgs.append(VNSPacketBatch(cur))
+                cur = []
+                size = 8 + VNSPacketBatch.HEADER_SIZE
+            cur.append((intf_name, frame))
+            size += need
+        if cur:
+            msgs.append(VNSPacketBatch(cur))
+        return msgs
+
+    def __str__(self):
+        return 'PACKET_BATCH: %u packets' % len(self.packets)
+VNS_MESSAGES.append(VNSPacketBatch)
+
 VNS_PROTOCOL = LTProtocol(VNS_MESSAGES, 'I', 'I')
 
 def create_vns_server(port, recv_callback, new_conn_callback, lost_conn_callback, verbose=True):
@@ -23,6 +23,7 @@ from twisted.internet import reactor
 from VNSProtocol import VNS_DEFAULT_PORT, create_vns_server
 from VNSProtocol import VNSOpen, VNSClose, VNSPacket, VNSOpenTemplate, VNSBanner
 from VNSProtocol import VNSRtable, VNSAuthRequest, VNSAuthReply, VNSAuthStatus, VNSInterface, VNSHardwareInfo
+from VNSProtocol import VNSCaps, VNSPacketBatch
 
 log = core.getLogger()
 
@@ -46,6 +47,10 @@ class SRServerListener(EventMixin):
     port = address[1]
     self.listenTo(core.cs144_ofhandler)
     self.srclients = []
+    # clients that agreed to VNSPacketBatch -> packets waiting to go out,
+    # filled from the POX thread and drained from the reactor thread
+    self.batch_clients = {}
+    self.batch_lock = threading.Lock()
     self.listen_port = port
     self.intfname_to_port = {}
     self.port_to_intfname = {}
@@ -61,6 +66,34 @@ class SRServerListener(EventMixin):
     for client in self.srclients:
       client.send(message)
 
+  def broadcast_packet(self, intfname, pkt):
+    # clients that take batches get every packet that shows up before the
+    # reactor next runs in one VNSPacketBatch, the rest one VNSPacket each
+    single = None
+    for client in self.srclients:
+      with self.batch_lock:
+        pending = self.batch_clients.get(client)
+        if pending is not None:
+          if not pending:
+            reactor.callFromThread(self._flush_batch, client)
+          pending.append((intfname, str(pkt)))
+          continue
+      if single is None:
+        single = VNSPacket(intfname, pkt)
+      client.send(single)
+
+  def _flush_batch(self, client):
+    with self.batch_lock:
+      pending = self.batch_clients.get(client)
+      if not pending:
+        return
+      self.batch_clients[client] = []
+    if len(pending) == 1:
+      client.send(VNSPacket(*pending[0]))
+      return
+    for msg in VNSPacketBatch.get_batches(pending):
+      client.send(msg)
+
   def _handle_SRPacketIn(self, event):
     #log.debug("SRServerListener catch SRPacketIn event, port=%d, pkt=%r" % (event.port, event.pkt))
     try:
@@ -69,7 +102,7 @@ class SRServerListener(EventMixin):
         log.debug("Couldn't find interface for portnumber %s" % event.port)
         return
     print "srpacketin, packet=%s" % ethernet(event.pkt)
-    self.broadcast(VNSPacket(intfname, event.pkt))
+    self.broadcast_packet(intfname, event.pkt)
 
   def _handle_RouterInfo(self, event):
     log.debug("SRServerListener catch RouterInfo even, info=%s, rtable=%s", event.info, event.rtable)
@@ -103,6 +136,10 @@ class SRServerListener(EventMixin):
       self._handle_close_msg(conn)
     elif vns_msg.get_type() == VNSPacket.get_type():
       self._handle_packet_msg(conn, vns_msg)
+    elif vns_msg.get_type() == VNSPacketBatch.get_type():
+      self._handle_packet_batch_msg(conn, vns_msg)
+    elif vns_msg.get_type() == VNSCaps.get_type():
+      self._handle_caps_msg(conn, vns_msg)
     elif vns_msg.get_type() == VNSOpenTemplate.get_type():
       # TODO: see if this is needed...
       self._handle_open_template_msg(conn, vns_msg)
@@ -124,6 +161,8 @@ class SRServerListener(EventMixin):
 
   def _handle_client_disconnected(self, conn):
     log.info("disconnected")
+    with self.batch_lock:
+      self.batch_clients.pop(conn, None)
     conn.transport.loseConnection()
     return
 
@@ -134,21 +173,33 @@ class SRServerListener(EventMixin):
       conn.send(VNSHardwareInfo(self.interfaces))
     except:
       log.debug('interfaces not populated yet')  
+      return
+    # offer extensions, old clients just ignore this
+    conn.send(VNSCaps(VNSCaps.PACKET_BATCH))
     return
 
+  def _handle_caps_msg(self, conn, vns_msg):
+    if vns_msg.caps & VNSCaps.PACKET_BATCH:
+      log.debug('client %s takes packet batches' % conn)
+      self.batch_clients.setdefault(conn, [])
+
   def _handle_close_msg(self, conn):
     conn.send("Goodbyte!") # spelling mistake intended...
     conn.transport.loseConnection()
     return
 
   def _handle_packet_msg(self, conn, vns_msg):
-    out_intf = vns_msg.intf_name
-    pkt = vns_msg.ethernet_frame
+    self._packet_out(vns_msg.intf_name, vns_msg.ethernet_frame)
+
+  def _handle_packet_batch_msg(self, conn, vns_msg):
+    for out_intf, pkt in vns_msg.packets:
+      self._packet_out(out_intf, pkt)
 
+  def _packet_out(self, out_intf, pkt):
     try:
       out_port = self.intfname_to_port[out_intf]
     except KeyError:
-      log.debug('packet-out through wrong port number %s' % out_port)
+      log.debug('packet-out through wrong interface %s' % out_intf)
       return
     log.debug("packet-out %s: %r" % (out_intf, pkt))
     #log.debug("packet-out %s: " % ethernet(raw=pkt))
@@ -0,0 +1,622 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_acl.c
+ *
+ * Description:
+ *
+ * ACL rules and the tuple space classifier, see sr_acl.h.
+ *
+ * A compiled list keeps its own copy of the rules that apply to it, in
+ * file order, so a rule's index is also its priority.  Each tuple has an
+ * open addressing table of entries, one per distinct (masked source,
+ * masked destination, protocol), and every entry a run of rule indices
+ * in priority order; the port ranges are checked along that run.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <limits.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_acl.h"
+#include "sr_router.h"
+
+#define SR_ACL_LINE 256
+
+struct sr_acl_entry
+{
+    uint32_t src, dst;          /* masked */
+    uint16_t proto;
+    uint32_t first;             /* into tuple->rules */
+    uint32_t n;
+};
+
+struct sr_acl_tuple
+{
+    uint32_t smask, dmask;
+    uint16_t pmask;             /* 0xffff, or 0 for any protocol */
+    int best;                   /* lowest rule index in the tuple */
+    unsigned int mask;          /* slots - 1 */
+    uint32_t* slots;            /* entry index + 1, 0 if empty */
+    struct sr_acl_entry* entries;
+    int nentries;
+    int* rules;
+};
+
+struct sr_acl
+{
+    struct sr_acl_rule* rules;
+    int nrules;
+    struct sr_acl_tuple* tuples;    /* by best rule, as they are made */
+    int ntuples;
+};
+
+static __inline__ uint32_t sr_acl_mask(int len)
+{
+    return len ? 0xffffffffU << (32 - len) : 0;
+} /* -- sr_acl_mask -- */
+
+static __inline__ unsigned int sr_acl_hash(uint32_t src, uint32_t dst,
+                                           uint16_t proto)
+{
+    unsigned int h = src * 0x9e3779b1U ^ dst * 0x85ebca6bU ^
+                     proto * 0xc2b2ae35U;
+
+    return h ^ (h >> 15);
+} /* -- sr_acl_hash -- */
+
+/*-----------------------------------------------------------------------------
+ * Rules
+ *---------------------------------------------------------------------------*/
+
+static int sr_acl_parse_prefix(const char* s, uint32_t* addr, uint8_t* len)
+{
+    char buf[32], *slash;
+    struct in_addr in;
+    long l = 32;
+
+    if (strcmp(s, "any") == 0)
+    {
+        *addr = 0;
+        *len  = 0;
+        return 0;
+    }
+    strncpy(buf, s, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = 0;
+    if ((slash = strchr(buf, '/')) != 0)
+    {
+        *slash++ = 0;
+        l = strtol(slash, &slash, 10);
+        if (*slash || l < 0 || l > 32)
+        { return -1; }
+    }
+    if (inet_pton(AF_INET, buf, &in) != 1)
+    { return -1; }
+
+    *len  = l;
+    *addr = ntohl(in.s_addr) & sr_acl_mask(l);
+    return 0;
+} /* -- sr_acl_parse_prefix -- */
+
+static int sr_acl_parse_ports(const char* s, uint16_t* lo, uint16_t* hi)
+{
+    char* end;
+    long a, b;
+
+    if (s == 0 || strcmp(s, "any") == 0)
+    {
+        *lo = 0;
+        *hi = 0xffff;
+        return 0;
+    }
+    a = strtol(s, &end, 10);
+    b = a;
+    if (*end == '-')
+    { b = strtol(end + 1, &end, 10); }
+    if (*end || end == s || a < 0 || b > 0xffff || a > b)
+    { return -1; }
+
+    *lo = a;
+    *hi = b;
+    return 0;
+} /* -- sr_acl_parse_ports -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_acl_parse_rule(..)
+ * Scope: Global
+ *
+ * Parse one line of a rules file.  Returns 1 for a rule, 0 for a blank or
+ * comment line, -1 if it doesn't parse.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_acl_parse_rule(const char* line, struct sr_acl_rule* r)
+{
+    char f[8][64];
+    char* hash;
+    char buf[SR_ACL_LINE];
+    int n;
+    long p;
+
+    strncpy(buf, line, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = 0;
+    if ((hash = strchr(buf, '#')) != 0)
+    { *hash = 0; }
+
+    n = sscanf(buf, "%63s %63s %63s %63s %63s %63s %63s %63s",
+               f[0], f[1], f[2], f[3], f[4], f[5], f[6], f[7]);
+    if (n <= 0)
+    { return 0; }
+    if (n < 6)
+    { return -1; }
+
+    memset(r, 0, sizeof(struct sr_acl_rule));
+    if (strcmp(f[0], "*") != 0)
+    { strncpy(r->iface, f[0], sr_IFACE_NAMELEN - 1); }
+
+    if (strcmp(f[1], "in") == 0)
+    { r->dir = SR_ACL_IN; }
+    else if (strcmp(f[1], "out") == 0)
+    { r->dir = SR_ACL_OUT; }
+    else
+    { return -1; }
+
+    if (strcmp(f[2], "permit") == 0)
+    { r->action = SR_ACL_PERMIT; }
+    else if (strcmp(f[2], "deny") == 0)
+    { r->action = SR_ACL_DENY; }
+    else
+    { return -1; }
+
+    if (strcmp(f[3], "any") == 0)
+    { r->proto = SR_ACL_ANY_PROTO; }
+    else if (strcmp(f[3], "icmp") == 0)
+    { r->proto = ip_protocol_icmp; }
+    else if (strcmp(f[3], "tcp") == 0)
+    { r->proto = ip_protocol_tcp; }
+    else if (strcmp(f[3], "udp") == 0)
+    { r->proto = ip_protocol_udp; }
+    else
+    {
+        p = strtol(f[3], &hash, 10);
+        if (*hash || hash == f[3] || p < 0 || p > 255)
+        { return -1; }
+        r->proto = p;
+    }
+
+    if (sr_acl_parse_prefix(f[4], &r->src, &r->slen) != 0 ||
+        sr_acl_parse_prefix(f[5], &r->dst, &r->dlen) != 0 ||
+        sr_acl_parse_ports(n > 6 ? f[6] : 0, &r->sport_lo, &r->sport_hi) != 0 ||
+        sr_acl_parse_ports(n > 7 ? f[7] : 0, &r->dport_lo, &r->dport_hi) != 0)
+    { return -1; }
+
+    return 1;
+} /* -- sr_acl_parse_rule -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_acl_load(..)
+ * Scope: Global
+ *
+ * Read a rules file.  Returns 0 and says where if it doesn't parse.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_acl_rules* sr_acl_load(const char* fname)
+{
+    struct sr_acl_rules* rs;
+    struct sr_acl_rule r;
+    char line[SR_ACL_LINE];
+    int cap = 0, lineno = 0, ret;
+    FILE* fp;
+
+    /* REQUIRES */
+    assert(fname);
+
+    if ((fp = fopen(fname, "r")) == 0)
+    {
+        perror(fname);
+        return 0;
+    }
+
+    rs = (struct sr_acl_rules*)calloc(1, sizeof(struct sr_acl_rules));
+    assert(rs);
+
+    while (fgets(line, sizeof(line), fp) != 0)
+    {
+        lineno++;
+        if ((ret = sr_acl_parse_rule(line, &r)) == 0)
+        { continue; }
+        if (ret < 0)
+        {
+            fprintf(stderr, "%s:%d: bad ACL rule\n", fname, lineno);
+            fclose(fp);
+            sr_acl_rules_free(rs);
+            return 0;
+        }
+        r.line = lineno;
+
+        if (rs->n == cap)
+        {
+            cap = cap ? cap * 2 : 64;
+            rs->r = (struct sr_acl_rule*)realloc(rs->r,
+                                         cap * sizeof(struct sr_acl_rule));
+            assert(rs->r);
+        }
+        rs->r[rs->n++] = r;
+    }
+
+    fclose(fp);
+    return rs;
+} /* -- sr_acl_load -- */
+
+void sr_acl_rules_free(struct sr_acl_rules* rs)
+{
+    if (rs)
+    {
+        free(rs->r);
+        free(rs);
+    }
+} /* -- sr_acl_rules_free -- */
+
+/*-----------------------------------------------------------------------------
+ * Classifier
+ *---------------------------------------------------------------------------*/
+
+static __inline__ int sr_acl_ports_match(const struct sr_acl_rule* r,
+                                         const struct sr_acl_key* k)
+{
+    if (r->sport_lo == 0 && r->sport_hi == 0xffff &&
+        r->dport_lo == 0 && r->dport_hi == 0xffff)
+    { return 1; }
+    if (k->frag || (k->proto != ip_protocol_tcp && k->proto != ip_protocol_udp))
+    { return 0; }
+    return k->sport >= r->sport_lo && k->sport <= r->sport_hi &&
+           k->dport >= r->dport_lo && k->dport <= r->dport_hi;
+} /* -- sr_acl_ports_match -- */
+
+static struct sr_acl_entry* sr_acl_find(const struct sr_acl_tuple* t,
+                                        uint32_t src, uint32_t dst,
+                                        uint16_t proto)
+{
+    struct sr_acl_entry* e;
+    unsigned int h = sr_acl_hash(src, dst, proto) & t->mask;
+
+    while (t->slots[h])
+    {
+        e = &t->entries[t->slots[h] - 1];
+        if (e->src == src && e->dst == dst && e->proto == proto)
+        { return e; }
+        h = (h + 1) & t->mask;
+    }
+    return 0;
+} /* -- sr_acl_find -- */
+
+/* -- fill in t's table from the rules with its masks, best first -- */
+static void sr_acl_build_tuple(struct sr_acl* acl, struct sr_acl_tuple* t,
+                               const int* tuple_of, int ti)
+{
+    struct sr_acl_rule* r;
+    struct sr_acl_entry* e;
+    unsigned int size, h;
+    int i, n = 0, *fill;
+
+    for (i = 0; i < acl->nrules; i++)
+    { n += (tuple_of[i] == ti); }
+    for (size = 8; size < 2 * (unsigned int)n; size *= 2)
+    { }
+
+    t->mask    = size - 1;
+    t->slots   = (uint32_t*)calloc(size, sizeof(uint32_t));
+    t->entries = (struct sr_acl_entry*)calloc(n, sizeof(struct sr_acl_entry));
+    t->rules   = (int*)calloc(n, sizeof(int));
+    fill       = (int*)calloc(n, sizeof(int));
+    assert(t->slots && t->entries && t->rules && fill);
+
+    /* -- one entry per key, counting its rules -- */
+    for (i = 0; i < acl->nrules; i++)
+    {
+        if (tuple_of[i] != ti)
+        { continue; }
+        r = &acl->rules[i];
+        if ((e = sr_acl_find(t, r->src, r->dst, r->proto & t->pmask)) == 0)
+        {
+            e = &t->entries[t->nentries++];
+            e->src   = r->src;
+            e->dst   = r->dst;
+            e->proto = r->proto & t->pmask;
+            h = sr_acl_hash(e->src, e->dst, e->proto) & t->mask;
+            while (t->slots[h])
+            { h = (h + 1) & t->mask; }
+            t->slots[h] = t->nentries;
+        }
+        e->n++;
+    }
+    for (i = 1; i < t->nentries; i++)
+    { t->entries[i].first = t->entries[i - 1].first + t->entries[i - 1].n; }
+
+    /* -- and each entry's rules in order -- */
+    for (i = 0; i < acl->nrules; i++)
+    {
+        if (tuple_of[i] != ti)
+        { continue; }
+        r = &acl->rules[i];
+        e = sr_acl_find(t, r->src, r->dst, r->proto & t->pmask);
+        t->rules[e->first + fill[e - t->entries]++] = i;
+    }
+
+    free(fill);
+} /* -- sr_acl_build_tuple -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_acl_compile(..)
+ * Scope: Global
+ *
+ * Compile the rules for interface iface (0: all rules regardless) and
+ * direction dir.  Returns 0 if there are none, so the caller needn't
+ * classify at all.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_acl* sr_acl_compile(const struct sr_acl_rules* rs, const char* iface,
+                              int dir)
+{
+    struct sr_acl* acl;
+    struct sr_acl_tuple* t;
+    const struct sr_acl_rule* r;
+    int i, j, *tuple_of;
+
+    /* REQUIRES */
+    assert(rs);
+
+    acl = (struct sr_acl*)calloc(1, sizeof(struct sr_acl));
+    assert(acl);
+    acl->rules = (struct sr_acl_rule*)calloc(rs->n + 1,
+                                             sizeof(struct sr_acl_rule));
+    assert(acl->rules);
+
+    for (i = 0; i < rs->n; i++)
+    {
+        r = &rs->r[i];
+        if (r->dir == dir && (iface == 0 || r->iface[0] == 0 ||
+                              strncmp(r->iface, iface, sr_IFACE_NAMELEN) == 0))
+        { acl->rules[acl->nrules++] = *r; }
+    }
+    if (acl->nrules == 0)
+    {
+        sr_acl_free(acl);
+        return 0;
+    }
+
+    /* -- tuples, numbered in order of their best rule -- */
+    tuple_of = (int*)calloc(acl->nrules, sizeof(int));
+    acl->tuples = (struct sr_acl_tuple*)calloc(acl->nrules,
+                                               sizeof(struct sr_acl_tuple));
+    assert(tuple_of && acl->tuples);
+    for (i = 0; i < acl->nrules; i++)
+    {
+        r = &acl->rules[i];
+        for (j = 0; j < acl->ntuples; j++)
+        {
+            t = &acl->tuples[j];
+            if (t->smask == sr_acl_mask(r->slen) &&
+                t->dmask == sr_acl_mask(r->dlen) &&
+                (t->pmask == 0) == (r->proto == SR_ACL_ANY_PROTO))
+            { break; }
+        }
+        if (j == acl->ntuples)
+        {
+            t = &acl->tuples[acl->ntuples++];
+            t->smask = sr_acl_mask(r->slen);
+            t->dmask = sr_acl_mask(r->dlen);
+            t->pmask = r->proto == SR_ACL_ANY_PROTO ? 0 : 0xffff;
+            t->best  = i;
+        }
+        tuple_of[i] = j;
+    }
+
+    for (j = 0; j < acl->ntuples; j++)
+    { sr_acl_build_tuple(acl, &acl->tuples[j], tuple_of, j); }
+
+    free(tuple_of);
+    return acl;
+} /* -- sr_acl_compile -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_acl_classify(..)
+ * Scope: Global
+ *
+ * Index of the first rule of acl that matches k, -1 if none does.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_acl_classify(const struct sr_acl* acl, const struct sr_acl_key* k)
+{
+    const struct sr_acl_tuple* t;
+    const struct sr_acl_entry* e;
+    int i, j, best = INT_MAX;
+
+    for (i = 0; i < acl->ntuples; i++)
+    {
+        t = &acl->tuples[i];
+        if (t->best >= best)
+        { break; }
+        if ((e = sr_acl_find(t, k->src & t->smask, k->dst & t->dmask,
+                             k->proto & t->pmask)) == 0)
+        { continue; }
+        for (j = 0; j < e->n && t->rules[e->first + j] < best; j++)
+        {
+            if (sr_acl_ports_match(&acl->rules[t->rules[e->first + j]], k))
+            {
+                best = t->rules[e->first + j];
+                break;
+            }
+        }
+    }
+
+    return best == INT_MAX ? -1 : best;
+} /* -- sr_acl_classify -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_acl_linear(..)
+ * Scope: Global
+ *
+ * sr_acl_classify() the slow way, one rule after the other.  For checking
+ * and measuring the classifier.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_acl_linear(const struct sr_acl* acl, const struct sr_acl_key* k)
+{
+    const struct sr_acl_rule* r;
+    int i;
+
+    for (i = 0; i < acl->nrules; i++)
+    {
+        r = &acl->rules[i];
+        if ((k->src & sr_acl_mask(r->slen)) == r->src &&
+            (k->dst & sr_acl_mask(r->dlen)) == r->dst &&
+            (r->proto == SR_ACL_ANY_PROTO || r->proto == k->proto) &&
+            sr_acl_ports_match(r, k))
+        { return i; }
+    }
+    return -1;
+} /* -- sr_acl_linear -- */
+
+int sr_acl_size(const struct sr_acl* acl, int* ntuples)
+{
+    if (ntuples)
+    { *ntuples = acl->ntuples; }
+    return acl->nrules;
+} /* -- sr_acl_size -- */
+
+void sr_acl_free(struct sr_acl* acl)
+{
+    int i;
+
+    if (acl == 0)
+    { return; }
+    for (i = 0; i < acl->ntuples; i++)
+    {
+        free(acl->tuples[i].slots);
+        free(acl->tuples[i].entries);
+        free(acl->tuples[i].rules);
+    }
+    free(acl->tuples);
+    free(acl->rules);
+    free(acl);
+} /* -- sr_acl_free -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_acl_attach(..)
+ * Scope: Global
+ *
+ * Compile the lists for every interface the router has.  Call once the
+ * interfaces are known.  Returns -1 if a rule names an interface that
+ * doesn't exist.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_acl_attach(struct sr_instance* sr, const struct sr_acl_rules* rs)
+{
+    struct sr_if* if_walker;
+    int i, n = 0;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(rs);
+
+    for (i = 0; i < rs->n; i++)
+    {
+        if (rs->r[i].iface[0] == 0)
+        { continue; }
+        for (if_walker = sr->if_list; if_walker; if_walker = if_walker->next)
+        {
+            if (strncmp(if_walker->name, rs->r[i].iface, sr_IFACE_NAMELEN) == 0)
+            { break; }
+        }
+        if (if_walker == 0)
+        {
+            fprintf(stderr, "ACL rule at line %d: no interface %s\n",
+                    rs->r[i].line, rs->r[i].iface);
+            return -1;
+        }
+    }
+
+    for (if_walker = sr->if_list; if_walker; if_walker = if_walker->next)
+    {
+        if (if_walker->id >= n)
+        { n = if_walker->id + 1; }
+    }
+    sr->acl = (struct sr_acl**)calloc(2 * n, sizeof(struct sr_acl*));
+    assert(sr->acl);
+    sr->acl_n = n;
+
+    for (if_walker = sr->if_list; if_walker; if_walker = if_walker->next)
+    {
+        for (i = SR_ACL_IN; i <= SR_ACL_OUT; i++)
+        {
+            sr->acl[2 * if_walker->id + i] =
+                sr_acl_compile(rs, if_walker->name, i);
+        }
+    }
+
+    return 0;
+} /* -- sr_acl_attach -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_acl_permit(..)
+ * Scope: Global
+ *
+ * Data path: 1 if the IPv4 packet ip (len bytes, header checked) may pass
+ * through interface ifid in direction dir, 0 if a rule denies it.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_acl_permit(struct sr_instance* sr, const sr_ip_hdr_t* ip,
+                  unsigned int len, int ifid, int dir)
+{
+    const struct sr_acl* acl;
+    const uint16_t* ports;
+    struct sr_acl_key k;
+    unsigned int hl;
+    int i;
+
+    if (ifid < 0 || ifid >= sr->acl_n ||
+        (acl = sr->acl[2 * ifid + dir]) == 0)
+    { return 1; }
+
+    k.src   = ntohl(ip->ip_src);
+    k.dst   = ntohl(ip->ip_dst);
+    k.proto = ip->ip_p;
+    k.frag  = (ntohs(ip->ip_off) & IP_OFFMASK) != 0;
+    k.sport = 0;
+    k.dport = 0;
+
+    hl = ip->ip_hl * 4;
+    if (!k.frag && (k.proto == ip_protocol_tcp || k.proto == ip_protocol_udp)
+        && len >= hl + 4)
+    {
+        ports   = (const uint16_t*)((const uint8_t*)ip + hl);
+        k.sport = ntohs(ports[0]);
+        k.dport = ntohs(ports[1]);
+    }
+
+    i = sr_acl_classify(acl, &k);
+    return i < 0 || acl->rules[i].action == SR_ACL_PERMIT;
+} /* -- sr_acl_permit -- */
+
+void sr_acl_detach(struct sr_instance* sr)
+{
+    int i;
+
+    for (i = 0; i < 2 * sr->acl_n; i++)
+    { sr_acl_free(sr->acl[i]); }
+    free(sr->acl);
+    sr->acl = 0;
+    sr->acl_n = 0;
+} /* -- sr_acl_detach -- */
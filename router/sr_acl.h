@@ -0,0 +1,118 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_acl.h
+ *
+ * Description:
+ *
+ * Access control lists behind "-X file".  Every rule permits or denies
+ * IPv4 packets by source and destination prefix, protocol and port
+ * ranges, on the way in through an interface or on the way out of one.
+ * One rule per line, fields separated by white space:
+ *
+ *   iface  in|out  permit|deny  proto  src  dst  [sport  [dport]]
+ *
+ *   iface   interface name, or * for all of them
+ *   proto   any | icmp | tcp | udp | NUM
+ *   src/dst any | A.B.C.D | A.B.C.D/LEN
+ *   ports   any | N | N-M, only ever match TCP and UDP
+ *
+ * e.g.  eth1 in deny tcp any 10.0.1.0/24 any 22
+ *
+ * '#' starts a comment.  The first matching rule decides; a packet no rule
+ * matches is permitted.  Ingress lists see everything that arrives,
+ * traffic for the router included, before it is looked at; egress lists
+ * see what is forwarded, once its way out is known.  Denied packets are
+ * dropped without an ICMP error.
+ *
+ * Rules are compiled per interface and direction into a tuple space
+ * classifier: rules with the same prefix lengths and the same choice of
+ * a protocol or any share a hash table keyed on the masked addresses and
+ * protocol, so a lookup costs one probe per distinct tuple rather than a
+ * test per rule.  Tuples are searched in order of their best rule and
+ * the search stops as soon as no later tuple can beat the match so far.
+ * sr_aclbench measures it against a linear scan.
+ *
+ * Nothing here calls into the rest of the router, so the classifier can
+ * be linked on its own.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_ACL_H
+#define SR_ACL_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include "sr_protocol.h"
+#include "sr_if.h"
+
+#define SR_ACL_IN  0
+#define SR_ACL_OUT 1
+
+#define SR_ACL_PERMIT 0
+#define SR_ACL_DENY   1
+
+#define SR_ACL_ANY_PROTO 0xffff
+
+/* ----------------------------------------------------------------------------
+ * struct sr_acl_rule
+ *
+ * One rule as loaded.  Addresses are in host byte order, already masked.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_acl_rule
+{
+    char     iface[sr_IFACE_NAMELEN];   /* "" for any */
+    uint8_t  dir;
+    uint8_t  action;
+    uint8_t  slen, dlen;                /* prefix lengths */
+    uint16_t proto;                     /* or SR_ACL_ANY_PROTO */
+    uint16_t sport_lo, sport_hi;
+    uint16_t dport_lo, dport_hi;
+    uint32_t src, dst;
+    int      line;                      /* in the rules file */
+};
+
+struct sr_acl_rules
+{
+    struct sr_acl_rule* r;
+    int n;
+};
+
+/* -- what a packet is classified on, addresses in host byte order -- */
+struct sr_acl_key
+{
+    uint32_t src, dst;
+    uint16_t sport, dport;              /* 0 unless TCP or UDP */
+    uint8_t  proto;
+    uint8_t  frag;                      /* not the first fragment: no ports */
+};
+
+struct sr_acl;
+struct sr_instance;
+
+/* -- rules -- */
+struct sr_acl_rules* sr_acl_load(const char* fname);
+int  sr_acl_parse_rule(const char* line, struct sr_acl_rule* );
+void sr_acl_rules_free(struct sr_acl_rules* );
+
+/* -- one compiled list; iface 0 takes the rules for every interface -- */
+struct sr_acl* sr_acl_compile(const struct sr_acl_rules* , const char* iface,
+                              int dir);
+int  sr_acl_classify(const struct sr_acl* , const struct sr_acl_key* );
+int  sr_acl_linear(const struct sr_acl* , const struct sr_acl_key* );
+int  sr_acl_size(const struct sr_acl* , int* ntuples);
+void sr_acl_free(struct sr_acl* );
+
+/* -- the router's lists, by interface id and direction -- */
+int  sr_acl_attach(struct sr_instance* , const struct sr_acl_rules* );
+int  sr_acl_permit(struct sr_instance* , const sr_ip_hdr_t* ip,
+                   unsigned int len, int ifid, int dir);
+void sr_acl_detach(struct sr_instance* );
+
+#endif /* -- SR_ACL_H -- */
@@ -0,0 +1,263 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_aclbench.c
+ *
+ * Description:
+ *
+ * Benchmark for the ACL classifier (sr_acl.h).  For each rule set size it
+ * generates random rules over a handful of prefix lengths, protocols and
+ * port ranges (none of them catch-alls), and packets half of which are
+ * built to hit some rule.  Both the compiled classifier and a linear scan
+ * classify every packet; they must agree, and the rates are reported side
+ * by side.
+ *
+ * Usage:
+ *
+ *   $ ./sr_aclbench -n 10,100,1000,10000 -p 1000000
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#include "sr_acl.h"
+
+extern char* optarg;
+
+#define DEFAULT_SIZES   "10,100,1000,10000"
+#define DEFAULT_PACKETS 1000000
+#define LINEAR_BUDGET   200000000.0     /* rule tests per linear run */
+
+/* -- destinations are rarely wide open, sources often are -- */
+static const int bench_slens[] = { 0, 0, 8, 16, 24, 24, 32, 32 };
+static const int bench_dlens[] = { 16, 24, 24, 32, 32 };
+static const uint16_t bench_ports[] = { 22, 25, 53, 80, 123, 443, 8080 };
+
+static uint32_t bench_state;
+
+static void usage(char* );
+
+/* -- xorshift, so runs with the same seed see the same rules -- */
+static uint32_t bench_rand(void)
+{
+    bench_state ^= bench_state << 13;
+    bench_state ^= bench_state >> 17;
+    bench_state ^= bench_state << 5;
+    return bench_state;
+} /* -- bench_rand -- */
+
+#define BENCH_PICK(a) (a[bench_rand() % (sizeof(a) / sizeof(a[0]))])
+
+static uint32_t bench_mask(int len)
+{
+    return len ? 0xffffffffU << (32 - len) : 0;
+} /* -- bench_mask -- */
+
+static void bench_rule(struct sr_acl_rule* r)
+{
+    unsigned int p = bench_rand() % 100;
+
+    memset(r, 0, sizeof(struct sr_acl_rule));
+    r->dir    = SR_ACL_IN;
+    r->action = bench_rand() & 1;
+    r->slen   = BENCH_PICK(bench_slens);
+    r->dlen   = BENCH_PICK(bench_dlens);
+    r->src    = (0x0a000000U | (bench_rand() & 0xffffff)) & bench_mask(r->slen);
+    r->dst    = (0x0a000000U | (bench_rand() & 0xffffff)) & bench_mask(r->dlen);
+    r->proto  = p < 25 ? SR_ACL_ANY_PROTO : p < 65 ? ip_protocol_tcp :
+                p < 90 ? ip_protocol_udp : ip_protocol_icmp;
+
+    r->sport_lo = 0;
+    r->sport_hi = 0xffff;
+    r->dport_lo = 0;
+    r->dport_hi = 0xffff;
+    if (r->proto == ip_protocol_tcp || r->proto == ip_protocol_udp)
+    {
+        p = bench_rand() % 100;
+        if (p < 50)
+        { r->dport_lo = r->dport_hi = BENCH_PICK(bench_ports); }
+        else if (p < 70)
+        {
+            r->dport_lo = 1024;
+            r->dport_hi = 1024 + bench_rand() % 64000;
+        }
+    }
+} /* -- bench_rule -- */
+
+static void bench_packet(struct sr_acl_key* k, const struct sr_acl_rules* rs)
+{
+    const struct sr_acl_rule* r;
+    unsigned int span;
+
+    k->src   = 0x0a000000U | (bench_rand() & 0xffffff);
+    k->dst   = 0x0a000000U | (bench_rand() & 0xffffff);
+    k->proto = (bench_rand() & 1) ? ip_protocol_tcp : ip_protocol_udp;
+    k->sport = 1024 + bench_rand() % 60000;
+    k->dport = BENCH_PICK(bench_ports);
+    k->frag  = 0;
+
+    /* -- half the packets aimed at a rule -- */
+    if (bench_rand() & 1)
+    {
+        r = &rs->r[bench_rand() % rs->n];
+        k->src = r->src | (bench_rand() & ~bench_mask(r->slen));
+        k->dst = r->dst | (bench_rand() & ~bench_mask(r->dlen));
+        if (r->proto != SR_ACL_ANY_PROTO)
+        { k->proto = r->proto; }
+        span = r->dport_hi - r->dport_lo + 1;
+        k->dport = r->dport_lo + bench_rand() % span;
+    }
+} /* -- bench_packet -- */
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+} /* -- bench_now -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: bench_run(..)
+ * Scope: Local
+ *
+ * One line of the report.  Returns the number of packets the two
+ * classifiers disagreed on.
+ *
+ *---------------------------------------------------------------------------*/
+
+static long bench_run(int nrules, int npkts)
+{
+    struct sr_acl_rules rs;
+    struct sr_acl_key* keys;
+    struct sr_acl* acl;
+    double t0, t_compile, t_tss, t_lin;
+    long sum = 0, bad = 0;
+    int i, ntuples, nlin, *res;
+
+    rs.n = nrules;
+    rs.r = (struct sr_acl_rule*)calloc(nrules, sizeof(struct sr_acl_rule));
+    keys = (struct sr_acl_key*)calloc(npkts, sizeof(struct sr_acl_key));
+    res  = (int*)calloc(npkts, sizeof(int));
+    if (rs.r == 0 || keys == 0 || res == 0)
+    {
+        perror("calloc(..):sr_aclbench.c::bench_run");
+        exit(1);
+    }
+    for (i = 0; i < nrules; i++)
+    { bench_rule(&rs.r[i]); }
+    for (i = 0; i < npkts; i++)
+    { bench_packet(&keys[i], &rs); }
+
+    t0 = bench_now();
+    acl = sr_acl_compile(&rs, 0, SR_ACL_IN);
+    t_compile = bench_now() - t0;
+    sr_acl_size(acl, &ntuples);
+
+    t0 = bench_now();
+    for (i = 0; i < npkts; i++)
+    { res[i] = sr_acl_classify(acl, &keys[i]); }
+    t_tss = bench_now() - t0;
+
+    nlin = npkts;
+    if (nlin > LINEAR_BUDGET / nrules)
+    { nlin = LINEAR_BUDGET / nrules; }
+    t0 = bench_now();
+    for (i = 0; i < nlin; i++)
+    {
+        if (sr_acl_linear(acl, &keys[i]) != res[i])
+        { bad++; }
+    }
+    t_lin = bench_now() - t0;
+
+    for (i = 0; i < npkts; i++)
+    { sum += res[i] >= 0; }
+
+    printf("%7d %7d %10.1f %9.2f %9.3f %8.1fx %6.1f%%\n", nrules, ntuples,
+           t_compile * 1e3, npkts / t_tss / 1e6, nlin / t_lin / 1e6,
+           (npkts / t_tss) / (nlin / t_lin), 100.0 * sum / npkts);
+
+    sr_acl_free(acl);
+    free(res);
+    free(keys);
+    free(rs.r);
+    return bad;
+} /* -- bench_run -- */
+
+int main(int argc, char** argv)
+{
+    char* sizes = DEFAULT_SIZES;
+    char* s;
+    int c, npkts = DEFAULT_PACKETS, n;
+    long bad = 0;
+
+    bench_state = 0x2545f491;
+
+    while ((c = getopt(argc, argv, "hn:p:s:")) != EOF)
+    {
+        switch (c)
+        {
+            case 'n':
+                sizes = optarg;
+                break;
+            case 'p':
+                npkts = atoi(optarg);
+                break;
+            case 's':
+                bench_state = strtoul(optarg, 0, 0) | 1;
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                exit(c == 'h' ? 0 : 1);
+        }
+    }
+    if (npkts <= 0)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    printf("%7s %7s %10s %9s %9s %9s %7s\n", "rules", "tuples",
+           "compile ms", "tss Mpps", "lin Mpps", "speedup", "hit");
+    for (s = sizes; *s; )
+    {
+        if ((n = strtol(s, &s, 10)) <= 0)
+        {
+            usage(argv[0]);
+            exit(1);
+        }
+        bad += bench_run(n, npkts);
+        if (*s == ',')
+        { s++; }
+    }
+
+    if (bad)
+    {
+        fprintf(stderr, "classifier and linear scan disagree on %ld packets\n",
+                bad);
+        return 1;
+    }
+    return 0;
+} /* -- main -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: usage(..)
+ * Scope: Local
+ *---------------------------------------------------------------------------*/
+
+static void usage(char* argv0)
+{
+    printf("ACL classifier benchmark\n");
+    printf("Format: %s [-h] [-n sizes] [-p packets] [-s seed]\n", argv0);
+    printf("   -n  comma separated rule set sizes (default %s)\n",
+           DEFAULT_SIZES);
+    printf("   -p  packets classified per size (default %d)\n",
+           DEFAULT_PACKETS);
+    printf("   -s  random seed\n");
+} /* -- usage -- */
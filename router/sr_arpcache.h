@@ -1,66 +1,12 @@
-/* This file defines an ARP cache, which is made of two structures: an ARP
-   request queue, and ARP cache entries. The ARP request queue holds data about
-   an outgoing ARP cache request and the packets that are waiting on a reply
-   to that ARP cache request. The ARP cache entries hold IP->MAC mappings and
-   are timed out every SR_ARPCACHE_TO seconds.
-
-   Pseudocode for use of these structures follows.
-
-   --
-
-   # When sending packet to next_hop_ip
-   entry = arpcache_lookup(next_hop_ip)
-
-   if entry:
-       use next_hop_ip->mac mapping in entry to send the packet
-       free entry
-   else:
-       req = arpcache_queuereq(next_hop_ip, packet, len)
-       handle_arpreq(req)
-
-   --
-
-   The handle_arpreq() function is a function you should write, and it should
-   handle sending ARP requests if necessary:
-
-   function handle_arpreq(req):
-       if difftime(now, req->sent) > 1.0
-           if req->times_sent >= 5:
-               send icmp host unreachable to source addr of all pkts waiting
-                 on this request
-               arpreq_destroy(req)
-           else:
-               send arp request
-               req->sent = now
-               req->times_sent++
-
-   --
-
-   The ARP reply processing code should move entries from the ARP request
-   queue to the ARP cache:
-
-   # When servicing an arp reply that gives us an IP->MAC mapping
-   req = arpcache_insert(ip, mac)
-
-   if req:
-       send all packets on the req->packets linked list
-       arpreq_destroy(req)
-
-   --
-
-   To meet the guidelines in the assignment (ARP requests are sent every second
-   until we send 5 ARP requests, then we send ICMP host unreachable back to
-   all packets waiting on this ARP request), you must fill out the following
-   function that is called every second and is defined in sr_arpcache.c:
-
-   void sr_arpcache_sweepreqs(struct sr_instance *sr) {
-       for each request on sr->cache.requests:
-           handle_arpreq(request)
-   }
-
-   Since handle_arpreq as defined in the comments above could destroy your
-   current request, make sure to save the next pointer before calling
-   handle_arpreq when traversing through the ARP requests linked list.
+/* This file defines the ARP cache: the master table of IP->MAC mappings,
+   written under cache.lock by the ARP handlers in sr_router.c and timed
+   out every SR_ARPCACHE_TO seconds by the timeout thread.  The forwarding
+   threads never read it directly; whoever changes it calls
+   sr_neigh_publish() to copy it into their replicas.
+
+   Packets waiting on ARP resolution, the ARP request retransmissions and
+   the ICMP host unreachables after five unanswered requests are handled
+   by sr_neigh.c; the timeout thread drives them through sr_neigh_sweep().
  */
 
 #ifndef SR_ARPCACHE_H
@@ -74,13 +20,6 @@
 #define SR_ARPCACHE_SZ    100  
 #define SR_ARPCACHE_TO    15.0
 
-struct sr_packet {
-    uint8_t *buf;               /* A raw Ethernet frame, presumably with the dest MAC empty */
-    unsigned int len;           /* Length of raw Ethernet frame */
-    char *iface;                /* The outgoing interface */
-    struct sr_packet *next;
-};
-
 struct sr_arpentry {
     unsigned char mac[6]; 
     uint32_t ip;                /* IP addr in network byte order */
@@ -88,52 +27,26 @@ struct sr_arpentry {
     int valid;
 };
 
-struct sr_arpreq {
-    uint32_t ip;
-    time_t sent;                /* Last time this ARP request was sent. You 
-                                   should update this. If the ARP request was 
-                                   never sent, will be 0. */
-    uint32_t times_sent;        /* Number of times this request was sent. You 
-                                   should update this. */
-    struct sr_packet *packets;  /* List of pkts waiting on this req to finish */
-    struct sr_arpreq *next;
-};
-
 struct sr_arpcache {
     struct sr_arpentry entries[SR_ARPCACHE_SZ];
-    struct sr_arpreq *requests;
     pthread_mutex_t lock;
     pthread_mutexattr_t attr;
+    pthread_cond_t wake;        /* cuts the timeout thread's nap short */
+    pthread_t thread;           /* the timeout thread */
+    int stop;                   /* set under lock by sr_arpcache_stop() */
 };
 
 /* Checks if an IP->MAC mapping is in the cache. IP is in network byte order. 
    You must free the returned structure if it is not NULL. */
 struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip);
 
-/* Adds an ARP request to the ARP request queue. If the request is already on
-   the queue, adds the packet to the linked list of packets for this sr_arpreq
-   that corresponds to this ARP request. The packet argument should not be
-   freed by the caller.
-
-   A pointer to the ARP request is returned; it should be freed. The caller
-   can remove the ARP request from the queue by calling sr_arpreq_destroy. */
-struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
-                         uint32_t ip,
-                         uint8_t *packet,               /* borrowed */
-                         unsigned int packet_len,
-                         char *iface);
-
-/* This method performs two functions:
-   1) Looks up this IP in the request queue. If it is found, returns a pointer
-      to the sr_arpreq with this IP. Otherwise, returns NULL.
-   2) Inserts this IP to MAC mapping in the cache, and marks it valid. */
-struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
-                                     unsigned char *mac,
-                                     uint32_t ip);
-
-/* Frees all memory associated with this arp request entry. If this arp request
-   entry is on the arp request queue, it is removed from the queue. */
-void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry);
+/* Inserts this IP to MAC mapping in the cache and marks it valid, or
+   refreshes the entry if the IP is already there.  The ARP handlers hold
+   cache->lock across this and the sr_neigh_publish() that follows it.
+   Returns 0 on success, -1 if the cache is full. */
+int sr_arpcache_insert(struct sr_arpcache *cache,
+                       unsigned char *mac,
+                       uint32_t ip);
 
 /* Prints out the ARP table. */
 void sr_arpcache_dump(struct sr_arpcache *cache);
@@ -146,7 +59,7 @@ void sr_arpcache_dump(struct sr_arpcache *cache);
 int   sr_arpcache_init(struct sr_arpcache *cache);
 int   sr_arpcache_destroy(struct sr_arpcache *cache);
 void *sr_arpcache_timeout(void *cache_ptr);
-void sr_handle_arpreq(struct sr_instance* sr /* borrowed */, struct sr_arpreq* req /* borrowed */);
+void  sr_arpcache_stop(struct sr_instance *sr);
 
 
 #endif
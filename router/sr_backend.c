@@ -0,0 +1,609 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_backend.c
+ *
+ * Description:
+ *
+ * Transport independent half of packet I/O: backend selection, the main
+ * receive loop, and sr_send_packet().  Sanity checks and packet logging
+ * that used to live in sr_vns_comm.c are done here so every backend gets
+ * them.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "sr_backend.h"
+#include "sr_capture.h"
+#include "sr_event.h"
+#include "sr_mbuf.h"
+#include "sr_worker.h"
+#include "sr_pipeline.h"
+#include "sr_qos.h"
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_log.h"
+#include "sr_protocol.h"
+
+static struct sr_backend* sr_backends[] = {
+    &sr_vns_backend,
+    &sr_shm_backend,
+    0
+};
+
+static void sr_log_packet(struct sr_instance* , uint8_t* , int ,
+                          const char* , int );
+static int  sr_arp_req_not_for_us(struct sr_instance* sr,
+                                  uint8_t * packet /* lent */,
+                                  unsigned int len,
+                                  char* interface  /* lent */);
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_backend_find(..)
+ * Scope: Global
+ *
+ * Look a backend up by name, 0 if there is no such backend.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_backend* sr_backend_find(const char* name)
+{
+    int i;
+
+    /* REQUIRES */
+    assert(name);
+
+    for (i = 0; sr_backends[i]; i++)
+    {
+        if (strcmp(sr_backends[i]->name, name) == 0)
+        { return sr_backends[i]; }
+    }
+    return 0;
+} /* -- sr_backend_find -- */
+
+void sr_backend_list(FILE* fp)
+{
+    int i;
+
+    for (i = 0; sr_backends[i]; i++)
+    { fprintf(fp, "%s%s", i ? ", " : "", sr_backends[i]->name); }
+} /* -- sr_backend_list -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_backend_open(..)
+ * Scope: Global
+ *
+ * Attach sr to the backend named by 'spec', which has the form
+ * name[:argument].  The argument is passed to the backend's open op.
+ *
+ * RETURN VALUES:
+ *
+ *  0 on success
+ *  something other than zero on error
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_backend_open(struct sr_instance* sr, const char* spec)
+{
+    char name[32];
+    const char* arg;
+    unsigned int len;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(spec);
+
+    arg = strchr(spec, ':');
+    len = arg ? (unsigned int)(arg - spec) : strlen(spec);
+    if (len >= sizeof(name))
+    { len = sizeof(name) - 1; }
+    memcpy(name, spec, len);
+    name[len] = 0;
+
+    if ((sr->backend = sr_backend_find(name)) == 0)
+    {
+        fprintf(stderr, "Unknown packet I/O backend '%s' (have: ", name);
+        sr_backend_list(stderr);
+        fprintf(stderr, ")\n");
+        return -1;
+    }
+
+    pthread_mutex_init(&(sr->tx_lock), 0);
+
+    return sr->backend->open(sr, arg ? arg + 1 : 0);
+} /* -- sr_backend_open -- */
+
+int sr_backend_get_interfaces(struct sr_instance* sr)
+{
+    /* REQUIRES */
+    assert(sr);
+    assert(sr->backend);
+
+    return sr->backend->get_interfaces(sr);
+} /* -- sr_backend_get_interfaces -- */
+
+void sr_backend_close(struct sr_instance* sr)
+{
+    /* REQUIRES */
+    assert(sr);
+
+    if (sr->backend)
+    {
+        sr->backend->close(sr);
+        pthread_mutex_destroy(&(sr->tx_lock));
+        sr->backend = 0;
+    }
+} /* -- sr_backend_close -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_backend_accept(..)
+ * Scope: Global
+ *
+ * Receive side bookkeeping for one frame: count it, drop ARP requests for
+ * other routers and log it.  Returns 1 if the frame should go on to the
+ * router, 0 if not.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_backend_accept(struct sr_instance* sr, struct sr_frame* frame)
+{
+    SR_STAT_INC(sr, rx_packets);
+
+    /* -- check if it is an ARP to another router if so drop   -- */
+    if ( sr_arp_req_not_for_us(sr, frame->buf, frame->len, frame->iface) )
+    { return 0; }
+
+    /* -- log packet -- */
+    sr_log_packet(sr, frame->buf, frame->len, frame->iface, SR_CAP_RX);
+
+    return 1;
+} /* -- sr_backend_accept -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_backend_input(..)
+ * Scope: Global
+ *
+ * Hand one received frame to the router.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_backend_input(struct sr_instance* sr, struct sr_frame* frame)
+{
+    if ( ! sr_backend_accept(sr, frame) )
+    { return; }
+
+    /* -- pass to router, student's code should take over here -- */
+    sr_handlepacket(sr, frame->buf, frame->len, frame->iface);
+} /* -- sr_backend_input -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_backend_input_burst(..)
+ * Scope: Global
+ *
+ * Hand a burst of received frames to the router, through the staged
+ * pipeline if -P is on, otherwise one frame at a time.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_backend_input_burst(struct sr_instance* sr, struct sr_frame* frames,
+                            int n)
+{
+    int i;
+
+    if (sr->pipeline)
+    {
+        sr_pipeline_input(sr, frames, n);
+        return;
+    }
+
+    for (i = 0; i < n; i++)
+    { sr_backend_input(sr, &frames[i]); }
+} /* -- sr_backend_input_burst -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_backend_run(..)
+ * Scope: Global
+ *
+ * Main receive loop.  Pulls bursts from the backend until the session
+ * ends, and either runs the router on them or hands them to the worker
+ * pool.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_backend_run(struct sr_instance* sr)
+{
+    struct sr_frame burst[SR_BURST_SIZE];
+    int n;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(sr->backend);
+
+    while ((n = sr->backend->rx_burst(sr, burst, SR_BURST_SIZE)) >= 0)
+    {
+        if (sr->workers)
+        {
+            if (n > 0)
+            { sr_workers_dispatch(sr, burst, n); }
+            continue;
+        }
+
+        /* -- let the backend batch whatever the burst sends -- */
+        if (sr->backend->flush && n > 0)
+        {
+            pthread_mutex_lock(&(sr->tx_lock));
+            sr->tx_defer = 1;
+            pthread_mutex_unlock(&(sr->tx_lock));
+        }
+
+        sr_backend_input_burst(sr, burst, n);
+
+        if (sr->backend->flush && n > 0 && sr_backend_flush(sr) != 0)
+        { break; }
+    }
+
+    return 0;
+} /* -- sr_backend_run -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_backend_flush(..)
+ * Scope: Global
+ *
+ * End a tx batch: clear tx_defer and have the backend send what it held
+ * back.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_backend_flush(struct sr_instance* sr)
+{
+    int ret = 0;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(sr->backend);
+
+    pthread_mutex_lock(&(sr->tx_lock));
+    sr->tx_defer = 0;
+    if (sr->backend->flush)
+    { ret = sr->backend->flush(sr); }
+    pthread_mutex_unlock(&(sr->tx_lock));
+
+    return ret;
+} /* -- sr_backend_flush -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_ether_addrs_match_interface(..)
+ * Scope: Local
+ *
+ * Make sure ethernet addresses are sane so we don't muck uo the system.
+ *
+ *----------------------------------------------------------------------------*/
+
+static int
+sr_ether_addrs_match_interface( uint8_t* buf, /* borrowed */
+                                const struct sr_if* iface /* borrowed */ )
+{
+    struct sr_ethernet_hdr* ether_hdr = 0;
+
+    /* -- REQUIRES -- */
+    assert(buf);
+    assert(iface);
+
+    ether_hdr = (struct sr_ethernet_hdr*)buf;
+
+    if ( memcmp( ether_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN) != 0 ){
+        SR_ERROR(SR_MOD_CORE, "** Error, source address does not match interface");
+        return 0;
+    }
+
+    /* TODO */
+    /* Check destination, hardware address.  If it is private (i.e. destined
+     * to a virtual interface) ensure it is going to the correct topology
+     * Note: This check should really be done server side ...
+     */
+
+    return 1;
+
+} /* -- sr_ether_addrs_match_interface -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_check(..)
+ * Scope: Local
+ *
+ * Log an outgoing frame and sanity check it.  Returns 1 if it may go.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_send_check(struct sr_instance* sr, uint8_t* buf,
+                         unsigned int len, const struct sr_if* iface)
+{
+    /* don't waste my time ... */
+    if ( len < sizeof(struct sr_ethernet_hdr) ){
+        SR_ERROR(SR_MOD_CORE, "** Error: packet is wayy to short");
+        SR_STAT_INC(sr, drops);
+        return 0;
+    }
+
+    /* -- log packet -- */
+    sr_log_packet(sr, buf, len, iface->name, SR_CAP_TX);
+
+    if ( ! sr_ether_addrs_match_interface( buf, iface) ){
+        SR_ERROR(SR_MOD_CORE, "*** Error: problem with ethernet header, check log");
+        SR_STAT_INC(sr, drops);
+        SR_EVENT(sr, SR_EV_DROP, SR_DROP_TX, buf, len, iface->name);
+        return 0;
+    }
+
+    return 1;
+} /* -- sr_send_check -- */
+
+/* -- the interface a frame is for, by id if it has one -- */
+static struct sr_if* sr_frame_interface(struct sr_instance* sr,
+                                        const struct sr_frame* frame)
+{
+    struct sr_if* iface;
+
+    iface = frame->ifid >= 0 ? sr_get_interface_id(sr, frame->ifid)
+                             : sr_get_interface(sr, frame->iface);
+    if ( iface == 0 )
+    {
+        SR_ERROR(SR_MOD_CORE, "** Error, interface %s, does not exist",
+                 frame->iface);
+        SR_STAT_INC(sr, drops);
+    }
+    return iface;
+} /* -- sr_frame_interface -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_packet(..)
+ * Scope: Global
+ *
+ * Send a packet (ethernet header included!) of length 'len' out of
+ * interface 'iface' through the active backend, or into its egress queues
+ * if it has them (-Q, see sr_qos.h) and can't take it right now.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_packet(struct sr_instance* sr /* borrowed */,
+                         uint8_t* buf /* borrowed */ ,
+                         unsigned int len,
+                         const char* iface /* borrowed */)
+{
+    struct sr_if* if_to_send;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(iface);
+
+    if ( (if_to_send = sr_get_interface(sr, iface)) == 0 ){
+        SR_ERROR(SR_MOD_CORE, "** Error, interface %s, does not exist", iface);
+        SR_STAT_INC(sr, drops);
+        return -1;
+    }
+
+    return sr_send_packet_if(sr, buf, len, if_to_send);
+} /* -- sr_send_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_packet_if(..)
+ * Scope: Global
+ *
+ * sr_send_packet() for a caller that already has the interface.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_packet_if(struct sr_instance* sr /* borrowed */,
+                      uint8_t* buf /* borrowed */ ,
+                      unsigned int len,
+                      struct sr_if* iface /* borrowed */)
+{
+    struct sr_frame frame;
+    int ret;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(buf);
+    assert(iface);
+    assert(sr->backend);
+
+    if ( ! sr_send_check(sr, buf, len, iface) )
+    { return -1; }
+
+    frame.buf   = buf;
+    frame.len   = len;
+    frame.iface = iface->name;
+    frame.ifid  = iface->id;
+
+    /* the ARP thread sends too */
+    pthread_mutex_lock(&(sr->tx_lock));
+    if (sr->qos && !sr_qos_pass(sr, iface, buf, len))
+    {
+        ret = sr_qos_enqueue(sr, iface, 0, buf, len);
+        pthread_mutex_unlock(&(sr->tx_lock));
+        return ret;
+    }
+    ret = sr->backend->tx_burst(sr, &frame, 1);
+    pthread_mutex_unlock(&(sr->tx_lock));
+
+    if ( ret != 1 ){
+        SR_ERROR(SR_MOD_CORE, "Error writing packet");
+        SR_STAT_INC(sr, drops);
+        return -1;
+    }
+    SR_STAT_INC(sr, tx_packets);
+
+    return 0;
+} /* -- sr_send_packet_if -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_mbuf(..)
+ * Scope: Global
+ *
+ * sr_send_packet() for a frame built in an mbuf.  Backends that can use the
+ * headroom send it without a copy.  Consumes the caller's reference, sent
+ * or not.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_mbuf(struct sr_instance* sr /* borrowed */,
+                 struct sr_mbuf* m /* consumed */,
+                 struct sr_if* iface /* borrowed */)
+{
+    struct sr_frame frame;
+    int ret;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(m);
+    assert(iface);
+    assert(sr->backend);
+
+    if ( ! sr_send_check(sr, sr_mbuf_data(m), m->len, iface) )
+    {
+        sr_mbuf_free(m);
+        return -1;
+    }
+
+    pthread_mutex_lock(&(sr->tx_lock));
+    if (sr->qos && !sr_qos_pass(sr, iface, sr_mbuf_data(m), m->len))
+    {
+        ret = sr_qos_enqueue(sr, iface, m, sr_mbuf_data(m), m->len);
+        pthread_mutex_unlock(&(sr->tx_lock));
+        return ret;
+    }
+    if (sr->backend->tx_mbuf)
+    { ret = sr->backend->tx_mbuf(sr, m, iface->name) == 0; }
+    else
+    {
+        frame.buf   = sr_mbuf_data(m);
+        frame.len   = m->len;
+        frame.iface = iface->name;
+        frame.ifid  = iface->id;
+        ret = sr->backend->tx_burst(sr, &frame, 1);
+    }
+    pthread_mutex_unlock(&(sr->tx_lock));
+    sr_mbuf_free(m);
+
+    if ( ret != 1 ){
+        SR_ERROR(SR_MOD_CORE, "Error writing packet");
+        SR_STAT_INC(sr, drops);
+        return -1;
+    }
+    SR_STAT_INC(sr, tx_packets);
+
+    return 0;
+} /* -- sr_send_mbuf -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_burst(..)
+ * Scope: Global
+ *
+ * sr_send_packet() for n frames at once: same checks and logging, but one
+ * tx_lock and one tx_burst for the lot.  Frames that fail the checks are
+ * dropped and the rest are moved down in 'frames'.  Returns the number
+ * sent; frames the -Q egress queues (sr_qos.h) take aren't counted.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_burst(struct sr_instance* sr, struct sr_frame* frames, int n)
+{
+    struct sr_if* iface;
+    int i, m = 0, ret;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(frames);
+    assert(sr->backend);
+
+    for (i = 0; i < n; i++)
+    {
+        if ((iface = sr_frame_interface(sr, &frames[i])) != 0 &&
+            sr_send_check(sr, frames[i].buf, frames[i].len, iface))
+        {
+            frames[i].ifid = iface->id;
+            frames[m++] = frames[i];
+        }
+    }
+    if (m == 0)
+    { return 0; }
+
+    pthread_mutex_lock(&(sr->tx_lock));
+    if (sr->qos)
+    {
+        /* -- frames the egress queues take go out later, by themselves -- */
+        for (i = 0, n = m, m = 0; i < n; i++)
+        {
+            iface = sr_get_interface_id(sr, frames[i].ifid);
+            if (sr_qos_pass(sr, iface, frames[i].buf, frames[i].len))
+            { frames[m++] = frames[i]; }
+            else
+            { sr_qos_enqueue(sr, iface, 0, frames[i].buf, frames[i].len); }
+        }
+    }
+    ret = m ? sr->backend->tx_burst(sr, frames, m) : 0;
+    pthread_mutex_unlock(&(sr->tx_lock));
+
+    if (ret < 0)
+    { ret = 0; }
+    if ( ret != m ){
+        SR_ERROR(SR_MOD_CORE, "Error writing packet");
+        __atomic_fetch_add(&sr->stats.drops, m - ret, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&sr->stats.tx_packets, ret, __ATOMIC_RELAXED);
+
+    return ret;
+} /* -- sr_send_burst -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_packet()
+ * Scope: Local
+ *
+ * Queue the frame for the capture writer (see sr_capture.c), if -l is on.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len,
+                          const char* iface, int dir)
+{
+    /* REQUIRES */
+    assert(sr);
+
+    if(!sr->capture)
+    {return; }
+
+    sr_capture_packet(sr->capture, buf, len, iface, dir);
+} /* -- sr_log_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_arp_req_not_for_us()
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------------*/
+
+int  sr_arp_req_not_for_us(struct sr_instance* sr,
+                           uint8_t * packet /* lent */,
+                           unsigned int len,
+                           char* interface  /* lent */)
+{
+    struct sr_if* iface = sr_get_interface(sr, interface);
+    struct sr_ethernet_hdr* e_hdr = 0;
+    struct sr_arp_hdr*       a_hdr = 0;
+
+    if (len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr) )
+    { return 0; }
+
+    assert(iface);
+
+    e_hdr = (struct sr_ethernet_hdr*)packet;
+    a_hdr = (struct sr_arp_hdr*)(packet + sizeof(struct sr_ethernet_hdr));
+
+    if ( (e_hdr->ether_type == htons(ethertype_arp)) &&
+            (a_hdr->ar_op      == htons(arp_op_request))   &&
+            (a_hdr->ar_tip     != iface->ip ) )
+    { return 1; }
+
+    return 0;
+} /* -- sr_arp_req_not_for_us -- */
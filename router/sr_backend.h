@@ -0,0 +1,116 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_backend.h
+ *
+ * Description:
+ *
+ * Packet I/O backend interface.  A backend moves raw Ethernet frames
+ * between the router and whatever stands in for the wire (the VNS server,
+ * a pcap file, an AF_PACKET ring, shared memory ...).  The router proper
+ * only ever sees sr_handlepacket() and sr_send_packet(); everything
+ * transport specific lives behind a struct sr_backend.
+ *
+ * The interface is burst oriented: rx_burst fills up to 'max' frame
+ * descriptors and tx_burst sends 'n' of them in one go.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_BACKEND_H
+#define SR_BACKEND_H
+
+#include <stdio.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_instance;
+struct sr_mbuf;
+
+/* largest burst the receive loop asks a backend for */
+#define SR_BURST_SIZE 32
+
+/* ----------------------------------------------------------------------------
+ * struct sr_frame
+ *
+ * Descriptor for one Ethernet frame.  Frames returned by rx_burst belong to
+ * the backend and stay valid until the next call to rx_burst.  Frames
+ * passed to tx_burst are borrowed for the duration of the call.
+ *
+ * The interface is always named; ifid is its id (sr_if.h) where whoever
+ * fills in the frame knows it, -1 otherwise.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_frame
+{
+    uint8_t* buf;           /* frame, ethernet header included */
+    unsigned int len;
+    char* iface;            /* interface name */
+    int ifid;               /* interface id, or -1 */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_backend
+ *
+ * Operations every backend provides.
+ *
+ *  open           - attach to the transport, 'arg' is backend specific.
+ *                   0 on success.
+ *  rx_burst       - block until at least one frame (or an event that ends
+ *                   the session) is available, then return up to 'max'
+ *                   frames.  Returns the number of frames, 0 if only
+ *                   control traffic was handled, -1 when the session is
+ *                   over.
+ *  tx_burst       - send 'n' frames, returns the number sent or -1.
+ *                   While sr->tx_defer is set the backend may hold them
+ *                   back until flush.
+ *  tx_mbuf        - optional: send one frame held in an mbuf (sr_mbuf.h)
+ *                   from 'iface'.  The backend may put its own header in
+ *                   the headroom and send straight from the buffer; it
+ *                   stays the caller's.  0 on success.
+ *  flush          - push out anything tx_burst held back, 0 on success.
+ *                   Optional; called after every receive burst.
+ *  get_interfaces - populate sr->if_list, returns the interface count or
+ *                   -1 on error.
+ *  poll_fd        - descriptor that becomes readable when rx_burst would
+ *                   not block, -1 if the backend must be polled.
+ *  close          - release the transport.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_backend
+{
+    const char* name;
+    int  (*open)(struct sr_instance* , const char* );
+    int  (*rx_burst)(struct sr_instance* , struct sr_frame* , int );
+    int  (*tx_burst)(struct sr_instance* , struct sr_frame* , int );
+    int  (*tx_mbuf)(struct sr_instance* , struct sr_mbuf* , const char* );
+    int  (*flush)(struct sr_instance* );
+    int  (*get_interfaces)(struct sr_instance* );
+    int  (*poll_fd)(struct sr_instance* );
+    void (*close)(struct sr_instance* );
+};
+
+/* -- available backends -- */
+extern struct sr_backend sr_vns_backend;   /* sr_vns_comm.c */
+extern struct sr_backend sr_shm_backend;   /* sr_shm_comm.c */
+
+struct sr_backend* sr_backend_find(const char* name);
+int  sr_backend_open(struct sr_instance* , const char* spec);
+int  sr_backend_get_interfaces(struct sr_instance* );
+int  sr_backend_accept(struct sr_instance* , struct sr_frame* );
+void sr_backend_input(struct sr_instance* , struct sr_frame* );
+void sr_backend_input_burst(struct sr_instance* , struct sr_frame* , int n);
+int  sr_backend_flush(struct sr_instance* );
+int  sr_backend_run(struct sr_instance* );
+void sr_backend_close(struct sr_instance* );
+void sr_backend_list(FILE* );
+
+/* -- like sr_send_packet(), see sr_backend.c -- */
+int  sr_send_burst(struct sr_instance* , struct sr_frame* , int n);
+
+#endif /* -- SR_BACKEND_H -- */
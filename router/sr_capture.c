@@ -0,0 +1,498 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_capture.c
+ *
+ * Description:
+ *
+ * Asynchronous packet capture, see sr_capture.h.
+ *
+ * Every thread that captures gets its own single-producer ring the first
+ * time it calls sr_capture_packet() (sr_tring.h), so the data path takes
+ * no lock.  The writer thread is the single consumer of all of them, and
+ * the only
+ * thread that touches the output: classic pcap through sr_dump(), pcapng
+ * through sr_pcapng.c, or the in-memory flight recorder (sr_flight.c).
+ *
+ * In flight recorder mode the writer also watches the router counters
+ * every SR_FLIGHT_TICK_NS and dumps the recorder to a timestamped pcap
+ * when it sees
+ *
+ *   - SIGUSR1,
+ *   - a drop spike: at least SR_FLIGHT_DROP_MIN drops in a tick, making
+ *     up SR_FLIGHT_DROP_PCT percent or more of what was received,
+ *   - an ICMP unreachable burst: SR_FLIGHT_UNREACH_MIN or more sent in
+ *     a tick.
+ *
+ * After an automatic dump the anomaly triggers are held off for
+ * SR_FLIGHT_HOLDOFF_S so a sustained problem doesn't fill the disk;
+ * SIGUSR1 always dumps.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "sr_capture.h"
+#include "sr_dumper.h"
+#include "sr_filter.h"
+#include "sr_flight.h"
+#include "sr_pcapng.h"
+#include "sr_ring.h"
+#include "sr_router.h"
+#include "sr_tring.h"
+
+#define SR_CAP_RING_SLOTS   2048            /* per thread, power of two */
+#define SR_CAP_FILE_BUF     (1024*1024)     /* stdio buffer of the dump */
+#define SR_CAP_IDLE_NS      1000000         /* writer poll interval */
+#define SR_CAP_FLUSH_IDLE   100             /* fflush after this many idle polls */
+
+#define SR_FLIGHT_TICK_NS     250000000ULL  /* anomaly check interval */
+#define SR_FLIGHT_DROP_MIN    50
+#define SR_FLIGHT_DROP_PCT    5
+#define SR_FLIGHT_UNREACH_MIN 25
+#define SR_FLIGHT_HOLDOFF_S   10
+
+/* ----------------------------------------------------------------------------
+ * struct sr_cap_rec
+ *
+ * One ring slot: a frame snapped to PACKET_DUMP_SIZE plus what the writer
+ * needs to log it.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_cap_rec
+{
+    uint64_t ts_ns;             /* CLOCK_REALTIME */
+    uint32_t caplen;
+    uint32_t len;
+    char     iface[16];
+    uint8_t  dir;
+    uint8_t  data[PACKET_DUMP_SIZE];
+};
+
+struct sr_cap_ring
+{
+    struct sr_ring ring;
+    struct sr_cap_rec* recs;
+    unsigned long packets;      /* producer only */
+    unsigned long drops;        /* producer only */
+};
+
+struct sr_capture
+{
+    struct sr_tring_set rings;  /* of struct sr_cap_ring */
+    struct sr_filter* filter;
+    pthread_t writer;
+    int stop;
+    FILE* fp;                   /* classic pcap ... */
+    char* fbuf;
+    struct sr_pcapng* ng;       /* ... or pcapng */
+    unsigned long written;      /* writer only */
+    unsigned long failed;       /* writer only */
+
+    /* -- flight recorder, writer only -- */
+    struct sr_instance* sr;
+    struct sr_flight* flight;
+    char dump_base[256];        /* dumps go to base-YYYYmmdd-HHMMSS-N.ext */
+    char dump_ext[16];
+    unsigned int ndumps;
+    uint64_t next_tick;
+    uint64_t holdoff_until;
+    struct sr_stats last;       /* counters at the previous tick */
+};
+
+/* SIGUSR1 asks for a flight recorder dump */
+static volatile sig_atomic_t sr_flight_requested;
+
+/* the calling thread's ring */
+static __thread struct sr_tring_mine sr_cap_mine;
+
+static void* sr_capture_ring_create(void)
+{
+    struct sr_cap_ring* r;
+
+    r = (struct sr_cap_ring*)calloc(1, sizeof(struct sr_cap_ring));
+    assert(r);
+    r->recs = (struct sr_cap_rec*)malloc(SR_CAP_RING_SLOTS *
+                                         sizeof(struct sr_cap_rec));
+    assert(r->recs);
+    sr_ring_init(&r->ring, SR_CAP_RING_SLOTS);
+
+    return r;
+} /* -- sr_capture_ring_create -- */
+
+static void sr_capture_ring_free(void* ring)
+{
+    struct sr_cap_ring* r = (struct sr_cap_ring*)ring;
+
+    free(r->recs);
+    free(r);
+} /* -- sr_capture_ring_free -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_capture_packet(..)
+ * Scope: Global
+ *
+ * Data path: if the filter wants the frame, stamp and copy the first
+ * PACKET_DUMP_SIZE bytes into this thread's ring, or count a drop if the
+ * ring is full.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_capture_packet(struct sr_capture* cap, const uint8_t* buf,
+                       unsigned int len, const char* iface, int dir)
+{
+    struct sr_cap_ring* r;
+    struct sr_cap_rec* rec;
+    struct timespec ts;
+
+    /* REQUIRES */
+    assert(cap);
+    assert(buf);
+
+    if (cap->filter && !sr_filter_match(cap->filter, buf, len, iface))
+    { return; }
+
+    if ((r = (struct sr_cap_ring*)sr_tring_get(&cap->rings,
+                                               &sr_cap_mine)) == 0)
+    { return; }
+
+    r->packets++;
+    if (sr_ring_free(&r->ring) == 0)
+    {
+        r->drops++;
+        return;
+    }
+
+    rec = &r->recs[sr_ring_head_slot(&r->ring, 0)];
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec->ts_ns  = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    rec->len    = len;
+    rec->caplen = min(PACKET_DUMP_SIZE, len);
+    rec->dir    = dir;
+    strncpy(rec->iface, iface ? iface : "", sizeof(rec->iface) - 1);
+    rec->iface[sizeof(rec->iface) - 1] = 0;
+    memcpy(rec->data, buf, rec->caplen);
+
+    sr_ring_produce(&r->ring, 1);
+} /* -- sr_capture_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Writer thread
+ *---------------------------------------------------------------------------*/
+
+static void sr_capture_output(struct sr_capture* cap,
+                              const struct sr_cap_rec* rec)
+{
+    struct pcap_pkthdr h;
+
+    if (cap->flight)
+    {
+        sr_flight_add(cap->flight, rec->ts_ns, rec->data, rec->caplen,
+                      rec->len);
+    }
+    else if (cap->ng)
+    {
+        if (sr_pcapng_write(cap->ng, rec->ts_ns, rec->iface, rec->dir,
+                            rec->data, rec->caplen, rec->len) < 0)
+        { cap->failed++; return; }
+    }
+    else
+    {
+        h.ts.tv_sec  = rec->ts_ns / 1000000000ULL;
+        h.ts.tv_usec = (rec->ts_ns % 1000000000ULL) / 1000;
+        h.caplen     = rec->caplen;
+        h.len        = rec->len;
+        sr_dump(cap->fp, &h, rec->data);
+    }
+    cap->written++;
+} /* -- sr_capture_output -- */
+
+static void sr_capture_flush(struct sr_capture* cap)
+{
+    if (cap->ng)
+    { sr_pcapng_flush(cap->ng); }
+    else if (cap->fp)
+    { fflush(cap->fp); }
+} /* -- sr_capture_flush -- */
+
+/* write everything queued so far, returns the number of records */
+static unsigned long sr_capture_drain(struct sr_capture* cap)
+{
+    struct sr_cap_ring* r;
+    unsigned long done = 0;
+    uint32_t n, j;
+    int i, nrings;
+
+    nrings = sr_tring_count(&cap->rings);
+    for (i = 0; i < nrings; i++)
+    {
+        r = (struct sr_cap_ring*)sr_tring_at(&cap->rings, i);
+        n = sr_ring_count(&r->ring);
+        for (j = 0; j < n; j++)
+        { sr_capture_output(cap, &r->recs[sr_ring_tail_slot(&r->ring, j)]); }
+        sr_ring_consume(&r->ring, n);
+        done += n;
+    }
+
+    return done;
+} /* -- sr_capture_drain -- */
+
+/*---------------------------------------------------------------------------
+ * Flight recorder triggers
+ *-------------------------------------------------------------------------*/
+
+static void sr_flight_signal(int sig)
+{
+    sr_flight_requested = 1;
+}
+
+static uint64_t sr_capture_now(clockid_t clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+} /* -- sr_capture_now -- */
+
+static void sr_flight_dump_now(struct sr_capture* cap, const char* why)
+{
+    char fname[300];
+    char stamp[32];
+    time_t now = time(0);
+
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+    snprintf(fname, sizeof(fname), "%s-%s-%u%s", cap->dump_base, stamp,
+             ++cap->ndumps, cap->dump_ext);
+
+    if (sr_flight_dump(cap->flight, fname) == 0)
+    { fprintf(stderr, "flight recorder: %s, dumped to %s\n", why, fname); }
+} /* -- sr_flight_dump_now -- */
+
+static void sr_flight_check(struct sr_capture* cap)
+{
+    struct sr_stats now;
+    unsigned long rx, drops, unreach;
+    const char* why = 0;
+    uint64_t t;
+
+    if (sr_flight_requested)
+    {
+        sr_flight_requested = 0;
+        sr_flight_dump_now(cap, "SIGUSR1");
+    }
+
+    t = sr_capture_now(CLOCK_MONOTONIC);
+    if (t < cap->next_tick)
+    { return; }
+    cap->next_tick = t + SR_FLIGHT_TICK_NS;
+
+    sr_stats_read(cap->sr, &now);
+    rx      = now.rx_packets - cap->last.rx_packets;
+    drops   = now.drops - cap->last.drops;
+    unreach = now.icmp_unreach - cap->last.icmp_unreach;
+    cap->last = now;
+
+    if (t < cap->holdoff_until)
+    { return; }
+
+    if (drops >= SR_FLIGHT_DROP_MIN && drops * 100 >= rx * SR_FLIGHT_DROP_PCT)
+    { why = "drop spike"; }
+    else if (unreach >= SR_FLIGHT_UNREACH_MIN)
+    { why = "ICMP unreachable burst"; }
+
+    if (why)
+    {
+        sr_flight_dump_now(cap, why);
+        cap->holdoff_until = t + SR_FLIGHT_HOLDOFF_S * 1000000000ULL;
+    }
+} /* -- sr_flight_check -- */
+
+static void* sr_capture_writer(void* arg)
+{
+    struct sr_capture* cap = (struct sr_capture*)arg;
+    struct timespec idle;
+    unsigned int idle_polls = 0;
+
+    idle.tv_sec  = 0;
+    idle.tv_nsec = SR_CAP_IDLE_NS;
+
+    while (!__atomic_load_n(&cap->stop, __ATOMIC_ACQUIRE))
+    {
+        if (sr_capture_drain(cap) > 0)
+        {
+            idle_polls = 0;
+            if (cap->flight)
+            { sr_flight_check(cap); }
+            continue;
+        }
+        if (cap->flight)
+        { sr_flight_check(cap); }
+
+        /* -- quiet: get what we have to disk, then nap -- */
+        if (++idle_polls == SR_CAP_FLUSH_IDLE)
+        { sr_capture_flush(cap); }
+        nanosleep(&idle, 0);
+    }
+
+    sr_capture_drain(cap);
+    sr_capture_flush(cap);
+
+    return 0;
+} /* -- sr_capture_writer -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_capture_open(..)
+ * Scope: Global
+ *
+ * Open the dump file and start the writer thread.  A name ending in
+ * ".pcapng" selects pcapng, which is also the only format that rotates.
+ * With flight_bytes set nothing is written until a trigger fires, and
+ * fname is the pattern for the dump files.  Returns 0 on error.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_flight_names(struct sr_capture* cap, const char* fname)
+{
+    const char* slash = strrchr(fname, '/');
+    const char* dot   = strrchr(fname, '.');
+    size_t n;
+
+    if (dot == 0 || (slash && dot < slash) ||
+        strlen(dot) >= sizeof(cap->dump_ext))
+    { dot = fname + strlen(fname); }
+    n = min((size_t)(dot - fname), sizeof(cap->dump_base) - 1);
+
+    memcpy(cap->dump_base, fname, n);
+    cap->dump_base[n] = 0;
+    strcpy(cap->dump_ext, dot);
+} /* -- sr_flight_names -- */
+
+struct sr_capture* sr_capture_open(struct sr_instance* sr, const char* fname,
+                                   struct sr_filter* filter,
+                                   uint64_t rotate_bytes,
+                                   unsigned int rotate_secs,
+                                   uint64_t flight_bytes)
+{
+    struct sr_capture* cap;
+    struct sigaction sa;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(fname);
+
+    cap = (struct sr_capture*)calloc(1, sizeof(struct sr_capture));
+    assert(cap);
+    cap->filter = filter;
+    cap->sr = sr;
+
+    if (flight_bytes)
+    {
+        if (rotate_bytes || rotate_secs || sr_pcapng_is_pcapng(fname))
+        {
+            fprintf(stderr, "The flight recorder only dumps classic pcap\n");
+            goto err;
+        }
+        if ((cap->flight = sr_flight_create(flight_bytes,
+                                            PACKET_DUMP_SIZE)) == 0)
+        { goto err; }
+        sr_flight_names(cap, fname);
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = sr_flight_signal;
+        sa.sa_flags   = SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGUSR1, &sa, 0);
+    }
+    else if (sr_pcapng_is_pcapng(fname))
+    {
+        cap->ng = sr_pcapng_open(sr, fname, rotate_bytes, rotate_secs,
+                                 PACKET_DUMP_SIZE);
+        if (cap->ng == 0)
+        { goto err; }
+    }
+    else
+    {
+        if (rotate_bytes || rotate_secs)
+        {
+            fprintf(stderr, "File rotation needs a .pcapng log file\n");
+            goto err;
+        }
+        if ((cap->fp = sr_dump_open(fname, 0, PACKET_DUMP_SIZE)) == 0)
+        { goto err; }
+
+        /* -- the writer does its own batching, stdio just needs room -- */
+        cap->fbuf = (char*)malloc(SR_CAP_FILE_BUF);
+        assert(cap->fbuf);
+        setvbuf(cap->fp, cap->fbuf, _IOFBF, SR_CAP_FILE_BUF);
+    }
+
+    sr_tring_init(&cap->rings, sr_capture_ring_create);
+
+    if (pthread_create(&cap->writer, 0, sr_capture_writer, cap) == 0)
+    { sr_sched_housekeeping(sr, cap->writer); }
+    else
+    {
+        perror("pthread_create(..):sr_capture.c::sr_capture_open");
+        sr_tring_destroy(&cap->rings, sr_capture_ring_free);
+        goto err;
+    }
+
+    return cap;
+
+err:
+    if (cap->fp)
+    { sr_dump_close(cap->fp); }
+    sr_pcapng_close(cap->ng);
+    sr_flight_destroy(cap->flight);
+    sr_filter_free(cap->filter);
+    free(cap->fbuf);
+    free(cap);
+    return 0;
+} /* -- sr_capture_open -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_capture_close(..)
+ * Scope: Global
+ *
+ * Stop the writer once it has drained the rings, report what was lost and
+ * close the dump.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_capture_close(struct sr_capture* cap)
+{
+    struct sr_cap_ring* r;
+    unsigned long packets = 0, drops;
+    int i;
+
+    if (cap == 0)
+    { return; }
+
+    __atomic_store_n(&cap->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(cap->writer, 0);
+
+    drops = cap->rings.lost;
+    for (i = 0; i < cap->rings.nrings; i++)
+    {
+        r = (struct sr_cap_ring*)sr_tring_at(&cap->rings, i);
+        packets += r->packets;
+        drops   += r->drops;
+    }
+    sr_tring_destroy(&cap->rings, sr_capture_ring_free);
+
+    fprintf(stderr, "capture: %lu packets, %lu written, %lu dropped\n",
+            packets + cap->rings.lost, cap->written, drops + cap->failed);
+
+    if (cap->fp)
+    { sr_dump_close(cap->fp); }
+    sr_pcapng_close(cap->ng);
+    sr_flight_destroy(cap->flight);
+    sr_filter_free(cap->filter);
+    free(cap->fbuf);
+    free(cap);
+} /* -- sr_capture_close -- */
@@ -0,0 +1,51 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_capture.h
+ *
+ * Description:
+ *
+ * Asynchronous packet capture behind "-l".  The forwarding path only
+ * copies the snapped frame into a ring owned by the calling thread; a
+ * writer thread drains the rings and hands the records to sr_dump()
+ * through a large stdio buffer, or to sr_pcapng.c for ".pcapng" files.
+ * When the writer falls behind, records are dropped and counted --
+ * capture never blocks forwarding.
+ *
+ * An optional filter (sr_filter.h) is run first, so frames that aren't
+ * wanted cost one short filter program and nothing else.
+ *
+ * With flight_bytes set, records go to an in-memory flight recorder
+ * instead (sr_flight.h) and are only written out when a trigger fires;
+ * see sr_capture.c for the triggers.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CAPTURE_H
+#define SR_CAPTURE_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+/* direction of a captured frame */
+#define SR_CAP_RX 0
+#define SR_CAP_TX 1
+
+struct sr_instance;
+struct sr_capture;
+struct sr_filter;
+
+/* takes ownership of filter, which may be 0; see sr_pcapng.h for rotation */
+struct sr_capture* sr_capture_open(struct sr_instance* , const char* fname,
+                                   struct sr_filter* filter,
+                                   uint64_t rotate_bytes,
+                                   unsigned int rotate_secs,
+                                   uint64_t flight_bytes);
+void sr_capture_packet(struct sr_capture* , const uint8_t* buf,
+                       unsigned int len, const char* iface, int dir);
+void sr_capture_close(struct sr_capture* );
+
+#endif /* -- SR_CAPTURE_H -- */
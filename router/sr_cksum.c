@@ -0,0 +1,325 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_cksum.c
+ *
+ * Description:
+ *
+ * Checksum kernels and their dispatch, see sr_cksum.h.
+ *
+ * The vector kernels widen 16 bit words into 32 bit lanes, which can take
+ * 32768 steps before they could overflow; they spill into a 64 bit total
+ * well before that.  Setting SR_CKSUM=<name> in the environment forces a
+ * kernel, for comparing them.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SR_CKSUM_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+#include "sr_cksum.h"
+
+#define SR_CKSUM_SPILL 8192     /* vector steps between spills */
+
+static uint16_t sr_cksum_fold(uint64_t sum)
+{
+    while (sum >> 16)
+    { sum = (sum & 0xffff) + (sum >> 16); }
+    return (uint16_t)sum;
+} /* -- sr_cksum_fold -- */
+
+/* -- what's left after the wide loop: 16 bit words, then an odd byte -- */
+static uint64_t sr_cksum_tail(const uint8_t* p, int len)
+{
+    uint64_t sum = 0;
+    uint16_t w;
+
+    for (; len >= 2; p += 2, len -= 2)
+    {
+        memcpy(&w, p, 2);
+        sum += w;
+    }
+    if (len > 0)
+    {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        sum += (uint16_t)(p[0] << 8);
+#else
+        sum += p[0];
+#endif
+    }
+    return sum;
+} /* -- sr_cksum_tail -- */
+
+/*-----------------------------------------------------------------------------
+ * Kernel: ref
+ *
+ * The original cksum() loop, network order, swapped at the end.  It folds
+ * the carries back in whenever the top bit of the total is set, which
+ * the original didn't: that one wrapped past 128k, and the check in
+ * sr_cksumtest.c runs buffers long enough to make every vector kernel
+ * spill.
+ *
+ *---------------------------------------------------------------------------*/
+
+static uint16_t sr_cksum_ref(const void* _data, int len)
+{
+    const uint8_t* data = _data;
+    uint32_t sum;
+
+    for (sum = 0; len >= 2; data += 2, len -= 2)
+    {
+        sum += data[0] << 8 | data[1];
+        if (sum & 0x80000000)
+        { sum = (sum >> 16) + (sum & 0xffff); }
+    }
+    if (len > 0)
+    { sum += data[0] << 8; }
+    while (sum > 0xffff)
+    { sum = (sum >> 16) + (sum & 0xffff); }
+
+    return ntohs((uint16_t)sum);
+} /* -- sr_cksum_ref -- */
+
+/*-----------------------------------------------------------------------------
+ * Kernel: word64
+ *
+ * 8 bytes per load, each added as two 32 bit halves so the 64 bit total
+ * can't carry out.
+ *
+ *---------------------------------------------------------------------------*/
+
+static uint64_t sr_cksum_words(const uint8_t** pp, int* plen)
+{
+    const uint8_t* p = *pp;
+    int len = *plen;
+    uint64_t sum = 0, w0, w1, w2, w3;
+
+    for (; len >= 32; p += 32, len -= 32)
+    {
+        memcpy(&w0, p, 8);
+        memcpy(&w1, p + 8, 8);
+        memcpy(&w2, p + 16, 8);
+        memcpy(&w3, p + 24, 8);
+        sum += (w0 & 0xffffffff) + (w0 >> 32) + (w1 & 0xffffffff) + (w1 >> 32)
+            +  (w2 & 0xffffffff) + (w2 >> 32) + (w3 & 0xffffffff) + (w3 >> 32);
+    }
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        memcpy(&w0, p, 8);
+        sum += (w0 & 0xffffffff) + (w0 >> 32);
+    }
+
+    *pp = p;
+    *plen = len;
+    return sum;
+} /* -- sr_cksum_words -- */
+
+static uint16_t sr_cksum_word64(const void* data, int len)
+{
+    const uint8_t* p = data;
+    uint64_t sum;
+
+    sum = sr_cksum_words(&p, &len);
+    return sr_cksum_fold(sum + sr_cksum_tail(p, len));
+} /* -- sr_cksum_word64 -- */
+
+#ifdef SR_CKSUM_X86
+
+/*-----------------------------------------------------------------------------
+ * Kernel: sse2
+ *
+ *---------------------------------------------------------------------------*/
+
+__attribute__ ((target ("sse2")))
+static uint64_t sr_cksum_spill128(__m128i acc)
+{
+    uint32_t lane[4];
+
+    _mm_storeu_si128((__m128i*)lane, acc);
+    return (uint64_t)lane[0] + lane[1] + lane[2] + lane[3];
+} /* -- sr_cksum_spill128 -- */
+
+__attribute__ ((target ("sse2")))
+static uint16_t sr_cksum_sse2(const void* data, int len)
+{
+    const uint8_t* p = data;
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero, v;
+    uint64_t sum = 0;
+    int steps = 0;
+
+    for (; len >= 16; p += 16, len -= 16)
+    {
+        v   = _mm_loadu_si128((const __m128i*)p);
+        acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_unpacklo_epi16(v, zero),
+                                               _mm_unpackhi_epi16(v, zero)));
+        if (++steps == SR_CKSUM_SPILL)
+        {
+            sum  += sr_cksum_spill128(acc);
+            acc   = zero;
+            steps = 0;
+        }
+    }
+    sum += sr_cksum_spill128(acc);
+
+    return sr_cksum_fold(sum + sr_cksum_tail(p, len));
+} /* -- sr_cksum_sse2 -- */
+
+/*-----------------------------------------------------------------------------
+ * Kernel: avx2
+ *
+ *---------------------------------------------------------------------------*/
+
+__attribute__ ((target ("avx2")))
+static uint64_t sr_cksum_spill256(__m256i acc)
+{
+    uint32_t lane[8];
+    int i;
+    uint64_t sum = 0;
+
+    _mm256_storeu_si256((__m256i*)lane, acc);
+    for (i = 0; i < 8; i++)
+    { sum += lane[i]; }
+    return sum;
+} /* -- sr_cksum_spill256 -- */
+
+__attribute__ ((target ("avx2")))
+static uint16_t sr_cksum_avx2(const void* data, int len)
+{
+    const uint8_t* p = data;
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc0 = zero, acc1 = zero, v0, v1;
+    uint64_t sum = 0;
+    int steps = 0;
+
+    /* -- headers: not worth setting up the vector pass -- */
+    if (len < 64)
+    { return sr_cksum_word64(data, len); }
+
+    for (; len >= 64; p += 64, len -= 64)
+    {
+        v0   = _mm256_loadu_si256((const __m256i*)p);
+        v1   = _mm256_loadu_si256((const __m256i*)(p + 32));
+        acc0 = _mm256_add_epi32(acc0, _mm256_unpacklo_epi16(v0, zero));
+        acc1 = _mm256_add_epi32(acc1, _mm256_unpackhi_epi16(v0, zero));
+        acc0 = _mm256_add_epi32(acc0, _mm256_unpacklo_epi16(v1, zero));
+        acc1 = _mm256_add_epi32(acc1, _mm256_unpackhi_epi16(v1, zero));
+        if (++steps == SR_CKSUM_SPILL)
+        {
+            sum  += sr_cksum_spill256(acc0) + sr_cksum_spill256(acc1);
+            acc0  = acc1 = zero;
+            steps = 0;
+        }
+    }
+    if (len >= 32)
+    {
+        v0   = _mm256_loadu_si256((const __m256i*)p);
+        acc0 = _mm256_add_epi32(acc0, _mm256_unpacklo_epi16(v0, zero));
+        acc1 = _mm256_add_epi32(acc1, _mm256_unpackhi_epi16(v0, zero));
+        p   += 32;
+        len -= 32;
+    }
+    sum += sr_cksum_spill256(acc0) + sr_cksum_spill256(acc1);
+
+    sum += sr_cksum_words(&p, &len);
+    return sr_cksum_fold(sum + sr_cksum_tail(p, len));
+} /* -- sr_cksum_avx2 -- */
+
+static int sr_cksum_has_sse2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+static int sr_cksum_has_avx2(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif /* SR_CKSUM_X86 */
+
+static int sr_cksum_always(void)
+{
+    return 1;
+}
+
+const struct sr_cksum_kernel sr_cksum_kernels[] = {
+    { "ref",    sr_cksum_ref,    sr_cksum_always },
+    { "word64", sr_cksum_word64, sr_cksum_always },
+#ifdef SR_CKSUM_X86
+    { "sse2",   sr_cksum_sse2,   sr_cksum_has_sse2 },
+    { "avx2",   sr_cksum_avx2,   sr_cksum_has_avx2 },
+#endif
+    { 0, 0, 0 }
+};
+
+/*-----------------------------------------------------------------------------
+ * Dispatch
+ *
+ * sr_cksum_impl starts out pointing at the resolver, which picks a kernel
+ * and points it there instead.  Every thread resolves to the same kernel,
+ * so a race on the first call is harmless.
+ *
+ *---------------------------------------------------------------------------*/
+
+static uint16_t sr_cksum_resolve(const void* data, int len);
+
+static sr_cksum_fn sr_cksum_impl = sr_cksum_resolve;
+static const char* sr_cksum_kname = 0;
+
+static uint16_t sr_cksum_resolve(const void* data, int len)
+{
+    const struct sr_cksum_kernel* k;
+    const struct sr_cksum_kernel* best = &sr_cksum_kernels[0];
+    const struct sr_cksum_kernel* pick = 0;
+    const char* want = getenv("SR_CKSUM");
+
+    for (k = sr_cksum_kernels; k->name; k++)
+    {
+        if (!k->usable())
+        { continue; }
+        best = k;
+        if (want && strcmp(want, k->name) == 0)
+        { pick = k; }
+    }
+    if (pick)
+    { best = pick; }
+    else if (want)
+    {
+        fprintf(stderr, "SR_CKSUM=%s not available here, using %s\n",
+                want, best->name);
+    }
+
+    __atomic_store_n(&sr_cksum_kname, best->name, __ATOMIC_RELAXED);
+    __atomic_store_n(&sr_cksum_impl, best->sum, __ATOMIC_RELEASE);
+
+    return best->sum(data, len);
+} /* -- sr_cksum_resolve -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_cksum_sum(..)
+ * Scope: Global
+ *
+ * One's complement sum of data, host byte order, folded to 16 bits.
+ *
+ *---------------------------------------------------------------------------*/
+
+uint16_t sr_cksum_sum(const void* data, int len)
+{
+    return __atomic_load_n(&sr_cksum_impl, __ATOMIC_ACQUIRE)(data, len);
+} /* -- sr_cksum_sum -- */
+
+const char* sr_cksum_name(void)
+{
+    if (__atomic_load_n(&sr_cksum_kname, __ATOMIC_RELAXED) == 0)
+    { sr_cksum_resolve("", 0); }
+    return sr_cksum_kname;
+} /* -- sr_cksum_name -- */
@@ -0,0 +1,46 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_cksum.h
+ *
+ * Description:
+ *
+ * Internet checksum engine behind cksum() and cksum_verify() (sr_utils.h).
+ *
+ * All kernels compute the one's complement sum of the data in host byte
+ * order (RFC 1071 sec. 2(B)) folded to 16 bits; byte order only matters
+ * for a trailing odd byte.  The fastest kernel the CPU supports is picked
+ * on first use:
+ *
+ *   ref     the original two-bytes-at-a-time loop
+ *   word64  64 bit loads into a 64 bit accumulator
+ *   sse2    16 bytes per step, x86 only
+ *   avx2    32 bytes per step, x86 only, if CPUID says so
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_CKSUM_H
+#define SR_CKSUM_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+typedef uint16_t (*sr_cksum_fn)(const void* data, int len);
+
+struct sr_cksum_kernel
+{
+    const char* name;
+    sr_cksum_fn sum;            /* folded host order sum */
+    int (*usable)(void);        /* 0 if the CPU can't run it */
+};
+
+/* -- all kernels, slowest first, terminated by a 0 name -- */
+extern const struct sr_cksum_kernel sr_cksum_kernels[];
+
+uint16_t sr_cksum_sum(const void* data, int len);
+const char* sr_cksum_name(void);
+
+#endif /* -- SR_CKSUM_H -- */
@@ -0,0 +1,191 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_cksumtest.c
+ *
+ * Description:
+ *
+ * Check for the checksum kernels (sr_cksum.h).  Every kernel the CPU can
+ * run sums the same buffers as the reference kernel and must agree with
+ * it: random data at random lengths and start alignments, lengths 0 to
+ * 64 one by one, lengths long enough for the vector kernels to spill
+ * their lanes several times, and all-0x00 and all-0xff buffers (the
+ * latter the worst case for lane overflow).  Exits nonzero on any
+ * mismatch.
+ *
+ * Usage:
+ *
+ *   $ ./sr_cksumtest -n 100000
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#include "sr_cksum.h"
+
+extern char* optarg;
+
+#define DEFAULT_ROUNDS  100000
+#define TEST_ALIGN      64              /* start offsets tried */
+#define TEST_SHORT      2048            /* most random lengths below this */
+#define TEST_LONG       (1 << 20)       /* > 8192 steps of the widest kernel */
+#define TEST_LONG_EVERY 1000            /* one round in this many is long */
+
+static uint32_t test_state;
+
+static void usage(char* );
+
+/* -- xorshift, so runs with the same seed see the same buffers -- */
+static uint32_t test_rand(void)
+{
+    test_state ^= test_state << 13;
+    test_state ^= test_state >> 17;
+    test_state ^= test_state << 5;
+    return test_state;
+} /* -- test_rand -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: test_one(..)
+ * Scope: Local
+ *
+ * Sum len bytes at p with kernel k and the reference.  Returns 1 and says
+ * so if they differ.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int test_one(const struct sr_cksum_kernel* k,
+                    const struct sr_cksum_kernel* ref,
+                    const uint8_t* p, int len, int off, const char* what)
+{
+    uint16_t want = ref->sum(p, len);
+    uint16_t got  = k->sum(p, len);
+
+    if (got == want)
+    { return 0; }
+    fprintf(stderr, "%s: %s buffer, len %d, offset %d: 0x%04x, want 0x%04x\n",
+            k->name, what, len, off, got, want);
+    return 1;
+} /* -- test_one -- */
+
+static long test_kernel(const struct sr_cksum_kernel* k,
+                        const struct sr_cksum_kernel* ref,
+                        uint8_t* buf, long rounds, long* nbufs)
+{
+    const char* what;
+    long bad = 0, i, n = 0;
+    int len, off;
+
+    /* -- every short length at every alignment -- */
+    for (off = 0; off < TEST_ALIGN; off++)
+    {
+        for (len = 0; len <= 64; len++, n++)
+        { bad += test_one(k, ref, buf + off, len, off, "random"); }
+    }
+
+    /* -- fixed patterns, short and long, odd and even -- */
+    for (i = 0; i < 2; i++)
+    {
+        what = i ? "0xff" : "0x00";
+        memset(buf, i ? 0xff : 0x00, TEST_LONG + TEST_ALIGN);
+        for (off = 0; off < 2; off++)
+        {
+            for (len = TEST_LONG - 1; len <= TEST_LONG; len++, n++)
+            { bad += test_one(k, ref, buf + off, len, off, what); }
+            for (len = 0; len < 300; len++, n++)
+            { bad += test_one(k, ref, buf + off, len, off, what); }
+        }
+    }
+
+    /* -- random data, lengths and alignments -- */
+    for (i = 0; i < TEST_LONG + TEST_ALIGN; i++)
+    { buf[i] = test_rand(); }
+    for (i = 0; i < rounds; i++, n++)
+    {
+        off = test_rand() % TEST_ALIGN;
+        len = i % TEST_LONG_EVERY == 0 ? test_rand() % (TEST_LONG + 1)
+                                       : test_rand() % TEST_SHORT;
+        bad += test_one(k, ref, buf + off, len, off, "random");
+
+        /* -- fresh bytes under the next short one -- */
+        buf[test_rand() % TEST_SHORT] = test_rand();
+    }
+
+    *nbufs = n;
+    return bad;
+} /* -- test_kernel -- */
+
+int main(int argc, char** argv)
+{
+    const struct sr_cksum_kernel* ref = &sr_cksum_kernels[0];
+    const struct sr_cksum_kernel* k;
+    uint8_t* buf;
+    long rounds = DEFAULT_ROUNDS, bad = 0, b, n;
+    int c;
+
+    test_state = 0x2545f491;
+
+    while ((c = getopt(argc, argv, "hn:s:")) != EOF)
+    {
+        switch (c)
+        {
+            case 'n':
+                rounds = atol(optarg);
+                break;
+            case 's':
+                test_state = strtoul(optarg, 0, 0) | 1;
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                exit(c == 'h' ? 0 : 1);
+        }
+    }
+    if (rounds < 0 || strcmp(ref->name, "ref") != 0)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    if ((buf = (uint8_t*)malloc(TEST_LONG + TEST_ALIGN)) == 0)
+    {
+        perror("malloc(..):sr_cksumtest.c::main");
+        exit(1);
+    }
+
+    for (k = &sr_cksum_kernels[0]; k->name; k++)
+    {
+        if (!k->usable())
+        {
+            printf("%-8s not usable on this CPU, skipped\n", k->name);
+            continue;
+        }
+        b = test_kernel(k, ref, buf, rounds, &n);
+        printf("%-8s %10ld buffers %10ld wrong\n", k->name, n, b);
+        bad += b;
+    }
+    free(buf);
+
+    if (bad)
+    {
+        fprintf(stderr, "%ld checksums differ from the reference\n", bad);
+        return 1;
+    }
+    return 0;
+} /* -- main -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: usage(..)
+ * Scope: Local
+ *---------------------------------------------------------------------------*/
+
+static void usage(char* argv0)
+{
+    printf("Checksum kernel check\n");
+    printf("Format: %s [-h] [-n rounds] [-s seed]\n", argv0);
+    printf("   -n  random buffers per kernel (default %d)\n", DEFAULT_ROUNDS);
+    printf("   -s  random seed\n");
+} /* -- usage -- */
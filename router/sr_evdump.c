@@ -0,0 +1,310 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_evdump.c
+ *
+ * Description:
+ *
+ * Offline decoder for the binary event log sr writes with -E (see
+ * sr_event.h).  Prints one line per event, or with -c only how many
+ * events of each kind there were.  Each of sr's threads logs through its
+ * own ring, so the file is only in time order per thread; -s sorts it.
+ *
+ * Usage:
+ *
+ *   $ ./sr -E events.bin ...
+ *   $ ./sr_evdump -s events.bin | less
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#include "sr_event.h"
+#include "sr_icmp.h"
+
+extern char* optarg;
+extern int optind;
+
+static const char* ev_types[SR_EV_TYPES] = {
+    "forward", "drop", "icmp", "icmp-limited",
+    "arp-request", "arp-resolved", "arp-failed"
+};
+
+static const char* ev_drops[SR_DROP_REASONS] = {
+    "runt", "ip-cksum", "icmp-cksum", "ttl", "no-route", "bad-arp",
+    "arp-failed", "neigh-full", "queue-full", "tx", "acl", "nat",
+    "egress"
+};
+
+static const char* ev_icmps[SR_ICMP_ERRORS] = {
+    "net-unreach", "host-unreach", "proto-unreach", "port-unreach",
+    "time-exceeded"
+};
+
+static void usage(char* );
+
+/*-----------------------------------------------------------------------------
+ *---------------------------------------------------------------------------*/
+
+static const char* ev_code(const struct sr_event* e)
+{
+    if (e->type == SR_EV_DROP && e->code < SR_DROP_REASONS)
+    { return ev_drops[e->code]; }
+    if (e->type == SR_EV_ICMP || e->type == SR_EV_ICMP_LIMITED)
+    {
+        if (e->code == SR_EV_ICMP_ECHO_REPLY)
+        { return "echo-reply"; }
+        if (e->code < SR_ICMP_ERRORS)
+        { return ev_icmps[e->code]; }
+    }
+    return 0;
+} /* -- ev_code -- */
+
+static const char* ev_proto(uint8_t p)
+{
+    static char buf[8];
+
+    switch (p)
+    {
+        case 1:  return "icmp";
+        case 6:  return "tcp";
+        case 17: return "udp";
+    }
+    snprintf(buf, sizeof(buf), "%u", p);
+    return buf;
+} /* -- ev_proto -- */
+
+static void ev_print(const struct sr_event* e)
+{
+    char stamp[16], src[INET_ADDRSTRLEN], dst[INET_ADDRSTRLEN];
+    time_t secs = e->ts_ns / 1000000000ULL;
+    const char* code = ev_code(e);
+
+    strftime(stamp, sizeof(stamp), "%H:%M:%S", localtime(&secs));
+    inet_ntop(AF_INET, &e->src, src, sizeof(src));
+    inet_ntop(AF_INET, &e->dst, dst, sizeof(dst));
+
+    printf("%s.%06lu t%u %-6s %s", stamp,
+           (unsigned long)(e->ts_ns % 1000000000ULL) / 1000, e->thread,
+           e->iface[0] ? e->iface : "-",
+           e->type < SR_EV_TYPES ? ev_types[e->type] : "?");
+    if (code)
+    { printf(" %s", code); }
+
+    switch (e->type)
+    {
+        case SR_EV_ARP_REQUEST:
+            printf(" who-has %s, try %u\n", dst, e->code + 1);
+            break;
+        case SR_EV_ARP_RESOLVED:
+            printf(" %s is-at %02x:%02x:%02x:%02x:%02x:%02x\n", dst,
+                   e->mac[0], e->mac[1], e->mac[2],
+                   e->mac[3], e->mac[4], e->mac[5]);
+            break;
+        case SR_EV_ARP_FAILED:
+            printf(" %s\n", dst);
+            break;
+        default:
+            if (e->proto)
+            {
+                printf(" %s > %s %s ttl %u len %u\n", src, dst,
+                       ev_proto(e->proto), e->ttl, e->len);
+            }
+            else
+            { printf(" %s > %s len %u\n", src, dst, e->len); }
+            break;
+    }
+} /* -- ev_print -- */
+
+static void ev_counts(const struct sr_event* ev, size_t n)
+{
+    unsigned long types[SR_EV_TYPES];
+    unsigned long drops[SR_DROP_REASONS];
+    unsigned long icmps[SR_ICMP_ERRORS + 1];
+    size_t i;
+    int j;
+
+    memset(types, 0, sizeof(types));
+    memset(drops, 0, sizeof(drops));
+    memset(icmps, 0, sizeof(icmps));
+
+    for (i = 0; i < n; i++)
+    {
+        if (ev[i].type >= SR_EV_TYPES)
+        { continue; }
+        types[ev[i].type]++;
+        if (ev[i].type == SR_EV_DROP && ev[i].code < SR_DROP_REASONS)
+        { drops[ev[i].code]++; }
+        if (ev[i].type == SR_EV_ICMP)
+        {
+            icmps[ev[i].code < SR_ICMP_ERRORS ? ev[i].code
+                                              : SR_ICMP_ERRORS]++;
+        }
+    }
+
+    for (j = 0; j < SR_EV_TYPES; j++)
+    {
+        if (types[j])
+        { printf("%-14s %lu\n", ev_types[j], types[j]); }
+        if (j == SR_EV_DROP)
+        {
+            for (i = 0; i < SR_DROP_REASONS; i++)
+            {
+                if (drops[i])
+                { printf("  %-12s %lu\n", ev_drops[i], drops[i]); }
+            }
+        }
+        if (j == SR_EV_ICMP)
+        {
+            for (i = 0; i < SR_ICMP_ERRORS; i++)
+            {
+                if (icmps[i])
+                { printf("  %-12s %lu\n", ev_icmps[i], icmps[i]); }
+            }
+            if (icmps[SR_ICMP_ERRORS])
+            { printf("  %-12s %lu\n", "echo-reply", icmps[SR_ICMP_ERRORS]); }
+        }
+    }
+} /* -- ev_counts -- */
+
+static int ev_cmp(const void* a, const void* b)
+{
+    const struct sr_event* x = (const struct sr_event*)a;
+    const struct sr_event* y = (const struct sr_event*)b;
+
+    if (x->ts_ns != y->ts_ns)
+    { return x->ts_ns < y->ts_ns ? -1 : 1; }
+    return (int)x->thread - (int)y->thread;
+} /* -- ev_cmp -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: ev_load(..)
+ * Scope: Local
+ *
+ * Read the whole file.  Returns the records (free() them), 0 on error.
+ *
+ *---------------------------------------------------------------------------*/
+
+static struct sr_event* ev_load(const char* fname, size_t* n)
+{
+    struct sr_event_file_hdr hdr;
+    struct sr_event* ev = 0;
+    size_t cap = 0, got;
+    FILE* fp;
+
+    if ((fp = fopen(fname, "rb")) == 0)
+    {
+        perror(fname);
+        return 0;
+    }
+    if (fread(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        memcmp(hdr.magic, SR_EVENT_MAGIC, sizeof(hdr.magic)) != 0)
+    {
+        fprintf(stderr, "%s: not an sr event log\n", fname);
+        goto err;
+    }
+    if (hdr.byteorder != SR_EVENT_BYTEORDER ||
+        hdr.recsize != sizeof(struct sr_event))
+    {
+        fprintf(stderr, "%s: written by a different build or byte order\n",
+                fname);
+        goto err;
+    }
+
+    *n = 0;
+    for (;;)
+    {
+        if (*n == cap)
+        {
+            cap = cap ? cap * 2 : 4096;
+            if ((ev = (struct sr_event*)realloc(ev, cap * sizeof(*ev))) == 0)
+            {
+                perror("realloc(..):sr_evdump.c::ev_load");
+                goto err;
+            }
+        }
+        got = fread(ev + *n, sizeof(*ev), cap - *n, fp);
+        *n += got;
+        if (got == 0)
+        { break; }
+    }
+    if (ferror(fp))
+    {
+        perror(fname);
+        goto err;
+    }
+
+    fclose(fp);
+    return ev;
+
+err:
+    free(ev);
+    fclose(fp);
+    return 0;
+} /* -- ev_load -- */
+
+int main(int argc, char** argv)
+{
+    struct sr_event* ev;
+    size_t n, i;
+    int c, sort = 0, counts = 0;
+
+    while ((c = getopt(argc, argv, "hsc")) != EOF)
+    {
+        switch (c)
+        {
+            case 's':
+                sort = 1;
+                break;
+            case 'c':
+                counts = 1;
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                exit(c == 'h' ? 0 : 1);
+        }
+    }
+    if (optind != argc - 1)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    if ((ev = ev_load(argv[optind], &n)) == 0)
+    { exit(1); }
+
+    if (counts)
+    { ev_counts(ev, n); }
+    else
+    {
+        if (sort)
+        { qsort(ev, n, sizeof(*ev), ev_cmp); }
+        for (i = 0; i < n; i++)
+        { ev_print(&ev[i]); }
+    }
+
+    free(ev);
+    return 0;
+} /* -- main -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: usage(..)
+ * Scope: Local
+ *---------------------------------------------------------------------------*/
+
+static void usage(char* argv0)
+{
+    printf("Decoder for sr -E event logs\n");
+    printf("Format: %s [-h] [-s] [-c] file\n", argv0);
+    printf("   -s  sort by time across threads\n");
+    printf("   -c  only count events by kind\n");
+} /* -- usage -- */
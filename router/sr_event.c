@@ -0,0 +1,349 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_event.c
+ *
+ * Description:
+ *
+ * Binary event log, see sr_event.h.
+ *
+ * Rings are per thread and created on a thread's first event (sr_tring.h),
+ * as in sr_capture.c.  The flusher thread is the single consumer of all of
+ * them; it writes straight from the ring slots into a large stdio buffer
+ * and flushes when things go quiet.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "sr_event.h"
+#include "sr_ring.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_tring.h"
+
+#define SR_EV_RING_SLOTS   4096            /* per thread, power of two */
+#define SR_EV_FILE_BUF     (1024*1024)
+#define SR_EV_IDLE_NS      1000000         /* flusher poll interval */
+#define SR_EV_FLUSH_IDLE   100             /* fflush after this many idle polls */
+
+struct sr_ev_ring
+{
+    struct sr_ring ring;
+    struct sr_event* recs;
+    unsigned long events;       /* producer only */
+    unsigned long drops;        /* producer only */
+};
+
+struct sr_evlog
+{
+    struct sr_tring_set rings;  /* of struct sr_ev_ring */
+    pthread_t flusher;
+    int stop;
+    FILE* fp;
+    char* fbuf;
+    unsigned long written;      /* flusher only */
+    unsigned long failed;       /* flusher only */
+};
+
+/* the calling thread's ring; its index goes in each event */
+static __thread struct sr_tring_mine sr_ev_mine;
+
+/* -- once sr_event_slot() has handed out a slot of it -- */
+static __inline__ struct sr_ev_ring* sr_event_my_ring(void)
+{
+    return (struct sr_ev_ring*)sr_ev_mine.ring;
+}
+
+static void* sr_event_ring_create(void)
+{
+    struct sr_ev_ring* r;
+
+    r = (struct sr_ev_ring*)calloc(1, sizeof(struct sr_ev_ring));
+    assert(r);
+    r->recs = (struct sr_event*)calloc(SR_EV_RING_SLOTS,
+                                       sizeof(struct sr_event));
+    assert(r->recs);
+    sr_ring_init(&r->ring, SR_EV_RING_SLOTS);
+
+    return r;
+} /* -- sr_event_ring_create -- */
+
+static void sr_event_ring_free(void* ring)
+{
+    struct sr_ev_ring* r = (struct sr_ev_ring*)ring;
+
+    free(r->recs);
+    free(r);
+} /* -- sr_event_ring_free -- */
+
+/* -- a zeroed slot of this thread's ring stamped with type and code, or 0 -- */
+static struct sr_event* sr_event_slot(struct sr_evlog* ev, int type, int code,
+                                      const char* iface)
+{
+    struct sr_ev_ring* r;
+    struct sr_event* e;
+    struct timespec ts;
+
+    if ((r = (struct sr_ev_ring*)sr_tring_get(&ev->rings, &sr_ev_mine)) == 0)
+    { return 0; }
+
+    r->events++;
+    if (sr_ring_free(&r->ring) == 0)
+    {
+        r->drops++;
+        return 0;
+    }
+
+    e = &r->recs[sr_ring_head_slot(&r->ring, 0)];
+    memset(e, 0, sizeof(struct sr_event));
+    clock_gettime(CLOCK_REALTIME, &ts);
+    e->ts_ns  = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    e->type   = type;
+    e->code   = code;
+    e->thread = sr_ev_mine.index;
+    if (iface)
+    { strncpy(e->iface, iface, sizeof(e->iface) - 1); }
+
+    return e;
+} /* -- sr_event_slot -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_frame(..)
+ * Scope: Global
+ *
+ * Data path: record an event about frame.  The addresses, protocol and
+ * TTL come out of its IP header, or for ARP the sender and target
+ * addresses.  Counts a drop if this thread's ring is full.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_event_frame(struct sr_evlog* ev, int type, int code,
+                    const uint8_t* frame, unsigned int len,
+                    const char* iface)
+{
+    const sr_ethernet_hdr_t* e_hdr = (const sr_ethernet_hdr_t*)frame;
+    const sr_ip_hdr_t* ip_hdr;
+    const sr_arp_hdr_t* a_hdr;
+    struct sr_event* e;
+
+    /* REQUIRES */
+    assert(ev);
+    assert(frame);
+
+    if ((e = sr_event_slot(ev, type, code, iface)) == 0)
+    { return; }
+
+    e->len = len;
+    if (len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) &&
+        e_hdr->ether_type == htons(ethertype_ip))
+    {
+        ip_hdr   = (const sr_ip_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+        e->src   = ip_hdr->ip_src;
+        e->dst   = ip_hdr->ip_dst;
+        e->proto = ip_hdr->ip_p;
+        e->ttl   = ip_hdr->ip_ttl;
+    }
+    else if (len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t) &&
+             e_hdr->ether_type == htons(ethertype_arp))
+    {
+        a_hdr  = (const sr_arp_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+        e->src = a_hdr->ar_sip;
+        e->dst = a_hdr->ar_tip;
+    }
+
+    sr_ring_produce(&sr_event_my_ring()->ring, 1);
+} /* -- sr_event_frame -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_addr(..)
+ * Scope: Global
+ *
+ * Record an event about neighbor ip, at mac if that's known.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_event_addr(struct sr_evlog* ev, int type, int code, uint32_t ip,
+                   const uint8_t* mac, const char* iface)
+{
+    struct sr_event* e;
+
+    /* REQUIRES */
+    assert(ev);
+
+    if ((e = sr_event_slot(ev, type, code, iface)) == 0)
+    { return; }
+
+    e->dst = ip;
+    if (mac)
+    { memcpy(e->mac, mac, ETHER_ADDR_LEN); }
+
+    sr_ring_produce(&sr_event_my_ring()->ring, 1);
+} /* -- sr_event_addr -- */
+
+/*-----------------------------------------------------------------------------
+ * Flusher thread
+ *---------------------------------------------------------------------------*/
+
+/* write everything queued so far, returns the number of records */
+static unsigned long sr_event_drain(struct sr_evlog* ev)
+{
+    struct sr_ev_ring* r;
+    unsigned long done = 0;
+    uint32_t n, first, run;
+    int i, nrings;
+
+    nrings = sr_tring_count(&ev->rings);
+    for (i = 0; i < nrings; i++)
+    {
+        r = (struct sr_ev_ring*)sr_tring_at(&ev->rings, i);
+        n = sr_ring_count(&r->ring);
+
+        /* -- at most two contiguous runs, either side of the wrap -- */
+        while (n > 0)
+        {
+            first = sr_ring_tail_slot(&r->ring, 0);
+            run   = SR_EV_RING_SLOTS - first;
+            if (run > n)
+            { run = n; }
+            if (fwrite(&r->recs[first], sizeof(struct sr_event), run,
+                       ev->fp) == run)
+            { ev->written += run; }
+            else
+            { ev->failed += run; }
+            sr_ring_consume(&r->ring, run);
+            n    -= run;
+            done += run;
+        }
+    }
+
+    return done;
+} /* -- sr_event_drain -- */
+
+static void* sr_event_flusher(void* arg)
+{
+    struct sr_evlog* ev = (struct sr_evlog*)arg;
+    struct timespec idle;
+    unsigned int idle_polls = 0;
+
+    idle.tv_sec  = 0;
+    idle.tv_nsec = SR_EV_IDLE_NS;
+
+    while (!__atomic_load_n(&ev->stop, __ATOMIC_ACQUIRE))
+    {
+        if (sr_event_drain(ev) > 0)
+        {
+            idle_polls = 0;
+            continue;
+        }
+        if (++idle_polls == SR_EV_FLUSH_IDLE)
+        { fflush(ev->fp); }
+        nanosleep(&idle, 0);
+    }
+
+    sr_event_drain(ev);
+    fflush(ev->fp);
+
+    return 0;
+} /* -- sr_event_flusher -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_open(..)
+ * Scope: Global
+ *
+ * Create the event log and start the flusher.  Returns 0 on error.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_evlog* sr_event_open(struct sr_instance* sr, const char* fname)
+{
+    struct sr_evlog* ev;
+    struct sr_event_file_hdr hdr;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(fname);
+
+    ev = (struct sr_evlog*)calloc(1, sizeof(struct sr_evlog));
+    assert(ev);
+
+    if ((ev->fp = fopen(fname, "wb")) == 0)
+    {
+        perror("fopen(..):sr_event.c::sr_event_open");
+        free(ev);
+        return 0;
+    }
+    ev->fbuf = (char*)malloc(SR_EV_FILE_BUF);
+    assert(ev->fbuf);
+    setvbuf(ev->fp, ev->fbuf, _IOFBF, SR_EV_FILE_BUF);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SR_EVENT_MAGIC, sizeof(hdr.magic));
+    hdr.byteorder = SR_EVENT_BYTEORDER;
+    hdr.recsize   = sizeof(struct sr_event);
+    if (fwrite(&hdr, sizeof(hdr), 1, ev->fp) != 1)
+    {
+        perror("fwrite(..):sr_event.c::sr_event_open");
+        goto err;
+    }
+
+    sr_tring_init(&ev->rings, sr_event_ring_create);
+
+    if (pthread_create(&ev->flusher, 0, sr_event_flusher, ev) == 0)
+    { sr_sched_housekeeping(sr, ev->flusher); }
+    else
+    {
+        perror("pthread_create(..):sr_event.c::sr_event_open");
+        sr_tring_destroy(&ev->rings, sr_event_ring_free);
+        goto err;
+    }
+
+    return ev;
+
+err:
+    fclose(ev->fp);
+    free(ev->fbuf);
+    free(ev);
+    return 0;
+} /* -- sr_event_open -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_event_close(..)
+ * Scope: Global
+ *
+ * Stop the flusher once it has drained the rings, report what was lost
+ * and close the file.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_event_close(struct sr_evlog* ev)
+{
+    struct sr_ev_ring* r;
+    unsigned long events = 0, drops;
+    int i;
+
+    if (ev == 0)
+    { return; }
+
+    __atomic_store_n(&ev->stop, 1, __ATOMIC_RELEASE);
+    pthread_join(ev->flusher, 0);
+
+    drops = ev->rings.lost;
+    for (i = 0; i < ev->rings.nrings; i++)
+    {
+        r = (struct sr_ev_ring*)sr_tring_at(&ev->rings, i);
+        events += r->events;
+        drops  += r->drops;
+    }
+    sr_tring_destroy(&ev->rings, sr_event_ring_free);
+
+    fprintf(stderr, "events: %lu recorded, %lu written, %lu dropped\n",
+            events + ev->rings.lost, ev->written, drops + ev->failed);
+
+    fclose(ev->fp);
+    free(ev->fbuf);
+    free(ev);
+} /* -- sr_event_close -- */
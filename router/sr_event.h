@@ -0,0 +1,121 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_event.h
+ *
+ * Description:
+ *
+ * Binary event log behind "-E file".  Router events (a packet forwarded,
+ * dropped and why, an ICMP message sent or rate limited, an ARP request
+ * sent, a neighbor resolved or given up on) are stored as fixed size
+ * struct sr_event records instead of being formatted.  As with capture,
+ * the data path only fills in a slot of its own thread's ring; a flusher
+ * thread appends the records to the file and sr_evdump renders them.
+ *
+ * The file is a struct sr_event_file_hdr followed by records in the
+ * writer's byte order, each thread's in order but threads interleaved.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_EVENT_H
+#define SR_EVENT_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_EVENT_MAGIC     "SREVENT1"
+#define SR_EVENT_BYTEORDER 0x1a2b3c4d
+
+/* -- event types -- */
+enum sr_event_type
+{
+    SR_EV_FORWARD,              /* iface is the way out */
+    SR_EV_DROP,                 /* code is an sr_drop_reason */
+    SR_EV_ICMP,                 /* code is an sr_icmp_error or below */
+    SR_EV_ICMP_LIMITED,         /* an ICMP error the rate limits held back */
+    SR_EV_ARP_REQUEST,          /* dst is the address asked for */
+    SR_EV_ARP_RESOLVED,         /* dst is now at mac */
+    SR_EV_ARP_FAILED,           /* no reply for dst, its packets dropped */
+    SR_EV_TYPES
+};
+
+#define SR_EV_ICMP_ECHO_REPLY 0x80
+
+enum sr_drop_reason
+{
+    SR_DROP_RUNT,               /* too short for its headers */
+    SR_DROP_IP_CKSUM,
+    SR_DROP_ICMP_CKSUM,
+    SR_DROP_TTL,
+    SR_DROP_NO_ROUTE,
+    SR_DROP_BAD_ARP,
+    SR_DROP_ARP_FAILED,         /* next hop never answered */
+    SR_DROP_NEIGH_FULL,         /* too much already waiting for ARP */
+    SR_DROP_QUEUE_FULL,         /* worker queue full */
+    SR_DROP_TX,                 /* failed the send checks or the send */
+    SR_DROP_ACL,                /* denied by an -X rule */
+    SR_DROP_NAT,                /* -N couldn't translate it */
+    SR_DROP_EGRESS,             /* -Q egress queue full */
+    SR_DROP_REASONS
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_event
+ *
+ * One event.  Addresses are in network byte order: for IP packets the
+ * source and destination, for ARP events the neighbor in dst.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_event
+{
+    uint64_t ts_ns;             /* CLOCK_REALTIME */
+    uint32_t src;
+    uint32_t dst;
+    uint16_t len;               /* frame length, 0 if there was none */
+    uint8_t  type;
+    uint8_t  code;
+    uint8_t  proto;             /* IP protocol and TTL, if an IP packet */
+    uint8_t  ttl;
+    uint8_t  thread;            /* ring the event came through */
+    uint8_t  pad0;
+    uint8_t  mac[6];            /* ARP_RESOLVED */
+    uint8_t  pad1[2];
+    char     iface[16];
+};
+
+struct sr_event_file_hdr
+{
+    char     magic[8];
+    uint32_t byteorder;
+    uint32_t recsize;           /* sizeof(struct sr_event) */
+};
+
+struct sr_instance;
+struct sr_evlog;
+
+struct sr_evlog* sr_event_open(struct sr_instance* , const char* fname);
+void sr_event_frame(struct sr_evlog* , int type, int code,
+                    const uint8_t* frame, unsigned int len,
+                    const char* iface);
+void sr_event_addr(struct sr_evlog* , int type, int code, uint32_t ip,
+                   const uint8_t* mac, const char* iface);
+void sr_event_close(struct sr_evlog* );
+
+/* -- what the data path calls; nothing but a test when -E isn't given -- */
+#define SR_EVENT(sr, type, code, frame, len, iface) \
+    do { \
+        if ((sr)->events) \
+        { sr_event_frame((sr)->events, type, code, frame, len, iface); } \
+    } while (0)
+
+#define SR_EVENT_ADDR(sr, type, code, ip, mac, iface) \
+    do { \
+        if ((sr)->events) \
+        { sr_event_addr((sr)->events, type, code, ip, mac, iface); } \
+    } while (0)
+
+#endif /* -- SR_EVENT_H -- */
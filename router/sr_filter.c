@@ -0,0 +1,609 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_filter.c
+ *
+ * Description:
+ *
+ * Capture filter compiler and interpreter, see sr_filter.h.
+ *
+ * The parser builds a small expression tree, which is then flattened into
+ * an array of tests.  Each test carries a jump for true and one for false,
+ * so "and", "or" and "not" cost nothing at run time and evaluation stops
+ * at the first test that decides the frame -- in particular a "sample" or
+ * "flow" test only sees the frames that reached it.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <arpa/inet.h>
+
+#include "sr_filter.h"
+#include "sr_protocol.h"
+
+#define SR_FILTER_MAX_NODES 64
+#define SR_FILTER_MAX_TOKS  128
+
+#define SR_FILTER_ACCEPT    (-1)
+#define SR_FILTER_REJECT    (-2)
+
+enum sr_filter_op
+{
+    F_IFACE,        /* name */
+    F_ETHER,        /* val = ethertype */
+    F_SRC_NET,      /* addr/mask */
+    F_DST_NET,
+    F_NET,          /* either end */
+    F_PROTO,        /* val = ip protocol */
+    F_SAMPLE,       /* val = N */
+    F_FLOW,         /* val = N */
+    F_TRUE,
+    /* -- tree only -- */
+    F_AND,
+    F_OR,
+    F_NOT
+};
+
+struct sr_filter_insn
+{
+    int op;
+    int jt, jf;                 /* next insn, or ACCEPT / REJECT */
+    uint32_t val;
+    uint32_t addr, mask;        /* network order */
+    char name[16];
+    unsigned long count;        /* F_SAMPLE, shared by all threads */
+};
+
+struct sr_filter
+{
+    struct sr_filter_insn* insns;
+    int ninsns;
+    int entry;
+};
+
+/* -- parser state -- */
+struct sr_filter_node
+{
+    struct sr_filter_insn t;    /* leaf */
+    int l, r;                   /* children */
+};
+
+struct sr_filter_parse
+{
+    char* toks[SR_FILTER_MAX_TOKS];
+    int ntoks, pos;
+    const char* last;           /* most recent token, for errors */
+    char* text;
+    struct sr_filter_node nodes[SR_FILTER_MAX_NODES];
+    int nnodes;
+    const char* err;
+};
+
+/* -- the few fields tests look at, extracted once per frame -- */
+struct sr_filter_pkt
+{
+    const uint8_t* buf;
+    unsigned int len;
+    const char* iface;
+    uint16_t ethertype;         /* host order */
+    const struct sr_ip_hdr* ip; /* 0 if not a complete IPv4 header */
+    uint16_t sport, dport;      /* network order, 0 if unknown */
+};
+
+/*---------------------------------------------------------------------------
+ * Parser
+ *-------------------------------------------------------------------------*/
+
+static int sr_filter_expr(struct sr_filter_parse* p);
+
+static void sr_filter_tokenize(struct sr_filter_parse* p, const char* expr)
+{
+    char* s;
+
+    p->text = (char*)malloc(strlen(expr) * 3 + 1);
+    assert(p->text);
+
+    /* -- pad parens with blanks so strtok splits them out -- */
+    s = p->text;
+    for (; *expr; expr++)
+    {
+        if (*expr == '(' || *expr == ')')
+        { *s++ = ' '; *s++ = *expr; *s++ = ' '; }
+        else
+        { *s++ = *expr; }
+    }
+    *s = 0;
+
+    p->ntoks = 0;
+    for (s = strtok(p->text, " \t\n"); s; s = strtok(0, " \t\n"))
+    {
+        if (p->ntoks == SR_FILTER_MAX_TOKS)
+        { p->err = "expression too long"; return; }
+        p->toks[p->ntoks++] = s;
+    }
+} /* -- sr_filter_tokenize -- */
+
+static const char* sr_filter_peek(struct sr_filter_parse* p)
+{
+    return (p->pos < p->ntoks) ? p->toks[p->pos] : "";
+}
+
+static const char* sr_filter_next(struct sr_filter_parse* p)
+{
+    const char* t = sr_filter_peek(p);
+    if (p->pos < p->ntoks)
+    { p->pos++; }
+    p->last = t;
+    return t;
+}
+
+static int sr_filter_node(struct sr_filter_parse* p, int op, int l, int r)
+{
+    struct sr_filter_node* n;
+
+    if (p->nnodes == SR_FILTER_MAX_NODES)
+    { p->err = "expression too long"; return -1; }
+
+    n = &p->nodes[p->nnodes];
+    memset(n, 0, sizeof(*n));
+    n->t.op = op;
+    n->l = l;
+    n->r = r;
+    return p->nnodes++;
+} /* -- sr_filter_node -- */
+
+static int sr_filter_number(const char* s, uint32_t* val)
+{
+    char* end;
+    unsigned long v;
+
+    if (!isdigit((unsigned char)*s))
+    { return -1; }
+    v = strtoul(s, &end, 0);
+    if (*end)
+    { return -1; }
+    *val = v;
+    return 0;
+} /* -- sr_filter_number -- */
+
+/* A.B.C.D or A.B.C.D/LEN into addr and mask, both network order */
+static int sr_filter_prefix(const char* s, int want_len,
+                            uint32_t* addr, uint32_t* mask)
+{
+    char tmp[32];
+    char* slash;
+    struct in_addr a;
+    uint32_t plen = 32;
+
+    strncpy(tmp, s, sizeof(tmp) - 1);
+    tmp[sizeof(tmp) - 1] = 0;
+
+    if ((slash = strchr(tmp, '/')) != 0)
+    {
+        *slash = 0;
+        if (!want_len || sr_filter_number(slash + 1, &plen) || plen > 32)
+        { return -1; }
+    }
+    if (inet_aton(tmp, &a) == 0)
+    { return -1; }
+
+    *mask = plen ? htonl(0xffffffff << (32 - plen)) : 0;
+    *addr = a.s_addr & *mask;
+    return 0;
+} /* -- sr_filter_prefix -- */
+
+static int sr_filter_primitive(struct sr_filter_parse* p)
+{
+    const char* t = sr_filter_next(p);
+    const char* arg;
+    int op = F_NET;
+    int n;
+
+    if (strcmp(t, "src") == 0 || strcmp(t, "dst") == 0)
+    {
+        op = (t[0] == 's') ? F_SRC_NET : F_DST_NET;
+        t = sr_filter_next(p);
+        if (strcmp(t, "net") && strcmp(t, "host"))
+        { p->err = "expected net or host after src/dst"; return -1; }
+    }
+
+    if ((n = sr_filter_node(p, F_TRUE, -1, -1)) < 0)
+    { return -1; }
+
+    if (strcmp(t, "net") == 0 || strcmp(t, "host") == 0)
+    {
+        p->nodes[n].t.op = op;
+        if (sr_filter_prefix(sr_filter_next(p), t[0] == 'n',
+                             &p->nodes[n].t.addr, &p->nodes[n].t.mask))
+        { p->err = "bad address"; return -1; }
+        return n;
+    }
+    if (op != F_NET)
+    { p->err = "expected net or host after src/dst"; return -1; }
+
+    if (strcmp(t, "arp") == 0 || strcmp(t, "ip") == 0)
+    {
+        p->nodes[n].t.op  = F_ETHER;
+        p->nodes[n].t.val = (t[0] == 'a') ? ethertype_arp : ethertype_ip;
+        return n;
+    }
+    if (strcmp(t, "ether") == 0)
+    {
+        p->nodes[n].t.op = F_ETHER;
+        if (sr_filter_number(sr_filter_next(p), &p->nodes[n].t.val) ||
+            p->nodes[n].t.val > 0xffff)
+        { p->err = "bad ethertype"; return -1; }
+        return n;
+    }
+    if (strcmp(t, "iface") == 0)
+    {
+        arg = sr_filter_next(p);
+        if (!*arg || strlen(arg) >= sizeof(p->nodes[n].t.name))
+        { p->err = "bad interface name"; return -1; }
+        p->nodes[n].t.op = F_IFACE;
+        strcpy(p->nodes[n].t.name, arg);
+        return n;
+    }
+    if (strcmp(t, "proto") == 0)
+    {
+        p->nodes[n].t.op = F_PROTO;
+        arg = sr_filter_next(p);
+        if (strcmp(arg, "icmp") == 0)
+        { p->nodes[n].t.val = ip_protocol_icmp; }
+        else if (strcmp(arg, "tcp") == 0)
+        { p->nodes[n].t.val = ip_protocol_tcp; }
+        else if (strcmp(arg, "udp") == 0)
+        { p->nodes[n].t.val = ip_protocol_udp; }
+        else if (sr_filter_number(arg, &p->nodes[n].t.val) ||
+                 p->nodes[n].t.val > 0xff)
+        { p->err = "bad protocol"; return -1; }
+        return n;
+    }
+    if (strcmp(t, "sample") == 0 || strcmp(t, "flow") == 0)
+    {
+        p->nodes[n].t.op = (t[0] == 's') ? F_SAMPLE : F_FLOW;
+        if (sr_filter_number(sr_filter_next(p), &p->nodes[n].t.val) ||
+            p->nodes[n].t.val == 0)
+        { p->err = "sampling rate must be a positive number"; return -1; }
+        return n;
+    }
+
+    p->err = *t ? "unknown primitive" : "unexpected end of expression";
+    return -1;
+} /* -- sr_filter_primitive -- */
+
+static int sr_filter_factor(struct sr_filter_parse* p)
+{
+    const char* t = sr_filter_peek(p);
+    int n;
+
+    if (strcmp(t, "not") == 0 || strcmp(t, "!") == 0)
+    {
+        sr_filter_next(p);
+        if ((n = sr_filter_factor(p)) < 0)
+        { return -1; }
+        return sr_filter_node(p, F_NOT, n, -1);
+    }
+    if (strcmp(t, "(") == 0)
+    {
+        sr_filter_next(p);
+        if ((n = sr_filter_expr(p)) < 0)
+        { return -1; }
+        if (strcmp(sr_filter_next(p), ")"))
+        { p->err = "missing )"; return -1; }
+        return n;
+    }
+    return sr_filter_primitive(p);
+} /* -- sr_filter_factor -- */
+
+static int sr_filter_term(struct sr_filter_parse* p)
+{
+    int l, r;
+
+    if ((l = sr_filter_factor(p)) < 0)
+    { return -1; }
+    while (strcmp(sr_filter_peek(p), "and") == 0 ||
+           strcmp(sr_filter_peek(p), "&&") == 0)
+    {
+        sr_filter_next(p);
+        if ((r = sr_filter_factor(p)) < 0)
+        { return -1; }
+        if ((l = sr_filter_node(p, F_AND, l, r)) < 0)
+        { return -1; }
+    }
+    return l;
+} /* -- sr_filter_term -- */
+
+static int sr_filter_expr(struct sr_filter_parse* p)
+{
+    int l, r;
+
+    if ((l = sr_filter_term(p)) < 0)
+    { return -1; }
+    while (strcmp(sr_filter_peek(p), "or") == 0 ||
+           strcmp(sr_filter_peek(p), "||") == 0)
+    {
+        sr_filter_next(p);
+        if ((r = sr_filter_term(p)) < 0)
+        { return -1; }
+        if ((l = sr_filter_node(p, F_OR, l, r)) < 0)
+        { return -1; }
+    }
+    return l;
+} /* -- sr_filter_expr -- */
+
+/*---------------------------------------------------------------------------
+ * Code generation
+ *
+ * Emitting the right operand first means every jump target already
+ * exists when a test is emitted, so no back-patching is needed; the
+ * program runs from the last instruction towards the first.
+ *-------------------------------------------------------------------------*/
+
+static int sr_filter_gen(struct sr_filter_parse* p, struct sr_filter* f,
+                         int n, int jt, int jf)
+{
+    struct sr_filter_node* node = &p->nodes[n];
+    int r;
+
+    switch (node->t.op)
+    {
+        case F_AND:
+            r = sr_filter_gen(p, f, node->r, jt, jf);
+            return sr_filter_gen(p, f, node->l, r, jf);
+        case F_OR:
+            r = sr_filter_gen(p, f, node->r, jt, jf);
+            return sr_filter_gen(p, f, node->l, jt, r);
+        case F_NOT:
+            return sr_filter_gen(p, f, node->l, jf, jt);
+        default:
+            f->insns[f->ninsns] = node->t;
+            f->insns[f->ninsns].jt = jt;
+            f->insns[f->ninsns].jf = jf;
+            return f->ninsns++;
+    }
+} /* -- sr_filter_gen -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_filter_compile(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_filter* sr_filter_compile(const char* expr)
+{
+    struct sr_filter_parse* p;
+    struct sr_filter* f = 0;
+    int root;
+
+    /* REQUIRES */
+    assert(expr);
+
+    p = (struct sr_filter_parse*)calloc(1, sizeof(struct sr_filter_parse));
+    assert(p);
+
+    sr_filter_tokenize(p, expr);
+    if (p->err)
+    { goto out; }
+
+    if (p->ntoks == 0)
+    { root = sr_filter_node(p, F_TRUE, -1, -1); }
+    else
+    { root = sr_filter_expr(p); }
+
+    if (root >= 0 && p->pos != p->ntoks)
+    {
+        sr_filter_next(p);
+        p->err = "trailing junk";
+    }
+    if (p->err)
+    { goto out; }
+
+    f = (struct sr_filter*)calloc(1, sizeof(struct sr_filter));
+    assert(f);
+    f->insns = (struct sr_filter_insn*)calloc(p->nnodes,
+                                              sizeof(struct sr_filter_insn));
+    assert(f->insns);
+    f->entry = sr_filter_gen(p, f, root, SR_FILTER_ACCEPT, SR_FILTER_REJECT);
+
+out:
+    if (p->err)
+    {
+        if (p->last && *p->last)
+        { fprintf(stderr, "capture filter: %s at \"%s\"\n", p->err, p->last); }
+        else
+        { fprintf(stderr, "capture filter: %s\n", p->err); }
+    }
+    free(p->text);
+    free(p);
+    return f;
+} /* -- sr_filter_compile -- */
+
+/*---------------------------------------------------------------------------
+ * Matching
+ *-------------------------------------------------------------------------*/
+
+static void sr_filter_decode(struct sr_filter_pkt* k)
+{
+    const struct sr_ethernet_hdr* eh;
+    const struct sr_ip_hdr* ip;
+    const uint8_t* l4;
+    unsigned int hl;
+
+    k->ethertype = 0;
+    k->ip = 0;
+    k->sport = k->dport = 0;
+
+    if (k->len < sizeof(struct sr_ethernet_hdr))
+    { return; }
+    eh = (const struct sr_ethernet_hdr*)k->buf;
+    k->ethertype = ntohs(eh->ether_type);
+
+    if (k->ethertype != ethertype_ip ||
+        k->len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr))
+    { return; }
+    ip = (const struct sr_ip_hdr*)(k->buf + sizeof(struct sr_ethernet_hdr));
+    hl = ip->ip_hl * 4;
+    if (ip->ip_v != 4 || hl < sizeof(struct sr_ip_hdr))
+    { return; }
+    k->ip = ip;
+
+    /* -- ports only from the first fragment of tcp/udp -- */
+    if ((ip->ip_p != ip_protocol_tcp && ip->ip_p != ip_protocol_udp) ||
+        (ntohs(ip->ip_off) & IP_OFFMASK) ||
+        k->len < sizeof(struct sr_ethernet_hdr) + hl + 4)
+    { return; }
+    l4 = (const uint8_t*)ip + hl;
+    memcpy(&k->sport, l4, 2);
+    memcpy(&k->dport, l4 + 2, 2);
+} /* -- sr_filter_decode -- */
+
+/* direction independent so both halves of a conversation are kept */
+static uint32_t sr_filter_flow_hash(const struct sr_filter_pkt* k)
+{
+    uint32_t h;
+
+    h  = k->ip->ip_src ^ k->ip->ip_dst;
+    h ^= (uint32_t)(k->sport ^ k->dport) << 16;
+    h ^= k->ip->ip_p;
+    h *= 0x9e3779b1;
+    return h ^ (h >> 16);
+} /* -- sr_filter_flow_hash -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_filter_match(..)
+ * Scope: Global
+ *
+ * Returns 1 if the frame should be captured.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_filter_match(struct sr_filter* f, const uint8_t* buf,
+                    unsigned int len, const char* iface)
+{
+    struct sr_filter_pkt k;
+    struct sr_filter_insn* in;
+    int pc, hit;
+
+    /* REQUIRES */
+    assert(f);
+    assert(buf);
+
+    k.buf   = buf;
+    k.len   = len;
+    k.iface = iface ? iface : "";
+    sr_filter_decode(&k);
+
+    for (pc = f->entry; pc >= 0; pc = hit ? in->jt : in->jf)
+    {
+        in = &f->insns[pc];
+        switch (in->op)
+        {
+            case F_IFACE:
+                hit = strncmp(k.iface, in->name, sizeof(in->name)) == 0;
+                break;
+            case F_ETHER:
+                hit = k.ethertype == in->val;
+                break;
+            case F_SRC_NET:
+                hit = k.ip && (k.ip->ip_src & in->mask) == in->addr;
+                break;
+            case F_DST_NET:
+                hit = k.ip && (k.ip->ip_dst & in->mask) == in->addr;
+                break;
+            case F_NET:
+                hit = k.ip && ((k.ip->ip_src & in->mask) == in->addr ||
+                               (k.ip->ip_dst & in->mask) == in->addr);
+                break;
+            case F_PROTO:
+                hit = k.ip && k.ip->ip_p == in->val;
+                break;
+            case F_SAMPLE:
+                hit = __atomic_fetch_add(&in->count, 1, __ATOMIC_RELAXED)
+                      % in->val == 0;
+                break;
+            case F_FLOW:
+                hit = k.ip && sr_filter_flow_hash(&k) % in->val == 0;
+                break;
+            default:
+                hit = 1;
+                break;
+        }
+    }
+
+    return pc == SR_FILTER_ACCEPT;
+} /* -- sr_filter_match -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_filter_dump(..)
+ * Scope: Global
+ *
+ * Print the compiled program, entry first.
+ *
+ *---------------------------------------------------------------------------*/
+
+static const char* sr_filter_target(int t, char* buf)
+{
+    if (t == SR_FILTER_ACCEPT)
+    { return "accept"; }
+    if (t == SR_FILTER_REJECT)
+    { return "reject"; }
+    sprintf(buf, "%d", t);
+    return buf;
+} /* -- sr_filter_target -- */
+
+void sr_filter_dump(struct sr_filter* f, FILE* fp)
+{
+    static const char* names[] = {
+        "iface", "ether", "src net", "dst net", "net", "proto",
+        "sample", "flow", "true"
+    };
+    struct sr_filter_insn* in;
+    struct in_addr a;
+    char bt[16], bf[16];
+    int pc;
+
+    /* REQUIRES */
+    assert(f);
+
+    for (pc = f->ninsns - 1; pc >= 0; pc--)
+    {
+        in = &f->insns[pc];
+        fprintf(fp, "  %2d: %-7s ", pc, names[in->op]);
+        switch (in->op)
+        {
+            case F_IFACE:
+                fprintf(fp, "%-18s", in->name);
+                break;
+            case F_SRC_NET:
+            case F_DST_NET:
+            case F_NET:
+                a.s_addr = in->addr;
+                fprintf(fp, "%-15s/%-2d", inet_ntoa(a),
+                        __builtin_popcount(in->mask));
+                break;
+            case F_ETHER:
+                fprintf(fp, "0x%04x            ", in->val);
+                break;
+            case F_TRUE:
+                fprintf(fp, "%-18s", "");
+                break;
+            default:
+                fprintf(fp, "%-18u", in->val);
+                break;
+        }
+        fprintf(fp, " jt %s jf %s\n", sr_filter_target(in->jt, bt),
+                sr_filter_target(in->jf, bf));
+    }
+} /* -- sr_filter_dump -- */
+
+void sr_filter_free(struct sr_filter* f)
+{
+    if (f == 0)
+    { return; }
+    free(f->insns);
+    free(f);
+} /* -- sr_filter_free -- */
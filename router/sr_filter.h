@@ -0,0 +1,46 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_filter.h
+ *
+ * Description:
+ *
+ * Capture filters for "-l".  A filter expression is compiled once into a
+ * short branch program (each test jumps to the next test or to accept /
+ * reject) that sr_filter_match() runs on every frame before it is copied.
+ *
+ *   expr      := term { "or" term }
+ *   term      := factor { "and" factor }
+ *   factor    := "not" factor | "(" expr ")" | primitive
+ *   primitive := iface NAME
+ *              | arp | ip | ether TYPE
+ *              | [src|dst] net A.B.C.D[/LEN] | [src|dst] host A.B.C.D
+ *              | proto icmp|tcp|udp|NUM
+ *              | sample N          keep 1 in N of the frames that get here
+ *              | flow N            keep flows whose 5-tuple hashes to 0 mod N
+ *
+ * e.g.  -F "iface eth1 and not arp and (proto icmp or sample 100)"
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FILTER_H
+#define SR_FILTER_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stdio.h>
+
+struct sr_filter;
+
+/* returns 0 and prints why if expr doesn't parse */
+struct sr_filter* sr_filter_compile(const char* expr);
+int  sr_filter_match(struct sr_filter* , const uint8_t* buf,
+                     unsigned int len, const char* iface);
+void sr_filter_dump(struct sr_filter* , FILE* );
+void sr_filter_free(struct sr_filter* );
+
+#endif /* -- SR_FILTER_H -- */
@@ -0,0 +1,168 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_flight.c
+ *
+ * Description:
+ *
+ * Flight recorder buffer, see sr_flight.h.
+ *
+ * head and tail are byte counts that only ever grow; the position in the
+ * buffer is the count modulo its size, and a record may wrap around the
+ * end.  Adding a record first retires the oldest ones until it fits, so
+ * [tail, head) is always a run of whole records in pcap file order and a
+ * dump is at most two fwrite()s.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "sr_flight.h"
+#include "sr_dumper.h"
+
+struct sr_flight
+{
+    uint8_t* buf;
+    uint64_t size;
+    uint64_t head;              /* next byte written */
+    uint64_t tail;              /* oldest record */
+    unsigned int snaplen;
+};
+
+/* -- copy in / out of the ring at byte count off, wrapping as needed -- */
+
+static void sr_flight_put(struct sr_flight* fl, uint64_t off,
+                          const void* src, uint32_t len)
+{
+    uint64_t pos = off % fl->size;
+    uint32_t n = min(len, fl->size - pos);
+
+    memcpy(fl->buf + pos, src, n);
+    memcpy(fl->buf, (const uint8_t*)src + n, len - n);
+} /* -- sr_flight_put -- */
+
+static void sr_flight_get(struct sr_flight* fl, uint64_t off,
+                          void* dst, uint32_t len)
+{
+    uint64_t pos = off % fl->size;
+    uint32_t n = min(len, fl->size - pos);
+
+    memcpy(dst, fl->buf + pos, n);
+    memcpy((uint8_t*)dst + n, fl->buf, len - n);
+} /* -- sr_flight_get -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flight_create(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_flight* sr_flight_create(uint64_t bytes, unsigned int snaplen)
+{
+    struct sr_flight* fl;
+
+    /* -- room for at least one full record -- */
+    if (bytes < sizeof(struct pcap_sf_pkthdr) + snaplen)
+    { bytes = sizeof(struct pcap_sf_pkthdr) + snaplen; }
+
+    fl = (struct sr_flight*)calloc(1, sizeof(struct sr_flight));
+    assert(fl);
+    if ((fl->buf = (uint8_t*)malloc(bytes)) == 0)
+    {
+        fprintf(stderr, "sr_flight_create: can't allocate %lu bytes\n",
+                (unsigned long)bytes);
+        free(fl);
+        return 0;
+    }
+    fl->size    = bytes;
+    fl->snaplen = snaplen;
+
+    return fl;
+} /* -- sr_flight_create -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flight_add(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_flight_add(struct sr_flight* fl, uint64_t ts_ns, const uint8_t* data,
+                   uint32_t caplen, uint32_t len)
+{
+    struct pcap_sf_pkthdr h;
+    uint32_t need;
+
+    /* REQUIRES */
+    assert(fl);
+    assert(data);
+
+    caplen = min(caplen, fl->snaplen);
+    need   = sizeof(h) + caplen;
+
+    /* -- retire the oldest records until this one fits -- */
+    while (fl->head + need - fl->tail > fl->size)
+    {
+        sr_flight_get(fl, fl->tail, &h, sizeof(h));
+        fl->tail += sizeof(h) + h.caplen;
+    }
+
+    h.ts.tv_sec  = ts_ns / 1000000000ULL;
+    h.ts.tv_usec = (ts_ns % 1000000000ULL) / 1000;
+    h.caplen     = caplen;
+    h.len        = len;
+    sr_flight_put(fl, fl->head, &h, sizeof(h));
+    sr_flight_put(fl, fl->head + sizeof(h), data, caplen);
+    fl->head += need;
+} /* -- sr_flight_add -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flight_dump(..)
+ * Scope: Global
+ *
+ * Write everything recorded so far to fname as a pcap file.  The buffer is
+ * left as it is.  Returns 0 on success, -1 on error.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_flight_dump(struct sr_flight* fl, const char* fname)
+{
+    FILE* fp;
+    uint64_t pos, n;
+    int ret = 0;
+
+    /* REQUIRES */
+    assert(fl);
+    assert(fname);
+
+    if ((fp = sr_dump_open(fname, 0, fl->snaplen)) == 0)
+    { return -1; }
+
+    pos = fl->tail % fl->size;
+    n   = fl->head - fl->tail;
+    if (pos + n > fl->size)
+    {
+        if (fwrite(fl->buf + pos, fl->size - pos, 1, fp) != 1)
+        { ret = -1; }
+        n  -= fl->size - pos;
+        pos = 0;
+    }
+    if (n && fwrite(fl->buf + pos, n, 1, fp) != 1)
+    { ret = -1; }
+
+    if (fflush(fp) != 0)
+    { ret = -1; }
+    if (ret < 0)
+    { perror("fwrite(..):sr_flight.c::sr_flight_dump"); }
+    sr_dump_close(fp);
+
+    return ret;
+} /* -- sr_flight_dump -- */
+
+void sr_flight_destroy(struct sr_flight* fl)
+{
+    if (fl == 0)
+    { return; }
+    free(fl->buf);
+    free(fl);
+} /* -- sr_flight_destroy -- */
@@ -0,0 +1,34 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_flight.h
+ *
+ * Description:
+ *
+ * Flight recorder: the last N bytes of captured packets, kept in memory as
+ * sr_dump() records (struct pcap_sf_pkthdr followed by the frame) in one
+ * circular buffer, oldest records overwritten first.  sr_flight_dump()
+ * writes the buffer out as an ordinary pcap file.
+ *
+ * Not thread safe; the capture writer thread is the only user.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FLIGHT_H
+#define SR_FLIGHT_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_flight;
+
+struct sr_flight* sr_flight_create(uint64_t bytes, unsigned int snaplen);
+void sr_flight_add(struct sr_flight* , uint64_t ts_ns, const uint8_t* data,
+                   uint32_t caplen, uint32_t len);
+int  sr_flight_dump(struct sr_flight* , const char* fname);
+void sr_flight_destroy(struct sr_flight* );
+
+#endif /* -- SR_FLIGHT_H -- */
@@ -0,0 +1,268 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_flow.c
+ *
+ * Description:
+ *
+ * Per-thread flow cache, see sr_flow.h.
+ *
+ * A thread gets its cache on its first lookup, registered in sr->flows
+ * only so it can be freed and its hit rate reported at exit.  Nothing but
+ * the owning thread ever reads or writes it; the one shared word is
+ * sr->flow_gen.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "sr_flow.h"
+#include "sr_event.h"
+#include "sr_ring.h"
+#include "sr_router.h"
+#include "sr_if.h"
+
+struct sr_flow_bucket
+{
+    struct sr_flow_entry e[SR_FLOW_WAYS];
+} __attribute__ ((aligned (SR_CACHELINE))) ;
+
+struct sr_flow_cache
+{
+    struct sr_flow_bucket b[SR_FLOW_BUCKETS];
+    unsigned long hits;
+    unsigned long misses;
+    unsigned int victim;        /* next way to evict */
+};
+
+struct sr_flows
+{
+    struct sr_flow_cache* caches[SR_FLOW_THREADS];
+    int n;
+    pthread_mutex_t lock;
+};
+
+/* the calling thread's cache, and which router it belongs to */
+static __thread struct sr_flow_cache* sr_flow_mine;
+static __thread struct sr_flows*      sr_flow_owner;
+
+static __inline__ struct sr_flow_bucket* sr_flow_bucket(
+        struct sr_flow_cache* fc, uint32_t dst)
+{
+    uint32_t h = dst * 0x9e3779b1U;
+
+    return &fc->b[(h >> 16) & (SR_FLOW_BUCKETS - 1)];
+} /* -- sr_flow_bucket -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flow_cache(..)
+ * Scope: Local
+ *
+ * The calling thread's cache, created on first use.  0 if there are
+ * already SR_FLOW_THREADS of them, and that thread goes without.
+ *
+ *---------------------------------------------------------------------------*/
+
+static struct sr_flow_cache* sr_flow_cache(struct sr_instance* sr)
+{
+    struct sr_flows* fl = sr->flows;
+    struct sr_flow_cache* fc = 0;
+
+    if (sr_flow_owner == fl)
+    { return sr_flow_mine; }
+
+    pthread_mutex_lock(&fl->lock);
+    if (fl->n < SR_FLOW_THREADS)
+    {
+        if (posix_memalign((void**)&fc, SR_CACHELINE,
+                           sizeof(struct sr_flow_cache)) != 0)
+        { fc = 0; }
+        assert(fc);
+        memset(fc, 0, sizeof(struct sr_flow_cache));
+        fl->caches[fl->n++] = fc;
+    }
+    pthread_mutex_unlock(&fl->lock);
+
+    sr_flow_owner = fl;
+    sr_flow_mine  = fc;
+    return fc;
+} /* -- sr_flow_cache -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flow_init(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_flow_init(struct sr_instance* sr)
+{
+    /* REQUIRES */
+    assert(sr);
+
+    sr->flows = (struct sr_flows*)calloc(1, sizeof(struct sr_flows));
+    assert(sr->flows);
+    pthread_mutex_init(&sr->flows->lock, 0);
+
+    return 0;
+} /* -- sr_flow_init -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flow_destroy(..)
+ * Scope: Global
+ *
+ * Report the hit rate and free the caches.  The forwarding threads must
+ * be gone.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_flow_destroy(struct sr_instance* sr)
+{
+    struct sr_flows* fl;
+    unsigned long hits = 0, misses = 0;
+    int i;
+
+    if ((fl = sr->flows) == 0)
+    { return; }
+
+    for (i = 0; i < fl->n; i++)
+    {
+        hits   += fl->caches[i]->hits;
+        misses += fl->caches[i]->misses;
+        free(fl->caches[i]);
+    }
+    fprintf(stderr, "flow cache: %lu hits, %lu misses\n", hits, misses);
+
+    pthread_mutex_destroy(&fl->lock);
+    free(fl);
+    sr->flows = 0;
+} /* -- sr_flow_destroy -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flow_invalidate(..)
+ * Scope: Global
+ *
+ * Start a new generation, which is a miss on every cached entry.  Call
+ * after changing anything a forwarding decision is made from.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_flow_invalidate(struct sr_instance* sr)
+{
+    /* -- 0 is what empty entries hold, skip it when wrapping -- */
+    if (__atomic_add_fetch(&sr->flow_gen, 1, __ATOMIC_RELEASE) == 0)
+    { __atomic_add_fetch(&sr->flow_gen, 1, __ATOMIC_RELEASE); }
+} /* -- sr_flow_invalidate -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flow_lookup(..)
+ * Scope: Global
+ *
+ * The caller's cached decision for dst, or 0.  Either way *gen is the
+ * current generation; on a miss, pass it to sr_flow_insert() with the
+ * decision, so a change made while it was being worked out isn't lost.
+ * The entry is only good until the thread's next insert.
+ *
+ *---------------------------------------------------------------------------*/
+
+const struct sr_flow_entry* sr_flow_lookup(struct sr_instance* sr,
+                                           uint32_t dst, uint32_t* gen)
+{
+    struct sr_flow_cache* fc;
+    struct sr_flow_bucket* b;
+    int i;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(gen);
+
+    *gen = __atomic_load_n(&sr->flow_gen, __ATOMIC_ACQUIRE);
+    if (sr->flows == 0 || (fc = sr_flow_cache(sr)) == 0)
+    { return 0; }
+
+    b = sr_flow_bucket(fc, dst);
+    for (i = 0; i < SR_FLOW_WAYS; i++)
+    {
+        if (b->e[i].dst == dst && b->e[i].gen == *gen)
+        {
+            fc->hits++;
+            return &b->e[i];
+        }
+    }
+
+    fc->misses++;
+    return 0;
+} /* -- sr_flow_lookup -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flow_insert(..)
+ * Scope: Global
+ *
+ * Cache the decision for dst made under generation gen: out of ifid to
+ * mac, or local to ifid if mac is 0.  Takes a free or stale way of the
+ * bucket if there is one, else the next in turn.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_flow_insert(struct sr_instance* sr, uint32_t dst, uint32_t gen,
+                    int ifid, const uint8_t* mac)
+{
+    struct sr_flow_cache* fc;
+    struct sr_flow_bucket* b;
+    struct sr_flow_entry* e = 0;
+    int i;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if (sr->flows == 0 || ifid < 0 || ifid > 255 ||
+        (fc = sr_flow_cache(sr)) == 0)
+    { return; }
+
+    b = sr_flow_bucket(fc, dst);
+    for (i = 0; i < SR_FLOW_WAYS && e == 0; i++)
+    {
+        if (b->e[i].dst == dst || b->e[i].gen != gen)
+        { e = &b->e[i]; }
+    }
+    if (e == 0)
+    { e = &b->e[fc->victim++ & (SR_FLOW_WAYS - 1)]; }
+
+    e->dst   = dst;
+    e->gen   = gen;
+    e->ifid  = ifid;
+    e->local = (mac == 0);
+    if (mac)
+    { memcpy(e->mac, mac, ETHER_ADDR_LEN); }
+} /* -- sr_flow_insert -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_flow_output(..)
+ * Scope: Global
+ *
+ * Forward an IP packet whose TTL has been taken care of: fill in the
+ * Ethernet addresses for interface ifid and next hop mac, and send it.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_flow_output(struct sr_instance* sr, int ifid, const uint8_t* mac,
+                   uint8_t* packet, unsigned int len)
+{
+    sr_ethernet_hdr_t* e_hdr = (sr_ethernet_hdr_t*)packet;
+    struct sr_if* iface;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(mac);
+    assert(packet);
+
+    if ((iface = sr_get_interface_id(sr, ifid)) == 0)
+    { return -1; }
+
+    memcpy(e_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN);
+    memcpy(e_hdr->ether_dhost, mac, ETHER_ADDR_LEN);
+    SR_EVENT(sr, SR_EV_FORWARD, 0, packet, len, iface->name);
+
+    return sr_send_packet_if(sr, packet, len, iface);
+} /* -- sr_flow_output -- */
@@ -0,0 +1,70 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_flow.h
+ *
+ * Description:
+ *
+ * Exact match flow cache in front of the forwarding decision.  Each
+ * forwarding thread remembers, per destination address, what the full
+ * decision came to: the packet is for one of the router's own addresses,
+ * or it goes out of interface ifid to Ethernet address mac.  A hit skips
+ * the local address check, the route lookup and the neighbor lookup.
+ *
+ * The decision depends on nothing but the destination (routes are matched
+ * on it and it is the next hop), so that is the whole key.  Only complete
+ * decisions are cached: no route, or a next hop still being resolved, is
+ * a miss every time.
+ *
+ * Entries are stamped with sr->flow_gen, which sr_flow_invalidate() bumps
+ * whenever routes, interface addresses or the ARP table change.  An entry
+ * of another generation is a miss, so nothing is ever flushed by hand.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FLOW_H
+#define SR_FLOW_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include "sr_protocol.h"
+
+#define SR_FLOW_WAYS    4               /* entries per cache line bucket */
+#define SR_FLOW_BUCKETS 256             /* per thread, power of two */
+#define SR_FLOW_THREADS 64
+
+/* ----------------------------------------------------------------------------
+ * struct sr_flow_entry
+ *
+ * One cached decision, 16 bytes so a bucket is a cache line.  Interfaces
+ * with ids above 255 are simply never cached.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_flow_entry
+{
+    uint32_t dst;               /* network byte order */
+    uint32_t gen;               /* sr->flow_gen it was filled under */
+    uint8_t  mac[ETHER_ADDR_LEN];   /* next hop, unless local */
+    uint8_t  ifid;              /* way out, or the interface owning dst */
+    uint8_t  local;
+};
+
+struct sr_instance;
+struct sr_flows;
+
+int  sr_flow_init(struct sr_instance* );
+void sr_flow_destroy(struct sr_instance* );
+void sr_flow_invalidate(struct sr_instance* );
+const struct sr_flow_entry* sr_flow_lookup(struct sr_instance* , uint32_t dst,
+                                           uint32_t* gen);
+void sr_flow_insert(struct sr_instance* , uint32_t dst, uint32_t gen,
+                    int ifid, const uint8_t* mac);
+int  sr_flow_output(struct sr_instance* , int ifid, const uint8_t* mac,
+                    uint8_t* packet, unsigned int len);
+
+#endif /* -- SR_FLOW_H -- */
@@ -0,0 +1,468 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_icmp.c
+ *
+ * Description:
+ *
+ * ICMP error templates, see sr_icmp.h.
+ *
+ * A template's IP header has a destination of 0.0.0.0 and an ICMP
+ * checksum over the 8 byte ICMP header alone, both with valid checksums,
+ * so filling in the destination is an ip_set_dst() and appending the
+ * quote a cksum_extend().
+ *
+ * The token buckets are kept as GCRA: a bucket is the time it will be
+ * full again ("theoretical arrival time"), which each error pushes one
+ * period further out; an error is allowed while that is at most burst-1
+ * periods ahead of now.  One 64 bit word, so the per-interface buckets are
+ * updated with a compare and swap.  The per-source buckets live in a
+ * direct mapped table, a slot taken over by a new prefix starts full, and
+ * each slot has a spin lock for the key and bucket together.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+
+#include "sr_icmp.h"
+#include "sr_event.h"
+#include "sr_mbuf.h"
+#include "sr_ring.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sr_if.h"
+
+#define SR_ICMP_IP_OFF   sizeof(sr_ethernet_hdr_t)
+#define SR_ICMP_OFF      (SR_ICMP_IP_OFF + sizeof(sr_ip_hdr_t))
+#define SR_ICMP_HDR_LEN  (SR_ICMP_OFF + sizeof(sr_icmp_t3_hdr_t) - ICMP_DATA_SIZE)
+#define SR_ICMP_LEN      (SR_ICMP_OFF + sizeof(sr_icmp_t3_hdr_t))
+
+#define SR_ICMP_SRC_SLOTS 1024  /* per-source buckets, power of 2 */
+
+struct sr_icmp_tmpl
+{
+    uint8_t hdr[SR_ICMP_HDR_LEN];   /* everything up to the quoted bytes */
+    uint64_t tat;                   /* interface bucket, ns */
+    unsigned long limited;          /* errors it suppressed */
+};
+
+struct sr_icmp_src
+{
+    uint32_t prefix;            /* network byte order */
+    uint8_t kind;
+    char lock;
+    uint64_t tat;
+};
+
+struct sr_icmp
+{
+    struct sr_icmp_limits lim;
+    uint64_t if_period;         /* ns per token, 0 = no limit */
+    uint64_t if_slack;          /* ns the bucket may run ahead of now */
+    uint64_t src_period;
+    uint64_t src_slack;
+    uint32_t src_mask;          /* network byte order */
+    unsigned long limited[SR_ICMP_ERRORS];  /* by the source buckets */
+    struct sr_icmp_src src[SR_ICMP_SRC_SLOTS];
+};
+
+static const struct
+{
+    uint8_t type;
+    uint8_t code;
+    const char* name;
+} sr_icmp_kinds[SR_ICMP_ERRORS] = {
+    { 0x03, 0x00, "net unreachable" },
+    { 0x03, 0x01, "host unreachable" },
+    { 0x03, 0x02, "protocol unreachable" },
+    { 0x03, 0x03, "port unreachable" },
+    { 0x0B, 0x00, "time exceeded" }
+};
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_icmp_limits_init(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_icmp_limits_init(struct sr_icmp_limits* l)
+{
+    /* REQUIRES */
+    assert(l);
+
+    l->if_rate    = 1000;
+    l->if_burst   = 50;
+    l->src_rate   = 100;
+    l->src_burst  = 10;
+    l->src_prefix = 24;
+} /* -- sr_icmp_limits_init -- */
+
+/* -- "rate[:burst]" up to the next comma -- */
+static const char* sr_icmp_parse_rate(const char* p, unsigned int* rate,
+                                      unsigned int* burst)
+{
+    char* end;
+
+    *rate = (unsigned int)strtoul(p, &end, 10);
+    if (end == p)
+    { return 0; }
+    if (*end == ':')
+    {
+        p = end + 1;
+        *burst = (unsigned int)strtoul(p, &end, 10);
+        if (end == p || *burst == 0)
+        { return 0; }
+    }
+    return end;
+} /* -- sr_icmp_parse_rate -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_icmp_parse_limits(..)
+ * Scope: Global
+ *
+ * Parse a -I spec into l, see sr_icmp.h.  Returns 0 on success, -1 on a
+ * malformed spec.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_icmp_parse_limits(struct sr_icmp_limits* l, const char* spec)
+{
+    const char* p = spec;
+    char* end;
+
+    /* REQUIRES */
+    assert(l);
+    assert(spec);
+
+    while (p && *p)
+    {
+        if (strncmp(p, "iface=", 6) == 0)
+        { p = sr_icmp_parse_rate(p + 6, &l->if_rate, &l->if_burst); }
+        else if (strncmp(p, "src=", 4) == 0)
+        { p = sr_icmp_parse_rate(p + 4, &l->src_rate, &l->src_burst); }
+        else if (strncmp(p, "prefix=", 7) == 0)
+        {
+            l->src_prefix = (unsigned int)strtoul(p + 7, &end, 10);
+            p = (end == p + 7 || l->src_prefix > 32) ? 0 : end;
+        }
+        else
+        { p = 0; }
+
+        if (p && *p == ',')
+        { p++; }
+        else if (p && *p)
+        { p = 0; }
+    }
+
+    if (p == 0)
+    {
+        fprintf(stderr, "Bad ICMP limits \"%s\"\n", spec);
+        return -1;
+    }
+    return 0;
+} /* -- sr_icmp_parse_limits -- */
+
+static uint64_t sr_icmp_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* -- take a token from the bucket at tat, 0 if there is none -- */
+static int sr_icmp_take(uint64_t* tat, uint64_t now, uint64_t period,
+                        uint64_t slack)
+{
+    uint64_t t, next;
+
+    t = __atomic_load_n(tat, __ATOMIC_RELAXED);
+    do
+    {
+        if (t > now + slack)
+        { return 0; }
+        next = (t > now ? t : now) + period;
+    } while (!__atomic_compare_exchange_n(tat, &t, next, 1, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+    return 1;
+} /* -- sr_icmp_take -- */
+
+/* -- the same for src's bucket for this class -- */
+static int sr_icmp_take_src(struct sr_icmp* ic, uint32_t src, int kind,
+                            uint64_t now)
+{
+    struct sr_icmp_src* e;
+    uint32_t prefix = src & ic->src_mask, h;
+    unsigned int spins = 0;
+    int ok;
+
+    h = (prefix * 0x9e3779b1) ^ ((uint32_t)kind * 0x85ebca6b);
+    e = &ic->src[(h ^ (h >> 16)) & (SR_ICMP_SRC_SLOTS - 1)];
+
+    while (__atomic_test_and_set(&e->lock, __ATOMIC_ACQUIRE))
+    { sr_ring_relax(++spins); }
+
+    if (e->prefix != prefix || e->kind != kind)
+    {
+        e->prefix = prefix;
+        e->kind   = kind;
+        e->tat    = 0;
+    }
+    ok = sr_icmp_take(&e->tat, now, ic->src_period, ic->src_slack);
+
+    __atomic_clear(&e->lock, __ATOMIC_RELEASE);
+    return ok;
+} /* -- sr_icmp_take_src -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_icmp_allow(..)
+ * Scope: Local
+ *
+ * 1 if an error of this kind to src may go out of iface now, 0 if one of
+ * the buckets is empty (and counted as such).
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_icmp_allow(struct sr_instance* sr, struct sr_icmp_tmpl* t,
+                         uint32_t src, int kind)
+{
+    struct sr_icmp* ic = sr->icmp;
+    uint64_t now;
+
+    if (ic->src_period == 0 && ic->if_period == 0)
+    { return 1; }
+    now = sr_icmp_now();
+
+    if (ic->src_period && !sr_icmp_take_src(ic, src, kind, now))
+    {
+        __atomic_fetch_add(&ic->limited[kind], 1, __ATOMIC_RELAXED);
+        SR_STAT_INC(sr, icmp_limited);
+        return 0;
+    }
+    if (ic->if_period &&
+        !sr_icmp_take(&t->tat, now, ic->if_period, ic->if_slack))
+    {
+        __atomic_fetch_add(&t->limited, 1, __ATOMIC_RELAXED);
+        SR_STAT_INC(sr, icmp_limited);
+        return 0;
+    }
+    return 1;
+} /* -- sr_icmp_allow -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_icmp_build(..)
+ * Scope: Local
+ *
+ * One template: iface's addresses, no destination, no quote.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_icmp_build(struct sr_icmp_tmpl* t, struct sr_if* iface,
+                          int kind)
+{
+    sr_ethernet_hdr_t* e_hdr = (sr_ethernet_hdr_t*)t->hdr;
+    sr_ip_hdr_t* ip_hdr = (sr_ip_hdr_t*)(t->hdr + SR_ICMP_IP_OFF);
+    sr_icmp_t3_hdr_t* icmp_hdr = (sr_icmp_t3_hdr_t*)(t->hdr + SR_ICMP_OFF);
+
+    memset(t->hdr, 0, sizeof(t->hdr));
+
+    memcpy(e_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN);
+    e_hdr->ether_type = htons(ethertype_ip);
+
+    prepare_ipv4_hdr(ip_hdr, 0x00 /* TOS */,
+                     SR_ICMP_LEN - SR_ICMP_IP_OFF, 0x0000 /* ID */,
+                     IP_DF /* offset */, ip_protocol_icmp,
+                     ntohl(iface->ip) /* source */, 0 /* destination */);
+
+    icmp_hdr->icmp_type = sr_icmp_kinds[kind].type;
+    icmp_hdr->icmp_code = sr_icmp_kinds[kind].code;
+    icmp_hdr->icmp_sum  = cksum(icmp_hdr, SR_ICMP_HDR_LEN - SR_ICMP_OFF);
+} /* -- sr_icmp_build -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_icmp_init(..)
+ * Scope: Global
+ *
+ * Build the templates for every interface.  Call once the interface list
+ * is complete.  Returns 0 on success.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_icmp_init(struct sr_instance* sr)
+{
+    struct sr_if* iface;
+    struct sr_icmp* ic;
+    const struct sr_icmp_limits* l;
+    int kind;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if ((ic = sr->icmp) == 0)
+    {
+        if ((ic = (struct sr_icmp*)calloc(1, sizeof(struct sr_icmp))) == 0)
+        {
+            perror("calloc(..):sr_icmp.c::sr_icmp_init");
+            return -1;
+        }
+        sr->icmp = ic;
+    }
+
+    l = &sr->icmp_limits;
+    ic->lim = *l;
+    ic->if_period  = l->if_rate ? 1000000000ULL / l->if_rate : 0;
+    ic->if_slack   = ic->if_period * (l->if_burst - 1);
+    ic->src_period = l->src_rate ? 1000000000ULL / l->src_rate : 0;
+    ic->src_slack  = ic->src_period * (l->src_burst - 1);
+    ic->src_mask   = l->src_prefix ? htonl(0xffffffffU << (32 - l->src_prefix))
+                                   : 0;
+
+    for (iface = sr->if_list; iface; iface = iface->next)
+    {
+        if (iface->icmp == 0)
+        {
+            iface->icmp = (struct sr_icmp_tmpl*)
+                calloc(SR_ICMP_ERRORS, sizeof(struct sr_icmp_tmpl));
+            if (iface->icmp == 0)
+            {
+                perror("malloc(..):sr_icmp.c::sr_icmp_init");
+                return -1;
+            }
+        }
+        for (kind = 0; kind < SR_ICMP_ERRORS; kind++)
+        { sr_icmp_build(&iface->icmp[kind], iface, kind); }
+    }
+
+    return 0;
+} /* -- sr_icmp_init -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_icmp_send_error(..)
+ * Scope: Global
+ *
+ * Send an ICMP error about frame (Ethernet header included, IP header
+ * checked by the caller) out of iface, back to the frame's Ethernet
+ * source.  Quotes the first 28 bytes of the IP packet, zero padded if it
+ * is shorter.  Returns 0 if it was sent, 1 if the rate limits held it
+ * back, -1 if it couldn't be sent.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_icmp_send_error(struct sr_instance* sr, enum sr_icmp_error kind,
+                       const uint8_t* frame, unsigned int len,
+                       const char* iface)
+{
+    const sr_ethernet_hdr_t* in_eth = (const sr_ethernet_hdr_t*)frame;
+    const sr_ip_hdr_t* in_ip = (const sr_ip_hdr_t*)(frame + SR_ICMP_IP_OFF);
+    struct sr_if* if_to_send;
+    struct sr_mbuf* m;
+    sr_ethernet_hdr_t* e_hdr;
+    sr_icmp_t3_hdr_t* icmp_hdr;
+    unsigned int quote;
+    uint8_t* buf;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(frame);
+    assert(kind < SR_ICMP_ERRORS);
+    assert(len >= SR_ICMP_IP_OFF + sizeof(sr_ip_hdr_t));
+
+    if_to_send = sr_get_interface(sr, iface);
+    if (if_to_send == 0 || if_to_send->icmp == 0)
+    { return -1; }
+    if (!sr_icmp_allow(sr, &if_to_send->icmp[kind], in_ip->ip_src, kind))
+    {
+        SR_EVENT(sr, SR_EV_ICMP_LIMITED, kind, frame, len, iface);
+        return 1;
+    }
+    if ((m = sr_mbuf_alloc(sr->mbufs)) == 0)
+    { return -1; }
+
+    buf = sr_mbuf_append(m, SR_ICMP_LEN);
+    memcpy(buf, if_to_send->icmp[kind].hdr, SR_ICMP_HDR_LEN);
+
+    e_hdr = (sr_ethernet_hdr_t*)buf;
+    memcpy(e_hdr->ether_dhost, in_eth->ether_shost, ETHER_ADDR_LEN);
+    ip_set_dst((sr_ip_hdr_t*)(buf + SR_ICMP_IP_OFF), in_ip->ip_src);
+
+    icmp_hdr = (sr_icmp_t3_hdr_t*)(buf + SR_ICMP_OFF);
+    quote = len - SR_ICMP_IP_OFF;
+    if (quote > ICMP_DATA_SIZE)
+    { quote = ICMP_DATA_SIZE; }
+    memcpy(icmp_hdr->data, in_ip, quote);
+    memset(icmp_hdr->data + quote, 0, ICMP_DATA_SIZE - quote);
+    icmp_hdr->icmp_sum = cksum_extend(icmp_hdr->icmp_sum, icmp_hdr->data,
+                                      ICMP_DATA_SIZE);
+
+    SR_EVENT(sr, SR_EV_ICMP, kind, frame, len, iface);
+    return sr_send_mbuf(sr, m, if_to_send);
+} /* -- sr_icmp_send_error -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_icmp_report(..)
+ * Scope: Global
+ *
+ * Print how many errors of each class the rate limits suppressed.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_icmp_report(struct sr_instance* sr, FILE* out)
+{
+    struct sr_icmp* ic;
+    struct sr_if* iface;
+    unsigned long n;
+    int kind;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(out);
+
+    if ((ic = sr->icmp) == 0)
+    { return; }
+
+    for (kind = 0; kind < SR_ICMP_ERRORS; kind++)
+    {
+        if ((n = __atomic_load_n(&ic->limited[kind], __ATOMIC_RELAXED)) != 0)
+        {
+            fprintf(out, "icmp: %lu %s suppressed by source\n", n,
+                    sr_icmp_kinds[kind].name);
+        }
+        for (iface = sr->if_list; iface; iface = iface->next)
+        {
+            if (iface->icmp == 0 ||
+                (n = __atomic_load_n(&iface->icmp[kind].limited,
+                                     __ATOMIC_RELAXED)) == 0)
+            { continue; }
+            fprintf(out, "icmp: %lu %s suppressed on %s\n", n,
+                    sr_icmp_kinds[kind].name, iface->name);
+        }
+    }
+} /* -- sr_icmp_report -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_icmp_destroy(..)
+ * Scope: Global
+ *
+ * Free the templates of every interface and the rate limit state.  Call
+ * once nothing can send an error any more.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_icmp_destroy(struct sr_instance* sr)
+{
+    struct sr_if* iface;
+
+    /* REQUIRES */
+    assert(sr);
+
+    for (iface = sr->if_list; iface; iface = iface->next)
+    {
+        free(iface->icmp);
+        iface->icmp = 0;
+    }
+    free(sr->icmp);
+    sr->icmp = 0;
+} /* -- sr_icmp_destroy -- */
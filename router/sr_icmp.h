@@ -0,0 +1,71 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_icmp.h
+ *
+ * Description:
+ *
+ * ICMP errors (destination unreachable, time exceeded) from prebuilt
+ * templates.  sr_icmp_init() builds, for every interface and every kind
+ * of error, the Ethernet, IPv4 and ICMP headers as they will go out of
+ * that interface, with the checksums of everything that doesn't depend on
+ * the offending packet.  An error is then a copy of the template, the
+ * destination MAC and IP, the 28 quoted bytes, and two incremental
+ * checksum updates.
+ *
+ * Errors are rate limited per class (the enum below), twice over: by a
+ * token bucket per outgoing interface, and by one per source prefix of
+ * the offending packet.  An error goes out only if both have a token.
+ * The limits are set with -I, as a comma separated list of
+ *
+ *   iface=rate[:burst]   per interface and class (default 1000:50)
+ *   src=rate[:burst]     per source prefix and class (default 100:10)
+ *   prefix=len           source prefix length (default 24)
+ *
+ * rate is in errors a second, 0 turns that bucket off.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_ICMP_H
+#define SR_ICMP_H
+
+#include <stdio.h>
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_instance;
+
+enum sr_icmp_error
+{
+    SR_ICMP_NET_UNREACH,        /* type 3 code 0 */
+    SR_ICMP_HOST_UNREACH,       /* type 3 code 1 */
+    SR_ICMP_PROTO_UNREACH,      /* type 3 code 2 */
+    SR_ICMP_PORT_UNREACH,       /* type 3 code 3 */
+    SR_ICMP_TIME_EXCEEDED,      /* type 11 code 0 */
+    SR_ICMP_ERRORS
+};
+
+struct sr_icmp_limits
+{
+    unsigned int if_rate;
+    unsigned int if_burst;
+    unsigned int src_rate;
+    unsigned int src_burst;
+    unsigned int src_prefix;
+};
+
+void sr_icmp_limits_init(struct sr_icmp_limits* );
+int  sr_icmp_parse_limits(struct sr_icmp_limits* , const char* spec);
+
+int  sr_icmp_init(struct sr_instance* );
+int  sr_icmp_send_error(struct sr_instance* , enum sr_icmp_error ,
+                        const uint8_t* frame, unsigned int len,
+                        const char* iface);
+void sr_icmp_report(struct sr_instance* , FILE* );
+void sr_icmp_destroy(struct sr_instance* );
+
+#endif /* -- SR_ICMP_H -- */
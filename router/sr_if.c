@@ -7,6 +7,10 @@
  *
  * Data structures and methods for handling interfaces
  *
+ * The id, name and address indexes (see sr_if.h) live in one struct
+ * sr_if_index that is rebuilt from the list whenever it changes.  Both
+ * hash tables use linear probing and are kept at most half full.
+ *
  *---------------------------------------------------------------------------*/
 
 #include <stdio.h>
@@ -24,6 +28,102 @@
 
 #include "sr_if.h"
 #include "sr_router.h"
+#include "sr_flow.h"
+
+#define SR_IF_HASH_MIN 8
+
+struct sr_if_index
+{
+    struct sr_if** by_id;       /* n entries */
+    int n;
+    struct sr_if** by_name;     /* mask + 1 slots each */
+    struct sr_if** by_ip;
+    unsigned int mask;
+};
+
+/* -- FNV-1a over the name -- */
+static unsigned int sr_if_hash_name(const char* name)
+{
+    unsigned int h = 2166136261U;
+    int i;
+
+    for (i = 0; i < sr_IFACE_NAMELEN && name[i]; i++)
+    { h = (h ^ (unsigned char)name[i]) * 16777619U; }
+    return h;
+} /* -- sr_if_hash_name -- */
+
+static unsigned int sr_if_hash_ip(uint32_t ip)
+{
+    unsigned int h = ip * 0x9e3779b1U;
+
+    return h ^ (h >> 16);
+} /* -- sr_if_hash_ip -- */
+
+static void sr_if_index_free(struct sr_if_index* ix)
+{
+    if (ix == 0)
+    { return; }
+
+    free(ix->by_id);
+    free(ix->by_name);
+    free(ix->by_ip);
+    free(ix);
+} /* -- sr_if_index_free -- */
+
+/*--------------------------------------------------------------------- 
+ * Method: sr_if_reindex(..)
+ * Scope: Local
+ *
+ * Number the interfaces in list order and rebuild the lookup tables.
+ * Of two interfaces with the same address the first one is found, as
+ * with a walk of the list.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_if_reindex(struct sr_instance* sr)
+{
+    struct sr_if_index* ix;
+    struct sr_if* if_walker;
+    unsigned int size, h;
+    int n;
+
+    n = 0;
+    for (if_walker = sr->if_list; if_walker; if_walker = if_walker->next)
+    { n++; }
+    for (size = SR_IF_HASH_MIN; size < 2 * (unsigned int)n; size *= 2)
+    { }
+
+    ix = (struct sr_if_index*)calloc(1, sizeof(struct sr_if_index));
+    assert(ix);
+    ix->by_id   = (struct sr_if**)calloc(n, sizeof(struct sr_if*));
+    ix->by_name = (struct sr_if**)calloc(size, sizeof(struct sr_if*));
+    ix->by_ip   = (struct sr_if**)calloc(size, sizeof(struct sr_if*));
+    assert(ix->by_id && ix->by_name && ix->by_ip);
+    ix->mask = size - 1;
+
+    for (if_walker = sr->if_list; if_walker; if_walker = if_walker->next)
+    {
+        if_walker->id = ix->n;
+        ix->by_id[ix->n++] = if_walker;
+
+        h = sr_if_hash_name(if_walker->name) & ix->mask;
+        while (ix->by_name[h])
+        { h = (h + 1) & ix->mask; }
+        ix->by_name[h] = if_walker;
+
+        if (if_walker->ip == 0)
+        { continue; }
+        h = sr_if_hash_ip(if_walker->ip) & ix->mask;
+        while (ix->by_ip[h] && ix->by_ip[h]->ip != if_walker->ip)
+        { h = (h + 1) & ix->mask; }
+        if (ix->by_ip[h] == 0)
+        { ix->by_ip[h] = if_walker; }
+    }
+
+    sr_if_index_free(sr->ifindex);
+    sr->ifindex = ix;
+    sr_flow_invalidate(sr);
+} /* -- sr_if_reindex -- */
 
 /*--------------------------------------------------------------------- 
  * Method: sr_get_interface
@@ -36,24 +136,78 @@
 
 struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name)
 {
-    struct sr_if* if_walker = 0;
+    struct sr_if_index* ix;
+    struct sr_if* iface;
+    unsigned int h;
 
     /* -- REQUIRES -- */
     assert(name);
     assert(sr);
 
-    if_walker = sr->if_list;
+    if ((ix = sr->ifindex) == 0)
+    { return 0; }
 
-    while(if_walker)
+    h = sr_if_hash_name(name) & ix->mask;
+    while ((iface = ix->by_name[h]) != 0)
     {
-       if(!strncmp(if_walker->name,name,sr_IFACE_NAMELEN))
-        { return if_walker; }
-        if_walker = if_walker->next;
+        if (strncmp(iface->name, name, sr_IFACE_NAMELEN) == 0)
+        { return iface; }
+        h = (h + 1) & ix->mask;
     }
 
     return 0;
 } /* -- sr_get_interface -- */
 
+/*--------------------------------------------------------------------- 
+ * Method: sr_get_interface_id
+ * Scope: Global
+ *
+ * The interface with the given id, or 0 if there is none.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_if* sr_get_interface_id(struct sr_instance* sr, int id)
+{
+    struct sr_if_index* ix = sr->ifindex;
+
+    if (ix == 0 || id < 0 || id >= ix->n)
+    { return 0; }
+    return ix->by_id[id];
+} /* -- sr_get_interface_id -- */
+
+/*--------------------------------------------------------------------- 
+ * Method: sr_get_interface_ip
+ * Scope: Global
+ *
+ * The interface that has address ip_nbo, or 0 if it isn't one of ours.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_if* sr_get_interface_ip(struct sr_instance* sr, uint32_t ip_nbo)
+{
+    struct sr_if_index* ix = sr->ifindex;
+    struct sr_if* iface;
+    unsigned int h;
+
+    if (ix == 0)
+    { return 0; }
+
+    h = sr_if_hash_ip(ip_nbo) & ix->mask;
+    while ((iface = ix->by_ip[h]) != 0)
+    {
+        if (iface->ip == ip_nbo)
+        { return iface; }
+        h = (h + 1) & ix->mask;
+    }
+
+    return 0;
+} /* -- sr_get_interface_ip -- */
+
+int sr_if_count(struct sr_instance* sr)
+{
+    return sr->ifindex ? sr->ifindex->n : 0;
+} /* -- sr_if_count -- */
+
 /*--------------------------------------------------------------------- 
  * Method: sr_add_interface(..)
  * Scope: Global
@@ -73,10 +227,11 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
     /* -- empty list special case -- */
     if(sr->if_list == 0)
     {
-        sr->if_list = (struct sr_if*)malloc(sizeof(struct sr_if));
+        sr->if_list = (struct sr_if*)calloc(1, sizeof(struct sr_if));
         assert(sr->if_list);
         sr->if_list->next = 0;
         strncpy(sr->if_list->name,name,sr_IFACE_NAMELEN);
+        sr_if_reindex(sr);
         return;
     }
 
@@ -85,13 +240,40 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
     while(if_walker->next)
     {if_walker = if_walker->next; }
 
-    if_walker->next = (struct sr_if*)malloc(sizeof(struct sr_if));
+    if_walker->next = (struct sr_if*)calloc(1, sizeof(struct sr_if));
     assert(if_walker->next);
     if_walker = if_walker->next;
     strncpy(if_walker->name,name,sr_IFACE_NAMELEN);
     if_walker->next = 0;
+    sr_if_reindex(sr);
 } /* -- sr_add_interface -- */ 
 
+/*--------------------------------------------------------------------- 
+ * Method: sr_if_destroy(..)
+ * Scope: Global
+ *
+ * Free the interface list and its lookup tables, at shutdown once
+ * nothing looks interfaces up any more.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_if_destroy(struct sr_instance* sr)
+{
+    struct sr_if* if_walker;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    sr_if_index_free(sr->ifindex);
+    sr->ifindex = 0;
+
+    while ((if_walker = sr->if_list) != 0)
+    {
+        sr->if_list = if_walker->next;
+        free(if_walker);
+    }
+} /* -- sr_if_destroy -- */
+
 /*--------------------------------------------------------------------- 
  * Method: sr_sat_ether_addr(..)
  * Scope: Global
@@ -137,9 +319,33 @@ void sr_set_ether_ip(struct sr_instance* sr, uint32_t ip_nbo)
 
     /* -- copy address -- */
     if_walker->ip = ip_nbo;
+    sr_if_reindex(sr);
 
 } /* -- sr_set_ether_ip -- */
 
+/*--------------------------------------------------------------------- 
+ * Method: sr_set_ether_speed(..)
+ * Scope: Global
+ *
+ * set the speed (Mbit/s) of the LAST interface in the interface list
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_set_ether_speed(struct sr_instance* sr, uint32_t mbps)
+{
+    struct sr_if* if_walker = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr->if_list);
+    
+    if_walker = sr->if_list;
+    while(if_walker->next)
+    {if_walker = if_walker->next; }
+
+    if_walker->speed = mbps;
+
+} /* -- sr_set_ether_speed -- */
+
 /*--------------------------------------------------------------------- 
  * Method: sr_print_if_list(..)
  * Scope: Global
@@ -191,4 +397,6 @@ void sr_print_if(struct sr_if* iface)
     DebugMAC(iface->addr);
     Debug("\n");
     Debug("\tinet addr %s\n",inet_ntoa(ip_addr));
+    if(iface->speed)
+    { Debug("\tspeed %u Mbit/s\n",iface->speed); }
 } /* -- sr_print_if -- */
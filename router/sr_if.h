@@ -7,6 +7,13 @@
  *
  * Data structures and methods for handeling interfaces
  *
+ * Every interface gets a dense id, 0 for the first one added, so routes,
+ * queued packets and frames can refer to it by number.  Lookups by id,
+ * by name and by IP address are all constant time: the first is an array
+ * index, the other two are open addressing hash tables.  The tables are
+ * rebuilt as interfaces are added and addressed, which only happens
+ * before forwarding starts.
+ *
  *---------------------------------------------------------------------------*/
 
 #ifndef sr_INTERFACE_H
@@ -27,6 +34,8 @@
 #include "sr_protocol.h"
 
 struct sr_instance;
+struct sr_icmp_tmpl;
+struct sr_if_index;
 
 /* ----------------------------------------------------------------------------
  * struct sr_if
@@ -41,13 +50,20 @@ struct sr_if
   unsigned char addr[ETHER_ADDR_LEN];
   uint32_t ip;
   uint32_t speed;
+  struct sr_icmp_tmpl* icmp;    /* error templates, see sr_icmp.c */
+  int id;                       /* dense, in the order interfaces are added */
   struct sr_if* next;
 };
 
 struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name);
+struct sr_if* sr_get_interface_id(struct sr_instance* sr, int id);
+struct sr_if* sr_get_interface_ip(struct sr_instance* sr, uint32_t ip_nbo);
+int  sr_if_count(struct sr_instance* sr);
 void sr_add_interface(struct sr_instance*, const char*);
+void sr_if_destroy(struct sr_instance*);
 void sr_set_ether_addr(struct sr_instance*, const unsigned char*);
 void sr_set_ether_ip(struct sr_instance*, uint32_t ip_nbo);
+void sr_set_ether_speed(struct sr_instance*, uint32_t mbps);
 void sr_print_if_list(struct sr_instance*);
 void sr_print_if(struct sr_if*);
 
@@ -0,0 +1,1165 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_loadgen.c
+ *
+ * Description:
+ *
+ * Stand-in VNS server for load testing sr on a single box.  It speaks the
+ * subset of the vnscommand.h protocol that sr uses (auth, OPEN,
+ * OPEN_TEMPLATE, HWINFO, VNS_RTABLE and VNSPACKET), presents a configurable
+ * set of interfaces, answers the router's ARP requests on behalf of one
+ * neighbor host per interface and blasts synthetic UDP flows between those
+ * hosts at a target rate.  Every frame carries a sequence number and a
+ * send timestamp so forwarded packets, drops and latency can be measured.
+ *
+ * With -m the frames go through a shared memory region (sr_shm.h)
+ * instead of the VNS socket, which takes the kernel out of the picture
+ * and shows the router's own per packet cost.
+ *
+ * Usage:
+ *
+ *   $ ./sr_loadgen -r 50000 -d 10 &
+ *   $ ./sr
+ *
+ *   $ ./sr_loadgen -m /sr0 -r 1000000 -d 10 &
+ *   $ ./sr -B shm:/sr0
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#include "sr_protocol.h"
+#include "sr_shm.h"
+#include "vnscommand.h"
+
+extern char* optarg;
+
+#define DEFAULT_PORT     8888
+#define DEFAULT_RATE     10000
+#define DEFAULT_FLOWS    64
+#define DEFAULT_SIZE     64
+#define DEFAULT_DURATION 10
+#define DRAIN_SECONDS    1
+
+#define LG_MAX_IFACES    16
+#define LG_MAX_FLOWS     65536
+#define LG_MAX_FRAME     1514
+#define LG_BURST         256
+#define LG_IOBUF         (1 << 20)
+#define LG_HIST_BUCKETS  32
+#define LG_MAGIC         0x53524c47 /* "SRLG" */
+#define LG_UDP_SPORT     20000
+#define LG_UDP_DPORT     30000
+
+/* UDP header, sr_protocol.h has no use for one */
+struct lg_udp_hdr {
+    uint16_t uh_sport;
+    uint16_t uh_dport;
+    uint16_t uh_ulen;
+    uint16_t uh_sum;
+} __attribute__ ((packed)) ;
+
+/* payload stamped into every generated frame */
+struct lg_payload {
+    uint32_t magic;
+    uint32_t flow;
+    uint32_t seq;
+    uint64_t tx_ns;
+} __attribute__ ((packed)) ;
+
+#define LG_MIN_FRAME (sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + \
+                      sizeof(struct lg_udp_hdr) + sizeof(struct lg_payload))
+
+/* one router interface plus the neighbor host hanging off it */
+struct lg_iface {
+    char     name[16];
+    uint8_t  rmac[ETHER_ADDR_LEN];   /* router side */
+    uint8_t  hmac[ETHER_ADDR_LEN];   /* neighbor host */
+    uint32_t rip;                    /* nbo */
+    uint32_t hip;                    /* nbo */
+    uint32_t speed;                  /* Mbit/s, 0 = unknown */
+    unsigned long arp_replies;
+};
+
+struct lg_flow {
+    int      in;                     /* ingress interface index */
+    int      out;                    /* egress interface index */
+    uint32_t seq;
+};
+
+struct lg_stats {
+    unsigned long tx;
+    unsigned long rx;
+    unsigned long rx_other;          /* non generated frames from sr */
+    unsigned long misrouted;
+    unsigned long reordered;
+    uint64_t lat_sum;
+    uint64_t lat_min;
+    uint64_t lat_max;
+    unsigned long hist[LG_HIST_BUCKETS]; /* log2(us) buckets */
+};
+
+struct lg_state {
+    int fd;
+    struct lg_iface ifs[LG_MAX_IFACES];
+    int nifs;
+    struct lg_flow* flows;
+    int nflows;
+    unsigned int rate;
+    unsigned int size;
+    unsigned int duration;
+    int quiet;
+    uint8_t* inbuf;
+    unsigned int inlen;
+    uint8_t* outbuf;
+    unsigned int outlen;
+    int no_batch;                    /* -S: don't offer VNS_PACKET_BATCH */
+    int batch;                       /* sr agreed to packet batches */
+    c_packet_batch* out_batch;       /* open batch in outbuf */
+    struct sr_shm shm;               /* -m: shared memory instead of VNS */
+    char* shm_name;
+    uint32_t shm_pending;            /* tx slots filled, not yet published */
+    uint32_t* last_seq;
+    struct lg_stats total;
+    struct lg_stats sec;
+};
+
+static void usage(char* );
+static int  lg_parse_iface(struct lg_state* , char* );
+static void lg_default_ifaces(struct lg_state* );
+static int  lg_listen(unsigned short );
+static int  lg_handshake(struct lg_state* );
+static int  lg_shm_setup(struct lg_state* );
+static int  lg_run(struct lg_state* );
+static void lg_report(const char* , struct lg_stats* , double );
+
+/*-----------------------------------------------------------------------------
+ *---------------------------------------------------------------------------*/
+
+static uint64_t lg_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+} /* -- lg_now_ns -- */
+
+static uint16_t lg_cksum(const void* _data, int len)
+{
+    const uint8_t* data = _data;
+    uint32_t sum;
+
+    for (sum = 0; len >= 2; data += 2, len -= 2)
+        sum += data[0] << 8 | data[1];
+    if (len > 0)
+        sum += data[0] << 8;
+    while (sum > 0xffff)
+        sum = (sum >> 16) + (sum & 0xffff);
+    sum = htons(~sum);
+    return sum ? sum : 0xffff;
+} /* -- lg_cksum -- */
+
+int main(int argc, char** argv)
+{
+    int c, lfd, ret;
+    unsigned int port = DEFAULT_PORT;
+    struct lg_state lg;
+
+    memset(&lg, 0, sizeof(lg));
+    lg.fd = -1;
+    lg.rate = DEFAULT_RATE;
+    lg.nflows = DEFAULT_FLOWS;
+    lg.size = DEFAULT_SIZE;
+    lg.duration = DEFAULT_DURATION;
+
+    while ((c = getopt(argc, argv, "hp:i:r:n:s:d:m:Sq")) != EOF)
+    {
+        switch (c)
+        {
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+                break;
+            case 'p':
+                port = atoi((char *) optarg);
+                break;
+            case 'i':
+                if (lg_parse_iface(&lg, optarg) != 0)
+                {
+                    fprintf(stderr, "Bad interface spec %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'r':
+                lg.rate = atoi((char *) optarg);
+                break;
+            case 'n':
+                lg.nflows = atoi((char *) optarg);
+                break;
+            case 's':
+                lg.size = atoi((char *) optarg);
+                break;
+            case 'd':
+                lg.duration = atoi((char *) optarg);
+                break;
+            case 'm':
+                lg.shm_name = optarg;
+                break;
+            case 'S':
+                lg.no_batch = 1;
+                break;
+            case 'q':
+                lg.quiet = 1;
+                break;
+            default:
+                usage(argv[0]);
+                exit(1);
+        } /* switch */
+    } /* -- while -- */
+
+    if (lg.nifs == 0)
+    { lg_default_ifaces(&lg); }
+
+    if (lg.nifs < 2)
+    {
+        fprintf(stderr, "Need at least two interfaces to generate flows\n");
+        exit(1);
+    }
+    if (lg.nflows < 1 || lg.nflows > LG_MAX_FLOWS)
+    { lg.nflows = DEFAULT_FLOWS; }
+    if (lg.size < LG_MIN_FRAME)
+    { lg.size = LG_MIN_FRAME; }
+    if (lg.size > LG_MAX_FRAME)
+    { lg.size = LG_MAX_FRAME; }
+
+    lg.inbuf  = (uint8_t*)malloc(LG_IOBUF);
+    lg.outbuf = (uint8_t*)malloc(LG_IOBUF);
+    lg.flows  = (struct lg_flow*)calloc(lg.nflows, sizeof(struct lg_flow));
+    lg.last_seq = (uint32_t*)calloc(lg.nflows, sizeof(uint32_t));
+    assert(lg.inbuf && lg.outbuf && lg.flows && lg.last_seq);
+
+    if (lg.shm_name)
+    {
+        if (lg_shm_setup(&lg) != 0)
+        { exit(1); }
+        ret = lg_run(&lg);
+        sr_shm_detach(&lg.shm);
+        return ret;
+    }
+
+    if ((lfd = lg_listen(port)) < 0)
+    { exit(1); }
+
+    printf("Waiting for sr on port %u (%d interfaces, %d flows, %u pps, %uB)\n",
+            port, lg.nifs, lg.nflows, lg.rate, lg.size);
+
+    if ((lg.fd = accept(lfd, 0, 0)) < 0)
+    {
+        perror("accept(..):sr_loadgen.c::main");
+        exit(1);
+    }
+    close(lfd);
+
+    if (lg_handshake(&lg) != 0)
+    {
+        fprintf(stderr, "Handshake with sr failed\n");
+        exit(1);
+    }
+
+    ret = lg_run(&lg);
+    close(lg.fd);
+
+    return ret;
+} /* -- main -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: usage(..)
+ * Scope: local
+ *---------------------------------------------------------------------------*/
+
+static void usage(char* argv0)
+{
+    printf("VNS load generator for sr\n");
+    printf("Format: %s [-h] [-q] [-p port | -m shm_name]\n", argv0);
+    printf("           [-i name:router_ip:host_ip[:mbps]]...\n");
+    printf("           [-r pps] [-n flows] [-s frame size] [-d seconds] [-S]\n");
+    printf("   defaults port=%d rate=%d flows=%d size=%d duration=%d\n",
+            DEFAULT_PORT, DEFAULT_RATE, DEFAULT_FLOWS, DEFAULT_SIZE,
+            DEFAULT_DURATION);
+    printf("   default interfaces match IP_CONFIG (eth1, eth2, eth3)\n");
+    printf("   -S sends one VNSPACKET per frame instead of offering batches\n");
+} /* -- usage -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lg_parse_iface(..)
+ * Scope: local
+ *
+ * Parse name:router_ip:host_ip[:mbps] and add it to the interface list.
+ * MAC addresses are synthesized from the interface index.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int lg_parse_iface(struct lg_state* lg, char* spec)
+{
+    struct lg_iface* iface;
+    char* name;
+    char* rip;
+    char* hip;
+    char* speed;
+    struct in_addr a;
+
+    if (lg->nifs >= LG_MAX_IFACES)
+    { return -1; }
+
+    name  = strtok(spec, ":");
+    rip   = strtok(0, ":");
+    hip   = strtok(0, ":");
+    speed = strtok(0, ":");
+    if (!name || !rip || !hip || strlen(name) >= sizeof(iface->name))
+    { return -1; }
+
+    iface = &lg->ifs[lg->nifs];
+    memset(iface, 0, sizeof(*iface));
+    strncpy(iface->name, name, sizeof(iface->name) - 1);
+
+    if (inet_aton(rip, &a) == 0)
+    { return -1; }
+    iface->rip = a.s_addr;
+    if (inet_aton(hip, &a) == 0)
+    { return -1; }
+    iface->hip = a.s_addr;
+    iface->speed = speed ? atoi(speed) : 0;
+
+    iface->rmac[0] = 0x02; iface->rmac[5] = (uint8_t)(lg->nifs + 1);
+    iface->hmac[0] = 0x02; iface->hmac[4] = 0x01;
+    iface->hmac[5] = (uint8_t)(lg->nifs + 1);
+
+    lg->nifs++;
+    return 0;
+} /* -- lg_parse_iface -- */
+
+static void lg_default_ifaces(struct lg_state* lg)
+{
+    char s1[] = "eth1:192.168.2.1:192.168.2.2";
+    char s2[] = "eth2:172.64.3.1:172.64.3.10";
+    char s3[] = "eth3:10.0.1.1:10.0.1.100";
+
+    lg_parse_iface(lg, s1);
+    lg_parse_iface(lg, s2);
+    lg_parse_iface(lg, s3);
+} /* -- lg_default_ifaces -- */
+
+static int lg_listen(unsigned short port)
+{
+    struct sockaddr_in addr;
+    int fd, on = 1;
+
+    if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    {
+        perror("socket(..):sr_loadgen.c::lg_listen");
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 ||
+        listen(fd, 1) < 0)
+    {
+        perror("bind/listen(..):sr_loadgen.c::lg_listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+} /* -- lg_listen -- */
+
+/*-----------------------------------------------------------------------------
+ * Blocking message helpers used during the handshake only.
+ *---------------------------------------------------------------------------*/
+
+static int lg_write_all(int fd, const void* buf, unsigned int len)
+{
+    const uint8_t* p = buf;
+    int ret;
+
+    while (len > 0)
+    {
+        if ((ret = write(fd, p, len)) < 0)
+        {
+            if (errno == EINTR)
+            { continue; }
+            perror("write(..):sr_loadgen.c::lg_write_all");
+            return -1;
+        }
+        p += ret;
+        len -= ret;
+    }
+    return 0;
+} /* -- lg_write_all -- */
+
+static int lg_read_all(int fd, void* buf, unsigned int len)
+{
+    uint8_t* p = buf;
+    int ret;
+
+    while (len > 0)
+    {
+        if ((ret = read(fd, p, len)) <= 0)
+        {
+            if (ret < 0 && errno == EINTR)
+            { continue; }
+            return -1;
+        }
+        p += ret;
+        len -= ret;
+    }
+    return 0;
+} /* -- lg_read_all -- */
+
+/* read one whole message into buf, returns its type or -1 */
+static int lg_read_msg(int fd, uint8_t* buf, unsigned int size)
+{
+    c_base* base = (c_base*)buf;
+    uint32_t len;
+
+    if (lg_read_all(fd, buf, sizeof(c_base)) != 0)
+    { return -1; }
+    len = ntohl(base->mLen);
+    if (len < sizeof(c_base) || len > size)
+    { return -1; }
+    if (lg_read_all(fd, buf + sizeof(c_base), len - sizeof(c_base)) != 0)
+    { return -1; }
+    return ntohl(base->mType);
+} /* -- lg_read_msg -- */
+
+static void lg_hw_entry(c_hw_entry* e, uint32_t key, const void* value,
+                        unsigned int len)
+{
+    memset(e, 0, sizeof(*e));
+    e->mKey = htonl(key);
+    memcpy(e->value, value, len);
+} /* -- lg_hw_entry -- */
+
+static int lg_send_hwinfo(struct lg_state* lg)
+{
+    c_hwinfo hw;
+    int i, n = 0;
+    uint32_t v;
+
+    for (i = 0; i < lg->nifs; i++)
+    {
+        struct lg_iface* iface = &lg->ifs[i];
+        lg_hw_entry(&hw.mHWInfo[n++], HWINTERFACE, iface->name,
+                    strlen(iface->name));
+        v = htonl(iface->speed);
+        lg_hw_entry(&hw.mHWInfo[n++], HWSPEED, &v, sizeof(v));
+        lg_hw_entry(&hw.mHWInfo[n++], HWETHER, iface->rmac, ETHER_ADDR_LEN);
+        lg_hw_entry(&hw.mHWInfo[n++], HWETHIP, &iface->rip, sizeof(uint32_t));
+        v = 0xffffffff;
+        lg_hw_entry(&hw.mHWInfo[n++], HWMASK, &v, sizeof(v));
+    }
+
+    v = 2 * sizeof(uint32_t) + n * sizeof(c_hw_entry);
+    hw.mLen  = htonl(v);
+    hw.mType = htonl(VNSHWINFO);
+    return lg_write_all(lg->fd, &hw, v);
+} /* -- lg_send_hwinfo -- */
+
+static int lg_send_rtable(struct lg_state* lg, const char* vhost)
+{
+    char buf[sizeof(c_rtable) + LG_MAX_IFACES * 128];
+    c_rtable* rt = (c_rtable*)buf;
+    char* p = rt->rtable;
+    struct in_addr a;
+    int i;
+
+    memset(buf, 0, sizeof(c_rtable));
+    strncpy(rt->mVirtualHostID, vhost, IDSIZE - 1);
+
+    for (i = 0; i < lg->nifs; i++)
+    {
+        a.s_addr = lg->ifs[i].hip;
+        p += sprintf(p, "%s %s 255.255.255.255 %s\n",
+                     inet_ntoa(a), inet_ntoa(a), lg->ifs[i].name);
+    }
+
+    rt->mLen  = htonl(p - buf);
+    rt->mType = htonl(VNS_RTABLE);
+    return lg_write_all(lg->fd, buf, p - buf);
+} /* -- lg_send_rtable -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lg_handshake(..)
+ * Scope: local
+ *
+ * Drive the sr client state machine the same way srhandler.py does: auth
+ * request, accept any reply, then answer OPEN / OPEN_TEMPLATE.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int lg_handshake(struct lg_state* lg)
+{
+    uint8_t buf[4096];
+    c_auth_status* st;
+    const char msg[] = "authenticated by sr_loadgen";
+    int type, i;
+    struct {
+        c_base  base;
+        uint8_t salt[20];
+    } __attribute__ ((packed)) areq;
+
+    areq.base.mLen  = htonl(sizeof(areq));
+    areq.base.mType = htonl(VNS_AUTH_REQUEST);
+    for (i = 0; i < sizeof(areq.salt); i++)
+    { areq.salt[i] = (uint8_t)rand(); }
+    if (lg_write_all(lg->fd, &areq, sizeof(areq)) != 0)
+    { return -1; }
+
+    if (lg_read_msg(lg->fd, buf, sizeof(buf)) != VNS_AUTH_REPLY)
+    { return -1; }
+
+    /* always authenticate */
+    st = (c_auth_status*)buf;
+    st->mLen  = htonl(sizeof(c_auth_status) + sizeof(msg) - 1);
+    st->mType = htonl(VNS_AUTH_STATUS);
+    st->auth_ok = 1;
+    memcpy(st->msg, msg, sizeof(msg) - 1);
+    if (lg_write_all(lg->fd, buf, ntohl(st->mLen)) != 0)
+    { return -1; }
+
+    type = lg_read_msg(lg->fd, buf, sizeof(buf));
+    if (type == VNS_OPEN_TEMPLATE)
+    {
+        c_open_template* ot = (c_open_template*)buf;
+        char vhost[IDSIZE + 1];
+
+        memcpy(vhost, ot->mVirtualHostID, IDSIZE);
+        vhost[IDSIZE] = 0;
+        if (lg_send_rtable(lg, vhost) != 0)
+        { return -1; }
+    }
+    else if (type != VNSOPEN)
+    {
+        fprintf(stderr, "Expected OPEN from sr, got %d\n", type);
+        return -1;
+    }
+
+    if (lg_send_hwinfo(lg) != 0)
+    { return -1; }
+
+    /* -- offer batching, sr's answer is picked up by lg_input -- */
+    if (!lg->no_batch)
+    {
+        c_caps caps;
+
+        caps.mLen  = htonl(sizeof(caps));
+        caps.mType = htonl(VNS_CAPS);
+        caps.mCaps = htonl(VNS_CAP_PACKET_BATCH);
+        if (lg_write_all(lg->fd, &caps, sizeof(caps)) != 0)
+        { return -1; }
+    }
+
+    return 0;
+} /* -- lg_handshake -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lg_shm_setup(..)
+ * Scope: local
+ *
+ * Shared memory counterpart of the handshake: create the region, describe
+ * the interfaces in it and wait for sr to attach.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int lg_shm_setup(struct lg_state* lg)
+{
+    unsigned int spins = 0;
+    int i;
+
+    if (sr_shm_create(&lg->shm, lg->shm_name, SR_SHM_DEF_SLOTS) != 0)
+    { return -1; }
+
+    for (i = 0; i < lg->nifs; i++)
+    {
+        sr_shm_add_iface(&lg->shm, lg->ifs[i].name, lg->ifs[i].rmac,
+                         lg->ifs[i].rip, 0xffffffff, lg->ifs[i].speed);
+    }
+    sr_shm_publish(&lg->shm);
+
+    printf("Waiting for sr on shm %s (%d interfaces, %d flows, %u pps, %uB)\n",
+            lg->shm_name, lg->nifs, lg->nflows, lg->rate, lg->size);
+    fflush(stdout);
+
+    while (!__atomic_load_n(&lg->shm.rgn->router_attached, __ATOMIC_ACQUIRE))
+    {
+        if (spins++ < 1024)
+        { sr_ring_relax(spins); }
+        else
+        { usleep(10000); }
+    }
+
+    return 0;
+} /* -- lg_shm_setup -- */
+
+/*-----------------------------------------------------------------------------
+ * Data path
+ *---------------------------------------------------------------------------*/
+
+static int lg_flush(struct lg_state* lg)
+{
+    int ret;
+
+    if (lg->shm_name)
+    {
+        if (lg->shm_pending)
+        {
+            sr_ring_produce(lg->shm.tx, lg->shm_pending);
+            lg->shm_pending = 0;
+        }
+        return 0;
+    }
+
+    /* -- outbuf moves below -- */
+    lg->out_batch = 0;
+
+    while (lg->outlen > 0)
+    {
+        ret = send(lg->fd, lg->outbuf, lg->outlen, MSG_DONTWAIT);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            { continue; }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            { return 0; }
+            perror("send(..):sr_loadgen.c::lg_flush");
+            return -1;
+        }
+        memmove(lg->outbuf, lg->outbuf + ret, lg->outlen - ret);
+        lg->outlen -= ret;
+    }
+    return 0;
+} /* -- lg_flush -- */
+
+/* reserve room for a frame of len bytes, 0 if the buffer / ring is full */
+static uint8_t* lg_packet_msg(struct lg_state* lg, struct lg_iface* iface,
+                              unsigned int len)
+{
+    c_packet_header* hdr;
+    unsigned int total = sizeof(c_packet_header) + len;
+
+    if (lg->shm_name)
+    {
+        struct sr_shm_desc* d;
+
+        if (lg->shm_pending >= sr_ring_free(lg->shm.tx))
+        { return 0; }
+        d = sr_shm_tx_desc(&lg->shm, lg->shm_pending++);
+        d->len   = len;
+        d->iface = iface - lg->ifs;
+        return lg->shm.base + d->off;
+    }
+
+    if (lg->batch)
+    {
+        c_packet_batch_entry* e;
+        c_packet_batch* b = lg->out_batch;
+
+        total = sizeof(c_packet_batch_entry) + len;
+        if (b && ntohl(b->mLen) + total > VNS_BATCH_MAX_LEN)
+        { b = 0; }
+        if (lg->outlen + total + (b ? 0 : sizeof(c_packet_batch)) > LG_IOBUF)
+        { return 0; }
+
+        if (b == 0)
+        {
+            b = (c_packet_batch*)(lg->outbuf + lg->outlen);
+            b->mLen   = htonl(sizeof(c_packet_batch));
+            b->mType  = htonl(VNS_PACKET_BATCH);
+            b->mCount = 0;
+            lg->outlen += sizeof(c_packet_batch);
+            lg->out_batch = b;
+        }
+
+        e = (c_packet_batch_entry*)(lg->outbuf + lg->outlen);
+        memset(e->mInterfaceName, 0, sizeof(e->mInterfaceName));
+        strncpy(e->mInterfaceName, iface->name, sizeof(e->mInterfaceName));
+        e->mLen = htonl(len);
+        lg->outlen += total;
+        b->mLen   = htonl(ntohl(b->mLen) + total);
+        b->mCount = htonl(ntohl(b->mCount) + 1);
+
+        return (uint8_t*)(e + 1);
+    }
+
+    if (lg->outlen + total > LG_IOBUF)
+    { return 0; }
+
+    hdr = (c_packet_header*)(lg->outbuf + lg->outlen);
+    hdr->mLen  = htonl(total);
+    hdr->mType = htonl(VNSPACKET);
+    memset(hdr->mInterfaceName, 0, sizeof(hdr->mInterfaceName));
+    strncpy(hdr->mInterfaceName, iface->name, sizeof(hdr->mInterfaceName));
+    lg->outlen += total;
+
+    return (uint8_t*)(hdr + 1);
+} /* -- lg_packet_msg -- */
+
+static int lg_emit(struct lg_state* lg, int flow_id, uint64_t now)
+{
+    struct lg_flow* flow = &lg->flows[flow_id];
+    struct lg_iface* in  = &lg->ifs[flow->in];
+    struct lg_iface* out = &lg->ifs[flow->out];
+    sr_ethernet_hdr_t* e_hdr;
+    sr_ip_hdr_t* ip_hdr;
+    struct lg_udp_hdr* udp;
+    struct lg_payload pl;
+    uint8_t* frame;
+
+    if ((frame = lg_packet_msg(lg, in, lg->size)) == 0)
+    { return -1; }
+
+    memset(frame, 0, lg->size);
+    e_hdr = (sr_ethernet_hdr_t*)frame;
+    memcpy(e_hdr->ether_dhost, in->rmac, ETHER_ADDR_LEN);
+    memcpy(e_hdr->ether_shost, in->hmac, ETHER_ADDR_LEN);
+    e_hdr->ether_type = htons(ethertype_ip);
+
+    ip_hdr = (sr_ip_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+    ip_hdr->ip_v   = 4;
+    ip_hdr->ip_hl  = 5;
+    ip_hdr->ip_len = htons(lg->size - sizeof(sr_ethernet_hdr_t));
+    ip_hdr->ip_id  = htons((uint16_t)flow->seq);
+    ip_hdr->ip_ttl = 64;
+    ip_hdr->ip_p   = ip_protocol_udp;
+    ip_hdr->ip_src = in->hip;
+    ip_hdr->ip_dst = out->hip;
+    ip_hdr->ip_sum = lg_cksum(ip_hdr, sizeof(sr_ip_hdr_t));
+
+    udp = (struct lg_udp_hdr*)(ip_hdr + 1);
+    udp->uh_sport = htons(LG_UDP_SPORT + (flow_id & 0x7fff));
+    udp->uh_dport = htons(LG_UDP_DPORT);
+    udp->uh_ulen  = htons(lg->size - sizeof(sr_ethernet_hdr_t) -
+                          sizeof(sr_ip_hdr_t));
+
+    pl.magic = htonl(LG_MAGIC);
+    pl.flow  = htonl(flow_id);
+    pl.seq   = htonl(++flow->seq);
+    pl.tx_ns = now;
+    memcpy(udp + 1, &pl, sizeof(pl));
+
+    lg->sec.tx++;
+    return 0;
+} /* -- lg_emit -- */
+
+static void lg_arp_reply(struct lg_state* lg, struct lg_iface* iface,
+                         sr_arp_hdr_t* req)
+{
+    sr_ethernet_hdr_t* e_hdr;
+    sr_arp_hdr_t* a_hdr;
+    uint8_t* frame;
+    unsigned int len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t);
+
+    if ((frame = lg_packet_msg(lg, iface, len)) == 0)
+    { return; }
+
+    e_hdr = (sr_ethernet_hdr_t*)frame;
+    memcpy(e_hdr->ether_dhost, req->ar_sha, ETHER_ADDR_LEN);
+    memcpy(e_hdr->ether_shost, iface->hmac, ETHER_ADDR_LEN);
+    e_hdr->ether_type = htons(ethertype_arp);
+
+    a_hdr = (sr_arp_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+    a_hdr->ar_hrd = htons(arp_hrd_ethernet);
+    a_hdr->ar_pro = htons(ethertype_ip);
+    a_hdr->ar_hln = ETHER_ADDR_LEN;
+    a_hdr->ar_pln = 4;
+    a_hdr->ar_op  = htons(arp_op_reply);
+    memcpy(a_hdr->ar_sha, iface->hmac, ETHER_ADDR_LEN);
+    a_hdr->ar_sip = iface->hip;
+    memcpy(a_hdr->ar_tha, req->ar_sha, ETHER_ADDR_LEN);
+    a_hdr->ar_tip = req->ar_sip;
+
+    iface->arp_replies++;
+} /* -- lg_arp_reply -- */
+
+static struct lg_iface* lg_iface_by_name(struct lg_state* lg, const char* name)
+{
+    int i;
+
+    for (i = 0; i < lg->nifs; i++)
+    {
+        if (strncmp(lg->ifs[i].name, name, 16) == 0)
+        { return &lg->ifs[i]; }
+    }
+    return 0;
+} /* -- lg_iface_by_name -- */
+
+static void lg_account(struct lg_state* lg, struct lg_iface* iface,
+                       uint8_t* frame, unsigned int len, uint64_t now)
+{
+    sr_ethernet_hdr_t* e_hdr = (sr_ethernet_hdr_t*)frame;
+    sr_ip_hdr_t* ip_hdr;
+    struct lg_payload pl;
+    uint32_t flow, seq;
+    uint64_t lat;
+    int b;
+
+    if (len < sizeof(sr_ethernet_hdr_t))
+    { return; }
+
+    if (e_hdr->ether_type == htons(ethertype_arp) &&
+        len >= sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t))
+    {
+        sr_arp_hdr_t* a_hdr = (sr_arp_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+        if (a_hdr->ar_op == htons(arp_op_request) && a_hdr->ar_tip == iface->hip)
+        {
+            lg_arp_reply(lg, iface, a_hdr);
+            return;
+        }
+        lg->sec.rx_other++;
+        return;
+    }
+
+    ip_hdr = (sr_ip_hdr_t*)(frame + sizeof(sr_ethernet_hdr_t));
+    if (e_hdr->ether_type != htons(ethertype_ip) || len < LG_MIN_FRAME ||
+        ip_hdr->ip_p != ip_protocol_udp)
+    {
+        lg->sec.rx_other++;
+        return;
+    }
+
+    memcpy(&pl, frame + LG_MIN_FRAME - sizeof(pl), sizeof(pl));
+    if (pl.magic != htonl(LG_MAGIC) || ntohl(pl.flow) >= lg->nflows)
+    {
+        lg->sec.rx_other++;
+        return;
+    }
+
+    flow = ntohl(pl.flow);
+    seq  = ntohl(pl.seq);
+    if (iface != &lg->ifs[lg->flows[flow].out] ||
+        memcmp(e_hdr->ether_dhost, iface->hmac, ETHER_ADDR_LEN) != 0)
+    { lg->sec.misrouted++; }
+    if (seq <= lg->last_seq[flow])
+    { lg->sec.reordered++; }
+    else
+    { lg->last_seq[flow] = seq; }
+
+    lat = now > pl.tx_ns ? now - pl.tx_ns : 0;
+    lg->sec.rx++;
+    lg->sec.lat_sum += lat;
+    if (lg->sec.lat_min == 0 || lat < lg->sec.lat_min)
+    { lg->sec.lat_min = lat; }
+    if (lat > lg->sec.lat_max)
+    { lg->sec.lat_max = lat; }
+
+    lat /= 1000;
+    for (b = 0; lat > 0 && b < LG_HIST_BUCKETS - 1; b++)
+    { lat >>= 1; }
+    lg->sec.hist[b]++;
+} /* -- lg_account -- */
+
+/* account a frame that sr sent out of the interface called 'name' */
+static void lg_account_named(struct lg_state* lg, const char* name,
+                             uint8_t* frame, unsigned int len, uint64_t now)
+{
+    struct lg_iface* iface;
+    char n[17];
+
+    memcpy(n, name, 16);
+    n[16] = 0;
+    if ((iface = lg_iface_by_name(lg, n)) != 0)
+    { lg_account(lg, iface, frame, len, now); }
+    else
+    { lg->sec.rx_other++; }
+} /* -- lg_account_named -- */
+
+static void lg_batch_input(struct lg_state* lg, c_packet_batch* b, uint64_t now)
+{
+    uint8_t* p   = (uint8_t*)(b + 1);
+    uint8_t* end = (uint8_t*)b + ntohl(b->mLen);
+    uint32_t count = ntohl(b->mCount);
+    c_packet_batch_entry* e;
+    uint32_t flen;
+
+    for (; count > 0; count--)
+    {
+        e = (c_packet_batch_entry*)p;
+        if (end - p < (long)sizeof(*e) ||
+            (flen = ntohl(e->mLen)) > end - p - sizeof(*e))
+        {
+            fprintf(stderr, "Malformed packet batch from sr\n");
+            return;
+        }
+        lg_account_named(lg, e->mInterfaceName, p + sizeof(*e), flen, now);
+        p += sizeof(*e) + flen;
+    }
+} /* -- lg_batch_input -- */
+
+/* parse every complete message in the input buffer */
+static int lg_input(struct lg_state* lg, uint64_t now)
+{
+    unsigned int off = 0;
+    c_base* base;
+    uint32_t len, type;
+
+    while (lg->inlen - off >= sizeof(c_base))
+    {
+        base = (c_base*)(lg->inbuf + off);
+        len  = ntohl(base->mLen);
+        type = ntohl(base->mType);
+
+        if (len < sizeof(c_base) || len > LG_IOBUF)
+        {
+            fprintf(stderr, "Bad message length %u from sr\n", len);
+            return -1;
+        }
+        if (lg->inlen - off < len)
+        { break; }
+
+        if (type == VNSPACKET && len >= sizeof(c_packet_header))
+        {
+            c_packet_header* hdr = (c_packet_header*)base;
+
+            lg_account_named(lg, hdr->mInterfaceName, (uint8_t*)(hdr + 1),
+                             len - sizeof(c_packet_header), now);
+        }
+        else if (type == VNS_PACKET_BATCH && len >= sizeof(c_packet_batch))
+        { lg_batch_input(lg, (c_packet_batch*)base, now); }
+        else if (type == VNS_CAPS && len >= sizeof(c_caps))
+        {
+            lg->batch = !lg->no_batch &&
+                (ntohl(((c_caps*)base)->mCaps) & VNS_CAP_PACKET_BATCH);
+            if (!lg->quiet)
+            { printf("sr %s packet batching\n", lg->batch ? "accepted" : "declined"); }
+        }
+        else if (type == VNSCLOSE)
+        {
+            fprintf(stderr, "sr closed the session\n");
+            return -1;
+        }
+
+        off += len;
+    }
+
+    memmove(lg->inbuf, lg->inbuf + off, lg->inlen - off);
+    lg->inlen -= off;
+    return 0;
+} /* -- lg_input -- */
+
+/* shared memory counterpart of lg_input, returns frames seen */
+static int lg_shm_input(struct lg_state* lg, uint64_t now)
+{
+    struct sr_shm_desc d;
+    uint8_t* frame;
+    uint32_t n, i;
+
+    n = sr_ring_count(lg->shm.rx);
+    for (i = 0; i < n; i++)
+    {
+        d = *sr_shm_rx_desc(&lg->shm, i);
+        if (d.iface < lg->nifs && (frame = sr_shm_frame(&lg->shm, &d)) != 0)
+        { lg_account(lg, &lg->ifs[d.iface], frame, d.len, now); }
+        else
+        { lg->sec.rx_other++; }
+    }
+    sr_ring_consume(lg->shm.rx, n);
+
+    return n;
+} /* -- lg_shm_input -- */
+
+static void lg_merge(struct lg_stats* dst, struct lg_stats* src)
+{
+    int i;
+
+    dst->tx        += src->tx;
+    dst->rx        += src->rx;
+    dst->rx_other  += src->rx_other;
+    dst->misrouted += src->misrouted;
+    dst->reordered += src->reordered;
+    dst->lat_sum   += src->lat_sum;
+    if (src->lat_min && (dst->lat_min == 0 || src->lat_min < dst->lat_min))
+    { dst->lat_min = src->lat_min; }
+    if (src->lat_max > dst->lat_max)
+    { dst->lat_max = src->lat_max; }
+    for (i = 0; i < LG_HIST_BUCKETS; i++)
+    { dst->hist[i] += src->hist[i]; }
+} /* -- lg_merge -- */
+
+/* upper bound, in microseconds, of the bucket holding the given percentile */
+static unsigned long lg_percentile(struct lg_stats* s, double pct)
+{
+    unsigned long want, seen = 0;
+    int i;
+
+    if (s->rx == 0)
+    { return 0; }
+    want = (unsigned long)(s->rx * pct);
+    for (i = 0; i < LG_HIST_BUCKETS; i++)
+    {
+        seen += s->hist[i];
+        if (seen > want)
+        { break; }
+    }
+    return 1UL << i;
+} /* -- lg_percentile -- */
+
+static void lg_report(const char* tag, struct lg_stats* s, double secs)
+{
+    long drops = (long)s->tx - (long)s->rx;
+
+    printf("%s tx %.0f pps  fwd %.0f pps  drop %ld (%.2f%%)  other %lu"
+           "  misrouted %lu  reordered %lu\n", tag,
+           s->tx / secs, s->rx / secs, drops,
+           s->tx ? 100.0 * drops / s->tx : 0.0,
+           s->rx_other, s->misrouted, s->reordered);
+    if (s->rx)
+    {
+        printf("%s latency us: min %.1f avg %.1f p50 <%lu p99 <%lu max %.1f\n",
+               tag, s->lat_min / 1000.0, s->lat_sum / 1000.0 / s->rx,
+               lg_percentile(s, 0.50), lg_percentile(s, 0.99),
+               s->lat_max / 1000.0);
+    }
+    fflush(stdout);
+} /* -- lg_report -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: lg_run(..)
+ * Scope: local
+ *
+ * Pace the flows at the target rate for the configured duration, then
+ * drain for DRAIN_SECONDS and print a summary.  Flows are spread round
+ * robin across ingress interfaces, each one egressing on the next.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int lg_run(struct lg_state* lg)
+{
+    uint64_t start, now, next_report, stop_tx, stop;
+    unsigned long due, sent = 0;
+    int next_flow = 0, i, ret;
+    struct pollfd pfd;
+
+    for (i = 0; i < lg->nflows; i++)
+    {
+        lg->flows[i].in  = i % lg->nifs;
+        lg->flows[i].out = (i + 1) % lg->nifs;
+    }
+
+    if (!lg->shm_name)
+    {
+        i = 1;
+        setsockopt(lg->fd, IPPROTO_TCP, TCP_NODELAY, &i, sizeof(i));
+        fcntl(lg->fd, F_SETFL, fcntl(lg->fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    start = lg_now_ns();
+    next_report = start + 1000000000ULL;
+    stop_tx = start + (uint64_t)lg->duration * 1000000000ULL;
+    stop = stop_tx + DRAIN_SECONDS * 1000000000ULL;
+
+    for (;;)
+    {
+        now = lg_now_ns();
+        if (now >= stop)
+        { break; }
+
+        /* -- generate whatever is due, a burst at a time -- */
+        if (now < stop_tx)
+        {
+            due = (unsigned long)((double)(now - start) * lg->rate / 1e9);
+            for (i = 0; sent < due && i < LG_BURST; i++)
+            {
+                if (lg_emit(lg, next_flow, now) != 0)
+                { break; }
+                sent++;
+                next_flow = (next_flow + 1) % lg->nflows;
+            }
+        }
+
+        if (lg_flush(lg) != 0)
+        { return 1; }
+
+        if (lg->shm_name)
+        {
+            if (__atomic_load_n(&lg->shm.rgn->closed, __ATOMIC_ACQUIRE))
+            {
+                fprintf(stderr, "sr detached\n");
+                break;
+            }
+            /* -- nothing to do, let sr have the cpu -- */
+            if (lg_shm_input(lg, lg_now_ns()) == 0 &&
+                (now >= stop_tx || sent >= due))
+            { sched_yield(); }
+        }
+        else
+        {
+            pfd.fd = lg->fd;
+            pfd.events = POLLIN | (lg->outlen ? POLLOUT : 0);
+            pfd.revents = 0;
+            ret = poll(&pfd, 1, (now < stop_tx && sent < due) ? 0 : 1);
+            if (ret < 0 && errno != EINTR)
+            {
+                perror("poll(..):sr_loadgen.c::lg_run");
+                return 1;
+            }
+
+            if (pfd.revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                ret = recv(lg->fd, lg->inbuf + lg->inlen, LG_IOBUF - lg->inlen,
+                           MSG_DONTWAIT);
+                if (ret == 0)
+                {
+                    fprintf(stderr, "sr disconnected\n");
+                    break;
+                }
+                if (ret > 0)
+                {
+                    lg->inlen += ret;
+                    if (lg_input(lg, lg_now_ns()) != 0)
+                    { break; }
+                }
+        }
+        }
+
+        now = lg_now_ns();
+        if (now >= next_report)
+        {
+            if (!lg->quiet)
+            { lg_report("[1s]", &lg->sec, 1.0); }
+            lg_merge(&lg->total, &lg->sec);
+            memset(&lg->sec, 0, sizeof(lg->sec));
+            next_report += 1000000000ULL;
+        }
+    }
+
+    lg_merge(&lg->total, &lg->sec);
+
+    printf("---------------------------------------------\n");
+    lg_report("[total]", &lg->total, (double)lg->duration);
+    for (i = 0; i < lg->nifs; i++)
+    {
+        printf("  %s: %lu ARP replies\n", lg->ifs[i].name,
+               lg->ifs[i].arp_replies);
+    }
+    printf("---------------------------------------------\n");
+
+    return 0;
+} /* -- lg_run -- */
@@ -0,0 +1,377 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_log.c
+ *
+ * Description:
+ *
+ * Asynchronous leveled logging, see sr_log.h.
+ *
+ * Like capture, every thread that logs gets its own single-producer ring
+ * on its first message (sr_tring.h) and the logger thread is the single
+ * consumer of all of them.  Messages it had to drop are reported at most
+ * once every SR_LOG_REPORT_NS.  The per thread rate limit is a GCRA bucket
+ * that only its own thread touches, timed with the coarse monotonic clock.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "sr_log.h"
+#include "sr_ring.h"
+#include "sr_router.h"
+#include "sr_tring.h"
+
+#define SR_LOG_RING_SLOTS  256          /* per thread, power of two */
+#define SR_LOG_MSG_LEN     176
+#define SR_LOG_IDLE_NS     10000000     /* logger poll interval */
+#define SR_LOG_REPORT_NS   1000000000ULL /* how often drops are reported */
+
+#define SR_LOG_PERIOD ((uint64_t)1000000000ULL / SR_LOG_RATE)
+#define SR_LOG_SLACK  (SR_LOG_PERIOD * (SR_LOG_BURST - 1))
+
+/* ----------------------------------------------------------------------------
+ * struct sr_log_rec
+ *
+ * One ring slot: a formatted message and where it came from.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_log_rec
+{
+    uint64_t ts_ns;             /* CLOCK_REALTIME */
+    uint8_t  mod;
+    uint8_t  level;
+    char     msg[SR_LOG_MSG_LEN];
+};
+
+struct sr_log_ring
+{
+    struct sr_ring ring;
+    struct sr_log_rec recs[SR_LOG_RING_SLOTS];
+    uint64_t tat;               /* rate limit, producer only */
+    unsigned long limited;      /* written by the producer only */
+    unsigned long full;
+    unsigned long seen_limited; /* logger only */
+    unsigned long seen_full;
+};
+
+static void* sr_log_ring_create(void);
+
+static struct
+{
+    struct sr_tring_set rings;  /* of struct sr_log_ring, never freed */
+    unsigned long seen_lost;
+    pthread_t thread;
+    int running;
+    int stop;
+} sr_log = { { {0}, 0, 0, PTHREAD_MUTEX_INITIALIZER, sr_log_ring_create } };
+
+unsigned char sr_log_levels[SR_LOG_MODULES] = {
+    SR_LOG_DEFAULT, SR_LOG_DEFAULT, SR_LOG_DEFAULT, SR_LOG_DEFAULT
+};
+
+static const char* sr_log_modnames[SR_LOG_MODULES] = {
+    "core", "fwd", "arp", "icmp"
+};
+
+static const char* sr_log_lvlnames[] = {
+    "error", "warn", "info", "debug"
+};
+
+static __thread struct sr_tring_mine sr_log_mine;
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_parse(..)
+ * Scope: Global
+ *
+ * Set the run time levels from a -L spec.  Returns 0 on success.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_log_level(const char* s, size_t n)
+{
+    int i;
+
+    for (i = 0; i <= SR_LOG_DEBUG; i++)
+    {
+        if (strlen(sr_log_lvlnames[i]) == n &&
+            strncmp(s, sr_log_lvlnames[i], n) == 0)
+        { return i; }
+    }
+    return -1;
+} /* -- sr_log_level -- */
+
+int sr_log_parse(const char* spec)
+{
+    const char* p = spec;
+    const char* end;
+    const char* eq;
+    int mod, level;
+
+    /* REQUIRES */
+    assert(spec);
+
+    while (*p)
+    {
+        if ((end = strchr(p, ',')) == 0)
+        { end = p + strlen(p); }
+        eq = memchr(p, '=', end - p);
+
+        if (eq == 0)
+        {
+            if ((level = sr_log_level(p, end - p)) < 0)
+            { goto bad; }
+            for (mod = 0; mod < SR_LOG_MODULES; mod++)
+            { sr_log_levels[mod] = level; }
+        }
+        else
+        {
+            for (mod = 0; mod < SR_LOG_MODULES; mod++)
+            {
+                if (strlen(sr_log_modnames[mod]) == (size_t)(eq - p) &&
+                    strncmp(p, sr_log_modnames[mod], eq - p) == 0)
+                { break; }
+            }
+            if (mod == SR_LOG_MODULES ||
+                (level = sr_log_level(eq + 1, end - eq - 1)) < 0)
+            { goto bad; }
+            sr_log_levels[mod] = level;
+        }
+        if (level > SR_LOG_MAX)
+        {
+            fprintf(stderr, "Log level %s is compiled out, have up to %s\n",
+                    sr_log_lvlnames[level], sr_log_lvlnames[SR_LOG_MAX]);
+        }
+
+        p = *end ? end + 1 : end;
+    }
+    return 0;
+
+bad:
+    fprintf(stderr, "Bad log spec \"%s\"\n", spec);
+    return -1;
+} /* -- sr_log_parse -- */
+
+/* -- "HH:MM:SS.uuuuuu module level: " -- */
+static void sr_log_prefix(char* buf, size_t len, uint64_t ts_ns,
+                          int mod, int level)
+{
+    time_t secs = ts_ns / 1000000000ULL;
+    struct tm tm;
+    size_t n;
+
+    localtime_r(&secs, &tm);
+    n = strftime(buf, len, "%H:%M:%S", &tm);
+    snprintf(buf + n, len - n, ".%06lu %s %s: ",
+             (unsigned long)(ts_ns % 1000000000ULL) / 1000,
+             sr_log_modnames[mod], sr_log_lvlnames[level]);
+} /* -- sr_log_prefix -- */
+
+static void sr_log_output(const struct sr_log_rec* rec)
+{
+    char prefix[64];
+
+    sr_log_prefix(prefix, sizeof(prefix), rec->ts_ns, rec->mod, rec->level);
+    fprintf(stderr, "%s%s\n", prefix, rec->msg);
+} /* -- sr_log_output -- */
+
+static void* sr_log_ring_create(void)
+{
+    struct sr_log_ring* r;
+
+    r = (struct sr_log_ring*)calloc(1, sizeof(struct sr_log_ring));
+    assert(r);
+    sr_ring_init(&r->ring, SR_LOG_RING_SLOTS);
+
+    return r;
+} /* -- sr_log_ring_create -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_write(..)
+ * Scope: Global
+ *
+ * Back end of the SR_LOG() macros, which have already checked the level.
+ * Queues the message on this thread's ring, unless the thread is over its
+ * rate or the ring is full.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_log_write(int mod, int level, const char* fmt, ...)
+{
+    struct sr_log_ring* r;
+    struct sr_log_rec* rec;
+    struct sr_log_rec tmp;
+    struct timespec ts;
+    uint64_t now;
+    va_list ap;
+
+    if (!__atomic_load_n(&sr_log.running, __ATOMIC_ACQUIRE))
+    {
+        /* -- no logger: startup or shutdown, write it here -- */
+        rec = &tmp;
+        r = 0;
+    }
+    else
+    {
+        if ((r = (struct sr_log_ring*)sr_tring_get(&sr_log.rings,
+                                                   &sr_log_mine)) == 0)
+        { return; }
+
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        now = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        if (r->tat < now)
+        { r->tat = now; }
+        if (r->tat - now > SR_LOG_SLACK)
+        {
+            __atomic_store_n(&r->limited, r->limited + 1, __ATOMIC_RELAXED);
+            return;
+        }
+        r->tat += SR_LOG_PERIOD;
+
+        if (sr_ring_free(&r->ring) == 0)
+        {
+            __atomic_store_n(&r->full, r->full + 1, __ATOMIC_RELAXED);
+            return;
+        }
+        rec = &r->recs[sr_ring_head_slot(&r->ring, 0)];
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    rec->ts_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    rec->mod   = mod;
+    rec->level = level;
+    va_start(ap, fmt);
+    vsnprintf(rec->msg, sizeof(rec->msg), fmt, ap);
+    va_end(ap);
+
+    if (r)
+    { sr_ring_produce(&r->ring, 1); }
+    else
+    { sr_log_output(rec); }
+} /* -- sr_log_write -- */
+
+/*-----------------------------------------------------------------------------
+ * Logger thread
+ *---------------------------------------------------------------------------*/
+
+static void sr_log_dropped(const char* what, unsigned long now,
+                           unsigned long* seen)
+{
+    if (now != *seen)
+    {
+        fprintf(stderr, "log: %lu messages %s\n", now - *seen, what);
+        *seen = now;
+    }
+} /* -- sr_log_dropped -- */
+
+/* write everything queued so far, and what was dropped if report is set;
+   returns the number of messages */
+static unsigned long sr_log_drain(int report)
+{
+    struct sr_log_ring* r;
+    unsigned long done = 0;
+    uint32_t n, j;
+    int i, nrings;
+
+    nrings = sr_tring_count(&sr_log.rings);
+    for (i = 0; i < nrings; i++)
+    {
+        r = (struct sr_log_ring*)sr_tring_at(&sr_log.rings, i);
+        n = sr_ring_count(&r->ring);
+        for (j = 0; j < n; j++)
+        { sr_log_output(&r->recs[sr_ring_tail_slot(&r->ring, j)]); }
+        sr_ring_consume(&r->ring, n);
+        done += n;
+
+        if (!report)
+        { continue; }
+        sr_log_dropped("over the rate limit",
+                       __atomic_load_n(&r->limited, __ATOMIC_RELAXED),
+                       &r->seen_limited);
+        sr_log_dropped("lost to a full ring",
+                       __atomic_load_n(&r->full, __ATOMIC_RELAXED),
+                       &r->seen_full);
+    }
+    if (report)
+    {
+        sr_log_dropped("from threads without a ring",
+                       __atomic_load_n(&sr_log.rings.lost, __ATOMIC_RELAXED),
+                       &sr_log.seen_lost);
+    }
+
+    return done;
+} /* -- sr_log_drain -- */
+
+static void* sr_log_thread(void* arg)
+{
+    struct timespec idle, ts;
+    uint64_t now, next_report = 0;
+    int report;
+
+    idle.tv_sec  = 0;
+    idle.tv_nsec = SR_LOG_IDLE_NS;
+
+    while (!__atomic_load_n(&sr_log.stop, __ATOMIC_ACQUIRE))
+    {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        now = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        if ((report = (now >= next_report)))
+        { next_report = now + SR_LOG_REPORT_NS; }
+
+        if (sr_log_drain(report) == 0)
+        { nanosleep(&idle, 0); }
+    }
+    sr_log_drain(1);
+
+    return 0;
+} /* -- sr_log_thread -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_start(..)
+ * Scope: Global
+ *
+ * Start the logger thread.  Until it runs messages are written by the
+ * thread logging them.  Returns 0 on success.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_log_start(struct sr_instance* sr)
+{
+    /* REQUIRES */
+    assert(sr);
+    assert(!sr_log.running);
+
+    sr_log.stop = 0;
+    if (pthread_create(&sr_log.thread, 0, sr_log_thread, 0) != 0)
+    {
+        perror("pthread_create(..):sr_log.c::sr_log_start");
+        return -1;
+    }
+    sr_sched_housekeeping(sr, sr_log.thread);
+    __atomic_store_n(&sr_log.running, 1, __ATOMIC_RELEASE);
+
+    return 0;
+} /* -- sr_log_start -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_log_stop(..)
+ * Scope: Global
+ *
+ * Write out what is queued and stop the logger.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_log_stop(void)
+{
+    if (!sr_log.running)
+    { return; }
+
+    __atomic_store_n(&sr_log.running, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&sr_log.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(sr_log.thread, 0);
+} /* -- sr_log_stop -- */
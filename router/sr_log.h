@@ -0,0 +1,76 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_log.h
+ *
+ * Description:
+ *
+ * Leveled logging for the router.  Every message has a module and a level,
+ * and goes out only if the level is at or below both
+ *
+ *   SR_LOG_MAX            fixed at compile time ("make LOG_MAX=n"); calls
+ *                         above it are compiled out, arguments and all,
+ *   sr_log_levels[mod]    set at run time with -L (default warn).
+ *
+ * A message that passes is formatted into a ring owned by the calling
+ * thread and written out by a logger thread, so the forwarding path never
+ * blocks on stderr.  Each thread may log SR_LOG_RATE messages a second
+ * (bursts of SR_LOG_BURST); the rest, and whatever doesn't fit in the
+ * ring, are counted and reported by the logger.  Before sr_log_start()
+ * and after sr_log_stop() messages are written directly.
+ *
+ * -L takes a comma separated list of "level" (all modules) and
+ * "module=level", e.g. -L info,arp=debug.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_LOG_H
+#define SR_LOG_H
+
+#define SR_LOG_ERROR 0
+#define SR_LOG_WARN  1
+#define SR_LOG_INFO  2
+#define SR_LOG_DEBUG 3
+
+#ifndef SR_LOG_MAX
+#ifdef _DEBUG_
+#define SR_LOG_MAX SR_LOG_DEBUG
+#else
+#define SR_LOG_MAX SR_LOG_INFO
+#endif
+#endif /* SR_LOG_MAX */
+
+#define SR_LOG_DEFAULT SR_LOG_WARN  /* run time level of every module */
+
+#define SR_LOG_RATE  100            /* messages a second, per thread */
+#define SR_LOG_BURST 200
+
+enum sr_log_module
+{
+    SR_MOD_CORE,                /* startup, backends, threads */
+    SR_MOD_FWD,                 /* IP input and forwarding */
+    SR_MOD_ARP,                 /* ARP and the neighbor tables */
+    SR_MOD_ICMP,
+    SR_LOG_MODULES
+};
+
+struct sr_instance;
+
+extern unsigned char sr_log_levels[SR_LOG_MODULES];
+
+int  sr_log_parse(const char* spec);
+int  sr_log_start(struct sr_instance* );
+void sr_log_stop(void);
+void sr_log_write(int mod, int level, const char* fmt, ...)
+    __attribute__ ((format (printf, 3, 4)));
+
+#define SR_LOG(mod, level, fmt, args...) \
+    do { \
+        if ((level) <= SR_LOG_MAX && (level) <= sr_log_levels[mod]) \
+        { sr_log_write(mod, level, fmt, ## args); } \
+    } while (0)
+
+#define SR_ERROR(mod, fmt, args...) SR_LOG(mod, SR_LOG_ERROR, fmt, ## args)
+#define SR_WARN(mod, fmt, args...)  SR_LOG(mod, SR_LOG_WARN, fmt, ## args)
+#define SR_INFO(mod, fmt, args...)  SR_LOG(mod, SR_LOG_INFO, fmt, ## args)
+#define SR_DEBUG(mod, fmt, args...) SR_LOG(mod, SR_LOG_DEBUG, fmt, ## args)
+
+#endif /* -- SR_LOG_H -- */
@@ -29,9 +29,22 @@
 #include <getopt.h>
 #endif /* _LINUX_ */
 
-#include "sr_dumper.h"
+#include "sr_acl.h"
+#include "sr_nat.h"
+#include "sr_qos.h"
+#include "sr_capture.h"
+#include "sr_event.h"
+#include "sr_filter.h"
+#include "sr_flow.h"
+#include "sr_icmp.h"
+#include "sr_mbuf.h"
+#include "sr_neigh.h"
+#include "sr_worker.h"
 #include "sr_router.h"
 #include "sr_rt.h"
+#include "sr_backend.h"
+#include "sr_cksum.h"
+#include "sr_log.h"
 
 extern char* optarg;
 
@@ -44,6 +57,8 @@ extern char* optarg;
 #define DEFAULT_SERVER "localhost"
 #define DEFAULT_RTABLE "rtable"
 #define DEFAULT_TOPO 0
+#define DEFAULT_BACKEND "vns"
+#define DEFAULT_FLIGHT_FILE "sr-flight.pcap"
 
 static void usage(char* );
 static void sr_init_instance(struct sr_instance* );
@@ -65,11 +80,30 @@ int main(int argc, char **argv)
     unsigned int port = DEFAULT_PORT;
     unsigned int topo = DEFAULT_TOPO;
     char *logfile = 0;
+    char *evfile = 0;
+    char *capfilter = 0;
+    unsigned long rotate_mb = 0;
+    unsigned int rotate_secs = 0;
+    unsigned long flight_mb = 0;
+    int nworkers = 0;
+    int pipeline = 0;
+    struct sr_sched sched;
+    struct sr_icmp_limits icmp_limits;
+    struct sr_filter* filter = 0;
+    struct sr_acl_rules* acl_rules = 0;
+    char *natspec = 0;
+    char *qosspec = 0;
+    char *backend = DEFAULT_BACKEND;
+    char backend_spec[512];
     struct sr_instance sr;
 
     printf("Using %s\n", VERSION_INFO);
+    printf("Using the %s checksum kernel\n", sr_cksum_name());
 
-    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:")) != EOF)
+    sr_sched_init(&sched);
+    sr_icmp_limits_init(&icmp_limits);
+
+    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:F:C:G:R:T:B:W:PA:a:S:MI:L:E:X:N:Q:")) != EOF)
     {
         switch (c)
         {
@@ -95,17 +129,86 @@ int main(int argc, char **argv)
             case 'l':
                 logfile = optarg;
                 break;
+            case 'F':
+                capfilter = optarg;
+                break;
+            case 'C':
+                rotate_mb = strtoul(optarg, 0, 10);
+                break;
+            case 'G':
+                rotate_secs = atoi((char *) optarg);
+                break;
+            case 'R':
+                flight_mb = strtoul(optarg, 0, 10);
+                break;
             case 'r':
                 rtable = optarg;
                 break;
             case 'T':
                 template = optarg;
                 break;
+            case 'B':
+                backend = optarg;
+                break;
+            case 'W':
+                nworkers = atoi((char *) optarg);
+                break;
+            case 'P':
+                pipeline = 1;
+                break;
+            case 'A':
+                if(sr_sched_parse_cpus(&sched, optarg) != 0)
+                { exit(1); }
+                break;
+            case 'a':
+                sched.arp_cpu = atoi((char *) optarg);
+                break;
+            case 'S':
+                sched.prio = atoi((char *) optarg);
+                if(sched.prio < sched_get_priority_min(SCHED_FIFO) ||
+                   sched.prio > sched_get_priority_max(SCHED_FIFO))
+                {
+                    fprintf(stderr,"SCHED_FIFO priority must be %d to %d\n",
+                            sched_get_priority_min(SCHED_FIFO),
+                            sched_get_priority_max(SCHED_FIFO));
+                    exit(1);
+                }
+                break;
+            case 'M':
+                sched.mlock = 1;
+                break;
+            case 'I':
+                if(sr_icmp_parse_limits(&icmp_limits, optarg) != 0)
+                { exit(1); }
+                break;
+            case 'E':
+                evfile = optarg;
+                break;
+            case 'L':
+                if(sr_log_parse(optarg) != 0)
+                { exit(1); }
+                break;
+            case 'X':
+                if((acl_rules = sr_acl_load(optarg)) == 0)
+                { exit(1); }
+                break;
+            case 'N':
+                natspec = optarg;
+                break;
+            case 'Q':
+                qosspec = optarg;
+                break;
         } /* switch */
     } /* -- while -- */
 
     /* -- zero out sr instance -- */
     sr_init_instance(&sr);
+    sr.pipeline = pipeline;
+    sr.sched = sched;
+    sr.icmp_limits = icmp_limits;
+
+    /* -- place this (the receive) thread before the FIB etc. exist -- */
+    sr_sched_start(&sr);
 
     /* -- set up routing table from file -- */
     if(template == NULL) {
@@ -124,25 +227,51 @@ int main(int argc, char **argv)
     { strncpy(sr.user, user, 32); }
 
     /* -- set up file pointer for logging of raw packets -- */
+    if(flight_mb != 0 && logfile == 0)
+    { logfile = DEFAULT_FLIGHT_FILE; }
+    if(capfilter != 0 && logfile == 0)
+    { fprintf(stderr,"Warning: -F given without -l, ignoring it\n"); }
     if(logfile != 0)
     {
-        sr.logfile = sr_dump_open(logfile,0,PACKET_DUMP_SIZE);
-        if(!sr.logfile)
+        if(capfilter != 0)
+        {
+            if((filter = sr_filter_compile(capfilter)) == 0)
+            { exit(1); }
+            printf("Capture filter \"%s\":\n", capfilter);
+            sr_filter_dump(filter, stdout);
+        }
+        sr.capture = sr_capture_open(&sr, logfile, filter,
+                                     (uint64_t)rotate_mb * 1000000,
+                                     rotate_secs,
+                                     (uint64_t)flight_mb * 1000000);
+        if(!sr.capture)
         {
             fprintf(stderr,"Error opening up dump file %s\n",
                     logfile);
             exit(1);
         }
     }
+    if(evfile != 0 && (sr.events = sr_event_open(&sr, evfile)) == 0)
+    {
+        exit(1);
+    }
 
-    Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
-    if(template)
-        Debug("Requesting topology template %s\n", template);
-    else
-        Debug("Requesting topology %d\n", topo);
+    /* -- the vns backend takes its server from -s / -p -- */
+    if(strcmp(backend, "vns") == 0)
+    {
+        snprintf(backend_spec, sizeof(backend_spec), "vns:%s:%u",
+                 server, port);
+        backend = backend_spec;
+
+        Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
+        if(template)
+            Debug("Requesting topology template %s\n", template);
+        else
+            Debug("Requesting topology %d\n", topo);
+    }
 
     /* connect to server and negotiate session */
-    if(sr_connect_to_server(&sr,port,server) == -1)
+    if(sr_backend_open(&sr, backend) != 0)
     {
         return 1;
     }
@@ -156,12 +285,57 @@ int main(int argc, char **argv)
       sr_load_rt_wrap(&sr, rtable);
     }
 
+    /* -- wait for the interface list -- */
+    if(sr_backend_get_interfaces(&sr) <= 0)
+    {
+        fprintf(stderr,"Unable to get interfaces from backend\n");
+        return 1;
+    }
+    if(acl_rules)
+    {
+        if(sr_acl_attach(&sr, acl_rules) != 0)
+        { return 1; }
+        printf("Loaded %d ACL rules\n", acl_rules->n);
+        sr_acl_rules_free(acl_rules);
+    }
+    if(natspec)
+    {
+        if(sr_nat_attach(&sr, natspec) != 0)
+        { return 1; }
+        printf("Translating addresses out of %s\n", natspec);
+    }
+    if(qosspec)
+    {
+        if(sr_qos_attach(&sr, qosspec) != 0)
+        { return 1; }
+        printf("Queueing egress on %s\n", qosspec);
+    }
+
+    /* -- from here on messages are written by the logger thread -- */
+    if(sr_log_start(&sr) != 0)
+    {
+        return 1;
+    }
+
     /* call router init (for arp subsystem etc.) */
     sr_init(&sr);
 
+    if(nworkers > 0 && sr_workers_start(&sr, nworkers) != 0)
+    {
+        return 1;
+    }
+    if(sr.pipeline)
+    {
+        printf("Forwarding in stages (-P)\n");
+    }
+
     /* -- whizbang main loop ;-) */
-    while( sr_read_from_server(&sr) == 1);
+    sr_backend_run(&sr);
 
+    sr_workers_stop(&sr);
+    sr_arpcache_stop(&sr);
+    sr_qos_stop(&sr);
+    sr_backend_close(&sr);
     sr_destroy_instance(&sr);
 
     return 0;
@@ -178,9 +352,21 @@ static void usage(char* argv0)
     printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
     printf("           [-T template_name] [-u username] \n");
     printf("           [-t topo id] [-r routing table] \n");
-    printf("           [-l log file] \n");
-    printf("   defaults server=%s port=%d host=%s  \n",
-            DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST );
+    printf("           [-l log file] [-F capture filter] \n");
+    printf("           [-C rotate MB] [-G rotate secs] (.pcapng log only) \n");
+    printf("           [-R flight recorder MB] [-E event log] \n");
+    printf("           [-B backend[:args]] [-W worker threads] [-P] \n");
+    printf("           [-A forwarding cpus] [-a ARP thread cpu] \n");
+    printf("           [-S SCHED_FIFO priority] [-M] \n");
+    printf("           [-I iface=rate[:burst],src=rate[:burst],prefix=len] \n");
+    printf("           [-L level[,module=level...]] [-X ACL rules] \n");
+    printf("           [-N outside iface[:connections]] \n");
+    printf("           [-Q iface[=mbps],...] \n");
+    printf("   defaults server=%s port=%d host=%s backend=%s \n",
+            DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST, DEFAULT_BACKEND );
+    printf("   backends: ");
+    sr_backend_list(stdout);
+    printf("\n");
 } /* -- usage -- */
 
 /*-----------------------------------------------------------------------------
@@ -220,10 +406,28 @@ static void sr_destroy_instance(struct sr_instance* sr)
     /* REQUIRES */
     assert(sr);
 
-    if(sr->logfile)
+    sr_log_stop();
+
+    if(sr->capture)
     {
-        sr_dump_close(sr->logfile);
+        sr_capture_close(sr->capture);
     }
+    sr_event_close(sr->events);
+
+    fprintf(stderr, "router: %lu received, %lu sent, %lu dropped, "
+            "%lu ICMP unreachable, %lu ICMP rate limited\n",
+            sr->stats.rx_packets, sr->stats.tx_packets, sr->stats.drops,
+            sr->stats.icmp_unreach, sr->stats.icmp_limited);
+    sr_icmp_report(sr, stderr);
+    sr_icmp_destroy(sr);
+    sr_flow_destroy(sr);
+    sr_neigh_destroy(sr);
+    sr_acl_detach(sr);
+    sr_nat_detach(sr);
+    sr_qos_detach(sr);
+    sr_mbuf_pool_destroy(sr->mbufs);
+    sr->mbufs = 0;
+    sr_if_destroy(sr);
 
     /*
     fprintf(stderr,"sr_destroy_instance leaking memory\n");
@@ -247,8 +451,26 @@ static void sr_init_instance(struct sr_instance* sr)
     sr->host[0] = 0;
     sr->topo_id = 0;
     sr->if_list = 0;
+    sr->ifindex = 0;
     sr->routing_table = 0;
-    sr->logfile = 0;
+    sr->capture = 0;
+    sr->events = 0;
+    sr->backend = 0;
+    sr->backend_state = 0;
+    sr->tx_defer = 0;
+    memset(&sr->stats, 0, sizeof(sr->stats));
+    sr->workers = 0;
+    sr->neigh = 0;
+    sr->icmp = 0;
+    sr->flows = 0;
+    sr->flow_gen = 1;
+    sr->acl = 0;
+    sr->acl_n = 0;
+    sr->nat = 0;
+    sr->nat_ifid = -1;
+    sr->qos = 0;
+    sr->pipeline = 0;
+    sr_sched_init(&sr->sched);
 } /* -- sr_init_instance -- */
 
 /*-----------------------------------------------------------------------------
@@ -257,7 +479,7 @@ static void sr_init_instance(struct sr_instance* sr)
  *
  * make sure the routing table is consistent with the interface list by
  * verifying that all interfaces used in the routing table actually exist
- * in the hardware.
+ * in the hardware, and bind each entry to its interface id.
  *
  * RETURN VALUES:
  *
@@ -269,7 +491,6 @@ static void sr_init_instance(struct sr_instance* sr)
 int sr_verify_routing_table(struct sr_instance* sr)
 {
     struct sr_rt* rt_walker = 0;
-    struct sr_if* if_walker = 0;
     int ret = 0;
 
     /* -- REQUIRES --*/
@@ -285,15 +506,7 @@ int sr_verify_routing_table(struct sr_instance* sr)
     while(rt_walker)
     {
         /* -- check to see if interface exists -- */
-        if_walker = sr->if_list;
-        while(if_walker)
-        {
-            if( strncmp(if_walker->name,rt_walker->interface,sr_IFACE_NAMELEN)
-                    == 0)
-            { break; }
-            if_walker = if_walker->next;
-        }
-        if(if_walker == 0)
+        if(sr_rt_bind(sr, rt_walker) == 0)
         { ret++; } /* -- interface not found! -- */
 
         rt_walker = rt_walker->next;
@@ -315,3 +528,27 @@ static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
     sr_print_routing_table(sr);
     printf("---------------------------------------------\n");
 }
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_stats_read()
+ * Scope: Global
+ *
+ * Snapshot the router counters.  Each counter is read atomically, the set
+ * as a whole is not.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_stats_read(struct sr_instance* sr, struct sr_stats* out)
+{
+    /* REQUIRES */
+    assert(sr);
+    assert(out);
+
+#define SR_STAT_READ(f) out->f = __atomic_load_n(&sr->stats.f, __ATOMIC_RELAXED)
+    SR_STAT_READ(rx_packets);
+    SR_STAT_READ(tx_packets);
+    SR_STAT_READ(drops);
+    SR_STAT_READ(icmp_unreach);
+    SR_STAT_READ(icmp_limited);
+#undef SR_STAT_READ
+} /* -- sr_stats_read -- */
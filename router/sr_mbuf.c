@@ -0,0 +1,265 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_mbuf.c
+ *
+ * Description:
+ *
+ * Packet buffer pool, see sr_mbuf.h.
+ *
+ * The pool is one cache line aligned array of buffers with a locked free
+ * list.  A thread's cache belongs to one pool at a time; using another
+ * pool hands the cached buffers back to the first one.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "sr_mbuf.h"
+#include "sr_ring.h"
+
+struct sr_mbuf_pool
+{
+    pthread_mutex_t lock;
+    struct sr_mbuf* free;
+    unsigned int nfree;
+    unsigned int count;
+    struct sr_mbuf* mem;
+};
+
+struct sr_mbuf_cache
+{
+    struct sr_mbuf_pool* pool;
+    unsigned int n;
+    struct sr_mbuf* m[SR_MBUF_CACHE];
+};
+
+static __thread struct sr_mbuf_cache sr_mbuf_tc;
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_mbuf_pool_create(..)
+ * Scope: Global
+ *
+ * Allocate count buffers.  Returns 0 if there isn't the memory for them.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_mbuf_pool* sr_mbuf_pool_create(unsigned int count)
+{
+    struct sr_mbuf_pool* pool;
+    unsigned int i;
+
+    /* REQUIRES */
+    assert(count > 0);
+    assert(sizeof(struct sr_mbuf) == SR_MBUF_SIZE);
+
+    if ((pool = (struct sr_mbuf_pool*)calloc(1, sizeof(*pool))) == 0)
+    {
+        perror("calloc(..):sr_mbuf.c::sr_mbuf_pool_create");
+        return 0;
+    }
+    if (posix_memalign((void**)&pool->mem, SR_CACHELINE,
+                       (size_t)count * sizeof(struct sr_mbuf)) != 0)
+    {
+        fprintf(stderr, "sr_mbuf_pool_create: no memory for %u buffers\n",
+                count);
+        free(pool);
+        return 0;
+    }
+
+    pthread_mutex_init(&pool->lock, 0);
+    pool->count = count;
+    for (i = count; i-- > 0; )
+    {
+        pool->mem[i].pool = pool;
+        pool->mem[i].next = pool->free;
+        pool->free = &pool->mem[i];
+    }
+    pool->nfree = count;
+
+    return pool;
+} /* -- sr_mbuf_pool_create -- */
+
+/* -- move up to n buffers from the pool into the calling thread's cache -- */
+static void sr_mbuf_refill(struct sr_mbuf_cache* tc, unsigned int n)
+{
+    struct sr_mbuf_pool* pool = tc->pool;
+    struct sr_mbuf* m;
+
+    pthread_mutex_lock(&pool->lock);
+    while (n-- > 0 && (m = pool->free) != 0)
+    {
+        pool->free = m->next;
+        pool->nfree--;
+        tc->m[tc->n++] = m;
+    }
+    pthread_mutex_unlock(&pool->lock);
+} /* -- sr_mbuf_refill -- */
+
+/* -- and back -- */
+static void sr_mbuf_spill(struct sr_mbuf_cache* tc, unsigned int n)
+{
+    struct sr_mbuf_pool* pool = tc->pool;
+    struct sr_mbuf* m;
+
+    pthread_mutex_lock(&pool->lock);
+    while (n-- > 0 && tc->n > 0)
+    {
+        m = tc->m[--tc->n];
+        m->next = pool->free;
+        pool->free = m;
+        pool->nfree++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+} /* -- sr_mbuf_spill -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_mbuf_cache_flush(..)
+ * Scope: Global
+ *
+ * Give the calling thread's cached buffers back to their pool.  Threads
+ * that exit call this first.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_mbuf_cache_flush(void)
+{
+    struct sr_mbuf_cache* tc = &sr_mbuf_tc;
+
+    if (tc->pool && tc->n)
+    { sr_mbuf_spill(tc, tc->n); }
+} /* -- sr_mbuf_cache_flush -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_mbuf_pool_destroy(..)
+ * Scope: Global
+ *
+ * Free the pool once every other thread that used it has exited.  The
+ * calling thread's cache goes back first; buffers that are still out
+ * after that are reported, and go with the rest.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_mbuf_pool_destroy(struct sr_mbuf_pool* pool)
+{
+    if (pool == 0)
+    { return; }
+
+    if (sr_mbuf_tc.pool == pool)
+    {
+        sr_mbuf_cache_flush();
+        sr_mbuf_tc.pool = 0;
+    }
+    if (pool->nfree != pool->count)
+    {
+        fprintf(stderr, "mbuf: %u of %u buffers never came back\n",
+                pool->count - pool->nfree, pool->count);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->mem);
+    free(pool);
+} /* -- sr_mbuf_pool_destroy -- */
+
+static __inline__ struct sr_mbuf_cache* sr_mbuf_cache(struct sr_mbuf_pool* p)
+{
+    struct sr_mbuf_cache* tc = &sr_mbuf_tc;
+
+    if (tc->pool != p)
+    {
+        sr_mbuf_cache_flush();
+        tc->pool = p;
+    }
+    return tc;
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_mbuf_alloc(..)
+ * Scope: Global
+ *
+ * An empty buffer with one reference and SR_MBUF_HEADROOM of headroom, or
+ * 0 if the pool has run dry.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_mbuf* sr_mbuf_alloc(struct sr_mbuf_pool* pool)
+{
+    struct sr_mbuf_cache* tc;
+    struct sr_mbuf* m;
+
+    /* REQUIRES */
+    assert(pool);
+
+    tc = sr_mbuf_cache(pool);
+    if (tc->n == 0)
+    {
+        sr_mbuf_refill(tc, SR_MBUF_BATCH);
+        if (tc->n == 0)
+        { return 0; }
+    }
+
+    m = tc->m[--tc->n];
+    m->next     = 0;
+    m->refcnt   = 1;
+    m->off      = SR_MBUF_HEADROOM;
+    m->len      = 0;
+    m->ifid     = -1;
+
+    return m;
+} /* -- sr_mbuf_alloc -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_mbuf_copy(..)
+ * Scope: Global
+ *
+ * A buffer holding a copy of buf.  0 if the pool is empty or len doesn't
+ * fit.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_mbuf* sr_mbuf_copy(struct sr_mbuf_pool* pool, const uint8_t* buf,
+                             unsigned int len)
+{
+    struct sr_mbuf* m;
+    uint8_t* p;
+
+    if ((m = sr_mbuf_alloc(pool)) == 0)
+    { return 0; }
+    if ((p = sr_mbuf_append(m, len)) == 0)
+    {
+        sr_mbuf_free(m);
+        return 0;
+    }
+    memcpy(p, buf, len);
+
+    return m;
+} /* -- sr_mbuf_copy -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_mbuf_free(..)
+ * Scope: Global
+ *
+ * Drop a reference; the last one returns the buffer to the calling
+ * thread's cache, whichever thread allocated it.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_mbuf_free(struct sr_mbuf* m)
+{
+    struct sr_mbuf_cache* tc;
+
+    if (m == 0)
+    { return; }
+
+    assert(m->refcnt > 0);
+    if (__atomic_sub_fetch(&m->refcnt, 1, __ATOMIC_ACQ_REL) != 0)
+    { return; }
+
+    tc = sr_mbuf_cache(m->pool);
+    if (tc->n == SR_MBUF_CACHE)
+    { sr_mbuf_spill(tc, SR_MBUF_BATCH); }
+    tc->m[tc->n++] = m;
+} /* -- sr_mbuf_free -- */
+
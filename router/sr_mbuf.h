@@ -0,0 +1,122 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_mbuf.h
+ *
+ * Description:
+ *
+ * Packet buffers for frames the router builds or has to hold on to (ICMP
+ * errors, ARP requests, packets waiting for ARP), so none of them costs a
+ * malloc().
+ *
+ * A buffer is SR_MBUF_SIZE bytes, descriptor included, taken from a pool
+ * allocated once at startup.  Data starts SR_MBUF_HEADROOM bytes in, so
+ * headers can be put in front of it in place: a frame is built payload
+ * first and encapsulated with sr_mbuf_prepend(), and a backend can write
+ * its own transport header there before sending (see tx_mbuf in
+ * sr_backend.h).
+ *
+ * Buffers are reference counted; sr_mbuf_free() drops one reference and
+ * the buffer goes back once the last is gone.  Each thread keeps a small
+ * cache of free buffers and only takes the pool lock to move
+ * SR_MBUF_BATCH of them at a time.  sr_mbuf_alloc() returns 0 when the
+ * pool is empty; callers drop the frame.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_MBUF_H
+#define SR_MBUF_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include "sr_if.h"
+
+#define SR_MBUF_SIZE      2048  /* per buffer, descriptor included */
+#define SR_MBUF_HEADROOM  128
+#define SR_MBUF_COUNT     4096  /* default pool size */
+#define SR_MBUF_CACHE     64    /* free buffers a thread keeps */
+#define SR_MBUF_BATCH     32    /* moved between cache and pool at once */
+
+#define SR_MBUF_HDR_SIZE  64
+#define SR_MBUF_ROOM      (SR_MBUF_SIZE - SR_MBUF_HDR_SIZE)
+
+struct sr_mbuf_pool;
+
+struct sr_mbuf
+{
+    struct sr_mbuf* next;       /* free list, or the holder's queue */
+    struct sr_mbuf_pool* pool;
+    uint32_t refcnt;
+    uint16_t off;               /* data starts at room + off */
+    uint16_t len;
+    int32_t ifid;               /* for the holder, unused here */
+    uint8_t pad[SR_MBUF_HDR_SIZE - 2 * sizeof(void*) - 12];
+    uint8_t room[SR_MBUF_ROOM];
+};
+
+struct sr_mbuf_pool* sr_mbuf_pool_create(unsigned int count);
+struct sr_mbuf* sr_mbuf_alloc(struct sr_mbuf_pool* );
+struct sr_mbuf* sr_mbuf_copy(struct sr_mbuf_pool* , const uint8_t* buf,
+                             unsigned int len);
+void sr_mbuf_free(struct sr_mbuf* );
+void sr_mbuf_cache_flush(void);
+void sr_mbuf_pool_destroy(struct sr_mbuf_pool* );
+
+static __inline__ uint8_t* sr_mbuf_data(struct sr_mbuf* m)
+{
+    return m->room + m->off;
+}
+
+static __inline__ unsigned int sr_mbuf_headroom(const struct sr_mbuf* m)
+{
+    return m->off;
+}
+
+static __inline__ unsigned int sr_mbuf_tailroom(const struct sr_mbuf* m)
+{
+    return SR_MBUF_ROOM - m->off - m->len;
+}
+
+/* -- take another reference, sr_mbuf_free() drops it -- */
+static __inline__ void sr_mbuf_ref(struct sr_mbuf* m)
+{
+    __atomic_fetch_add(&m->refcnt, 1, __ATOMIC_RELAXED);
+}
+
+/* -- grow the data by n bytes at the front, 0 if there's no headroom -- */
+static __inline__ uint8_t* sr_mbuf_prepend(struct sr_mbuf* m, unsigned int n)
+{
+    if (n > m->off)
+    { return 0; }
+    m->off -= n;
+    m->len += n;
+    return m->room + m->off;
+}
+
+/* -- grow the data by n bytes at the end, returns where they start -- */
+static __inline__ uint8_t* sr_mbuf_append(struct sr_mbuf* m, unsigned int n)
+{
+    uint8_t* p;
+
+    if (n > sr_mbuf_tailroom(m))
+    { return 0; }
+    p = m->room + m->off + m->len;
+    m->len += n;
+    return p;
+}
+
+/* -- strip n bytes off the front -- */
+static __inline__ uint8_t* sr_mbuf_adj(struct sr_mbuf* m, unsigned int n)
+{
+    if (n > m->len)
+    { return 0; }
+    m->off += n;
+    m->len -= n;
+    return m->room + m->off;
+}
+
+#endif /* -- SR_MBUF_H -- */
@@ -0,0 +1,1121 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_nat.c
+ *
+ * Description:
+ *
+ * NAPT connection table and packet rewriting, see sr_nat.h.
+ *
+ * Connections are handed out of one array, index 0 meaning none.  Both
+ * hash tables hold (tag, index) slots, the tag being the key's full hash:
+ * the primary bucket is tag & mask and the alternate one is found from
+ * the bucket and the tag alone, so an entry can be moved without looking
+ * at its connection.  An insert into two full buckets searches breadth
+ * first for a chain of moves that ends in a free slot, then makes them
+ * from the free end back, so every entry stays findable throughout.
+ *
+ * Writers (new connections, expiry) hold nat->lock and make the sequence
+ * count odd while they change the tables or recycle a connection.
+ * Readers look up and copy the connection out without the lock, and try
+ * again if the count moved; after a few misses they take the lock.  The
+ * clock, the last-used stamp and the TCP state bits are single words,
+ * written with relaxed atomics, outside of all that.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "sr_nat.h"
+#include "sr_ring.h"
+#include "sr_router.h"
+#include "sr_if.h"
+
+#define SR_NAT_WAYS   8                 /* slots per cache line bucket */
+#define SR_NAT_BFS    512               /* buckets an insert may search */
+#define SR_NAT_TRIES  64                /* outside ports tried per connection */
+#define SR_NAT_RETRY  4                 /* lock-free lookups before locking */
+#define SR_NAT_WHEEL  4096              /* seconds, power of two */
+
+/* -- connection state, TCP only -- */
+#define SR_NAT_ANSWERED 0x01            /* seen from outside */
+#define SR_NAT_FIN_OUT  0x02
+#define SR_NAT_FIN_IN   0x04
+#define SR_NAT_RST      0x08
+
+/* -- TCP header flags, byte 13 -- */
+#define SR_TCP_FIN 0x01
+#define SR_TCP_SYN 0x02
+#define SR_TCP_RST 0x04
+#define SR_TCP_ACK 0x10
+
+#define SR_ICMP_ECHO_REPLY   0
+#define SR_ICMP_UNREACH      3
+#define SR_ICMP_ECHO_REQUEST 8
+#define SR_ICMP_TIME_EXCEEDED 11
+#define SR_ICMP_PARAM_PROBLEM 12
+
+struct sr_nat_conn
+{
+    uint32_t in_ip;             /* addresses and ports network byte order */
+    uint32_t rem_ip;
+    uint16_t in_port;           /* or ICMP echo identifier */
+    uint16_t rem_port;          /* 0 for ICMP */
+    uint16_t out_port;
+    uint8_t  proto;
+    uint8_t  state;             /* SR_NAT_* */
+    uint32_t last;              /* nat->now at the last packet */
+    uint32_t next;              /* timer wheel or free list */
+};
+
+/* -- what a packet is looked up by; out_port or in_ip/in_port unused -- */
+struct sr_nat_key
+{
+    uint32_t in_ip, rem_ip;
+    uint16_t in_port, rem_port, out_port;
+    uint8_t  proto;
+};
+
+struct sr_nat_slot
+{
+    uint32_t tag;               /* hash of the key */
+    uint32_t idx;               /* connection, 0 if free */
+};
+
+struct sr_nat_bucket
+{
+    struct sr_nat_slot s[SR_NAT_WAYS];
+} __attribute__ ((aligned (SR_CACHELINE))) ;
+
+struct sr_nat_table
+{
+    struct sr_nat_bucket* b;
+    uint32_t mask;              /* buckets - 1 */
+    void* mem;                  /* b before alignment */
+};
+
+struct sr_nat
+{
+    uint32_t ip;                /* outside address */
+    uint32_t seq;               /* odd while the tables change */
+    uint32_t now;               /* seconds, set by sr_nat_tick() */
+    struct sr_nat_table out;    /* inside five tuple */
+    struct sr_nat_table in;     /* outside port and remote end */
+    struct sr_nat_conn* conns;
+    uint32_t nconns;
+    uint32_t used;              /* highest index ever handed out */
+    uint32_t free;              /* recycled connections */
+    uint32_t wheel[SR_NAT_WHEEL];
+    uint32_t wheel_t;           /* the wheel has been run up to here */
+    struct sr_nat_stats stats;
+    pthread_mutex_t lock;
+};
+
+/*-----------------------------------------------------------------------------
+ * Hashing and checksums
+ *---------------------------------------------------------------------------*/
+
+static __inline__ uint32_t sr_nat_mix(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+} /* -- sr_nat_mix -- */
+
+static __inline__ uint32_t sr_nat_hash_out(const struct sr_nat_key* k)
+{
+    return sr_nat_mix(k->in_ip * 0x9e3779b1U ^
+                      sr_nat_mix(k->rem_ip ^ ((uint32_t)k->in_port << 16)) ^
+                      ((uint32_t)k->rem_port << 8 | k->proto));
+} /* -- sr_nat_hash_out -- */
+
+static __inline__ uint32_t sr_nat_hash_in(const struct sr_nat_key* k)
+{
+    return sr_nat_mix(k->rem_ip * 0x9e3779b1U ^
+                      sr_nat_mix((uint32_t)k->out_port << 16 | k->rem_port) ^
+                      k->proto);
+} /* -- sr_nat_hash_in -- */
+
+/* -- the other bucket an entry may be in, from one bucket and its tag -- */
+static __inline__ uint32_t sr_nat_alt(const struct sr_nat_table* t,
+                                      uint32_t b, uint32_t tag)
+{
+    uint32_t x = tag * 0x5bd1e995U;
+
+    return (b ^ x ^ (x >> 15)) & t->mask;
+} /* -- sr_nat_alt -- */
+
+/* -- RFC 1624 eqn. 3 for a 32 bit and a 16 bit field at once -- */
+static __inline__ uint16_t sr_nat_adjust(uint16_t sum,
+                                         uint32_t old_a, uint32_t new_a,
+                                         uint16_t old_p, uint16_t new_p)
+{
+    uint32_t s = (uint16_t)~sum +
+                 (uint16_t)~(old_a >> 16) + (uint16_t)~old_a +
+                 (new_a >> 16) + (new_a & 0xffff) +
+                 (uint16_t)~old_p + new_p;
+
+    s = (s & 0xffff) + (s >> 16);
+    s = (s & 0xffff) + (s >> 16);
+    s = ~s & 0xffff;
+    return s ? s : 0xffff;
+} /* -- sr_nat_adjust -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_nat_parse(..)
+ * Scope: Local
+ *
+ * Fill in the key ip is looked up by, going out (inside five tuple) or
+ * coming in (outside port and remote end), and the TCP flags.  -1 if ip
+ * is nothing the NAT can translate.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_nat_parse(const sr_ip_hdr_t* ip, unsigned int len, int out,
+                        struct sr_nat_key* k, uint8_t* flags)
+{
+    unsigned int hl = ip->ip_hl * 4;
+    const uint8_t* l4 = (const uint8_t*)ip + hl;
+    const uint16_t* p = (const uint16_t*)l4;
+    uint16_t here, there;
+
+    if (ntohs(ip->ip_off) & IP_OFFMASK)
+    { return -1; }
+
+    *flags = 0;
+    switch (ip->ip_p)
+    {
+        case ip_protocol_tcp:
+            if (len < hl + 20)
+            { return -1; }
+            *flags = l4[13];
+            here   = out ? p[0] : p[1];
+            there  = out ? p[1] : p[0];
+            break;
+        case ip_protocol_udp:
+            if (len < hl + 8)
+            { return -1; }
+            here   = out ? p[0] : p[1];
+            there  = out ? p[1] : p[0];
+            break;
+        case ip_protocol_icmp:
+            if (len < hl + 8 ||
+                l4[0] != (out ? SR_ICMP_ECHO_REQUEST : SR_ICMP_ECHO_REPLY))
+            { return -1; }
+            here   = p[2];
+            there  = 0;
+            break;
+        default:
+            return -1;
+    }
+
+    k->proto    = ip->ip_p;
+    k->rem_port = there;
+    if (out)
+    {
+        k->in_ip    = ip->ip_src;
+        k->rem_ip   = ip->ip_dst;
+        k->in_port  = here;
+        k->out_port = 0;
+    }
+    else
+    {
+        k->in_ip    = 0;
+        k->rem_ip   = ip->ip_src;
+        k->in_port  = 0;
+        k->out_port = here;
+    }
+    return 0;
+} /* -- sr_nat_parse -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_nat_rewrite(..)
+ * Scope: Local
+ *
+ * Replace the source (out) or destination address and port of a packet
+ * sr_nat_parse() took, keeping the IPv4 and L4 checksums right.  A UDP
+ * checksum of 0 means there is none and stays 0.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_nat_rewrite(sr_ip_hdr_t* ip, int out, uint32_t addr,
+                           uint16_t port)
+{
+    uint8_t* l4 = (uint8_t*)ip + ip->ip_hl * 4;
+    uint32_t old_a = out ? ip->ip_src : ip->ip_dst;
+    uint16_t* p;
+    uint16_t* sum;
+    uint16_t old_p;
+
+    switch (ip->ip_p)
+    {
+        case ip_protocol_tcp:
+            p   = (uint16_t*)(l4 + (out ? 0 : 2));
+            sum = (uint16_t*)(l4 + 16);
+            break;
+        case ip_protocol_udp:
+            p   = (uint16_t*)(l4 + (out ? 0 : 2));
+            sum = (uint16_t*)(l4 + 6);
+            break;
+        default:
+            p   = (uint16_t*)(l4 + 4);
+            sum = (uint16_t*)(l4 + 2);
+            break;
+    }
+    old_p = *p;
+
+    ip->ip_sum = sr_nat_adjust(ip->ip_sum, old_a, addr, 0, 0);
+    if (out)
+    { ip->ip_src = addr; }
+    else
+    { ip->ip_dst = addr; }
+
+    /* -- ICMP has no pseudo header, TCP and UDP cover the address too -- */
+    if (ip->ip_p == ip_protocol_icmp)
+    { *sum = sr_nat_adjust(*sum, 0, 0, old_p, port); }
+    else if (ip->ip_p == ip_protocol_tcp || *sum != 0)
+    { *sum = sr_nat_adjust(*sum, old_a, addr, old_p, port); }
+    *p = port;
+} /* -- sr_nat_rewrite -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_nat_parse_error(..)
+ * Scope: Local
+ *
+ * If ip is an ICMP error (destination unreachable, time exceeded,
+ * parameter problem) fill in the key of the connection the packet it
+ * quotes belongs to.  Coming in, the quoted packet is one that went out,
+ * so its source is the outside end; going out, it is one that came in
+ * to the inside host.  -1 if ip is no such error or quotes too little of
+ * the packet to tell: its IP header and the 8 bytes after it.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_nat_parse_error(const sr_ip_hdr_t* ip, unsigned int len, int out,
+                              struct sr_nat_key* k)
+{
+    unsigned int hl = ip->ip_hl * 4;
+    const uint8_t* icmp = (const uint8_t*)ip + hl;
+    const sr_ip_hdr_t* in = (const sr_ip_hdr_t*)(icmp + 8);
+    const uint16_t* p;
+    unsigned int ihl;
+
+    if (ip->ip_p != ip_protocol_icmp || (ntohs(ip->ip_off) & IP_OFFMASK) ||
+        len < hl + 8 + sizeof(sr_ip_hdr_t))
+    { return -1; }
+    if (icmp[0] != SR_ICMP_UNREACH && icmp[0] != SR_ICMP_TIME_EXCEEDED &&
+        icmp[0] != SR_ICMP_PARAM_PROBLEM)
+    { return -1; }
+
+    ihl = in->ip_hl * 4;
+    if (in->ip_v != 4 || ihl < sizeof(sr_ip_hdr_t) || len < hl + 8 + ihl + 8 ||
+        (ntohs(in->ip_off) & IP_OFFMASK))
+    { return -1; }
+    p = (const uint16_t*)((const uint8_t*)in + ihl);
+
+    k->proto = in->ip_p;
+    switch (in->ip_p)
+    {
+        case ip_protocol_tcp:
+        case ip_protocol_udp:
+            k->rem_port = out ? p[0] : p[1];
+            k->in_port  = out ? p[1] : 0;
+            k->out_port = out ? 0 : p[0];
+            break;
+        case ip_protocol_icmp:
+            if (((const uint8_t*)p)[0] !=
+                (out ? SR_ICMP_ECHO_REPLY : SR_ICMP_ECHO_REQUEST))
+            { return -1; }
+            k->rem_port = 0;
+            k->in_port  = out ? p[2] : 0;
+            k->out_port = out ? 0 : p[2];
+            break;
+        default:
+            return -1;
+    }
+    k->in_ip  = out ? in->ip_dst : 0;
+    k->rem_ip = out ? in->ip_src : in->ip_dst;
+    return 0;
+} /* -- sr_nat_parse_error -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_nat_rewrite_error(..)
+ * Scope: Local
+ *
+ * sr_nat_rewrite() for an ICMP error sr_nat_parse_error() took: replace
+ * the source (out) or destination address of the error, and the same
+ * end of the quoted packet, which is its destination (out) or source
+ * address and port.  The quoted IP header and L4 checksums are adjusted
+ * as for a packet of the connection, if they were quoted at all, and the
+ * ICMP checksum for every word that changed under it.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_nat_rewrite_error(sr_ip_hdr_t* ip, unsigned int len, int out,
+                                 uint32_t addr, uint16_t port)
+{
+    uint8_t* icmp = (uint8_t*)ip + ip->ip_hl * 4;
+    uint16_t* icmp_sum = (uint16_t*)(icmp + 2);
+    sr_ip_hdr_t* in = (sr_ip_hdr_t*)(icmp + 8);
+    uint8_t* l4 = (uint8_t*)in + in->ip_hl * 4;
+    unsigned int quoted = len - (l4 - (uint8_t*)ip);
+    uint32_t old_a = out ? in->ip_dst : in->ip_src;
+    uint16_t* p;
+    uint16_t* sum = 0;
+    uint16_t old_p, old_ip_sum, old_sum = 0;
+
+    switch (in->ip_p)
+    {
+        case ip_protocol_tcp:
+            p = (uint16_t*)(l4 + (out ? 2 : 0));
+            if (quoted >= 18)
+            { sum = (uint16_t*)(l4 + 16); }
+            break;
+        case ip_protocol_udp:
+            p = (uint16_t*)(l4 + (out ? 2 : 0));
+            if (*(uint16_t*)(l4 + 6) != 0)
+            { sum = (uint16_t*)(l4 + 6); }
+            break;
+        default:
+            p   = (uint16_t*)(l4 + 4);
+            sum = (uint16_t*)(l4 + 2);
+            break;
+    }
+    old_p = *p;
+
+    /* -- the error itself; ICMP has no pseudo header -- */
+    if (out)
+    {
+        ip->ip_sum = sr_nat_adjust(ip->ip_sum, ip->ip_src, addr, 0, 0);
+        ip->ip_src = addr;
+    }
+    else
+    {
+        ip->ip_sum = sr_nat_adjust(ip->ip_sum, ip->ip_dst, addr, 0, 0);
+        ip->ip_dst = addr;
+    }
+
+    /* -- the packet it quotes -- */
+    old_ip_sum = in->ip_sum;
+    in->ip_sum = sr_nat_adjust(in->ip_sum, old_a, addr, 0, 0);
+    if (out)
+    { in->ip_dst = addr; }
+    else
+    { in->ip_src = addr; }
+    if (sum)
+    {
+        old_sum = *sum;
+        if (in->ip_p == ip_protocol_icmp)
+        { *sum = sr_nat_adjust(*sum, 0, 0, old_p, port); }
+        else
+        { *sum = sr_nat_adjust(*sum, old_a, addr, old_p, port); }
+    }
+    *p = port;
+
+    *icmp_sum = sr_nat_adjust(*icmp_sum, old_a, addr, old_p, port);
+    *icmp_sum = sr_nat_adjust(*icmp_sum, 0, 0, old_ip_sum, in->ip_sum);
+    if (sum)
+    { *icmp_sum = sr_nat_adjust(*icmp_sum, 0, 0, old_sum, *sum); }
+} /* -- sr_nat_rewrite_error -- */
+
+/*-----------------------------------------------------------------------------
+ * Connection table
+ *---------------------------------------------------------------------------*/
+
+static __inline__ uint32_t sr_nat_timeout(const struct sr_nat_conn* c)
+{
+    switch (c->proto)
+    {
+        case ip_protocol_tcp:
+            if ((c->state & SR_NAT_RST) ||
+                (c->state & (SR_NAT_FIN_OUT | SR_NAT_FIN_IN)) ==
+                (SR_NAT_FIN_OUT | SR_NAT_FIN_IN) ||
+                !(c->state & SR_NAT_ANSWERED))
+            { return SR_NAT_TO_TCP_TRANS; }
+            return SR_NAT_TO_TCP_EST;
+        case ip_protocol_udp:
+            return SR_NAT_TO_UDP;
+        default:
+            return SR_NAT_TO_ICMP;
+    }
+} /* -- sr_nat_timeout -- */
+
+static __inline__ int sr_nat_match(const struct sr_nat_conn* c,
+                                   const struct sr_nat_key* k, int out)
+{
+    if (c->rem_ip != k->rem_ip || c->rem_port != k->rem_port ||
+        c->proto != k->proto)
+    { return 0; }
+    if (out)
+    { return c->in_ip == k->in_ip && c->in_port == k->in_port; }
+    return c->out_port == k->out_port;
+} /* -- sr_nat_match -- */
+
+/* -- index of the connection k names in t (out or in), or 0 -- */
+static uint32_t sr_nat_find(const struct sr_nat* nat,
+                            const struct sr_nat_table* t, uint32_t tag,
+                            const struct sr_nat_key* k, int out)
+{
+    const struct sr_nat_bucket* b;
+    uint32_t bi = tag & t->mask;
+    uint32_t alt = sr_nat_alt(t, bi, tag);
+    uint32_t idx;
+    int i, j;
+
+    __builtin_prefetch(&t->b[alt]);
+    for (j = 0; j < 2; j++)
+    {
+        b = &t->b[j ? alt : bi];
+        for (i = 0; i < SR_NAT_WAYS; i++)
+        {
+            idx = b->s[i].idx;
+            if (b->s[i].tag == tag && idx &&
+                sr_nat_match(&nat->conns[idx], k, out))
+            { return idx; }
+        }
+    }
+    return 0;
+} /* -- sr_nat_find -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_nat_get(..)
+ * Scope: Local
+ *
+ * Reader side of sr_nat_find(): copy the connection out, without the lock
+ * unless a writer keeps getting in the way.
+ *
+ *---------------------------------------------------------------------------*/
+
+static uint32_t sr_nat_get(struct sr_nat* nat, const struct sr_nat_table* t,
+                           uint32_t tag, const struct sr_nat_key* k, int out,
+                           struct sr_nat_conn* copy)
+{
+    uint32_t s, idx;
+    int tries;
+
+    for (tries = 0; tries < SR_NAT_RETRY; tries++)
+    {
+        s = __atomic_load_n(&nat->seq, __ATOMIC_ACQUIRE);
+        if (s & 1)
+        { continue; }
+        if ((idx = sr_nat_find(nat, t, tag, k, out)) != 0)
+        { *copy = nat->conns[idx]; }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&nat->seq, __ATOMIC_RELAXED) == s)
+        { return idx; }
+    }
+
+    pthread_mutex_lock(&nat->lock);
+    if ((idx = sr_nat_find(nat, t, tag, k, out)) != 0)
+    { *copy = nat->conns[idx]; }
+    pthread_mutex_unlock(&nat->lock);
+    return idx;
+} /* -- sr_nat_get -- */
+
+static __inline__ void sr_nat_write_begin(struct sr_nat* nat)
+{
+    __atomic_store_n(&nat->seq, nat->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+} /* -- sr_nat_write_begin -- */
+
+static __inline__ void sr_nat_write_end(struct sr_nat* nat)
+{
+    __atomic_store_n(&nat->seq, nat->seq + 1, __ATOMIC_RELEASE);
+} /* -- sr_nat_write_end -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_nat_place(..)
+ * Scope: Local
+ *
+ * Put connection idx into t under tag.  If both its buckets are full,
+ * search breadth first for a bucket with a free slot that entries can be
+ * moved along to, each to its other bucket, no bucket twice on the way.
+ * -1 if there is none within SR_NAT_BFS buckets.  Writers only.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_nat_place(struct sr_nat_table* t, uint32_t tag, uint32_t idx)
+{
+    struct
+    {
+        uint32_t b;
+        int parent;             /* node whose slot moves here, -1 for none */
+        int slot;               /* ... and which slot of it */
+    } q[SR_NAT_BFS];
+    struct sr_nat_bucket* b;
+    int head = 0, tail = 0, i = 0, n;
+
+    q[tail].b = tag & t->mask;
+    q[tail].parent = -1;
+    tail++;
+    q[tail].b = sr_nat_alt(t, q[0].b, tag);
+    q[tail].parent = -1;
+    tail++;
+
+    for (; head < tail; head++)
+    {
+        b = &t->b[q[head].b];
+        for (i = 0; i < SR_NAT_WAYS; i++)
+        {
+            if (b->s[i].idx == 0)
+            { break; }
+        }
+        if (i < SR_NAT_WAYS)
+        { break; }
+        for (i = 0; i < SR_NAT_WAYS && tail < SR_NAT_BFS; i++)
+        {
+            q[tail].b = sr_nat_alt(t, q[head].b, b->s[i].tag);
+            q[tail].parent = head;
+            q[tail].slot = i;
+
+            /* -- a path through a bucket twice would move stale slots -- */
+            for (n = head; n >= 0 && q[n].b != q[tail].b; n = q[n].parent)
+            { }
+            if (n < 0)
+            { tail++; }
+        }
+    }
+    if (head == tail)
+    { return -1; }
+
+    /* -- free slot i of node head; fill it from the parent, and so on -- */
+    for (n = head; q[n].parent >= 0; n = q[n].parent)
+    {
+        t->b[q[n].b].s[i] = t->b[q[q[n].parent].b].s[q[n].slot];
+        i = q[n].slot;
+        t->b[q[q[n].parent].b].s[i].idx = 0;
+    }
+    t->b[q[n].b].s[i].tag = tag;
+    t->b[q[n].b].s[i].idx = idx;
+    return 0;
+} /* -- sr_nat_place -- */
+
+static void sr_nat_unplace(struct sr_nat_table* t, uint32_t tag, uint32_t idx)
+{
+    uint32_t bi = tag & t->mask;
+    int i, j;
+
+    for (j = 0; j < 2; j++)
+    {
+        for (i = 0; i < SR_NAT_WAYS; i++)
+        {
+            if (t->b[bi].s[i].idx == idx)
+            {
+                t->b[bi].s[i].idx = 0;
+                return;
+            }
+        }
+        bi = sr_nat_alt(t, bi, tag);
+    }
+} /* -- sr_nat_unplace -- */
+
+static __inline__ void sr_nat_wheel_add(struct sr_nat* nat, uint32_t idx,
+                                        uint32_t when)
+{
+    uint32_t* head = &nat->wheel[when & (SR_NAT_WHEEL - 1)];
+
+    nat->conns[idx].next = *head;
+    *head = idx;
+} /* -- sr_nat_wheel_add -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_nat_new(..)
+ * Scope: Local
+ *
+ * Make the connection for key k (inside five tuple, hash tag): pick an
+ * outside port no connection to the same remote end has, preferring the
+ * inside port, and enter it in both tables.  Returns its index, 0 if
+ * the table is full.  Called with the lock held.
+ *
+ *---------------------------------------------------------------------------*/
+
+static uint32_t sr_nat_new(struct sr_nat* nat, struct sr_nat_key* k,
+                           uint32_t tag)
+{
+    const uint32_t range = SR_NAT_PORT_HI - SR_NAT_PORT_LO + 1;
+    struct sr_nat_conn* c;
+    uint32_t idx, tag_in = 0, port;
+    int i;
+
+    idx = nat->free ? nat->free : nat->used + 1;
+    if (idx > nat->nconns)
+    {
+        nat->stats.full++;
+        return 0;
+    }
+
+    port = ntohs(k->in_port);
+    for (i = 0; i < SR_NAT_TRIES; i++)
+    {
+        if (i > 0 || port < SR_NAT_PORT_LO)
+        { port = SR_NAT_PORT_LO + (tag + i * 7919U) % range; }
+        k->out_port = htons(port);
+        tag_in = sr_nat_hash_in(k);
+        if (sr_nat_find(nat, &nat->in, tag_in, k, 0) == 0)
+        { break; }
+    }
+    if (i == SR_NAT_TRIES)
+    {
+        nat->stats.full++;
+        return 0;
+    }
+
+    sr_nat_write_begin(nat);
+    c = &nat->conns[idx];
+    if (idx == nat->free)
+    { nat->free = c->next; }
+    else
+    { nat->used = idx; }
+    c->in_ip    = k->in_ip;
+    c->rem_ip   = k->rem_ip;
+    c->in_port  = k->in_port;
+    c->rem_port = k->rem_port;
+    c->out_port = k->out_port;
+    c->proto    = k->proto;
+    c->state    = 0;
+    c->last     = nat->now;
+
+    if (sr_nat_place(&nat->out, tag, idx) != 0)
+    { goto full; }
+    if (sr_nat_place(&nat->in, tag_in, idx) != 0)
+    {
+        sr_nat_unplace(&nat->out, tag, idx);
+        goto full;
+    }
+    sr_nat_write_end(nat);
+
+    sr_nat_wheel_add(nat, idx, nat->now + sr_nat_timeout(c));
+    nat->stats.created++;
+    nat->stats.conns++;
+    return idx;
+
+full:
+    c->next = nat->free;
+    nat->free = idx;
+    sr_nat_write_end(nat);
+    nat->stats.full++;
+    return 0;
+} /* -- sr_nat_new -- */
+
+/* -- a packet of connection idx went out or came in -- */
+static __inline__ void sr_nat_touch(struct sr_nat* nat, uint32_t idx,
+                                    const struct sr_nat_conn* c,
+                                    uint8_t flags, int out)
+{
+    struct sr_nat_conn* live = &nat->conns[idx];
+    uint32_t now = __atomic_load_n(&nat->now, __ATOMIC_RELAXED);
+    uint8_t set = 0;
+
+    /* -- don't dirty the line for nothing -- */
+    if (c->last != now)
+    { __atomic_store_n(&live->last, now, __ATOMIC_RELAXED); }
+    if (c->proto != ip_protocol_tcp)
+    { return; }
+
+    if (out && (flags & (SR_TCP_SYN | SR_TCP_ACK)) == SR_TCP_SYN &&
+        (c->state & (SR_NAT_RST | SR_NAT_FIN_OUT | SR_NAT_FIN_IN)))
+    {
+        /* -- the inside host is starting over on the same five tuple -- */
+        __atomic_store_n(&live->state, 0, __ATOMIC_RELAXED);
+        return;
+    }
+    if (flags & SR_TCP_RST)
+    { set |= SR_NAT_RST; }
+    if (flags & SR_TCP_FIN)
+    { set |= out ? SR_NAT_FIN_OUT : SR_NAT_FIN_IN; }
+    if (!out)
+    { set |= SR_NAT_ANSWERED; }
+    if (set & ~c->state)
+    { __atomic_or_fetch(&live->state, set, __ATOMIC_RELAXED); }
+} /* -- sr_nat_touch -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_nat_create(..)
+ * Scope: Global
+ *
+ * A NAT for outside address ip (network byte order) with room for nconns
+ * connections, its clock starting at now.  The tables are sized for at
+ * most 75% load and only take memory as they fill.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_nat_table_init(struct sr_nat_table* t, uint32_t nconns)
+{
+    uint32_t n = 1;
+
+    while (n * SR_NAT_WAYS * 3 < nconns * 4)
+    { n <<= 1; }
+
+    /* -- calloc, not posix_memalign + memset, so pages stay untouched -- */
+    if ((t->mem = calloc(n + 1, sizeof(struct sr_nat_bucket))) == 0)
+    { return -1; }
+    t->b = (struct sr_nat_bucket*)(((uintptr_t)t->mem + SR_CACHELINE - 1) &
+                                   ~(uintptr_t)(SR_CACHELINE - 1));
+    t->mask = n - 1;
+    return 0;
+} /* -- sr_nat_table_init -- */
+
+struct sr_nat* sr_nat_create(uint32_t ip, unsigned int nconns, uint32_t now)
+{
+    struct sr_nat* nat;
+
+    /* REQUIRES */
+    assert(nconns > 0 && nconns <= SR_NAT_MAX_CONNS);
+
+    if ((nat = (struct sr_nat*)calloc(1, sizeof(struct sr_nat))) == 0)
+    {
+        perror("calloc(..):sr_nat.c::sr_nat_create");
+        return 0;
+    }
+    nat->conns = (struct sr_nat_conn*)calloc(nconns + 1,
+                                             sizeof(struct sr_nat_conn));
+    if (nat->conns == 0 || sr_nat_table_init(&nat->out, nconns) != 0 ||
+        sr_nat_table_init(&nat->in, nconns) != 0)
+    {
+        perror("calloc(..):sr_nat.c::sr_nat_create");
+        sr_nat_free(nat);
+        return 0;
+    }
+
+    nat->ip      = ip;
+    nat->nconns  = nconns;
+    nat->now     = now;
+    nat->wheel_t = now;
+    pthread_mutex_init(&nat->lock, 0);
+
+    return nat;
+} /* -- sr_nat_create -- */
+
+void sr_nat_free(struct sr_nat* nat)
+{
+    if (nat == 0)
+    { return; }
+
+    free(nat->in.mem);
+    free(nat->out.mem);
+    free(nat->conns);
+    pthread_mutex_destroy(&nat->lock);
+    free(nat);
+} /* -- sr_nat_free -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_nat_error(..)
+ * Scope: Local
+ *
+ * Data path: translate ICMP error ip, going out or coming in, if the
+ * packet it quotes belongs to a live connection (RFC 5508 section 4).
+ * The connection isn't touched: errors neither refresh nor close it.
+ * 1 if translated, 0 if not.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_nat_error(struct sr_nat* nat, sr_ip_hdr_t* ip, unsigned int len,
+                        int out)
+{
+    const sr_ip_hdr_t* in;
+    struct sr_nat_key k;
+    struct sr_nat_conn c;
+    uint32_t tag, idx, now;
+
+    if (sr_nat_parse_error(ip, len, out, &k) != 0)
+    { return 0; }
+    in = (const sr_ip_hdr_t*)((uint8_t*)ip + ip->ip_hl * 4 + 8);
+    if (!out && in->ip_src != nat->ip)
+    { return 0; }
+
+    tag = out ? sr_nat_hash_out(&k) : sr_nat_hash_in(&k);
+    now = __atomic_load_n(&nat->now, __ATOMIC_RELAXED);
+    if ((idx = sr_nat_get(nat, out ? &nat->out : &nat->in, tag, &k, out,
+                          &c)) == 0 ||
+        (int32_t)(c.last + sr_nat_timeout(&c) - now) < 0)
+    {
+        __atomic_fetch_add(&nat->stats.unmatched, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    if (out)
+    { sr_nat_rewrite_error(ip, len, 1, nat->ip, c.out_port); }
+    else
+    { sr_nat_rewrite_error(ip, len, 0, c.in_ip, c.in_port); }
+    return 1;
+} /* -- sr_nat_error -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_nat_out(..)
+ * Scope: Global
+ *
+ * Data path: translate IPv4 packet ip (len bytes, header checked) leaving
+ * through the outside interface, making its connection if it's the first
+ * packet.  An ICMP error from an inside host is translated if it is
+ * about a connection, and never makes one.  0 if done, -1 if it can't be
+ * and should be dropped.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_nat_out(struct sr_nat* nat, sr_ip_hdr_t* ip, unsigned int len)
+{
+    struct sr_nat_key k;
+    struct sr_nat_conn c;
+    uint32_t tag, idx;
+    uint8_t flags;
+
+    /* REQUIRES */
+    assert(nat);
+    assert(ip);
+
+    if (sr_nat_parse(ip, len, 1, &k, &flags) != 0)
+    { return sr_nat_error(nat, ip, len, 1) ? 0 : -1; }
+
+    tag = sr_nat_hash_out(&k);
+    if ((idx = sr_nat_get(nat, &nat->out, tag, &k, 1, &c)) == 0)
+    {
+        pthread_mutex_lock(&nat->lock);
+        if ((idx = sr_nat_find(nat, &nat->out, tag, &k, 1)) == 0)
+        { idx = sr_nat_new(nat, &k, tag); }
+        if (idx)
+        { c = nat->conns[idx]; }
+        pthread_mutex_unlock(&nat->lock);
+        if (idx == 0)
+        { return -1; }
+    }
+
+    sr_nat_touch(nat, idx, &c, flags, 1);
+    sr_nat_rewrite(ip, 1, nat->ip, c.out_port);
+    return 0;
+} /* -- sr_nat_out -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_nat_in(..)
+ * Scope: Global
+ *
+ * Data path: if ip is a reply to a live connection, or an ICMP error about
+ * one, translate it back to the inside host and return 1.  0 leaves it as
+ * it was, for the router.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_nat_in(struct sr_nat* nat, sr_ip_hdr_t* ip, unsigned int len)
+{
+    struct sr_nat_key k;
+    struct sr_nat_conn c;
+    uint32_t tag, idx, now;
+    uint8_t flags;
+
+    /* REQUIRES */
+    assert(nat);
+    assert(ip);
+
+    if (ip->ip_dst != nat->ip)
+    { return 0; }
+    if (sr_nat_parse(ip, len, 0, &k, &flags) != 0)
+    { return sr_nat_error(nat, ip, len, 0); }
+
+    tag = sr_nat_hash_in(&k);
+    now = __atomic_load_n(&nat->now, __ATOMIC_RELAXED);
+    if ((idx = sr_nat_get(nat, &nat->in, tag, &k, 0, &c)) == 0 ||
+        (int32_t)(c.last + sr_nat_timeout(&c) - now) < 0)
+    {
+        __atomic_fetch_add(&nat->stats.unmatched, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    sr_nat_touch(nat, idx, &c, flags, 0);
+    sr_nat_rewrite(ip, 0, c.in_ip, c.in_port);
+    return 1;
+} /* -- sr_nat_in -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_nat_tick(..)
+ * Scope: Global
+ *
+ * Set the clock to now (seconds) and run the timer wheel up to it.  Each
+ * connection in a slot that's come around is either idle for longer than
+ * its timeout, and goes, or back on the wheel for when it will be.
+ * Returns the number that went.
+ *
+ *---------------------------------------------------------------------------*/
+
+unsigned int sr_nat_tick(struct sr_nat* nat, uint32_t now)
+{
+    struct sr_nat_conn* c;
+    struct sr_nat_key k;
+    uint32_t idx, next, when, steps;
+    unsigned int n = 0;
+
+    /* REQUIRES */
+    assert(nat);
+
+    pthread_mutex_lock(&nat->lock);
+    __atomic_store_n(&nat->now, now, __ATOMIC_RELAXED);
+
+    steps = (int32_t)(now - nat->wheel_t) > 0 ? now - nat->wheel_t : 0;
+    if (steps > SR_NAT_WHEEL)
+    {
+        nat->wheel_t = now - SR_NAT_WHEEL;
+        steps = SR_NAT_WHEEL;
+    }
+
+    while (steps--)
+    {
+        nat->wheel_t++;
+        idx = nat->wheel[nat->wheel_t & (SR_NAT_WHEEL - 1)];
+        nat->wheel[nat->wheel_t & (SR_NAT_WHEEL - 1)] = 0;
+
+        for (; idx; idx = next)
+        {
+            c = &nat->conns[idx];
+            next = c->next;
+            when = __atomic_load_n(&c->last, __ATOMIC_RELAXED) +
+                   sr_nat_timeout(c);
+            if ((int32_t)(when - now) > 0)
+            {
+                sr_nat_wheel_add(nat, idx, when);
+                continue;
+            }
+
+            k.in_ip    = c->in_ip;
+            k.rem_ip   = c->rem_ip;
+            k.in_port  = c->in_port;
+            k.rem_port = c->rem_port;
+            k.out_port = c->out_port;
+            k.proto    = c->proto;
+
+            sr_nat_write_begin(nat);
+            sr_nat_unplace(&nat->out, sr_nat_hash_out(&k), idx);
+            sr_nat_unplace(&nat->in, sr_nat_hash_in(&k), idx);
+            c->next = nat->free;
+            nat->free = idx;
+            sr_nat_write_end(nat);
+            n++;
+        }
+    }
+
+    nat->stats.expired += n;
+    nat->stats.conns   -= n;
+    pthread_mutex_unlock(&nat->lock);
+
+    return n;
+} /* -- sr_nat_tick -- */
+
+void sr_nat_stats(struct sr_nat* nat, struct sr_nat_stats* st)
+{
+    /* REQUIRES */
+    assert(nat);
+    assert(st);
+
+    pthread_mutex_lock(&nat->lock);
+    *st = nat->stats;
+    st->unmatched = __atomic_load_n(&nat->stats.unmatched, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&nat->lock);
+} /* -- sr_nat_stats -- */
+
+/*-----------------------------------------------------------------------------
+ * Router
+ *---------------------------------------------------------------------------*/
+
+static uint32_t sr_nat_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+} /* -- sr_nat_clock -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_nat_attach(..)
+ * Scope: Global
+ *
+ * Translate out of the interface named by spec, "iface[:conns]".  Call
+ * once the interfaces are known.  Returns -1 if there's no such
+ * interface or the number doesn't parse.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_nat_attach(struct sr_instance* sr, const char* spec)
+{
+    char name[sr_IFACE_NAMELEN];
+    struct sr_if* if_walker;
+    unsigned long n = SR_NAT_DEFAULT_CONNS;
+    const char* colon;
+    char* end;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(spec);
+
+    if ((colon = strchr(spec, ':')) != 0)
+    {
+        n = strtoul(colon + 1, &end, 10);
+        if (*end || n == 0 || n > SR_NAT_MAX_CONNS)
+        {
+            fprintf(stderr, "NAT: connections must be 1 to %d\n",
+                    SR_NAT_MAX_CONNS);
+            return -1;
+        }
+    }
+    else
+    { colon = spec + strlen(spec); }
+    if (colon - spec >= sr_IFACE_NAMELEN)
+    {
+        fprintf(stderr, "NAT: no interface %s\n", spec);
+        return -1;
+    }
+    memcpy(name, spec, colon - spec);
+    name[colon - spec] = 0;
+
+    for (if_walker = sr->if_list; if_walker; if_walker = if_walker->next)
+    {
+        if (strncmp(if_walker->name, name, sr_IFACE_NAMELEN) == 0)
+        { break; }
+    }
+    if (if_walker == 0)
+    {
+        fprintf(stderr, "NAT: no interface %s\n", name);
+        return -1;
+    }
+
+    if ((sr->nat = sr_nat_create(if_walker->ip, n, sr_nat_clock())) == 0)
+    { return -1; }
+    sr->nat_ifid = if_walker->id;
+
+    return 0;
+} /* -- sr_nat_attach -- */
+
+/* -- once a second, from the housekeeping thread -- */
+void sr_nat_sweep(struct sr_instance* sr)
+{
+    if (sr->nat)
+    { sr_nat_tick(sr->nat, sr_nat_clock()); }
+} /* -- sr_nat_sweep -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_nat_detach(..)
+ * Scope: Global
+ *
+ * Report the counters at exit and free the table.  Call once the
+ * forwarding threads and the housekeeping thread that runs the wheel have
+ * stopped.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_nat_detach(struct sr_instance* sr)
+{
+    struct sr_nat_stats st;
+
+    if (sr->nat == 0)
+    { return; }
+
+    sr_nat_stats(sr->nat, &st);
+    fprintf(stderr, "nat: %lu connections, %lu made, %lu expired, "
+            "%lu turned away, %lu unmatched replies\n",
+            st.conns, st.created, st.expired, st.full, st.unmatched);
+
+    sr_nat_free(sr->nat);
+    sr->nat = 0;
+} /* -- sr_nat_detach -- */
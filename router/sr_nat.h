@@ -0,0 +1,94 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_nat.h
+ *
+ * Description:
+ *
+ * Network address and port translation behind "-N iface[:conns]".  Traffic
+ * forwarded out of the outside interface iface leaves with that
+ * interface's address as its source and a port picked by the router;
+ * replies to that address and port are translated back and forwarded to
+ * the inside host.  TCP, UDP and ICMP echo (the identifier standing in
+ * for the port) are translated; anything else that would leave through
+ * the outside interface is dropped, as are non-first fragments.
+ *
+ * ICMP errors (destination unreachable, time exceeded, parameter problem)
+ * about a connection are translated both ways, RFC 5508 style: the
+ * error's own address and the address and port in the header it quotes
+ * are rewritten, with their checksums.  An error neither makes nor
+ * refreshes a connection.
+ *
+ * A connection is the full five tuple, so an outside port is only unique
+ * per remote address and port and one outside address carries far more
+ * than 64k connections (address and port dependent mapping, RFC 4787).
+ *
+ * The connection table is two bucketized cuckoo hash tables, one keyed
+ * on the inside five tuple and one on the outside port and remote end.
+ * A bucket is one cache line of 8 (tag, index) slots, and an entry lives
+ * in one of two buckets, so a lookup touches at most two lines of table
+ * and then the connection.  Lookups take no lock: the table is guarded by
+ * a sequence count that readers check, and only new connections and
+ * expiry take the mutex.
+ *
+ * Connections expire lazily.  Packets only stamp the connection with the
+ * NAT's clock; a timer wheel holds every connection in the slot for the
+ * time it would have expired when last looked at, and one still in use
+ * when its slot comes around is simply put back further on.  The clock
+ * and the wheel are driven by sr_nat_tick(), once a second.
+ *
+ * Addresses and checksums are rewritten in place, the IPv4 header and
+ * L4 checksums adjusted incrementally (RFC 1624) for address and port in
+ * one go.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_NAT_H
+#define SR_NAT_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include "sr_protocol.h"
+
+#define SR_NAT_DEFAULT_CONNS (1 << 20)
+#define SR_NAT_MAX_CONNS     (1 << 24)
+
+#define SR_NAT_PORT_LO 1024             /* outside ports handed out */
+#define SR_NAT_PORT_HI 65535
+
+/* -- idle timeouts, seconds -- */
+#define SR_NAT_TO_TCP_EST   7440        /* RFC 5382 REQ-5 */
+#define SR_NAT_TO_TCP_TRANS 240         /* not yet answered, or closing */
+#define SR_NAT_TO_UDP       300         /* RFC 4787 REQ-5 */
+#define SR_NAT_TO_ICMP      60          /* RFC 5508 REQ-1 */
+
+struct sr_nat_stats
+{
+    unsigned long conns;        /* in the table now */
+    unsigned long created;
+    unsigned long expired;
+    unsigned long full;         /* new connections turned away */
+    unsigned long unmatched;    /* replies, errors no connection was found for */
+};
+
+struct sr_nat;
+struct sr_instance;
+
+/* -- the translator on its own; ip is the outside address -- */
+struct sr_nat* sr_nat_create(uint32_t ip, unsigned int nconns, uint32_t now);
+void sr_nat_free(struct sr_nat* );
+int  sr_nat_out(struct sr_nat* , sr_ip_hdr_t* ip, unsigned int len);
+int  sr_nat_in(struct sr_nat* , sr_ip_hdr_t* ip, unsigned int len);
+unsigned int sr_nat_tick(struct sr_nat* , uint32_t now);
+void sr_nat_stats(struct sr_nat* , struct sr_nat_stats* );
+
+/* -- the router's, on interface sr->nat_ifid -- */
+int  sr_nat_attach(struct sr_instance* , const char* spec);
+void sr_nat_sweep(struct sr_instance* );
+void sr_nat_detach(struct sr_instance* );
+
+#endif /* -- SR_NAT_H -- */
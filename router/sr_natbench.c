@@ -0,0 +1,420 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_natbench.c
+ *
+ * Description:
+ *
+ * Benchmark for the NAT connection table (sr_nat.h).  Opens a number of
+ * TCP and UDP connections from random inside hosts to a few hundred
+ * outside servers, then translates random packets of them outbound and
+ * the replies inbound, then ICMP errors about them both ways, and finally
+ * lets them all time out.  Reports new connections per second, the
+ * steady state rates both ways and the time the timer wheel takes to
+ * reap the lot.
+ *
+ * Every translation is checked: the outside port must be the one the
+ * connection got, replies must come back to the inside end, and one
+ * packet in BENCH_CHECK carries real checksums, which must still verify.
+ * Errors always carry real checksums, their own and the quoted packet's.
+ *
+ * Usage:
+ *
+ *   $ ./sr_natbench -n 1000000 -p 4000000
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#ifdef _LINUX_
+#include <getopt.h>
+#endif /* _LINUX_ */
+
+#include "sr_nat.h"
+
+extern char* optarg;
+
+#define DEFAULT_FLOWS   1000000
+#define DEFAULT_PACKETS 4000000
+#define BENCH_SERVERS   256
+#define BENCH_CHECK     1024            /* one packet in this many verified */
+#define BENCH_OUTSIDE   0xc6336401U     /* 198.51.100.1 */
+#define BENCH_HOP       0xc63364feU     /* 198.51.100.254, a router outside */
+#define BENCH_ERRORS    16              /* one error per this many packets */
+#define BENCH_START     1000            /* NAT clock, seconds */
+
+struct bench_flow
+{
+    uint32_t in_ip, rem_ip;             /* network byte order */
+    uint16_t in_port, rem_port, out_port;
+    uint8_t  proto;
+};
+
+static const uint16_t bench_ports[] = { 53, 80, 123, 443, 993, 8080 };
+
+static uint32_t bench_state;
+
+static void usage(char* );
+
+/* -- xorshift, so runs with the same seed see the same flows -- */
+static uint32_t bench_rand(void)
+{
+    bench_state ^= bench_state << 13;
+    bench_state ^= bench_state >> 17;
+    bench_state ^= bench_state << 5;
+    return bench_state;
+} /* -- bench_rand -- */
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+} /* -- bench_now -- */
+
+/* -- one's complement sum of big endian words, not folded -- */
+static uint32_t bench_sum(uint32_t s, const void* data, int len)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    int i;
+
+    for (i = 0; i + 1 < len; i += 2)
+    { s += p[i] << 8 | p[i + 1]; }
+    if (len & 1)
+    { s += p[len - 1] << 8; }
+    return s;
+} /* -- bench_sum -- */
+
+static uint16_t bench_fold(uint32_t s)
+{
+    s = (s & 0xffff) + (s >> 16);
+    s = (s & 0xffff) + (s >> 16);
+    return ~s & 0xffff;
+} /* -- bench_fold -- */
+
+/* -- L4 checksum with the pseudo header; 0 if the packet's verifies -- */
+static uint16_t bench_l4_sum(const sr_ip_hdr_t* ip)
+{
+    const uint8_t* l4 = (const uint8_t*)(ip + 1);
+    int l4len = ntohs(ip->ip_len) - sizeof(sr_ip_hdr_t);
+    uint32_t s = 0;
+
+    s = bench_sum(s, &ip->ip_src, 4);
+    s = bench_sum(s, &ip->ip_dst, 4);
+    s += ip->ip_p + l4len;
+    return bench_fold(bench_sum(s, l4, l4len));
+} /* -- bench_l4_sum -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: bench_packet(..)
+ * Scope: Local
+ *
+ * Build the packet of flow f going out, or its reply coming in to the
+ * outside address, into buf.  Checksums are only real if check is set;
+ * translation doesn't care either way.
+ *
+ *---------------------------------------------------------------------------*/
+
+static sr_ip_hdr_t* bench_packet(uint8_t* buf, const struct bench_flow* f,
+                                 int out, int check)
+{
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)buf;
+    uint8_t* l4 = buf + sizeof(sr_ip_hdr_t);
+    uint16_t* ports = (uint16_t*)l4;
+    int l4len = f->proto == ip_protocol_tcp ? 20 : 8;
+    uint16_t* sum = (uint16_t*)(l4 + (f->proto == ip_protocol_tcp ? 16 : 6));
+
+    memset(buf, 0, sizeof(sr_ip_hdr_t) + l4len);
+    ip->ip_v   = 4;
+    ip->ip_hl  = 5;
+    ip->ip_len = htons(sizeof(sr_ip_hdr_t) + l4len);
+    ip->ip_ttl = 64;
+    ip->ip_p   = f->proto;
+    if (out)
+    {
+        ip->ip_src = f->in_ip;
+        ip->ip_dst = f->rem_ip;
+        ports[0]   = f->in_port;
+        ports[1]   = f->rem_port;
+    }
+    else
+    {
+        ip->ip_src = f->rem_ip;
+        ip->ip_dst = htonl(BENCH_OUTSIDE);
+        ports[0]   = f->rem_port;
+        ports[1]   = f->out_port;
+    }
+    if (f->proto == ip_protocol_tcp)
+    {
+        l4[12] = 5 << 4;
+        l4[13] = 0x10;                  /* ACK */
+    }
+    else
+    { ports[2] = htons(l4len); }
+
+    if (check)
+    {
+        ip->ip_sum = htons(bench_fold(bench_sum(0, ip, sizeof(sr_ip_hdr_t))));
+        *sum = htons(bench_l4_sum(ip));
+        if (*sum == 0 && f->proto == ip_protocol_udp)
+        { *sum = 0xffff; }
+    }
+    return ip;
+} /* -- bench_packet -- */
+
+/* -- 0 if both checksums of ip verify -- */
+static int bench_verify(const sr_ip_hdr_t* ip)
+{
+    return bench_fold(bench_sum(0, ip, sizeof(sr_ip_hdr_t))) != 0 ||
+           bench_l4_sum(ip) != 0;
+} /* -- bench_verify -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: bench_error(..)
+ * Scope: Local
+ *
+ * Build into buf an ICMP error quoting the first qlen bytes of packet q:
+ * port unreachable from the inside host going out, or time exceeded
+ * from a router outside coming in to the outside address.
+ *
+ *---------------------------------------------------------------------------*/
+
+static sr_ip_hdr_t* bench_error(uint8_t* buf, const sr_ip_hdr_t* q, int qlen,
+                                const struct bench_flow* f, int out)
+{
+    sr_ip_hdr_t* ip = (sr_ip_hdr_t*)buf;
+    uint8_t* icmp = buf + sizeof(sr_ip_hdr_t);
+    int len = sizeof(sr_ip_hdr_t) + 8 + qlen;
+
+    memset(buf, 0, sizeof(sr_ip_hdr_t) + 8);
+    memcpy(icmp + 8, q, qlen);
+    ip->ip_v   = 4;
+    ip->ip_hl  = 5;
+    ip->ip_len = htons(len);
+    ip->ip_ttl = 64;
+    ip->ip_p   = ip_protocol_icmp;
+    ip->ip_src = out ? f->in_ip : htonl(BENCH_HOP);
+    ip->ip_dst = out ? f->rem_ip : htonl(BENCH_OUTSIDE);
+    icmp[0]    = out ? 3 : 11;
+    icmp[1]    = out ? 3 : 0;
+
+    ip->ip_sum = htons(bench_fold(bench_sum(0, ip, sizeof(sr_ip_hdr_t))));
+    *(uint16_t*)(icmp + 2) = htons(bench_fold(bench_sum(0, icmp, len -
+                                                       sizeof(sr_ip_hdr_t))));
+    return ip;
+} /* -- bench_error -- */
+
+/* -- 0 if the checksums of error ip and of what it quotes verify -- */
+static int bench_verify_error(const sr_ip_hdr_t* ip, int len, int whole)
+{
+    const sr_ip_hdr_t* q = (const sr_ip_hdr_t*)((const uint8_t*)(ip + 1) + 8);
+
+    return bench_fold(bench_sum(0, ip, sizeof(sr_ip_hdr_t))) != 0 ||
+           bench_fold(bench_sum(0, ip + 1, len - sizeof(sr_ip_hdr_t))) != 0 ||
+           bench_fold(bench_sum(0, q, sizeof(sr_ip_hdr_t))) != 0 ||
+           (whole && bench_l4_sum(q) != 0);
+} /* -- bench_verify_error -- */
+
+static void bench_flow(struct bench_flow* f)
+{
+    f->in_ip    = htonl(0x0a000000U | (bench_rand() & 0xffffff));
+    f->rem_ip   = htonl(0xcb007100U + bench_rand() % BENCH_SERVERS);
+    f->in_port  = htons(1024 + bench_rand() % 64000);
+    f->rem_port = htons(bench_ports[bench_rand() % (sizeof(bench_ports) /
+                                                   sizeof(bench_ports[0]))]);
+    f->out_port = 0;
+    f->proto    = (bench_rand() & 1) ? ip_protocol_tcp : ip_protocol_udp;
+} /* -- bench_flow -- */
+
+static void bench_report(const char* what, unsigned long n, double t)
+{
+    printf("%-8s %10lu %10.1f %10.3f\n", what, n, t * 1e3, n / t / 1e6);
+} /* -- bench_report -- */
+
+int main(int argc, char** argv)
+{
+    struct sr_nat* nat;
+    struct sr_nat_stats st;
+    struct bench_flow* flows;
+    struct bench_flow* f;
+    sr_ip_hdr_t* ip;
+    sr_ip_hdr_t* q;
+    uint8_t buf[128], qbuf[64];
+    uint16_t* qports;
+    int out, qlen;
+    unsigned int nconns = SR_NAT_DEFAULT_CONNS;
+    unsigned long nflows = DEFAULT_FLOWS, npkts = DEFAULT_PACKETS;
+    unsigned long i, made = 0, bad = 0, expired;
+    double t0, t;
+    int c;
+
+    bench_state = 0x2545f491;
+
+    while ((c = getopt(argc, argv, "hc:n:p:s:")) != EOF)
+    {
+        switch (c)
+        {
+            case 'c':
+                nconns = strtoul(optarg, 0, 10);
+                break;
+            case 'n':
+                nflows = strtoul(optarg, 0, 10);
+                break;
+            case 'p':
+                npkts = strtoul(optarg, 0, 10);
+                break;
+            case 's':
+                bench_state = strtoul(optarg, 0, 0) | 1;
+                break;
+            case 'h':
+            default:
+                usage(argv[0]);
+                exit(c == 'h' ? 0 : 1);
+        }
+    }
+    if (nconns == 0 || nconns > SR_NAT_MAX_CONNS || nflows == 0 || npkts == 0)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+
+    flows = (struct bench_flow*)calloc(nflows, sizeof(struct bench_flow));
+    nat = sr_nat_create(htonl(BENCH_OUTSIDE), nconns, BENCH_START);
+    if (flows == 0 || nat == 0)
+    {
+        perror("calloc(..):sr_natbench.c::main");
+        exit(1);
+    }
+    for (i = 0; i < nflows; i++)
+    { bench_flow(&flows[i]); }
+
+    printf("%-8s %10s %10s %10s\n", "", "packets", "ms", "M/s");
+
+    /* -- first packets: one new connection each -- */
+    t0 = bench_now();
+    for (i = 0; i < nflows; i++)
+    {
+        f = &flows[i];
+        ip = bench_packet(buf, f, 1, 0);
+        if (sr_nat_out(nat, ip, sizeof(buf)) == 0)
+        {
+            f->out_port = ((uint16_t*)(ip + 1))[0];
+            made++;
+        }
+    }
+    bench_report("new", nflows, bench_now() - t0);
+
+    /* -- steady state out, and back in -- */
+    t0 = bench_now();
+    for (i = 0; i < npkts; i++)
+    {
+        f = &flows[bench_rand() % nflows];
+        if (f->out_port == 0)
+        { continue; }
+        ip = bench_packet(buf, f, 1, i % BENCH_CHECK == 0);
+        if (sr_nat_out(nat, ip, sizeof(buf)) != 0 ||
+            ((uint16_t*)(ip + 1))[0] != f->out_port ||
+            ip->ip_src != htonl(BENCH_OUTSIDE) ||
+            (i % BENCH_CHECK == 0 && bench_verify(ip)))
+        { bad++; }
+    }
+    bench_report("out", npkts, bench_now() - t0);
+
+    t0 = bench_now();
+    for (i = 0; i < npkts; i++)
+    {
+        f = &flows[bench_rand() % nflows];
+        if (f->out_port == 0)
+        { continue; }
+        ip = bench_packet(buf, f, 0, i % BENCH_CHECK == 0);
+        if (sr_nat_in(nat, ip, sizeof(buf)) != 1 ||
+            ((uint16_t*)(ip + 1))[1] != f->in_port ||
+            ip->ip_dst != f->in_ip ||
+            (i % BENCH_CHECK == 0 && bench_verify(ip)))
+        { bad++; }
+    }
+    bench_report("in", npkts, bench_now() - t0);
+
+    /* -- errors about them, each after the packet it quotes went through;
+          every other TCP one quotes just the 8 bytes RFC 792 asks for -- */
+    t0 = bench_now();
+    for (i = 0; i < npkts / BENCH_ERRORS; i++)
+    {
+        f = &flows[bench_rand() % nflows];
+        if (f->out_port == 0)
+        { continue; }
+        out = i & 1;
+        q = bench_packet(qbuf, f, !out, 1);
+        if (out ? sr_nat_in(nat, q, sizeof(qbuf)) != 1
+                : sr_nat_out(nat, q, sizeof(qbuf)) != 0)
+        {
+            bad++;
+            continue;
+        }
+        qlen = ntohs(q->ip_len);
+        if (f->proto == ip_protocol_tcp && (i & 2))
+        { qlen = sizeof(sr_ip_hdr_t) + 8; }
+
+        ip = bench_error(buf, q, qlen, f, out);
+        q = (sr_ip_hdr_t*)((uint8_t*)(ip + 1) + 8);
+        qports = (uint16_t*)(q + 1);
+        if (out)
+        {
+            if (sr_nat_out(nat, ip, ntohs(ip->ip_len)) != 0 ||
+                ip->ip_src != htonl(BENCH_OUTSIDE) ||
+                q->ip_dst != htonl(BENCH_OUTSIDE) || qports[1] != f->out_port)
+            { bad++; }
+        }
+        else
+        {
+            if (sr_nat_in(nat, ip, ntohs(ip->ip_len)) != 1 ||
+                ip->ip_dst != f->in_ip ||
+                q->ip_src != f->in_ip || qports[0] != f->in_port)
+            { bad++; }
+        }
+        if (bench_verify_error(ip, ntohs(ip->ip_len), qlen == ntohs(q->ip_len)))
+        { bad++; }
+    }
+    bench_report("errors", npkts / BENCH_ERRORS, bench_now() - t0);
+
+    /* -- everything idle long enough, answered TCP included -- */
+    t0 = bench_now();
+    expired = sr_nat_tick(nat, BENCH_START + SR_NAT_TO_TCP_EST + 1);
+    t = bench_now() - t0;
+    bench_report("expire", expired, t);
+
+    sr_nat_stats(nat, &st);
+    printf("%lu of %lu connections made, %lu turned away, %lu left\n",
+           made, nflows, st.full, st.conns);
+    sr_nat_free(nat);
+    free(flows);
+
+    if (bad || expired != made || st.conns != 0)
+    {
+        fprintf(stderr, "%lu packets translated wrong, %lu of %lu expired\n",
+                bad, expired, made);
+        return 1;
+    }
+    return 0;
+} /* -- main -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: usage(..)
+ * Scope: Local
+ *---------------------------------------------------------------------------*/
+
+static void usage(char* argv0)
+{
+    printf("NAT connection table benchmark\n");
+    printf("Format: %s [-h] [-c conns] [-n flows] [-p packets] [-s seed]\n",
+           argv0);
+    printf("   -c  table size (default %d, at most %d)\n",
+           SR_NAT_DEFAULT_CONNS, SR_NAT_MAX_CONNS);
+    printf("   -n  connections opened (default %d)\n", DEFAULT_FLOWS);
+    printf("   -p  packets translated each way (default %d)\n",
+           DEFAULT_PACKETS);
+    printf("   -s  random seed\n");
+} /* -- usage -- */
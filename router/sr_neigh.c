@@ -0,0 +1,653 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_neigh.c
+ *
+ * Description:
+ *
+ * Per-thread neighbor replicas, see sr_neigh.h.
+ *
+ * A replica is a sequence locked copy of the master entries: the writer
+ * makes seq odd, copies, bumps gen and makes seq even again; a reader
+ * retries if seq was odd or changed under it.  All writers hold
+ * cache.lock, so there is only ever one.
+ *
+ * A context's pending list has a mutex, but the owner takes it only on an
+ * ARP miss or once after each publication, and the only other user is
+ * the once a second sweep.  To keep a flow in order the owner never sends
+ * a packet past a publication it hasn't yet checked its pending list
+ * against; seen is only advanced once the packets it released are out.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "sr_neigh.h"
+#include "sr_mbuf.h"
+#include "sr_icmp.h"
+#include "sr_event.h"
+#include "sr_flow.h"
+#include "sr_log.h"
+#include "sr_ring.h"
+#include "sr_worker.h"
+#include "sr_router.h"
+#include "sr_arpcache.h"
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sr_rt.h"
+#include "sr_if.h"
+
+#define SR_NEIGH_MAX (SR_MAX_WORKERS + 1)   /* receive loop + workers */
+#define SR_NEIGH_REQS 64        /* unresolved next hops per context */
+#define SR_NEIGH_QLEN 128       /* packets queued per next hop */
+
+struct sr_neigh_entry
+{
+    uint32_t ip;                /* network byte order */
+    unsigned char mac[ETHER_ADDR_LEN];
+    uint16_t valid;
+};
+
+/* -- a next hop being resolved and the packets waiting for it -- */
+struct sr_neigh_req
+{
+    uint32_t ip;                /* network byte order */
+    time_t sent;
+    uint32_t times_sent;
+    unsigned int qlen;
+    struct sr_mbuf* head;       /* oldest first, ifid set */
+    struct sr_mbuf* tail;
+    struct sr_neigh_req* next;
+};
+
+struct sr_neigh_ctx
+{
+    /* -- replica, written by sr_neigh_publish() only -- */
+    uint32_t seq;               /* odd while a copy is in progress */
+    uint32_t gen;               /* number of publications */
+    struct sr_neigh_entry e[SR_ARPCACHE_SZ];
+
+    /* -- pending packets -- */
+    pthread_mutex_t lock;
+    struct sr_neigh_req* reqs;
+    struct sr_neigh_req* free_reqs;
+    uint32_t seen;              /* gen reqs were last checked against */
+    struct sr_neigh_req req[SR_NEIGH_REQS];
+} __attribute__ ((aligned (SR_CACHELINE))) ;
+
+struct sr_neigh
+{
+    int n;                      /* grows only, under cache.lock */
+    struct sr_neigh_ctx* ctx[SR_NEIGH_MAX];
+};
+
+static __thread struct sr_neigh_ctx* sr_neigh_self;
+
+/* -- threads that never bound a context share the first one -- */
+static __inline__ struct sr_neigh_ctx* sr_neigh_ctx(struct sr_instance* sr)
+{
+    return sr_neigh_self ? sr_neigh_self : sr->neigh->ctx[0];
+}
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_neigh_copy(..)
+ * Scope: Local
+ *
+ * Writer side: copy the master table into one replica.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_neigh_copy(struct sr_neigh_ctx* c, struct sr_arpcache* cache)
+{
+    uint32_t seq = c->seq;
+    int i;
+
+    __atomic_store_n(&c->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (i = 0; i < SR_ARPCACHE_SZ; i++)
+    {
+        c->e[i].ip    = cache->entries[i].ip;
+        c->e[i].valid = cache->entries[i].valid != 0;
+        memcpy(c->e[i].mac, cache->entries[i].mac, ETHER_ADDR_LEN);
+    }
+    __atomic_store_n(&c->gen, c->gen + 1, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&c->seq, seq + 2, __ATOMIC_RELEASE);
+} /* -- sr_neigh_copy -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_neigh_find(..)
+ * Scope: Local
+ *
+ * Reader side: look ip up in replica c.  Like sr_arpcache_lookup() the
+ * last valid match wins.  Also returns the replica's gen as of the lookup.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_neigh_find(struct sr_neigh_ctx* c, uint32_t ip,
+                         unsigned char* mac, uint32_t* gen)
+{
+    uint32_t seq;
+    unsigned int spins = 0;
+    int i, found;
+
+    while (1)
+    {
+        seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            sr_ring_relax(++spins);
+            continue;
+        }
+
+        found = -1;
+        for (i = 0; i < SR_ARPCACHE_SZ; i++)
+        {
+            if (c->e[i].valid && c->e[i].ip == ip)
+            { found = i; }
+        }
+        if (found >= 0)
+        { memcpy(mac, c->e[found].mac, ETHER_ADDR_LEN); }
+        *gen = c->gen;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&c->seq, __ATOMIC_RELAXED) == seq)
+        { return found >= 0; }
+    }
+} /* -- sr_neigh_find -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_neigh_fill(..)
+ * Scope: Local
+ *
+ * Fill in the Ethernet addresses.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_neigh_fill(uint8_t* packet, const unsigned char* mac,
+                          const struct sr_if* iface)
+{
+    sr_ethernet_hdr_t* e_hdr = (sr_ethernet_hdr_t*)packet;
+
+    memcpy(e_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN);
+    memcpy(e_hdr->ether_dhost, mac, ETHER_ADDR_LEN);
+} /* -- sr_neigh_fill -- */
+
+/* -- drop whatever is still queued on req and put it back on the free list -- */
+static void sr_neigh_free_req(struct sr_neigh_ctx* c, struct sr_neigh_req* req)
+{
+    struct sr_mbuf *m, *nxt;
+
+    for (m = req->head; m; m = nxt)
+    {
+        nxt = m->next;
+        sr_mbuf_free(m);
+    }
+    req->next = c->free_reqs;
+    c->free_reqs = req;
+} /* -- sr_neigh_free_req -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_neigh_resolve(..)
+ * Scope: Local
+ *
+ * With c->lock held: send the pending packets whose neighbor has turned up
+ * in c's replica, oldest first.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_neigh_resolve(struct sr_instance* sr, struct sr_neigh_ctx* c)
+{
+    struct sr_neigh_req *req, **prev;
+    struct sr_mbuf *m, *nxt;
+    struct sr_if* iface;
+    unsigned char mac[ETHER_ADDR_LEN];
+    uint32_t gen, g;
+
+    gen = __atomic_load_n(&c->gen, __ATOMIC_ACQUIRE);
+
+    prev = &c->reqs;
+    while ((req = *prev) != 0)
+    {
+        if (!sr_neigh_find(c, req->ip, mac, &g))
+        {
+            prev = &req->next;
+            continue;
+        }
+        for (m = req->head; m; m = nxt)
+        {
+            nxt = m->next;
+            iface = sr_get_interface_id(sr, m->ifid);
+            sr_neigh_fill(sr_mbuf_data(m), mac, iface);
+            sr_send_mbuf(sr, m, iface);
+        }
+        req->head = 0;
+        *prev = req->next;
+        sr_neigh_free_req(c, req);
+    }
+
+    __atomic_store_n(&c->seen, gen, __ATOMIC_RELEASE);
+} /* -- sr_neigh_resolve -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_neigh_arpreq(..)
+ * Scope: Local
+ *
+ * With c->lock held: service a pending list entry.  (Re)send the ARP
+ * request at most once a second; after five tries send ICMP host
+ * unreachables for the waiting packets.  Returns 1 if req is done, or has
+ * no packets waiting at all, and should be unlinked and freed.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_neigh_arpreq(struct sr_instance* sr, struct sr_neigh_req* req)
+{
+    time_t now = time(0);
+    unsigned int len;
+    uint8_t* buf;
+    struct sr_if* if_to_send;
+    struct sr_rt* rt_match;
+    struct sr_mbuf *pkt, *m;
+    sr_ethernet_hdr_t* eth_hdr;
+    sr_ip_hdr_t* ip_hdr;
+    sr_arp_hdr_t* arp_req;
+
+    /* -- nothing waiting, nothing to ask for -- */
+    if (req->head == 0)
+    { return 1; }
+
+    if (difftime(now, req->sent) < 1.0)
+    { return 0; }
+
+    if_to_send = sr_get_interface_id(sr, req->head->ifid);
+
+    if (req->times_sent >= 5)
+    {
+        for (pkt = req->head; pkt; pkt = pkt->next)
+        {
+            ip_hdr = (sr_ip_hdr_t*)(sr_mbuf_data(pkt) +
+                                    sizeof(sr_ethernet_hdr_t));
+            rt_match = sr_get_longest_rt_table_match(sr->routing_table,
+                                                     ip_hdr->ip_src);
+            if (rt_match &&
+                sr_icmp_send_error(sr, SR_ICMP_HOST_UNREACH,
+                                   sr_mbuf_data(pkt), pkt->len,
+                                   rt_match->interface) == 0)
+            { SR_STAT_INC(sr, icmp_unreach); }
+            SR_STAT_INC(sr, drops);
+            SR_EVENT(sr, SR_EV_DROP, SR_DROP_ARP_FAILED, sr_mbuf_data(pkt),
+                     pkt->len, if_to_send->name);
+        }
+        SR_EVENT_ADDR(sr, SR_EV_ARP_FAILED, 0, req->ip, 0, if_to_send->name);
+        SR_DEBUG(SR_MOD_ICMP, "Sent ICMP host not reachable (type 3, code 1)");
+        return 1;
+    }
+
+    /* -- send an ARP request out of the interface the packets are for -- */
+    if ((m = sr_mbuf_alloc(sr->mbufs)) == 0)
+    { return 0; }
+    len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t);
+    buf = sr_mbuf_append(m, len);
+    eth_hdr = (sr_ethernet_hdr_t*)buf;
+    arp_req = (sr_arp_hdr_t*)(buf + sizeof(sr_ethernet_hdr_t));
+
+    memset(eth_hdr->ether_dhost, 0xff, ETHER_ADDR_LEN);
+    memcpy(eth_hdr->ether_shost, if_to_send->addr, ETHER_ADDR_LEN);
+    eth_hdr->ether_type = htons(ethertype_arp);
+
+    arp_req->ar_hrd = htons(arp_hrd_ethernet);
+    arp_req->ar_pro = htons(ethertype_ip);
+    arp_req->ar_hln = ETHER_ADDR_LEN;
+    arp_req->ar_pln = 0x04;
+    arp_req->ar_op  = htons(arp_op_request);
+    memcpy(arp_req->ar_sha, if_to_send->addr, ETHER_ADDR_LEN);
+    arp_req->ar_sip = if_to_send->ip;
+    memset(arp_req->ar_tha, 0xff, ETHER_ADDR_LEN);
+    arp_req->ar_tip = req->ip;
+
+    SR_DEBUG(SR_MOD_ARP, "Sending ARP request");
+    SR_EVENT_ADDR(sr, SR_EV_ARP_REQUEST, req->times_sent, req->ip, 0,
+                  if_to_send->name);
+    sr_send_mbuf(sr, m, if_to_send);
+
+    req->sent = time(0);
+    req->times_sent++;
+    return 0;
+} /* -- sr_neigh_arpreq -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_neigh_bind(..)
+ * Scope: Global
+ *
+ * Give the calling thread a replica and pending list of its own.  Returns
+ * 0 on success, -1 if there are no contexts left.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_neigh_bind(struct sr_instance* sr)
+{
+    struct sr_neigh* ng;
+    struct sr_neigh_ctx* c;
+    int i;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(sr->neigh);
+
+    ng = sr->neigh;
+    pthread_mutex_lock(&(sr->cache.lock));
+
+    if (ng->n == SR_NEIGH_MAX)
+    {
+        pthread_mutex_unlock(&(sr->cache.lock));
+        fprintf(stderr, "sr_neigh_bind: out of neighbor contexts\n");
+        return -1;
+    }
+
+    if (posix_memalign((void**)&c, SR_CACHELINE,
+                       sizeof(struct sr_neigh_ctx)) != 0)
+    { c = 0; }
+    assert(c);
+    memset(c, 0, sizeof(struct sr_neigh_ctx));
+    pthread_mutex_init(&c->lock, 0);
+    for (i = 0; i < SR_NEIGH_REQS; i++)
+    {
+        c->req[i].next = c->free_reqs;
+        c->free_reqs = &c->req[i];
+    }
+    sr_neigh_copy(c, &sr->cache);
+    c->seen = c->gen;
+
+    ng->ctx[ng->n] = c;
+    __atomic_store_n(&ng->n, ng->n + 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&(sr->cache.lock));
+
+    sr_neigh_self = c;
+    return 0;
+} /* -- sr_neigh_bind -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_neigh_init(..)
+ * Scope: Global
+ *
+ * Called from sr_init(); the calling thread (the receive loop) gets the
+ * first context.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_neigh_init(struct sr_instance* sr)
+{
+    /* REQUIRES */
+    assert(sr);
+
+    sr->neigh = (struct sr_neigh*)calloc(1, sizeof(struct sr_neigh));
+    assert(sr->neigh);
+
+    return sr_neigh_bind(sr);
+} /* -- sr_neigh_init -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_neigh_publish(..)
+ * Scope: Global
+ *
+ * Copy the master ARP table into every replica, and retire the flow
+ * cache entries made from the old one.  Call with cache.lock held, after
+ * changing sr->cache.entries.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_neigh_publish(struct sr_instance* sr)
+{
+    struct sr_neigh* ng;
+    int i;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if ((ng = sr->neigh) == 0)
+    { return; }
+
+    for (i = 0; i < ng->n; i++)
+    { sr_neigh_copy(ng->ctx[i], &sr->cache); }
+    sr_flow_invalidate(sr);
+} /* -- sr_neigh_publish -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_neigh_lookup(..)
+ * Scope: Global
+ *
+ * Look next hop ip up in the caller's replica.  Returns 1 and fills in mac
+ * if it is known; the caller may then send to it straight away, anything
+ * still queued for it has gone out first.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_neigh_lookup(struct sr_instance* sr, uint32_t ip, unsigned char* mac)
+{
+    struct sr_neigh_ctx* c;
+    uint32_t gen;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(mac);
+
+    c = sr_neigh_ctx(sr);
+
+    if (!sr_neigh_find(c, ip, mac, &gen))
+    { return 0; }
+
+    /* -- packets queued before this publication go first -- */
+    if (gen != __atomic_load_n(&c->seen, __ATOMIC_ACQUIRE))
+    {
+        pthread_mutex_lock(&c->lock);
+        sr_neigh_resolve(sr, c);
+        pthread_mutex_unlock(&c->lock);
+    }
+    return 1;
+} /* -- sr_neigh_lookup -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_neigh_output(..)
+ * Scope: Global
+ *
+ * Send an IP packet to next hop ip out of interface ifid, or queue it on the
+ * caller's context until ip is resolved.  A queued packet is copied into an
+ * mbuf; it is dropped instead if SR_NEIGH_REQS next hops or SR_NEIGH_QLEN
+ * packets for this one are already waiting.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_neigh_output(struct sr_instance* sr, uint8_t* packet,
+                     unsigned int len, uint32_t ip, int ifid)
+{
+    struct sr_if* iface = sr_get_interface_id(sr, ifid);
+    struct sr_neigh_ctx* c;
+    struct sr_neigh_req *req, **prev;
+    struct sr_mbuf* m;
+    unsigned char mac[ETHER_ADDR_LEN];
+    uint32_t gen;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(packet);
+    assert(iface);
+
+    if (sr_neigh_lookup(sr, ip, mac))
+    {
+        sr_neigh_fill(packet, mac, iface);
+        sr_send_packet_if(sr, packet, len, iface);
+        return;
+    }
+
+    c = sr_neigh_ctx(sr);
+    pthread_mutex_lock(&c->lock);
+
+    /* -- the reply may have been published since -- */
+    sr_neigh_resolve(sr, c);
+    if (sr_neigh_find(c, ip, mac, &gen))
+    {
+        sr_neigh_fill(packet, mac, iface);
+        sr_send_packet_if(sr, packet, len, iface);
+        pthread_mutex_unlock(&c->lock);
+        return;
+    }
+
+    for (prev = &c->reqs; (req = *prev) != 0; prev = &req->next)
+    {
+        if (req->ip == ip)
+        { break; }
+    }
+
+    /* -- too many packets pending or next hops, or out of buffers; a new
+     *    request is only linked once it has a packet to hold -- */
+    if ((req && req->qlen == SR_NEIGH_QLEN) ||
+        (req == 0 && c->free_reqs == 0) ||
+        (m = sr_mbuf_copy(sr->mbufs, packet, len)) == 0)
+    {
+        SR_STAT_INC(sr, drops);
+        SR_EVENT(sr, SR_EV_DROP, SR_DROP_NEIGH_FULL, packet, len, iface->name);
+        pthread_mutex_unlock(&c->lock);
+        return;
+    }
+    if (req == 0)
+    {
+        req = c->free_reqs;
+        c->free_reqs = req->next;
+        memset(req, 0, sizeof(struct sr_neigh_req));
+        req->ip = ip;
+        *prev = req;
+    }
+    m->ifid = ifid;
+    if (req->tail)
+    { req->tail->next = m; }
+    else
+    { req->head = m; }
+    req->tail = m;
+    req->qlen++;
+
+    /* -- a new request goes out right away -- */
+    if (sr_neigh_arpreq(sr, req))
+    {
+        *prev = req->next;
+        sr_neigh_free_req(c, req);
+    }
+
+    pthread_mutex_unlock(&c->lock);
+} /* -- sr_neigh_output -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_neigh_poll(..)
+ * Scope: Global
+ *
+ * Forwarding threads: send whatever the last publication has resolved.
+ * Cheap when there is nothing new.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_neigh_poll(struct sr_instance* sr)
+{
+    struct sr_neigh_ctx* c;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if ((c = sr_neigh_self) == 0)
+    { return; }
+
+    if (__atomic_load_n(&c->gen, __ATOMIC_RELAXED) !=
+        __atomic_load_n(&c->seen, __ATOMIC_RELAXED))
+    {
+        pthread_mutex_lock(&c->lock);
+        sr_neigh_resolve(sr, c);
+        pthread_mutex_unlock(&c->lock);
+    }
+} /* -- sr_neigh_poll -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_neigh_sweep(..)
+ * Scope: Global
+ *
+ * ARP timeout thread, once a second: go through every context's pending
+ * list, sending resolved packets and retrying or giving up on the rest.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_neigh_sweep(struct sr_instance* sr)
+{
+    struct sr_neigh* ng;
+    struct sr_neigh_ctx* c;
+    struct sr_neigh_req *req, **prev;
+    int i, n;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if ((ng = sr->neigh) == 0)
+    { return; }
+
+    n = __atomic_load_n(&ng->n, __ATOMIC_ACQUIRE);
+    for (i = 0; i < n; i++)
+    {
+        c = ng->ctx[i];
+        pthread_mutex_lock(&c->lock);
+
+        sr_neigh_resolve(sr, c);
+
+        prev = &c->reqs;
+        while ((req = *prev) != 0)
+        {
+            if (sr_neigh_arpreq(sr, req))
+            {
+                *prev = req->next;
+                sr_neigh_free_req(c, req);
+            }
+            else
+            { prev = &req->next; }
+        }
+
+        pthread_mutex_unlock(&c->lock);
+    }
+} /* -- sr_neigh_sweep -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_neigh_destroy(..)
+ * Scope: Global
+ *
+ * Drop whatever is still pending and free the contexts.  Call once the
+ * forwarding threads and the ARP timeout thread have stopped.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_neigh_destroy(struct sr_instance* sr)
+{
+    struct sr_neigh* ng;
+    struct sr_neigh_ctx* c;
+    struct sr_neigh_req* req;
+    int i;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if ((ng = sr->neigh) == 0)
+    { return; }
+
+    for (i = 0; i < ng->n; i++)
+    {
+        c = ng->ctx[i];
+        while ((req = c->reqs) != 0)
+        {
+            c->reqs = req->next;
+            sr_neigh_free_req(c, req);
+        }
+        pthread_mutex_destroy(&c->lock);
+        free(c);
+    }
+    free(ng);
+    sr->neigh = 0;
+    sr_neigh_self = 0;
+} /* -- sr_neigh_destroy -- */
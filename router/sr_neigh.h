@@ -0,0 +1,45 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_neigh.h
+ *
+ * Description:
+ *
+ * Neighbor (ARP) state for the forwarding threads.  sr_arpcache stays the
+ * master table, written under cache.lock by the ARP handlers and the ARP
+ * timeout thread.  Every forwarding thread ("context": the receive loop,
+ * or each -W worker) gets its own read-only replica of it, and a lookup
+ * only ever reads the caller's replica, without a lock.  Whoever changes
+ * the master calls sr_neigh_publish(), which copies it into every
+ * replica under a per-replica sequence counter.
+ *
+ * Packets waiting for ARP resolution are queued on the context that
+ * forwarded them, so each thread owns its own pending list.  The owner
+ * sends them as soon as it notices a new publication; the ARP timeout
+ * thread calls sr_neigh_sweep() once a second for retransmissions, host
+ * unreachables and contexts that have gone idle.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_NEIGH_H
+#define SR_NEIGH_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_instance;
+
+int  sr_neigh_init(struct sr_instance* );
+int  sr_neigh_bind(struct sr_instance* );
+void sr_neigh_publish(struct sr_instance* );
+int  sr_neigh_lookup(struct sr_instance* , uint32_t ip, unsigned char* mac);
+void sr_neigh_output(struct sr_instance* , uint8_t* packet, unsigned int len,
+                     uint32_t ip, int ifid);
+void sr_neigh_poll(struct sr_instance* );
+void sr_neigh_sweep(struct sr_instance* );
+void sr_neigh_destroy(struct sr_instance* );
+
+#endif /* -- SR_NEIGH_H -- */
@@ -0,0 +1,457 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_pcapng.c
+ *
+ * Description:
+ *
+ * pcapng writer, see sr_pcapng.h.  Only the capture writer thread calls
+ * into this file.
+ *
+ * Each file is preallocated up front (the rotation size, or
+ * SR_PCAPNG_CHUNK at a time when rotating by age only) so the filesystem
+ * hands out one extent instead of growing the file a page at a time, and
+ * blocks are formatted straight into a MAP_SHARED mapping of it.  The
+ * unused tail is truncated away when the file is closed.
+ *
+ * Blocks are written in host byte order, which the Section Header Block's
+ * byte-order magic tells readers about.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sr_pcapng.h"
+#include "sr_capture.h"
+#include "sr_router.h"
+#include "sr_if.h"
+
+#define SR_PCAPNG_SUFFIX    ".pcapng"
+#define SR_PCAPNG_CHUNK     (16*1024*1024)  /* growth step without -C */
+#define SR_PCAPNG_MIN_FILE  (64*1024)
+#define SR_PCAPNG_MAX_IFS   64
+#define SR_PCAPNG_IDB_MAX   256             /* enough for our options */
+
+/* -- block types and options, from the pcapng draft -- */
+#define PCAPNG_SHB          0x0A0D0D0A
+#define PCAPNG_IDB          0x00000001
+#define PCAPNG_EPB          0x00000006
+#define PCAPNG_BYTE_ORDER   0x1A2B3C4D
+#define PCAPNG_LINKTYPE_ETHERNET 1
+
+#define OPT_ENDOFOPT        0
+#define OPT_SHB_USERAPPL    4
+#define OPT_IF_NAME         2
+#define OPT_IF_IPV4ADDR     4
+#define OPT_IF_MACADDR      6
+#define OPT_IF_SPEED        8
+#define OPT_IF_TSRESOL      9
+#define OPT_EPB_FLAGS       2
+
+#define EPB_FLAG_INBOUND    0x1
+#define EPB_FLAG_OUTBOUND   0x2
+
+#define PAD4(x) (((x) + 3) & ~3U)
+
+struct sr_pcapng
+{
+    struct sr_instance* sr;
+    char base[256];             /* file name without ".pcapng" */
+    uint64_t rotate_bytes;
+    uint64_t rotate_ns;
+    unsigned int snaplen;
+
+    /* -- current file -- */
+    int fd;
+    uint8_t* map;
+    uint64_t size;              /* allocated and mapped */
+    uint64_t used;
+    uint64_t first_ns;          /* first packet, 0 if none yet */
+    unsigned int seq;
+
+    /* -- interfaces described in the current file, index = id -- */
+    char ifs[SR_PCAPNG_MAX_IFS][sr_IFACE_NAMELEN];
+    int nifs;
+};
+
+int sr_pcapng_is_pcapng(const char* fname)
+{
+    size_t n = strlen(fname), s = strlen(SR_PCAPNG_SUFFIX);
+    return n > s && strcmp(fname + n - s, SR_PCAPNG_SUFFIX) == 0;
+} /* -- sr_pcapng_is_pcapng -- */
+
+/*---------------------------------------------------------------------------
+ * Files
+ *-------------------------------------------------------------------------*/
+
+static int sr_pcapng_map(struct sr_pcapng* ng, uint64_t size)
+{
+    int err;
+
+    /* -- fall back to a sparse file where fallocate isn't supported -- */
+    if ((err = posix_fallocate(ng->fd, 0, size)) != 0)
+    {
+        if (err != EOPNOTSUPP && err != EINVAL)
+        {
+            errno = err;
+            perror("posix_fallocate(..):sr_pcapng.c::sr_pcapng_map");
+            return -1;
+        }
+        if (ftruncate(ng->fd, size) < 0)
+        {
+            perror("ftruncate(..):sr_pcapng.c::sr_pcapng_map");
+            return -1;
+        }
+    }
+
+    ng->map = (uint8_t*)mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                             ng->fd, 0);
+    if (ng->map == MAP_FAILED)
+    {
+        perror("mmap(..):sr_pcapng.c::sr_pcapng_map");
+        ng->map = 0;
+        return -1;
+    }
+    ng->size = size;
+    return 0;
+} /* -- sr_pcapng_map -- */
+
+static void sr_pcapng_unmap(struct sr_pcapng* ng)
+{
+    if (ng->map)
+    {
+        munmap(ng->map, ng->size);
+        ng->map = 0;
+    }
+} /* -- sr_pcapng_unmap -- */
+
+static void sr_pcapng_close_file(struct sr_pcapng* ng)
+{
+    if (ng->fd < 0)
+    { return; }
+
+    sr_pcapng_unmap(ng);
+    if (ftruncate(ng->fd, ng->used) < 0)
+    { perror("ftruncate(..):sr_pcapng.c::sr_pcapng_close_file"); }
+    close(ng->fd);
+    ng->fd = -1;
+} /* -- sr_pcapng_close_file -- */
+
+/* -- little helpers for formatting blocks in place -- */
+
+static uint8_t* sr_pcapng_put32(uint8_t* p, uint32_t v)
+{
+    memcpy(p, &v, 4);
+    return p + 4;
+}
+
+static uint8_t* sr_pcapng_opt(uint8_t* p, uint16_t code,
+                              const void* val, uint16_t len)
+{
+    memcpy(p, &code, 2);
+    memcpy(p + 2, &len, 2);
+    if (len != 0)
+    { memcpy(p + 4, val, len); }
+    memset(p + 4 + len, 0, PAD4(len) - len);
+    return p + 4 + PAD4(len);
+}
+
+/* -- close off a block started at b and ending (before trailer) at p -- */
+static void sr_pcapng_finish(struct sr_pcapng* ng, uint8_t* b, uint8_t* p)
+{
+    uint32_t total = (p - b) + 4;
+
+    memcpy(b + 4, &total, 4);
+    sr_pcapng_put32(p, total);
+    ng->used += total;
+} /* -- sr_pcapng_finish -- */
+
+static void sr_pcapng_shb(struct sr_pcapng* ng)
+{
+    static const char appl[] = "sr (simple router)";
+    uint8_t* b = ng->map + ng->used;
+    uint8_t* p = b;
+    uint16_t v;
+    int64_t section_len = -1;
+
+    p = sr_pcapng_put32(p, PCAPNG_SHB);
+    p += 4;
+    p = sr_pcapng_put32(p, PCAPNG_BYTE_ORDER);
+    v = 1; memcpy(p, &v, 2);
+    v = 0; memcpy(p + 2, &v, 2);
+    p += 4;
+    memcpy(p, &section_len, 8);
+    p += 8;
+    p = sr_pcapng_opt(p, OPT_SHB_USERAPPL, appl, sizeof(appl) - 1);
+    p = sr_pcapng_opt(p, OPT_ENDOFOPT, 0, 0);
+    sr_pcapng_finish(ng, b, p);
+} /* -- sr_pcapng_shb -- */
+
+static int sr_pcapng_open_file(struct sr_pcapng* ng)
+{
+    char fname[300];
+    uint64_t size;
+
+    if (ng->seq == 0)
+    { snprintf(fname, sizeof(fname), "%s%s", ng->base, SR_PCAPNG_SUFFIX); }
+    else
+    {
+        snprintf(fname, sizeof(fname), "%s.%u%s", ng->base, ng->seq,
+                 SR_PCAPNG_SUFFIX);
+    }
+
+    if ((ng->fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+    {
+        fprintf(stderr, "sr_pcapng_open: can't open %s\n", fname);
+        return -1;
+    }
+
+    size = ng->rotate_bytes ? ng->rotate_bytes : SR_PCAPNG_CHUNK;
+    if (sr_pcapng_map(ng, size) < 0)
+    {
+        close(ng->fd);
+        ng->fd = -1;
+        return -1;
+    }
+
+    ng->used     = 0;
+    ng->first_ns = 0;
+    ng->nifs     = 0;
+    sr_pcapng_shb(ng);
+    return 0;
+} /* -- sr_pcapng_open_file -- */
+
+/*---------------------------------------------------------------------------
+ * Make room for need more bytes: start the next file if this one is full
+ * (and has something in it) and we rotate by size, otherwise grow it.
+ *-------------------------------------------------------------------------*/
+
+static int sr_pcapng_reserve(struct sr_pcapng* ng, uint64_t need)
+{
+    uint64_t size;
+
+    if (ng->used + need <= ng->size)
+    { return 0; }
+
+    if (ng->rotate_bytes && ng->first_ns)
+    {
+        sr_pcapng_close_file(ng);
+        ng->seq++;
+        if (sr_pcapng_open_file(ng) < 0)
+        { return -1; }
+        if (ng->used + need <= ng->size)
+        { return 0; }
+    }
+
+    size = ng->size + SR_PCAPNG_CHUNK;
+    while (size < ng->used + need)
+    { size += SR_PCAPNG_CHUNK; }
+
+    sr_pcapng_unmap(ng);
+    return sr_pcapng_map(ng, size);
+} /* -- sr_pcapng_reserve -- */
+
+/*---------------------------------------------------------------------------
+ * Interface ids, one IDB per interface per file
+ *-------------------------------------------------------------------------*/
+
+static int sr_pcapng_iface(struct sr_pcapng* ng, const char* name)
+{
+    struct sr_if* iface;
+    uint8_t* b;
+    uint8_t* p;
+    uint16_t v;
+    uint32_t ipv4[2];
+    uint64_t bps;
+    uint8_t tsresol = 9;        /* 10^-9 */
+    int i;
+
+    for (i = 0; i < ng->nifs; i++)
+    {
+        if (strncmp(ng->ifs[i], name, sr_IFACE_NAMELEN) == 0)
+        { return i; }
+    }
+    if (ng->nifs == SR_PCAPNG_MAX_IFS)
+    { return -1; }
+    if (sr_pcapng_reserve(ng, SR_PCAPNG_IDB_MAX) < 0)
+    { return -1; }
+
+    b = p = ng->map + ng->used;
+    p = sr_pcapng_put32(p, PCAPNG_IDB);
+    p += 4;
+    v = PCAPNG_LINKTYPE_ETHERNET; memcpy(p, &v, 2);
+    v = 0;                        memcpy(p + 2, &v, 2);
+    p += 4;
+    p = sr_pcapng_put32(p, ng->snaplen);
+
+    strncpy(ng->ifs[ng->nifs], name, sr_IFACE_NAMELEN);
+    ng->ifs[ng->nifs][sr_IFACE_NAMELEN - 1] = 0;
+    p = sr_pcapng_opt(p, OPT_IF_NAME, ng->ifs[ng->nifs],
+                      strlen(ng->ifs[ng->nifs]));
+
+    /* -- if_list is fixed once the router is up, safe to read here -- */
+    if ((iface = sr_get_interface(ng->sr, name)) != 0)
+    {
+        p = sr_pcapng_opt(p, OPT_IF_MACADDR, iface->addr, ETHER_ADDR_LEN);
+        ipv4[0] = iface->ip;
+        ipv4[1] = 0xffffffff;
+        p = sr_pcapng_opt(p, OPT_IF_IPV4ADDR, ipv4, 8);
+        if (iface->speed)
+        {
+            bps = (uint64_t)iface->speed * 1000000;
+            p = sr_pcapng_opt(p, OPT_IF_SPEED, &bps, 8);
+        }
+    }
+    p = sr_pcapng_opt(p, OPT_IF_TSRESOL, &tsresol, 1);
+    p = sr_pcapng_opt(p, OPT_ENDOFOPT, 0, 0);
+    sr_pcapng_finish(ng, b, p);
+
+    return ng->nifs++;
+} /* -- sr_pcapng_iface -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_pcapng_write(..)
+ * Scope: Global
+ *
+ * Append one Enhanced Packet Block.  Returns 0 on success, -1 if the
+ * packet could not be written.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_pcapng_write(struct sr_pcapng* ng, uint64_t ts_ns, const char* iface,
+                    int dir, const uint8_t* data, uint32_t caplen,
+                    uint32_t len)
+{
+    uint8_t* b;
+    uint8_t* p;
+    uint32_t flags;
+    int id;
+
+    /* REQUIRES */
+    assert(ng);
+    assert(data);
+
+    /* -- a failed rotation or growth leaves nothing mapped -- */
+    if (ng->map == 0)
+    { return -1; }
+
+    /* -- start the next file once this one is old enough -- */
+    if (ng->rotate_ns && ng->first_ns && ts_ns - ng->first_ns >= ng->rotate_ns)
+    {
+        sr_pcapng_close_file(ng);
+        ng->seq++;
+        if (sr_pcapng_open_file(ng) < 0)
+        { return -1; }
+    }
+
+    /* header 28, data, epb_flags 8, end of options 4, trailer 4 -- and
+     * room for an IDB, so that rotating can't happen between the two */
+    if (sr_pcapng_reserve(ng, 44 + PAD4(caplen) + SR_PCAPNG_IDB_MAX) < 0)
+    { return -1; }
+    if ((id = sr_pcapng_iface(ng, iface ? iface : "?")) < 0)
+    { return -1; }
+    if (ng->first_ns == 0)
+    { ng->first_ns = ts_ns; }
+
+    b = p = ng->map + ng->used;
+    p = sr_pcapng_put32(p, PCAPNG_EPB);
+    p += 4;
+    p = sr_pcapng_put32(p, id);
+    p = sr_pcapng_put32(p, (uint32_t)(ts_ns >> 32));
+    p = sr_pcapng_put32(p, (uint32_t)ts_ns);
+    p = sr_pcapng_put32(p, caplen);
+    p = sr_pcapng_put32(p, len);
+    memcpy(p, data, caplen);
+    memset(p + caplen, 0, PAD4(caplen) - caplen);
+    p += PAD4(caplen);
+
+    flags = (dir == SR_CAP_TX) ? EPB_FLAG_OUTBOUND : EPB_FLAG_INBOUND;
+    p = sr_pcapng_opt(p, OPT_EPB_FLAGS, &flags, 4);
+    p = sr_pcapng_opt(p, OPT_ENDOFOPT, 0, 0);
+    sr_pcapng_finish(ng, b, p);
+
+    return 0;
+} /* -- sr_pcapng_write -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_pcapng_flush(..)
+ * Scope: Global
+ *
+ * Start writeback of what has been written so far; called when idle.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_pcapng_flush(struct sr_pcapng* ng)
+{
+    /* REQUIRES */
+    assert(ng);
+
+    if (ng->map && ng->used)
+    { msync(ng->map, ng->used, MS_ASYNC); }
+} /* -- sr_pcapng_flush -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_pcapng_open(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_pcapng* sr_pcapng_open(struct sr_instance* sr, const char* fname,
+                                 uint64_t rotate_bytes,
+                                 unsigned int rotate_secs,
+                                 unsigned int snaplen)
+{
+    struct sr_pcapng* ng;
+    long page = sysconf(_SC_PAGESIZE);
+
+    /* REQUIRES */
+    assert(sr);
+    assert(fname);
+    assert(sr_pcapng_is_pcapng(fname));
+
+    ng = (struct sr_pcapng*)calloc(1, sizeof(struct sr_pcapng));
+    assert(ng);
+
+    ng->sr = sr;
+    ng->fd = -1;
+    ng->snaplen = snaplen;
+    ng->rotate_ns = (uint64_t)rotate_secs * 1000000000ULL;
+    if (rotate_bytes)
+    {
+        if (rotate_bytes < SR_PCAPNG_MIN_FILE)
+        { rotate_bytes = SR_PCAPNG_MIN_FILE; }
+        ng->rotate_bytes = (rotate_bytes + page - 1) & ~(uint64_t)(page - 1);
+    }
+
+    if (strlen(fname) - strlen(SR_PCAPNG_SUFFIX) >= sizeof(ng->base))
+    {
+        fprintf(stderr, "sr_pcapng_open: file name too long\n");
+        free(ng);
+        return 0;
+    }
+    memcpy(ng->base, fname, strlen(fname) - strlen(SR_PCAPNG_SUFFIX));
+
+    if (sr_pcapng_open_file(ng) < 0)
+    {
+        free(ng);
+        return 0;
+    }
+
+    return ng;
+} /* -- sr_pcapng_open -- */
+
+void sr_pcapng_close(struct sr_pcapng* ng)
+{
+    if (ng == 0)
+    { return; }
+
+    sr_pcapng_close_file(ng);
+    free(ng);
+} /* -- sr_pcapng_close -- */
@@ -0,0 +1,44 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_pcapng.h
+ *
+ * Description:
+ *
+ * pcapng output for the capture writer, used when the "-l" file name ends
+ * in ".pcapng".  Timestamps are nanoseconds, every packet carries its
+ * RX/TX direction, and each router interface gets an Interface
+ * Description Block (name, MAC, IP, speed) the first time it shows up in
+ * a file.
+ *
+ * Files are preallocated and written through a shared mapping, and can
+ * be rotated by size and/or age: cap.pcapng, cap.1.pcapng, cap.2.pcapng...
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_PCAPNG_H
+#define SR_PCAPNG_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_instance;
+struct sr_pcapng;
+
+/* rotate_bytes / rotate_secs of 0 mean never */
+struct sr_pcapng* sr_pcapng_open(struct sr_instance* , const char* fname,
+                                 uint64_t rotate_bytes,
+                                 unsigned int rotate_secs,
+                                 unsigned int snaplen);
+int  sr_pcapng_write(struct sr_pcapng* , uint64_t ts_ns, const char* iface,
+                     int dir, const uint8_t* data, uint32_t caplen,
+                     uint32_t len);
+void sr_pcapng_flush(struct sr_pcapng* );
+void sr_pcapng_close(struct sr_pcapng* );
+
+int  sr_pcapng_is_pcapng(const char* fname);
+
+#endif /* -- SR_PCAPNG_H -- */
@@ -0,0 +1,396 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_pipeline.c
+ *
+ * Description:
+ *
+ * Staged forwarding, see sr_pipeline.h.
+ *
+ * Each node owns a vector of indices into the burst.  A node walks its
+ * vector once, prefetching the next frame's headers, and appends every
+ * frame to the vector of the node it goes to next.  Edges only ever point
+ * further down the node table, so running the nodes once in table order
+ * drains the graph.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "sr_pipeline.h"
+#include "sr_backend.h"
+#include "sr_event.h"
+#include "sr_flow.h"
+#include "sr_acl.h"
+#include "sr_nat.h"
+#include "sr_neigh.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+#include "sr_utils.h"
+#include "sr_rt.h"
+#include "sr_if.h"
+
+/* -- in execution order; a node only hands frames to later ones -- */
+enum sr_pipe_node_id
+{
+    SR_PIPE_PARSE,
+    SR_PIPE_CLASSIFY,
+    SR_PIPE_LOOKUP,
+    SR_PIPE_REWRITE,
+    SR_PIPE_TX,
+    SR_PIPE_NEIGH,
+    SR_PIPE_PUNT,
+    SR_PIPE_NODES
+};
+
+struct sr_pipe_vec
+{
+    int n;
+    uint8_t idx[SR_BURST_SIZE];
+};
+
+/* -- what earlier nodes found out about a frame -- */
+struct sr_pipe_meta
+{
+    sr_ip_hdr_t* ip;
+    struct sr_rt* rt;           /* 0 on a flow cache hit */
+    struct sr_if* out;          /* from rewrite on */
+    uint32_t gen;               /* flow generation at classify */
+    int ifid;                   /* on a hit, the cached decision */
+    uint8_t mac[ETHER_ADDR_LEN];
+};
+
+struct sr_pipe
+{
+    struct sr_frame* frames;
+    struct sr_pipe_meta meta[SR_BURST_SIZE];
+    struct sr_pipe_vec vec[SR_PIPE_NODES];
+};
+
+typedef void (*sr_pipe_fn)(struct sr_instance* , struct sr_pipe* ,
+                           struct sr_pipe_vec* );
+
+static __inline__ void sr_pipe_next(struct sr_pipe* p, int node, int i)
+{
+    p->vec[node].idx[p->vec[node].n++] = i;
+}
+
+static __inline__ void sr_pipe_prefetch(struct sr_pipe* p,
+                                        struct sr_pipe_vec* v, int k)
+{
+    if (k + 1 < v->n)
+    { __builtin_prefetch(p->frames[v->idx[k + 1]].buf); }
+}
+
+/*-----------------------------------------------------------------------------
+ * Node: parse
+ *
+ * Well formed IPv4 with a good header checksum goes on, everything else
+ * (ARP included) is punted.  The frame is left as it was.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_pipe_parse(struct sr_instance* sr, struct sr_pipe* p,
+                          struct sr_pipe_vec* v)
+{
+    struct sr_frame* f;
+    sr_ip_hdr_t* ip;
+    unsigned int hl;
+    int k, i;
+
+    for (k = 0; k < v->n; k++)
+    {
+        sr_pipe_prefetch(p, v, k);
+        i = v->idx[k];
+        f = &p->frames[i];
+
+        if (f->len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) ||
+            ((sr_ethernet_hdr_t*)f->buf)->ether_type != htons(ethertype_ip))
+        {
+            sr_pipe_next(p, SR_PIPE_PUNT, i);
+            continue;
+        }
+
+        ip = (sr_ip_hdr_t*)(f->buf + sizeof(sr_ethernet_hdr_t));
+        hl = ip->ip_hl * 4;
+        if (ip->ip_v != 4 || hl < sizeof(sr_ip_hdr_t) ||
+            f->len < sizeof(sr_ethernet_hdr_t) + hl)
+        {
+            sr_pipe_next(p, SR_PIPE_PUNT, i);
+            continue;
+        }
+
+        p->meta[i].ip = ip;
+        sr_pipe_next(p, cksum_verify(ip, hl) ? SR_PIPE_CLASSIFY : SR_PIPE_PUNT,
+                     i);
+    }
+} /* -- sr_pipe_parse -- */
+
+/* -- the interface frame i came in on, -1 if it's not known -- */
+static int sr_pipe_in_ifid(struct sr_instance* sr, struct sr_pipe* p, int i)
+{
+    struct sr_if* iface;
+
+    if (p->frames[i].ifid >= 0)
+    { return p->frames[i].ifid; }
+    iface = sr_get_interface(sr, p->frames[i].iface);
+    return iface ? iface->id : -1;
+} /* -- sr_pipe_in_ifid -- */
+
+/* -- does the ACL for ifid let frame i through?  Denials are left to
+      sr_handlepacket() to drop and count -- */
+static int sr_pipe_acl(struct sr_instance* sr, struct sr_pipe* p, int i,
+                       int ifid, int dir)
+{
+    if (sr->acl == 0)
+    { return 1; }
+    if (ifid < 0 && (ifid = sr_pipe_in_ifid(sr, p, i)) < 0)
+    { return 1; }
+    return sr_acl_permit(sr, p->meta[i].ip,
+                         p->frames[i].len - sizeof(sr_ethernet_hdr_t), ifid,
+                         dir);
+} /* -- sr_pipe_acl -- */
+
+/* -- does frame i cross the NAT's outside interface, coming in on it or
+      going out of interface ifid?  Those are translated by
+      sr_handlepacket() -- */
+static int sr_pipe_nat(struct sr_instance* sr, struct sr_pipe* p, int i,
+                       int ifid)
+{
+    return sr->nat && (ifid == sr->nat_ifid ||
+                       sr_pipe_in_ifid(sr, p, i) == sr->nat_ifid);
+} /* -- sr_pipe_nat -- */
+
+/*-----------------------------------------------------------------------------
+ * Node: classify
+ *
+ * Traffic for one of the router's own addresses is punted, as is anything
+ * the ingress ACL denies or that came in through the NAT's outside
+ * interface.  A flow cache hit for transit traffic skips
+ * lookup and takes its next hop along.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_pipe_classify(struct sr_instance* sr, struct sr_pipe* p,
+                             struct sr_pipe_vec* v)
+{
+    const struct sr_flow_entry* f;
+    struct sr_pipe_meta* m;
+    int k, i;
+
+    for (k = 0; k < v->n; k++)
+    {
+        i = v->idx[k];
+        m = &p->meta[i];
+        m->rt = 0;
+
+        if (!sr_pipe_acl(sr, p, i, p->frames[i].ifid, SR_ACL_IN) ||
+            sr_pipe_nat(sr, p, i, -1))
+        {
+            sr_pipe_next(p, SR_PIPE_PUNT, i);
+            continue;
+        }
+
+        f = sr_flow_lookup(sr, m->ip->ip_dst, &m->gen);
+        if (f && !f->local && m->ip->ip_ttl > 1 &&
+            sr_pipe_acl(sr, p, i, f->ifid, SR_ACL_OUT) &&
+            !sr_pipe_nat(sr, p, i, f->ifid))
+        {
+            m->ifid = f->ifid;
+            memcpy(m->mac, f->mac, ETHER_ADDR_LEN);
+            sr_pipe_next(p, SR_PIPE_REWRITE, i);
+        }
+        else if (f || is_ip_match_router_if(sr, m->ip->ip_dst))
+        { sr_pipe_next(p, SR_PIPE_PUNT, i); }
+        else
+        { sr_pipe_next(p, SR_PIPE_LOOKUP, i); }
+    }
+} /* -- sr_pipe_classify -- */
+
+/*-----------------------------------------------------------------------------
+ * Node: lookup
+ *
+ * Longest prefix match.  No route, or a TTL that would expire here, means
+ * an ICMP error: punted.  So is a packet the egress ACL denies, or one
+ * leaving through the NAT's outside interface.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_pipe_lookup(struct sr_instance* sr, struct sr_pipe* p,
+                           struct sr_pipe_vec* v)
+{
+    struct sr_pipe_meta* m;
+    int k, i;
+
+    for (k = 0; k < v->n; k++)
+    {
+        i = v->idx[k];
+        m = &p->meta[i];
+        if (m->ip->ip_ttl > 1)
+        {
+            m->rt = sr_get_longest_rt_table_match(sr->routing_table,
+                                                  m->ip->ip_dst);
+        }
+        if (m->rt && sr_pipe_acl(sr, p, i, m->rt->ifid, SR_ACL_OUT) &&
+            !sr_pipe_nat(sr, p, i, m->rt->ifid))
+        { sr_pipe_next(p, SR_PIPE_REWRITE, i); }
+        else
+        { sr_pipe_next(p, SR_PIPE_PUNT, i); }
+    }
+} /* -- sr_pipe_lookup -- */
+
+/*-----------------------------------------------------------------------------
+ * Node: rewrite
+ *
+ * Decrement the TTL, and fill in the Ethernet header if the next hop came
+ * from the flow cache or is in this thread's neighbor replica; the latter
+ * is cached for next time.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_pipe_rewrite(struct sr_instance* sr, struct sr_pipe* p,
+                            struct sr_pipe_vec* v)
+{
+    struct sr_pipe_meta* m;
+    sr_ethernet_hdr_t* e_hdr;
+    int k, i;
+
+    for (k = 0; k < v->n; k++)
+    {
+        sr_pipe_prefetch(p, v, k);
+        i = v->idx[k];
+        m = &p->meta[i];
+
+        ip_set_ttl(m->ip, m->ip->ip_ttl - 1);
+
+        if (m->rt)
+        {
+            if (!sr_neigh_lookup(sr, m->ip->ip_dst, m->mac))
+            {
+                sr_pipe_next(p, SR_PIPE_NEIGH, i);
+                continue;
+            }
+            m->ifid = m->rt->ifid;
+            sr_flow_insert(sr, m->ip->ip_dst, m->gen, m->ifid, m->mac);
+        }
+
+        e_hdr = (sr_ethernet_hdr_t*)p->frames[i].buf;
+        m->out = sr_get_interface_id(sr, m->ifid);
+        memcpy(e_hdr->ether_shost, m->out->addr, ETHER_ADDR_LEN);
+        memcpy(e_hdr->ether_dhost, m->mac, ETHER_ADDR_LEN);
+        sr_pipe_next(p, SR_PIPE_TX, i);
+    }
+} /* -- sr_pipe_rewrite -- */
+
+/*-----------------------------------------------------------------------------
+ * Node: tx
+ *
+ * Send everything that made it through in one burst.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_pipe_tx(struct sr_instance* sr, struct sr_pipe* p,
+                       struct sr_pipe_vec* v)
+{
+    struct sr_frame out[SR_BURST_SIZE];
+    int k, i;
+
+    for (k = 0; k < v->n; k++)
+    {
+        i = v->idx[k];
+        out[k].buf   = p->frames[i].buf;
+        out[k].len   = p->frames[i].len;
+        out[k].iface = p->meta[i].out->name;
+        out[k].ifid  = p->meta[i].out->id;
+        SR_EVENT(sr, SR_EV_FORWARD, 0, out[k].buf, out[k].len, out[k].iface);
+    }
+    sr_send_burst(sr, out, v->n);
+} /* -- sr_pipe_tx -- */
+
+/*-----------------------------------------------------------------------------
+ * Node: neigh
+ *
+ * Next hop not resolved (yet): queue for ARP.  Runs after tx so a frame
+ * resolved meanwhile can't overtake one sent from the same burst.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_pipe_neigh(struct sr_instance* sr, struct sr_pipe* p,
+                          struct sr_pipe_vec* v)
+{
+    int k, i;
+
+    for (k = 0; k < v->n; k++)
+    {
+        i = v->idx[k];
+        SR_EVENT(sr, SR_EV_FORWARD, 0, p->frames[i].buf, p->frames[i].len,
+                 p->meta[i].rt->interface);
+        sr_neigh_output(sr, p->frames[i].buf, p->frames[i].len,
+                        p->meta[i].ip->ip_dst, p->meta[i].rt->ifid);
+    }
+} /* -- sr_pipe_neigh -- */
+
+/*-----------------------------------------------------------------------------
+ * Node: punt
+ *
+ * Slow path, the frame goes through sr_handlepacket() as usual.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_pipe_punt(struct sr_instance* sr, struct sr_pipe* p,
+                         struct sr_pipe_vec* v)
+{
+    int k, i;
+
+    for (k = 0; k < v->n; k++)
+    {
+        i = v->idx[k];
+        sr_handlepacket(sr, p->frames[i].buf, p->frames[i].len,
+                        p->frames[i].iface);
+    }
+} /* -- sr_pipe_punt -- */
+
+static const sr_pipe_fn sr_pipe_nodes[SR_PIPE_NODES] = {
+    sr_pipe_parse,
+    sr_pipe_classify,
+    sr_pipe_lookup,
+    sr_pipe_rewrite,
+    sr_pipe_tx,
+    sr_pipe_neigh,
+    sr_pipe_punt
+};
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_pipeline_input(..)
+ * Scope: Global
+ *
+ * Run a received burst (at most SR_BURST_SIZE frames) through the graph.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_pipeline_input(struct sr_instance* sr, struct sr_frame* frames, int n)
+{
+    struct sr_pipe p;
+    int i;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(n <= SR_BURST_SIZE);
+
+    p.frames = frames;
+    for (i = 0; i < SR_PIPE_NODES; i++)
+    { p.vec[i].n = 0; }
+
+    for (i = 0; i < n; i++)
+    {
+        if (sr_backend_accept(sr, &frames[i]))
+        { sr_pipe_next(&p, SR_PIPE_PARSE, i); }
+    }
+
+    for (i = 0; i < SR_PIPE_NODES; i++)
+    {
+        if (p.vec[i].n)
+        { sr_pipe_nodes[i](sr, &p, &p.vec[i]); }
+    }
+} /* -- sr_pipeline_input -- */
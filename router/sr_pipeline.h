@@ -0,0 +1,31 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_pipeline.h
+ *
+ * Description:
+ *
+ * Staged forwarding ("-P").  Instead of running sr_handlepacket() on one
+ * frame at a time, a receive burst is pushed through a small graph of
+ * nodes, each of which handles the whole vector of frames that reached it
+ * before the next node runs:
+ *
+ *   parse -> classify -> lookup -> rewrite -> tx
+ *               \--- flow hit ---/    \-> neigh (ARP miss)
+ *   anything else                          -> punt (sr_handlepacket())
+ *
+ * Only plain IPv4 transit traffic stays on the fast path.  ARP, traffic
+ * for the router itself, anything an ACL denies, anything crossing the
+ * NAT's outside interface and anything that needs an ICMP error is
+ * punted, untouched, to sr_handlepacket(), so behaviour is the same as
+ * without -P.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_PIPELINE_H
+#define SR_PIPELINE_H
+
+struct sr_instance;
+struct sr_frame;
+
+void sr_pipeline_input(struct sr_instance* , struct sr_frame* , int n);
+
+#endif /* -- SR_PIPELINE_H -- */
@@ -0,0 +1,629 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_qos.c
+ *
+ * Description:
+ *
+ * Egress queues and pacing, see sr_qos.h.
+ *
+ * Token buckets count in millibits so that a refill is one multiply:
+ * an interface of speed Mbit/s earns speed millibits a nanosecond, and a
+ * frame costs its bytes on the wire times 8000.  The bucket may go
+ * negative by one frame; the interface then waits until it is positive
+ * again.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+
+#include "sr_qos.h"
+#include "sr_backend.h"
+#include "sr_event.h"
+#include "sr_if.h"
+#include "sr_log.h"
+#include "sr_mbuf.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+
+#define SR_QOS_QUANTUM     SR_MBUF_ROOM    /* DRR weight 1, no frame is larger */
+#define SR_QOS_WIRE_EXTRA  24              /* preamble, FCS, inter-frame gap */
+#define SR_QOS_WIRE_MIN    60              /* shorter frames are padded */
+#define SR_QOS_DEPTH_NS    1000000         /* bucket depth at line rate */
+#define SR_QOS_MIN_WAIT_NS 50000           /* pacer never sleeps less */
+#define SR_QOS_MAX_IDLE_NS 1000000000      /* refill at most this much */
+#define SR_QOS_MAX_MBPS    1000000
+
+struct sr_qos_queue
+{
+    struct sr_mbuf* head;
+    struct sr_mbuf* tail;
+    unsigned int n;
+    unsigned int limit;
+    int deficit;                /* bytes, DRR classes */
+    int quantum;
+    unsigned long sent;
+    unsigned long dropped;
+};
+
+struct sr_qos_if
+{
+    struct sr_qos_queue q[SR_QOS_CLASSES];
+    uint32_t speed;             /* Mbit/s, 0 = not queued */
+    unsigned int queued;        /* frames in q[] */
+    int cur;                    /* DRR class being served */
+    int in_turn;                /* cur has had its quantum this round */
+    int64_t tokens;             /* millibits */
+    int64_t depth;
+    uint64_t last;              /* ns, tokens last brought up to date */
+};
+
+struct sr_qos
+{
+    struct sr_qos_if* ifs;      /* by interface id */
+    int nifs;
+    pthread_t pacer;
+    pthread_cond_t wake;
+    uint64_t wake_at;           /* ns the pacer looks again, 0 = when woken */
+    int stop;
+};
+
+#define P SR_QOS_PRIO
+#define I SR_QOS_INTERACTIVE
+#define A SR_QOS_ASSURED
+#define B SR_QOS_BEST
+#define L SR_QOS_BULK
+
+/* -- class by DSCP, RFC 4594 groups -- */
+static const uint8_t sr_qos_dscp[64] = {
+    B, L, B, B, B, B, B, B,     /* 0 default, 1 LE */
+    L, B, A, B, A, B, A, B,     /* CS1, AF1x */
+    A, B, A, B, A, B, A, B,     /* CS2, AF2x */
+    I, B, I, B, I, B, I, B,     /* CS3, AF3x */
+    I, B, I, B, I, B, I, B,     /* CS4, AF4x */
+    P, B, B, B, P, B, P, B,     /* CS5, VOICE-ADMIT, EF */
+    P, B, B, B, B, B, B, B,     /* CS6 */
+    P, B, B, B, B, B, B, B      /* CS7 */
+};
+
+#undef P
+#undef I
+#undef A
+#undef B
+#undef L
+
+static const int sr_qos_weight[SR_QOS_CLASSES] = { 0, 4, 3, 2, 1 };
+
+static const char* sr_qos_names[SR_QOS_CLASSES] = {
+    "prio", "interactive", "assured", "best", "bulk"
+};
+
+static void* sr_qos_pacer(void* arg);
+
+static uint64_t sr_qos_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+} /* -- sr_qos_now -- */
+
+static int sr_qos_classify(const uint8_t* buf, unsigned int len)
+{
+    const sr_ethernet_hdr_t* eth = (const sr_ethernet_hdr_t*)buf;
+    const sr_ip_hdr_t* ip;
+
+    if (len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) ||
+        eth->ether_type != htons(ethertype_ip))
+    { return SR_QOS_PRIO; }
+    ip = (const sr_ip_hdr_t*)(buf + sizeof(sr_ethernet_hdr_t));
+    return sr_qos_dscp[ip->ip_tos >> 2];
+} /* -- sr_qos_classify -- */
+
+/* -- what a frame of len bytes costs, millibits -- */
+static int64_t sr_qos_cost(unsigned int len)
+{
+    if (len < SR_QOS_WIRE_MIN)
+    { len = SR_QOS_WIRE_MIN; }
+    return (int64_t)(len + SR_QOS_WIRE_EXTRA) * 8000;
+} /* -- sr_qos_cost -- */
+
+static void sr_qos_refill(struct sr_qos_if* qi, uint64_t now)
+{
+    uint64_t idle = now - qi->last;
+
+    if (idle > SR_QOS_MAX_IDLE_NS)
+    { idle = SR_QOS_MAX_IDLE_NS; }
+    qi->tokens += (int64_t)idle * qi->speed;
+    if (qi->tokens > qi->depth)
+    { qi->tokens = qi->depth; }
+    qi->last = now;
+} /* -- sr_qos_refill -- */
+
+/* -- when qi, which has a backlog, has credit again -- */
+static uint64_t sr_qos_ready(const struct sr_qos_if* qi, uint64_t now)
+{
+    uint64_t wait = 0;
+
+    if (qi->tokens <= 0)
+    { wait = (uint64_t)(1 - qi->tokens) / qi->speed + 1; }
+    if (wait < SR_QOS_MIN_WAIT_NS)
+    { wait = SR_QOS_MIN_WAIT_NS; }
+    return now + wait;
+} /* -- sr_qos_ready -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_qos_pick(..)
+ * Scope: Local
+ *
+ * The class the next frame comes from, -1 if nothing is queued.  prio
+ * first, then deficit round robin over the rest.  A class is charged
+ * when its frame is taken, not here, so picking twice without taking
+ * gives the same answer.  Every quantum is at least a full frame, so
+ * this ends within one round.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_qos_pick(struct sr_qos_if* qi)
+{
+    struct sr_qos_queue* q;
+
+    if (qi->q[SR_QOS_PRIO].head)
+    { return SR_QOS_PRIO; }
+    if (qi->queued == 0)
+    { return -1; }
+
+    for (;;)
+    {
+        q = &qi->q[qi->cur];
+        if (!qi->in_turn)
+        {
+            q->deficit += q->quantum;
+            qi->in_turn = 1;
+        }
+        if (q->head == 0)
+        { q->deficit = 0; }
+        else if (q->head->len <= q->deficit)
+        { return qi->cur; }
+
+        qi->in_turn = 0;
+        qi->cur = qi->cur == SR_QOS_CLASSES - 1 ? SR_QOS_PRIO + 1
+                                                : qi->cur + 1;
+    }
+} /* -- sr_qos_pick -- */
+
+static struct sr_mbuf* sr_qos_take(struct sr_qos_if* qi, int c)
+{
+    struct sr_qos_queue* q = &qi->q[c];
+    struct sr_mbuf* m = q->head;
+
+    if ((q->head = m->next) == 0)
+    {
+        q->tail = 0;
+        q->deficit = 0;
+    }
+    else if (c != SR_QOS_PRIO)
+    { q->deficit -= m->len; }
+    m->next = 0;
+    q->n--;
+    q->sent++;
+    qi->queued--;
+    qi->tokens -= sr_qos_cost(m->len);
+    return m;
+} /* -- sr_qos_take -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_qos_drain(..)
+ * Scope: Local
+ *
+ * Send what interface ifid has credit for, SR_BURST_SIZE frames to a
+ * tx_burst.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_qos_drain(struct sr_instance* sr, int ifid, uint64_t now)
+{
+    struct sr_qos_if* qi = &sr->qos->ifs[ifid];
+    struct sr_frame frames[SR_BURST_SIZE];
+    struct sr_mbuf* ms[SR_BURST_SIZE];
+    struct sr_if* iface;
+    int c, i, n, ret;
+
+    if (qi->queued == 0)
+    { return; }
+    iface = sr_get_interface_id(sr, ifid);
+    sr_qos_refill(qi, now);
+
+    do
+    {
+        for (n = 0; n < SR_BURST_SIZE && qi->tokens > 0 &&
+                    (c = sr_qos_pick(qi)) >= 0; n++)
+        {
+            ms[n] = sr_qos_take(qi, c);
+            frames[n].buf   = sr_mbuf_data(ms[n]);
+            frames[n].len   = ms[n]->len;
+            frames[n].iface = iface->name;
+            frames[n].ifid  = ifid;
+        }
+        if (n == 0)
+        { break; }
+
+        if ((ret = sr->backend->tx_burst(sr, frames, n)) < 0)
+        { ret = 0; }
+        if (ret != n)
+        {
+            SR_ERROR(SR_MOD_CORE, "Error writing packet");
+            __atomic_fetch_add(&sr->stats.drops, n - ret, __ATOMIC_RELAXED);
+        }
+        __atomic_fetch_add(&sr->stats.tx_packets, ret, __ATOMIC_RELAXED);
+
+        for (i = 0; i < n; i++)
+        { sr_mbuf_free(ms[i]); }
+    } while (n == SR_BURST_SIZE);
+} /* -- sr_qos_drain -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_qos_pass(..)
+ * Scope: Global
+ *
+ * 1 if the frame may go straight to the backend: its interface isn't
+ * queued, or has nothing waiting and credit for it, in which case it is
+ * charged.  0 if it has to go through sr_qos_enqueue().
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_qos_pass(struct sr_instance* sr, struct sr_if* iface,
+                const uint8_t* buf, unsigned int len)
+{
+    struct sr_qos_if* qi;
+
+    /* REQUIRES */
+    assert(sr->qos);
+    assert(iface->id < sr->qos->nifs);
+
+    qi = &sr->qos->ifs[iface->id];
+    if (qi->speed == 0)
+    { return 1; }
+    if (qi->queued != 0)
+    { return 0; }
+
+    sr_qos_refill(qi, sr_qos_now());
+    if (qi->tokens <= 0)
+    { return 0; }
+
+    qi->tokens -= sr_qos_cost(len);
+    qi->q[sr_qos_classify(buf, len)].sent++;
+    return 1;
+} /* -- sr_qos_pass -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_qos_enqueue(..)
+ * Scope: Global
+ *
+ * Queue a frame sr_qos_pass() turned back: m if the caller has it in an
+ * mbuf, which is consumed, otherwise a copy of buf.  Sends whatever the
+ * interface has credit for and makes sure the pacer will come back for
+ * the rest.  Returns -1 if the frame was dropped.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_qos_enqueue(struct sr_instance* sr, struct sr_if* iface,
+                   struct sr_mbuf* m, const uint8_t* buf, unsigned int len)
+{
+    struct sr_qos* qos = sr->qos;
+    struct sr_qos_if* qi;
+    struct sr_qos_queue* q;
+    uint64_t now, ready;
+
+    /* REQUIRES */
+    assert(qos);
+    assert(iface->id < qos->nifs);
+
+    qi = &qos->ifs[iface->id];
+    q  = &qi->q[sr_qos_classify(buf, len)];
+
+    if (q->n >= q->limit ||
+        (m == 0 && (m = sr_mbuf_copy(sr->mbufs, buf, len)) == 0))
+    {
+        q->dropped++;
+        SR_STAT_INC(sr, drops);
+        SR_EVENT(sr, SR_EV_DROP, SR_DROP_EGRESS, buf, len, iface->name);
+        if (m)
+        { sr_mbuf_free(m); }
+        return -1;
+    }
+
+    m->next = 0;
+    if (q->tail)
+    { q->tail->next = m; }
+    else
+    { q->head = m; }
+    q->tail = m;
+    q->n++;
+    qi->queued++;
+
+    now = sr_qos_now();
+    sr_qos_drain(sr, iface->id, now);
+
+    if (qi->queued != 0 && !qos->stop)
+    {
+        ready = sr_qos_ready(qi, now);
+        if (qos->wake_at == 0 || ready < qos->wake_at)
+        {
+            qos->wake_at = ready;
+            pthread_cond_signal(&qos->wake);
+        }
+    }
+
+    return 0;
+} /* -- sr_qos_enqueue -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_qos_pacer(..)
+ * Scope: Local
+ *
+ * Drain every interface with a backlog, then sleep until the first of
+ * them has credit again, or until a send wakes it.
+ *
+ *---------------------------------------------------------------------------*/
+
+static void* sr_qos_pacer(void* arg)
+{
+    struct sr_instance* sr = (struct sr_instance*)arg;
+    struct sr_qos* qos = sr->qos;
+    struct timespec ts;
+    uint64_t now, next, ready;
+    int i;
+
+    pthread_mutex_lock(&(sr->tx_lock));
+    while (!qos->stop)
+    {
+        now  = sr_qos_now();
+        next = 0;
+        for (i = 0; i < qos->nifs; i++)
+        {
+            sr_qos_drain(sr, i, now);
+            if (qos->ifs[i].queued == 0)
+            { continue; }
+            ready = sr_qos_ready(&qos->ifs[i], now);
+            if (next == 0 || ready < next)
+            { next = ready; }
+        }
+
+        qos->wake_at = next;
+        if (next == 0)
+        { pthread_cond_wait(&qos->wake, &(sr->tx_lock)); }
+        else
+        {
+            ts.tv_sec  = next / 1000000000;
+            ts.tv_nsec = next % 1000000000;
+            pthread_cond_timedwait(&qos->wake, &(sr->tx_lock), &ts);
+        }
+    }
+    pthread_mutex_unlock(&(sr->tx_lock));
+
+    sr_mbuf_cache_flush();
+    return 0;
+} /* -- sr_qos_pacer -- */
+
+/* -- queue frames out of iface at mbps -- */
+static void sr_qos_if_init(struct sr_qos_if* qi, uint32_t mbps)
+{
+    int c;
+
+    memset(qi, 0, sizeof(struct sr_qos_if));
+    for (c = 0; c < SR_QOS_CLASSES; c++)
+    {
+        qi->q[c].limit   = c == SR_QOS_PRIO ? SR_QOS_PRIO_LIMIT : SR_QOS_LIMIT;
+        qi->q[c].quantum = sr_qos_weight[c] * SR_QOS_QUANTUM;
+    }
+    qi->speed  = mbps;
+    qi->cur    = SR_QOS_PRIO + 1;
+    qi->depth  = (int64_t)mbps * SR_QOS_DEPTH_NS;
+    if (qi->depth < 2 * sr_qos_cost(SR_MBUF_ROOM))
+    { qi->depth = 2 * sr_qos_cost(SR_MBUF_ROOM); }
+    qi->tokens = qi->depth;
+    qi->last   = sr_qos_now();
+} /* -- sr_qos_if_init -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_qos_attach(..)
+ * Scope: Global
+ *
+ * Queue the interfaces named by spec, "iface[=mbps],...", and start the
+ * pacer.  Call once the interfaces are known, before sr_init() (so the
+ * mbuf pool has room for the queues).  Returns -1 if an interface doesn't
+ * exist or its speed isn't known.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_qos_attach(struct sr_instance* sr, const char* spec)
+{
+    char name[sr_IFACE_NAMELEN];
+    struct sr_qos* qos;
+    struct sr_if* iface;
+    pthread_condattr_t ca;
+    unsigned long mbps;
+    const char* s;
+    const char* eq;
+    char* end;
+    int len;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(spec);
+    assert(sr->qos == 0);
+
+    qos = (struct sr_qos*)calloc(1, sizeof(struct sr_qos));
+    assert(qos);
+    qos->nifs = sr_if_count(sr);
+    qos->ifs  = (struct sr_qos_if*)calloc(qos->nifs, sizeof(struct sr_qos_if));
+    assert(qos->ifs);
+
+    for (s = spec; *s; )
+    {
+        len = strcspn(s, ",");
+        eq  = memchr(s, '=', len);
+        if ((eq ? eq - s : len) >= sr_IFACE_NAMELEN)
+        { goto no_iface; }
+        memcpy(name, s, eq ? eq - s : len);
+        name[eq ? eq - s : len] = 0;
+
+        if ((iface = sr_get_interface(sr, name)) == 0)
+        { goto no_iface; }
+        mbps = iface->speed;
+        if (eq)
+        {
+            mbps = strtoul(eq + 1, &end, 10);
+            if (end != s + len || mbps == 0 ||
+                mbps > SR_QOS_MAX_MBPS)
+            {
+                fprintf(stderr, "QoS: bad speed for %s\n", name);
+                goto err;
+            }
+        }
+        if (mbps == 0)
+        {
+            fprintf(stderr, "QoS: speed of %s not known, give it as %s=mbps\n",
+                    name, name);
+            goto err;
+        }
+        sr_qos_if_init(&qos->ifs[iface->id], mbps);
+
+        s += len;
+        if (*s == ',')
+        { s++; }
+    }
+
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_init(&qos->wake, &ca);
+    pthread_condattr_destroy(&ca);
+
+    sr->qos = qos;
+    if (pthread_create(&qos->pacer, 0, sr_qos_pacer, sr) != 0)
+    {
+        perror("pthread_create(..):sr_qos.c::sr_qos_attach");
+        sr->qos = 0;
+        pthread_cond_destroy(&qos->wake);
+        goto err;
+    }
+    sr_sched_housekeeping(sr, qos->pacer);
+
+    return 0;
+
+no_iface:
+    fprintf(stderr, "QoS: no interface %.*s\n", (int)strcspn(s, ",="), s);
+err:
+    free(qos->ifs);
+    free(qos);
+    return -1;
+} /* -- sr_qos_attach -- */
+
+/* -- mbufs the queues may hold at once -- */
+unsigned int sr_qos_buffers(struct sr_instance* sr)
+{
+    unsigned int n = 0;
+    int i, c;
+
+    if (sr->qos == 0)
+    { return 0; }
+    for (i = 0; i < sr->qos->nifs; i++)
+    {
+        if (sr->qos->ifs[i].speed == 0)
+        { continue; }
+        for (c = 0; c < SR_QOS_CLASSES; c++)
+        { n += sr->qos->ifs[i].q[c].limit; }
+    }
+    return n;
+} /* -- sr_qos_buffers -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_qos_stop(..)
+ * Scope: Global
+ *
+ * Stop the pacer, before the backend goes.  Frames still queued are
+ * dropped.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_qos_stop(struct sr_instance* sr)
+{
+    struct sr_qos* qos = sr->qos;
+    struct sr_qos_queue* q;
+    struct sr_mbuf* m;
+    int i, c;
+
+    if (qos == 0 || qos->stop)
+    { return; }
+
+    pthread_mutex_lock(&(sr->tx_lock));
+    qos->stop = 1;
+    pthread_cond_signal(&qos->wake);
+    pthread_mutex_unlock(&(sr->tx_lock));
+    pthread_join(qos->pacer, 0);
+
+    pthread_mutex_lock(&(sr->tx_lock));
+    for (i = 0; i < qos->nifs; i++)
+    {
+        for (c = 0; c < SR_QOS_CLASSES; c++)
+        {
+            q = &qos->ifs[i].q[c];
+            while ((m = q->head) != 0)
+            {
+                q->head = m->next;
+                q->dropped++;
+                SR_STAT_INC(sr, drops);
+                sr_mbuf_free(m);
+            }
+            q->tail = 0;
+            q->n = 0;
+        }
+        qos->ifs[i].queued = 0;
+    }
+    pthread_mutex_unlock(&(sr->tx_lock));
+} /* -- sr_qos_stop -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_qos_detach(..)
+ * Scope: Global
+ *
+ * Report frames sent and dropped per interface and class at exit and
+ * free the queues.  Call once sr_qos_stop() and everything else that
+ * sends has stopped.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_qos_detach(struct sr_instance* sr)
+{
+    struct sr_qos_if* qi;
+    struct sr_if* iface;
+    int i, c;
+
+    if (sr->qos == 0)
+    { return; }
+
+    for (i = 0; i < sr->qos->nifs; i++)
+    {
+        qi = &sr->qos->ifs[i];
+        if (qi->speed == 0 || (iface = sr_get_interface_id(sr, i)) == 0)
+        { continue; }
+        fprintf(stderr, "qos: %s at %u Mbit/s, sent/dropped", iface->name,
+                qi->speed);
+        for (c = 0; c < SR_QOS_CLASSES; c++)
+        {
+            fprintf(stderr, " %s %lu/%lu", sr_qos_names[c], qi->q[c].sent,
+                    qi->q[c].dropped);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    pthread_cond_destroy(&sr->qos->wake);
+    free(sr->qos->ifs);
+    free(sr->qos);
+    sr->qos = 0;
+} /* -- sr_qos_detach -- */
@@ -0,0 +1,78 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_qos.h
+ *
+ * Description:
+ *
+ * Egress queueing behind "-Q iface[=mbps],...".  Frames sent out of a
+ * listed interface are paced to its speed, the one the backend reported
+ * (sr_if.speed) unless the option gives another, and whatever the link
+ * can't take right away waits in one of five queues picked by the DSCP
+ * of the packet:
+ *
+ *   prio         EF, VOICE-ADMIT, CS5-CS7 and anything that isn't IPv4
+ *                (ARP), served first
+ *   interactive  CS3/AF3x, CS4/AF4x      weight 4
+ *   assured      AF1x, CS2/AF2x          weight 3
+ *   best         default and unassigned  weight 2
+ *   bulk         CS1, LE (RFC 8622)      weight 1
+ *
+ * The four weighted classes share what prio leaves by deficit round
+ * robin.  prio is strict and only bounded by its short queue; traffic
+ * marked EF is expected to be policed before it gets here.  A full queue
+ * drops the frame at the tail.
+ *
+ * While an interface keeps up nothing is queued: a frame that finds its
+ * queues empty and the token bucket positive goes straight to the backend
+ * as before.  Otherwise it is queued, in the mbuf it came in or a copy,
+ * and sent as the bucket refills, inline by later sends or by the pacer
+ * thread, which sleeps until the next interface with a backlog has
+ * credit.  The bucket holds a millisecond at line rate, or two full
+ * frames if that is more, and charges each frame its Ethernet preamble,
+ * FCS and inter-frame gap too.
+ *
+ * The queues are guarded by sr->tx_lock; every function here but attach,
+ * stop and detach is called with it held.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_QOS_H
+#define SR_QOS_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+enum sr_qos_class
+{
+    SR_QOS_PRIO,
+    SR_QOS_INTERACTIVE,
+    SR_QOS_ASSURED,
+    SR_QOS_BEST,
+    SR_QOS_BULK,
+    SR_QOS_CLASSES
+};
+
+#define SR_QOS_PRIO_LIMIT  32           /* frames queued, prio class */
+#define SR_QOS_LIMIT       128          /* frames queued, each other class */
+
+struct sr_instance;
+struct sr_if;
+struct sr_mbuf;
+struct sr_qos;
+
+int  sr_qos_attach(struct sr_instance* , const char* spec);
+unsigned int sr_qos_buffers(struct sr_instance* );
+void sr_qos_stop(struct sr_instance* );
+void sr_qos_detach(struct sr_instance* );
+
+/* -- with tx_lock held -- */
+int  sr_qos_pass(struct sr_instance* , struct sr_if* ,
+                 const uint8_t* buf, unsigned int len);
+int  sr_qos_enqueue(struct sr_instance* , struct sr_if* , struct sr_mbuf* m,
+                    const uint8_t* buf, unsigned int len);
+
+#endif /* -- SR_QOS_H -- */
@@ -0,0 +1,112 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_ring.h
+ *
+ * Description:
+ *
+ * Lock-free single-producer / single-consumer ring.  The ring only hands
+ * out slot indices; the slots themselves live wherever the user puts them.
+ * It holds no pointers, so a ring can sit in memory shared between
+ * processes.
+ *
+ * head and tail are free running 32 bit counters and slot = counter & mask.
+ * The producer owns head and the consumer owns tail, each on its own cache
+ * line.  Publishing is a release store and observing the other side is an
+ * acquire load, which orders the slot contents with the index update.
+ *
+ *   producer:  n = sr_ring_free(r); fill slots head..head+n-1;
+ *              sr_ring_produce(r, n);
+ *   consumer:  n = sr_ring_count(r); use slots tail..tail+n-1;
+ *              sr_ring_consume(r, n);
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_RING_H
+#define SR_RING_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <sched.h>
+
+#define SR_CACHELINE 64
+
+struct sr_ring
+{
+    uint32_t head;                      /* written by the producer only */
+    uint8_t  pad0[SR_CACHELINE - sizeof(uint32_t)];
+    uint32_t tail;                      /* written by the consumer only */
+    uint8_t  pad1[SR_CACHELINE - sizeof(uint32_t)];
+    uint32_t size;                      /* power of two */
+    uint32_t mask;
+    uint8_t  pad2[SR_CACHELINE - 2*sizeof(uint32_t)];
+} __attribute__ ((aligned (SR_CACHELINE))) ;
+
+/* size must be a power of two */
+static __inline__ void sr_ring_init(struct sr_ring* r, uint32_t size)
+{
+    r->head = 0;
+    r->tail = 0;
+    r->size = size;
+    r->mask = size - 1;
+}
+
+/* -- producer side -- */
+
+static __inline__ uint32_t sr_ring_free(struct sr_ring* r)
+{
+    return r->size - (__atomic_load_n(&r->head, __ATOMIC_RELAXED) -
+                      __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE));
+}
+
+/* index of the i-th free slot */
+static __inline__ uint32_t sr_ring_head_slot(struct sr_ring* r, uint32_t i)
+{
+    return (__atomic_load_n(&r->head, __ATOMIC_RELAXED) + i) & r->mask;
+}
+
+static __inline__ void sr_ring_produce(struct sr_ring* r, uint32_t n)
+{
+    __atomic_store_n(&r->head, __atomic_load_n(&r->head, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELEASE);
+}
+
+/* -- consumer side -- */
+
+static __inline__ uint32_t sr_ring_count(struct sr_ring* r)
+{
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) -
+           __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+}
+
+/* index of the i-th filled slot */
+static __inline__ uint32_t sr_ring_tail_slot(struct sr_ring* r, uint32_t i)
+{
+    return (__atomic_load_n(&r->tail, __ATOMIC_RELAXED) + i) & r->mask;
+}
+
+static __inline__ void sr_ring_consume(struct sr_ring* r, uint32_t n)
+{
+    __atomic_store_n(&r->tail, __atomic_load_n(&r->tail, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELEASE);
+}
+
+/* -- busy wait helper -- */
+
+static __inline__ void sr_ring_relax(unsigned int spins)
+{
+    if (spins < 1024)
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+    else
+    { sched_yield(); }
+}
+
+#endif /* -- SR_RING_H -- */
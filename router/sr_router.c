@@ -15,12 +15,22 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <arpa/inet.h>
 
 #include "sr_if.h"
 #include "sr_rt.h"
 #include "sr_router.h"
 #include "sr_protocol.h"
 #include "sr_arpcache.h"
+#include "sr_neigh.h"
+#include "sr_mbuf.h"
+#include "sr_icmp.h"
+#include "sr_event.h"
+#include "sr_acl.h"
+#include "sr_nat.h"
+#include "sr_qos.h"
+#include "sr_flow.h"
+#include "sr_log.h"
 #include "sr_utils.h"
 
 /*---------------------------------------------------------------------
@@ -38,14 +48,18 @@ void sr_init(struct sr_instance* sr)
 
     /* Initialize cache and cache cleanup thread */
     sr_arpcache_init(&(sr->cache));
+    sr->mbufs = sr_mbuf_pool_create(SR_MBUF_COUNT + sr_qos_buffers(sr));
+    assert(sr->mbufs);
+    sr_icmp_init(sr);
+    sr_neigh_init(sr);
+    sr_flow_init(sr);
 
     pthread_attr_init(&(sr->attr));
     pthread_attr_setdetachstate(&(sr->attr), PTHREAD_CREATE_JOINABLE);
     pthread_attr_setscope(&(sr->attr), PTHREAD_SCOPE_SYSTEM);
     pthread_attr_setscope(&(sr->attr), PTHREAD_SCOPE_SYSTEM);
-    pthread_t thread;
-
-    pthread_create(&thread, &(sr->attr), sr_arpcache_timeout, sr);
+    pthread_create(&(sr->cache.thread), &(sr->attr), sr_arpcache_timeout, sr);
+    sr_sched_housekeeping(sr, sr->cache.thread);
     
     /* Add initialization code here! */
 
@@ -82,7 +96,9 @@ void sr_handlepacket(struct sr_instance* sr,
     assert(interface);
  
     if( len < minlen ){
-        fprintf(stderr, "Invalid ethernet frame header length\n");
+        SR_WARN(SR_MOD_FWD, "Invalid ethernet frame header length");
+        SR_STAT_INC(sr, drops);
+        SR_EVENT(sr, SR_EV_DROP, SR_DROP_RUNT, packet, len, interface);
         return;
     }
 #ifdef MYDEBUG
@@ -96,21 +112,49 @@ void sr_handlepacket(struct sr_instance* sr,
 	/* Handle IP */
     if ( e_hdr->ether_type == htons(ethertype_ip) ) {
 		sr_ip_hdr_t* ip_hdr = (sr_ip_hdr_t*)(packet+minlen);
+		const struct sr_flow_entry* flow = 0;
+		struct sr_if* if_in;
+		uint32_t flow_gen;
 		uint16_t checksum = 0x0000;
 		minlen += sizeof(sr_ip_hdr_t);
 
 		if( len < minlen ) {
-			fprintf(stderr,"Invalid IP packet length\n");
+			SR_WARN(SR_MOD_FWD, "Invalid IP packet length");
+			SR_STAT_INC(sr, drops);
+			SR_EVENT(sr, SR_EV_DROP, SR_DROP_RUNT, packet, len, interface);
 			return;
 		}
 		checksum = ip_hdr->ip_sum;
-		ip_hdr->ip_sum = 0x0000; /* for recalculate checksum */
-		ip_hdr->ip_sum = cksum(ip_hdr,ip_hdr->ip_hl*4); /* recalculate checksum */
-		if(checksum != ip_hdr->ip_sum) {
-			fprintf(stderr,"Invalid IP checksum: Expected:%04X  Calculated:%04X\n",checksum,ip_hdr->ip_sum);
+		if(!cksum_verify(ip_hdr,ip_hdr->ip_hl*4)) {
+			ip_hdr->ip_sum = 0x0000; /* recalculate, just for the message */
+			ip_hdr->ip_sum = cksum(ip_hdr,ip_hdr->ip_hl*4);
+			SR_WARN(SR_MOD_FWD, "Invalid IP checksum: Expected:%04X  Calculated:%04X",checksum,ip_hdr->ip_sum);
+			SR_STAT_INC(sr, drops);
+			SR_EVENT(sr, SR_EV_DROP, SR_DROP_IP_CKSUM, packet, len, interface);
+			return;
+		}
+		/* ingress ACL, before anything is decided about the packet */
+		if_in = (sr->acl || sr->nat) ? sr_get_interface(sr, interface) : 0;
+		if(sr->acl && if_in &&
+		   !sr_acl_permit(sr, ip_hdr, len - sizeof(sr_ethernet_hdr_t), if_in->id, SR_ACL_IN)) {
+			SR_STAT_INC(sr, drops);
+			SR_EVENT(sr, SR_EV_DROP, SR_DROP_ACL, packet, len, interface);
 			return;
 		}
-		if_match = is_ip_match_router_if(sr,ip_hdr->ip_dst);	
+		/* a cached decision saves the address, route and ARP lookups */
+		flow = sr_flow_lookup(sr, ip_hdr->ip_dst, &flow_gen);
+		if(flow)
+			if_match = flow->local ? sr_get_interface_id(sr, flow->ifid) : 0;
+		else if((if_match = is_ip_match_router_if(sr,ip_hdr->ip_dst)) != 0)
+			sr_flow_insert(sr, ip_hdr->ip_dst, flow_gen, if_match->id, 0);
+		/* NAT: a reply to the outside address is for an inside host */
+		if(if_match && sr->nat && if_in && if_in->id == sr->nat_ifid &&
+		   sr_nat_in(sr->nat, ip_hdr, len - sizeof(sr_ethernet_hdr_t))) {
+			flow = sr_flow_lookup(sr, ip_hdr->ip_dst, &flow_gen);
+			if(flow && flow->local)
+				flow = 0;
+			if_match = 0;
+		}
 		if(if_match) { /* packet is for router */
 			/* Handle ICMP */
 			if(ip_hdr->ip_p == ip_protocol_icmp) {
@@ -119,14 +163,18 @@ void sr_handlepacket(struct sr_instance* sr,
 
 				/*Make sure packet length for ICMP*/
 				if( len < minlen ) {
-         			fprintf(stderr,"Invalid ICMP packet length\n");
+         			SR_WARN(SR_MOD_ICMP, "Invalid ICMP packet length");
+		            SR_STAT_INC(sr, drops);
+		            SR_EVENT(sr, SR_EV_DROP, SR_DROP_RUNT, packet, len, interface);
 		            return;
         		}
 				checksum = icmp_hdr->icmp_sum;
-				icmp_hdr->icmp_sum = 0x0000; /* for recalculate checksum */
-				icmp_hdr->icmp_sum = cksum(icmp_hdr,len-(sizeof(sr_ethernet_hdr_t)+(ip_hdr->ip_hl*4))); /* recalculate checksum */
-				if(checksum != icmp_hdr->icmp_sum) {
-            		fprintf(stderr,"Invalid ICMP checksum: Expected:%04X  Calculated:%04X\n",checksum,icmp_hdr->icmp_sum);
+				if(!cksum_verify(icmp_hdr,len-(sizeof(sr_ethernet_hdr_t)+(ip_hdr->ip_hl*4)))) {
+					icmp_hdr->icmp_sum = 0x0000; /* recalculate, just for the message */
+					icmp_hdr->icmp_sum = cksum(icmp_hdr,len-(sizeof(sr_ethernet_hdr_t)+(ip_hdr->ip_hl*4)));
+            		SR_WARN(SR_MOD_ICMP, "Invalid ICMP checksum: Expected:%04X  Calculated:%04X",checksum,icmp_hdr->icmp_sum);
+		            SR_STAT_INC(sr, drops);
+		            SR_EVENT(sr, SR_EV_DROP, SR_DROP_ICMP_CKSUM, packet, len, interface);
 		            return;
         		}
 				if(0x0008 == icmp_hdr->icmp_type){
@@ -150,105 +198,74 @@ void sr_handlepacket(struct sr_instance* sr,
 
 					/* Send on wire */
                 	sr_send_packet(sr,packet,len,interface);
-					fprintf(stderr,"ICMP reply has been sent to ");
-					print_addr_ip_int(ntohl(ip_hdr->ip_dst));
+					SR_EVENT(sr, SR_EV_ICMP, SR_EV_ICMP_ECHO_REPLY, packet, len, interface);
+					SR_DEBUG(SR_MOD_ICMP, "ICMP reply has been sent to %s",
+					         inet_ntoa(*(struct in_addr*)&ip_hdr->ip_dst));
 
 					return;
 				} 
 			}
 			else if(ip_hdr->ip_p == ip_protocol_tcp || ip_hdr->ip_p == ip_protocol_udp) {
-				unsigned int len = sizeof(sr_ethernet_hdr_t)+sizeof(sr_ip_hdr_t)+sizeof(sr_icmp_t3_hdr_t);
-                struct sr_if* if_to_send = sr_get_interface(sr,interface);
-                uint8_t* buf = (uint8_t*)malloc(len);
-                assert(buf);
-
-                prepare_icmp_t3_hdr( (sr_icmp_t3_hdr_t*)( buf+(len-sizeof(sr_icmp_t3_hdr_t)) ), 0x03 /* type */, 0x03/* code */, ip_hdr );
-                /* Note: Not looking at arpcache for mac, just reusing mac->IP from existing queued packet */
-                prepare_ipv4_hdr((sr_ip_hdr_t*)(buf+sizeof(sr_ethernet_hdr_t)),0x00 /* TOS */, len-sizeof(sr_ethernet_hdr_t), 0x0000 /* ID */, IP_DF /* offset */, ip_protocol_icmp /* protocol */, ntohl(if_to_send->ip) /* source */ ,ntohl(ip_hdr->ip_src) /* destination */);
-                prepare_eth_hdr((sr_ethernet_hdr_t*)buf, e_hdr->ether_shost /* destination */, if_to_send->addr /* sender */, ethertype_ip);
-
-                sr_send_packet(sr,buf,len,interface);
-                free(buf);
-
-				fprintf(stderr, "Sent ICMP Port unreachable (type 3, code 3)\n");
+				if(sr_icmp_send_error(sr,SR_ICMP_PORT_UNREACH,packet,len,interface) == 0) {
+                	SR_STAT_INC(sr, icmp_unreach);
+					SR_DEBUG(SR_MOD_ICMP, "Sent ICMP Port unreachable (type 3, code 3)");
+				}
 				return;
 			}
 			/* Send ICMP protocol unreachable error */
-			unsigned int len = sizeof(sr_ethernet_hdr_t)+sizeof(sr_ip_hdr_t)+sizeof(sr_icmp_t3_hdr_t);
-            struct sr_if* if_to_send = sr_get_interface(sr,interface);
-            uint8_t* buf = (uint8_t*)malloc(len);
-            assert(buf);
-
-            prepare_icmp_t3_hdr( (sr_icmp_t3_hdr_t*)( buf+(len-sizeof(sr_icmp_t3_hdr_t)) ), 0x03 /* type */, 0x02/* code */, ip_hdr );
-            /* Note: Not looking at arpcache for mac, just reusing mac->IP from existing queued packet */
-            prepare_ipv4_hdr((sr_ip_hdr_t*)(buf+sizeof(sr_ethernet_hdr_t)),0x00 /* TOS */, len-sizeof(sr_ethernet_hdr_t), 0x0000 /* ID */, IP_DF /* offset */, ip_protocol_icmp /* protocol */, ntohl(if_to_send->ip) /* source */ ,ntohl(ip_hdr->ip_src) /* destination */);
-            prepare_eth_hdr((sr_ethernet_hdr_t*)buf, e_hdr->ether_shost /* destination */, if_to_send->addr /* sender */, ethertype_ip);
-
-            sr_send_packet(sr,buf,len,interface);
-            free(buf);
-
-			fprintf(stderr, "Sent ICMP protocol unreachable error. Type-3 Code-2\n");
+			if(sr_icmp_send_error(sr,SR_ICMP_PROTO_UNREACH,packet,len,interface) == 0) {
+            	SR_STAT_INC(sr, icmp_unreach);
+				SR_DEBUG(SR_MOD_ICMP, "Sent ICMP protocol unreachable error. Type-3 Code-2");
+			}
 		} else { /* packet is not for router */
-			struct sr_rt* rt_match = sr_get_longest_rt_table_match(sr->routing_table,ip_hdr->ip_dst);
-			if(rt_match) {
-				struct sr_arpentry* entry = 0;
-				struct sr_if* if_to_send = sr_get_interface(sr,rt_match->interface);
-
-				fprintf(stderr,"IP packet received for forward\n");	
-				ip_hdr->ip_ttl = ip_hdr->ip_ttl - 1;
+			struct sr_rt* rt_match = flow ? 0 : sr_get_longest_rt_table_match(sr->routing_table,ip_hdr->ip_dst);
+			if(flow || rt_match) {
+				SR_DEBUG(SR_MOD_FWD, "IP packet received for forward");
+				ip_set_ttl(ip_hdr, ip_hdr->ip_ttl - 1); /* updates ip_sum incrementally (RFC 1624) */
 				if(0 < ip_hdr->ip_ttl) {
-					ip_hdr->ip_ttl = ip_hdr->ip_ttl;
-					ip_hdr->ip_sum = 0x0000; /* for recalculate checksum */	
-					ip_hdr->ip_sum = cksum(ip_hdr,ip_hdr->ip_hl*4); /* recalculate checksum */
-
-					entry = sr_arpcache_lookup(&sr->cache, ip_hdr->ip_dst);
-					if(entry) {
-						/* Update Ethernet header */
-						memcpy(e_hdr->ether_shost,if_to_send->addr,ETHER_ADDR_LEN);
-						memcpy(e_hdr->ether_dhost,entry->mac,ETHER_ADDR_LEN);
-
-						sr_send_packet(sr, packet, len, rt_match->interface);
-						/* sr_arpcache_dump(&sr->cache); */
-						free(entry);
+					unsigned char mac[ETHER_ADDR_LEN];
+					int ifid = flow ? flow->ifid : rt_match->ifid;
+
+					/* NAT: leaving through the outside interface */
+					if(sr->nat && ifid == sr->nat_ifid && (if_in == 0 || if_in->id != ifid) &&
+					   sr_nat_out(sr->nat, ip_hdr, len - sizeof(sr_ethernet_hdr_t)) != 0) {
+						SR_STAT_INC(sr, drops);
+						SR_EVENT(sr, SR_EV_DROP, SR_DROP_NAT, packet, len, interface);
+						return;
+					}
+					if(sr->acl && !sr_acl_permit(sr, ip_hdr, len - sizeof(sr_ethernet_hdr_t), ifid, SR_ACL_OUT)) {
+						SR_STAT_INC(sr, drops);
+						SR_EVENT(sr, SR_EV_DROP, SR_DROP_ACL, packet, len, interface);
+						return;
+					}
+					if(flow) {
+						sr_flow_output(sr, flow->ifid, flow->mac, packet, len);
 						return;
 					}
-					else {
-						struct sr_arpreq* req = 0;
-						fprintf(stderr,"Calling sr_arpcache_queuereq\n");
-						req = sr_arpcache_queuereq(&sr->cache,ip_hdr->ip_dst,packet,len,rt_match->interface); 
-						sr_handle_arpreq(sr,req);
+					/* resolve against this thread's neighbor replica, or
+					   queue on its own pending list */
+					if(sr_neigh_lookup(sr, ip_hdr->ip_dst, mac)) {
+						sr_flow_insert(sr, ip_hdr->ip_dst, flow_gen, rt_match->ifid, mac);
+						sr_flow_output(sr, rt_match->ifid, mac, packet, len);
+					} else {
+						SR_EVENT(sr, SR_EV_FORWARD, 0, packet, len, rt_match->interface);
+						sr_neigh_output(sr, packet, len, ip_hdr->ip_dst, rt_match->ifid);
 					}
+					return;
 				} else {
-					unsigned int len = sizeof(sr_ethernet_hdr_t)+sizeof(sr_ip_hdr_t)+sizeof(sr_icmp_t11_hdr_t);
-	                struct sr_if* if_to_send = sr_get_interface(sr,interface);
-    	            uint8_t* buf = (uint8_t*)malloc(len);
-        	        assert(buf);
-
-	                prepare_icmp_t3_hdr( (sr_icmp_t11_hdr_t*)( buf+(len-sizeof(sr_icmp_t11_hdr_t)) ), 0x0B /* type */, 0x00/* code */, ip_hdr );
-    	            /* Note: Not looking at arpcache for mac, just reusing mac->IP from existing queued packet */
-        	        prepare_ipv4_hdr((sr_ip_hdr_t*)(buf+sizeof(sr_ethernet_hdr_t)),0x00 /* TOS */, len-sizeof(sr_ethernet_hdr_t), 0x0000 /* ID */, IP_DF /* offset */, ip_protocol_icmp /* protocol */, ntohl(if_to_send->ip) /* source */ ,ntohl(ip_hdr->ip_src) /* destination */);
-            	    prepare_eth_hdr((sr_ethernet_hdr_t*)buf, e_hdr->ether_shost /* destination */, if_to_send->addr /* sender */, ethertype_ip);
-
-	                sr_send_packet(sr,buf,len,interface);
-    	            free(buf);
-					fprintf(stderr,"Sent ICMP Time exceeded (type 11, code 0)\n");
+	                SR_STAT_INC(sr, drops);
+					SR_EVENT(sr, SR_EV_DROP, SR_DROP_TTL, packet, len, interface);
+					if(sr_icmp_send_error(sr,SR_ICMP_TIME_EXCEEDED,packet,len,interface) == 0)
+						SR_DEBUG(SR_MOD_ICMP, "Sent ICMP Time exceeded (type 11, code 0)");
 				}
 			}
 			else {
-				unsigned int len = sizeof(sr_ethernet_hdr_t)+sizeof(sr_ip_hdr_t)+sizeof(sr_icmp_t3_hdr_t);
-				struct sr_if* if_to_send = sr_get_interface(sr,interface);
-	            uint8_t* buf = (uint8_t*)malloc(len);
-				assert(buf);
-
-				prepare_icmp_t3_hdr( (sr_icmp_t3_hdr_t*)( buf+(len-sizeof(sr_icmp_t3_hdr_t)) ), 0x03 /* type */, 0x00/* code */, ip_hdr );
-				/* Note: Not looking at arpcache for mac, just reusing mac->IP from existing queued packet */
-                prepare_ipv4_hdr((sr_ip_hdr_t*)(buf+sizeof(sr_ethernet_hdr_t)),0x00 /* TOS */, len-sizeof(sr_ethernet_hdr_t), 0x0000 /* ID */, IP_DF /* offset */, ip_protocol_icmp /* protocol */, ntohl(if_to_send->ip) /* source */ ,ntohl(ip_hdr->ip_src) /* destination */);
-                prepare_eth_hdr((sr_ethernet_hdr_t*)buf, e_hdr->ether_shost /* destination */, if_to_send->addr /* sender */, ethertype_ip);
-
-                sr_send_packet(sr,buf,len,interface);
-				free(buf);
-
-				fprintf(stderr,"Sent ICMP Destination net not reachable(Type-3, Code-0)\n");
+                SR_STAT_INC(sr, drops);
+				SR_EVENT(sr, SR_EV_DROP, SR_DROP_NO_ROUTE, packet, len, interface);
+				if(sr_icmp_send_error(sr,SR_ICMP_NET_UNREACH,packet,len,interface) == 0) {
+                	SR_STAT_INC(sr, icmp_unreach);
+					SR_DEBUG(SR_MOD_ICMP, "Sent ICMP Destination net not reachable(Type-3, Code-0)");
+				}
 			}
 		}
 
@@ -260,7 +277,9 @@ void sr_handlepacket(struct sr_instance* sr,
     	sr_arp_hdr_t* a_hdr = 0;
 
 		if( len < sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t) ) {
-			fprintf(stderr, "Invalid ARP header length\n");
+			SR_WARN(SR_MOD_ARP, "Invalid ARP header length");
+			SR_STAT_INC(sr, drops);
+			SR_EVENT(sr, SR_EV_DROP, SR_DROP_RUNT, packet, len, interface);
 			return;
 		}
 		a_hdr=(sr_arp_hdr_t*)(packet+sizeof(sr_ethernet_hdr_t));
@@ -269,10 +288,7 @@ void sr_handlepacket(struct sr_instance* sr,
             /* if ARP request is for one of router's interface, send ARP reply */
             if_match = is_ip_match_router_if(sr, a_hdr->ar_tip);
             if(if_match) {
-				/* Send ARP reply */
-				uint8_t* buf;
-                buf=(uint8_t *)malloc(len);
-                assert(buf);
+				/* Send ARP reply, turned around in place */
                 memcpy(e_hdr->ether_dhost,e_hdr->ether_shost,ETHER_ADDR_LEN);
 			    memcpy(e_hdr->ether_shost,if_match->addr,ETHER_ADDR_LEN);
                 a_hdr->ar_op = htons(arp_op_reply);
@@ -280,58 +296,61 @@ void sr_handlepacket(struct sr_instance* sr,
                 memcpy(a_hdr->ar_tha,a_hdr->ar_sha,ETHER_ADDR_LEN);
                 memcpy(a_hdr->ar_sha,if_match->addr,ETHER_ADDR_LEN);
                 a_hdr->ar_sip = if_match->ip;
-                memcpy(buf,(uint8_t*)packet,len);
-                sr_send_packet(sr,buf,len,interface);
-                sr_arpcache_insert(&sr->cache,a_hdr->ar_tha,a_hdr->ar_tip); 
+                sr_send_packet(sr,packet,len,interface);
+                pthread_mutex_lock(&(sr->cache.lock));
+                if(sr_arpcache_insert(&sr->cache,a_hdr->ar_tha,a_hdr->ar_tip) == 0)
+                    sr_neigh_publish(sr);
+                else
+                    SR_WARN(SR_MOD_ARP, "ARP cache full, not learning the requester");
+                pthread_mutex_unlock(&(sr->cache.lock));
 
 #ifdef MYDEBUG
 				fprintf(stderr,"++++++++++++++++++ Sending ARP reply ++++++++++++++++++\n");
-			    print_hdrs(buf,len);
+			    print_hdrs(packet,len);
 				fprintf(stderr,"+++++++++++++++++++++++++++++++++++++++++++++++++++++++\n");
 #endif
-
-                free(buf);  
             }
             else {
-                fprintf(stderr,"ARP request detail:\n");
-                print_hdrs(packet,len);
+                SR_DEBUG(SR_MOD_ARP, "ARP request for %s, not ours",
+                         inet_ntoa(*(struct in_addr*)&a_hdr->ar_tip));
             }
         }/* end Handle ARP request */
 		else if( a_hdr->ar_op == htons(arp_op_reply) ) { /* Handle ARP reply */
 			unsigned char broadcast_adr[ETHER_ADDR_LEN];
-			struct sr_arpreq* req = 0; 
 			memset(broadcast_adr,0xff,ETHER_ADDR_LEN);
 			if(0 == memcmp(a_hdr->ar_tha,broadcast_adr,ETHER_ADDR_LEN)) {
-				fprintf(stderr,"Hacky!! Source MAC is broadcast address on ARP reply (o_O)\n");
+				SR_WARN(SR_MOD_ARP, "Hacky!! Source MAC is broadcast address on ARP reply (o_O)");
+				SR_STAT_INC(sr, drops);
+				SR_EVENT(sr, SR_EV_DROP, SR_DROP_BAD_ARP, packet, len, interface);
 				return;
 			}
 			if(0 == a_hdr->ar_sip) {
-				fprintf(stderr,"Invalid source IP in ARP reply (o_O)\n");
+				SR_WARN(SR_MOD_ARP, "Invalid source IP in ARP reply (o_O)");
+				SR_STAT_INC(sr, drops);
+				SR_EVENT(sr, SR_EV_DROP, SR_DROP_BAD_ARP, packet, len, interface);
 				return;
 			}
 			/* Not verifying the target IP */
-			req = sr_arpcache_insert(&sr->cache,a_hdr->ar_sha,a_hdr->ar_sip);
-			fprintf(stderr,"ARP cache updated for ");
-			print_addr_eth(a_hdr->ar_sha);
-			fprintf(stderr," <-> ");
-			print_addr_ip_int(ntohl(a_hdr->ar_sip));
-			fprintf(stderr,"\n");
-			
-			if(NULL != req) {
-				/* Send all packets waiting in queue */
-				while(req->packets) {
-					fprintf(stderr,"SEND WAITING PACKETS\n");
-
-					memcpy(((sr_ethernet_hdr_t*)req->packets->buf)->ether_dhost,a_hdr->ar_sha,ETHER_ADDR_LEN);
-					memcpy(((sr_ethernet_hdr_t*)req->packets->buf)->ether_shost,a_hdr->ar_tha,ETHER_ADDR_LEN);
-#ifdef MYDEBUG
-					print_hdrs(req->packets->buf,req->packets->len);
-#endif
-					sr_send_packet(sr,req->packets->buf,req->packets->len,req->packets->iface);
-					req->packets = req->packets->next;
-				}
-				sr_arpreq_destroy(&sr->cache, req);
+			pthread_mutex_lock(&(sr->cache.lock));
+			if(sr_arpcache_insert(&sr->cache,a_hdr->ar_sha,a_hdr->ar_sip) != 0) {
+				pthread_mutex_unlock(&(sr->cache.lock));
+				SR_WARN(SR_MOD_ARP, "ARP cache full, dropping reply from %s",
+				        inet_ntoa(*(struct in_addr*)&a_hdr->ar_sip));
+				SR_STAT_INC(sr, drops);
+				SR_EVENT(sr, SR_EV_DROP, SR_DROP_NEIGH_FULL, packet, len, interface);
+				return;
 			}
+			sr_neigh_publish(sr);
+			pthread_mutex_unlock(&(sr->cache.lock));
+			SR_EVENT_ADDR(sr, SR_EV_ARP_RESOLVED, 0, a_hdr->ar_sip, a_hdr->ar_sha, interface);
+			SR_INFO(SR_MOD_ARP, "ARP cache updated for %02x:%02x:%02x:%02x:%02x:%02x <-> %s",
+			        a_hdr->ar_sha[0], a_hdr->ar_sha[1], a_hdr->ar_sha[2],
+			        a_hdr->ar_sha[3], a_hdr->ar_sha[4], a_hdr->ar_sha[5],
+			        inet_ntoa(*(struct in_addr*)&a_hdr->ar_sip));
+
+			/* Send the packets this thread has waiting; other threads
+			   pick the update up from their own replica */
+			sr_neigh_poll(sr);
 		}
     }/* end Handle ARP */
 }/* end sr_ForwardPacket */
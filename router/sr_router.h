@@ -15,12 +15,10 @@
 
 #include "sr_protocol.h"
 #include "sr_arpcache.h"
+#include "sr_sched.h"
+#include "sr_icmp.h"
 
-#ifndef _DEBUG_
-#define _DEBUG_
-#endif /* enable debug */
-
-/* we dont like this debug , but what to do for varargs ? */
+/* startup chatter only; anything on the packet path goes through sr_log.h */
 #ifdef _DEBUG_
 #define Debug(x, args...) printf(x, ## args)
 #define DebugMAC(x) \
@@ -36,7 +34,40 @@
 
 /* forward declare */
 struct sr_if;
+struct sr_if_index;
 struct sr_rt;
+struct sr_backend;
+struct sr_capture;
+struct sr_workers;
+struct sr_neigh;
+struct sr_mbuf;
+struct sr_mbuf_pool;
+struct sr_icmp;
+struct sr_flows;
+struct sr_acl;
+struct sr_nat;
+struct sr_qos;
+struct sr_evlog;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_stats
+ *
+ * Router counters.  Bumped with relaxed atomics from whichever thread
+ * sees the event; read them with sr_stats_read().
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_stats
+{
+    unsigned long rx_packets;
+    unsigned long tx_packets;
+    unsigned long drops;        /* frames the router gave up on */
+    unsigned long icmp_unreach; /* ICMP destination unreachables sent */
+    unsigned long icmp_limited; /* ICMP errors the rate limits held back */
+};
+
+#define SR_STAT_INC(sr, f) \
+    __atomic_fetch_add(&(sr)->stats.f, 1, __ATOMIC_RELAXED)
 
 /* ----------------------------------------------------------------------------
  * struct sr_instance
@@ -54,17 +85,44 @@ struct sr_instance
     unsigned short topo_id;
     struct sockaddr_in sr_addr; /* address to server */
     struct sr_if* if_list; /* list of interfaces */
+    struct sr_if_index* ifindex; /* by id, name and address, see sr_if.c */
     struct sr_rt* routing_table; /* routing table */
     struct sr_arpcache cache;   /* ARP cache */
     pthread_attr_t attr;
-    FILE* logfile;
+    struct sr_capture* capture; /* -l packet capture */
+    struct sr_evlog* events;    /* -E binary event log */
+    struct sr_backend* backend; /* packet I/O backend */
+    void* backend_state;        /* owned by the backend */
+    pthread_mutex_t tx_lock;    /* serializes backend tx */
+    int tx_defer;               /* in a receive burst, tx may be batched */
+    struct sr_stats stats;
+    struct sr_workers* workers; /* -W worker pool, 0 = forward inline */
+    struct sr_neigh* neigh;     /* per-thread ARP replicas */
+    struct sr_mbuf_pool* mbufs; /* buffers for frames the router builds */
+    int pipeline;               /* -P: forward bursts in stages */
+    struct sr_sched sched;      /* -A/-a/-S/-M thread placement */
+    struct sr_icmp_limits icmp_limits;  /* -I */
+    struct sr_icmp* icmp;       /* error templates and rate limits */
+    struct sr_flows* flows;     /* per-thread flow caches, see sr_flow.h */
+    uint32_t flow_gen;          /* bumped when a cached decision may change */
+    struct sr_acl** acl;        /* -X, [2 * ifid + dir], 0 = no rules */
+    int acl_n;                  /* interfaces in acl */
+    struct sr_nat* nat;         /* -N address translation, see sr_nat.h */
+    int nat_ifid;               /* its outside interface */
+    struct sr_qos* qos;         /* -Q egress queues, see sr_qos.h */
 };
 
 /* -- sr_main.c -- */
 int sr_verify_routing_table(struct sr_instance* sr);
+void sr_stats_read(struct sr_instance* , struct sr_stats* );
 
-/* -- sr_vns_comm.c -- */
+/* -- sr_backend.c -- */
 int sr_send_packet(struct sr_instance* , uint8_t* , unsigned int , const char*);
+int sr_send_packet_if(struct sr_instance* , uint8_t* , unsigned int ,
+                      struct sr_if* );
+int sr_send_mbuf(struct sr_instance* , struct sr_mbuf* , struct sr_if* );
+
+/* -- sr_vns_comm.c -- */
 int sr_connect_to_server(struct sr_instance* ,unsigned short , char* );
 int sr_read_from_server(struct sr_instance* );
 
@@ -76,6 +134,7 @@ void sr_handlepacket(struct sr_instance* , uint8_t * , unsigned int , char* );
 void sr_add_interface(struct sr_instance* , const char* );
 void sr_set_ether_ip(struct sr_instance* , uint32_t );
 void sr_set_ether_addr(struct sr_instance* , const unsigned char* );
+void sr_set_ether_speed(struct sr_instance* , uint32_t );
 void sr_print_if_list(struct sr_instance* );
 
 #endif /* SR_ROUTER_H */
@@ -22,6 +22,27 @@
 #include "sr_rt.h"
 #include "sr_router.h"
 #include "sr_utils.h"
+#include "sr_flow.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_bind(..)
+ *
+ * Point entry at its interface's id.  The table is usually loaded before
+ * the interfaces are known, so sr_verify_routing_table() binds it again.
+ * Every change to a route comes through here, so this is also where
+ * cached forwarding decisions are invalidated.  Returns 0 if the
+ * interface doesn't exist (yet).
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rt_bind(struct sr_instance* sr, struct sr_rt* entry)
+{
+    struct sr_if* iface = sr_get_interface(sr, entry->interface);
+
+    entry->ifid = iface ? iface->id : -1;
+    sr_flow_invalidate(sr);
+    return iface != 0;
+} /* -- sr_rt_bind -- */
 
 /*---------------------------------------------------------------------
  * Method:
@@ -110,6 +131,7 @@ struct in_addr gw, struct in_addr mask,char* if_name)
         sr->routing_table->gw   = gw;
         sr->routing_table->mask = mask;
         strncpy(sr->routing_table->interface,if_name,sr_IFACE_NAMELEN);
+        sr_rt_bind(sr, sr->routing_table);
 
         return;
     }
@@ -129,6 +151,7 @@ struct in_addr gw, struct in_addr mask,char* if_name)
     rt_walker->gw   = gw;
     rt_walker->mask = mask;
     strncpy(rt_walker->interface,if_name,sr_IFACE_NAMELEN);
+    sr_rt_bind(sr, rt_walker);
 
 } /* -- sr_add_entry -- */
 
@@ -182,7 +205,6 @@ void sr_print_routing_entry(struct sr_rt* entry)
 	Search through the routing table for longest IP match
 */
 struct sr_rt* sr_get_longest_rt_table_match(struct sr_rt* rt_walker,in_addr_t ip) {
-	fprintf(stderr,"TODO: implement longest prefix\n");
 	while(rt_walker) {
 		if(rt_walker->dest.s_addr == ip)
 			return rt_walker;
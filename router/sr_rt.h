@@ -33,6 +33,7 @@ struct sr_rt
     struct in_addr gw;
     struct in_addr mask;
     char   interface[sr_IFACE_NAMELEN];
+    int    ifid;            /* id of interface, -1 until it exists */
     struct sr_rt* next;
 };
 
@@ -40,6 +41,7 @@ struct sr_rt
 int sr_load_rt(struct sr_instance*,const char*);
 void sr_add_rt_entry(struct sr_instance*, struct in_addr,struct in_addr,
                   struct in_addr, char*);
+int  sr_rt_bind(struct sr_instance*, struct sr_rt*);
 void sr_print_routing_table(struct sr_instance* sr);
 void sr_print_routing_entry(struct sr_rt* entry);
 struct sr_rt* sr_get_longest_rt_table_match(struct sr_rt* rt_walker,in_addr_t ip);
@@ -0,0 +1,296 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_sched.c
+ *
+ * Description:
+ *
+ * CPU affinity, real-time priority, NUMA memory policy and mlockall() for
+ * the router's threads, see sr_sched.h.
+ *
+ * The memory policy is set with the raw set_mempolicy() system call so
+ * there is no dependency on libnuma.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifdef _LINUX_
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#endif /* _LINUX_ */
+
+#include "sr_sched.h"
+#include "sr_router.h"
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_sched_init(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_sched_init(struct sr_sched* s)
+{
+    /* REQUIRES */
+    assert(s);
+
+    memset(s, 0, sizeof(struct sr_sched));
+    s->arp_cpu = -1;
+} /* -- sr_sched_init -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_sched_parse_cpus(..)
+ * Scope: Global
+ *
+ * Parse a CPU list like "0,2,4-7" into s->cpus.  Returns 0 on success,
+ * -1 on a malformed list.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_sched_parse_cpus(struct sr_sched* s, const char* list)
+{
+    const char* p = list;
+    char* end;
+    long lo, hi;
+
+    /* REQUIRES */
+    assert(s);
+    assert(list);
+
+    s->ncpus = 0;
+    while (*p)
+    {
+        lo = strtol(p, &end, 10);
+        if (end == p)
+        { break; }
+        hi = lo;
+        if (*end == '-')
+        {
+            p  = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p)
+            { break; }
+        }
+        if (lo < 0 || hi < lo || hi >= CPU_SETSIZE)
+        { break; }
+
+        for (; lo <= hi && s->ncpus < SR_SCHED_MAX_CPUS; lo++)
+        { s->cpus[s->ncpus++] = (int)lo; }
+
+        p = end;
+        if (*p == ',')
+        { p++; }
+        else if (*p)
+        { break; }
+    }
+
+    if (*p || s->ncpus == 0)
+    {
+        fprintf(stderr, "Bad CPU list \"%s\"\n", list);
+        s->ncpus = 0;
+        return -1;
+    }
+    return 0;
+} /* -- sr_sched_parse_cpus -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_sched_cpu_node(..)
+ * Scope: Local
+ *
+ * NUMA node of cpu, from sysfs.  -1 if it can't be told.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_sched_cpu_node(int cpu)
+{
+    char path[64];
+    DIR* dir;
+    struct dirent* de;
+    int node = -1;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    if ((dir = opendir(path)) == 0)
+    { return -1; }
+
+    while ((de = readdir(dir)) != 0)
+    {
+        if (sscanf(de->d_name, "node%d", &node) == 1)
+        { break; }
+        node = -1;
+    }
+    closedir(dir);
+
+    return node;
+} /* -- sr_sched_cpu_node -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_sched_pin(..)
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_sched_pin(pthread_t thread, int cpu, const char* who)
+{
+    cpu_set_t set;
+    int err;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if ((err = pthread_setaffinity_np(thread, sizeof(set), &set)) != 0)
+    {
+        fprintf(stderr, "pthread_setaffinity_np(..):sr_sched.c::%s: "
+                "cpu %d: %s\n", who, cpu, strerror(err));
+        return -1;
+    }
+    return 0;
+} /* -- sr_sched_pin -- */
+
+static int sr_sched_fifo(pthread_t thread, int prio, const char* who)
+{
+    struct sched_param param;
+    int err;
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = prio;
+    if ((err = pthread_setschedparam(thread, SCHED_FIFO, &param)) != 0)
+    {
+        fprintf(stderr, "pthread_setschedparam(..):sr_sched.c::%s: "
+                "SCHED_FIFO %d: %s\n", who, prio, strerror(err));
+        return -1;
+    }
+    return 0;
+} /* -- sr_sched_fifo -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_sched_forwarder(..)
+ * Scope: Global
+ *
+ * Called by a forwarding thread on itself, before it allocates anything:
+ * idx 0 is the receive loop, idx i+1 is worker i.  Returns 0 if everything
+ * asked for was done, -1 if not.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_sched_forwarder(struct sr_instance* sr, int idx)
+{
+    struct sr_sched* s;
+    unsigned long mask[4];
+    int cpu, node, ret = 0;
+
+    /* REQUIRES */
+    assert(sr);
+
+    s = &sr->sched;
+
+    if (s->ncpus > 0)
+    {
+        cpu = s->cpus[idx % s->ncpus];
+        if (sr_sched_pin(pthread_self(), cpu, "sr_sched_forwarder") != 0)
+        { ret = -1; }
+        else if ((node = sr_sched_cpu_node(cpu)) >= 0 &&
+                 node < (int)(sizeof(mask) * 8))
+        {
+#ifdef _LINUX_
+            memset(mask, 0, sizeof(mask));
+            mask[node / (8 * sizeof(long))] |= 1UL << (node % (8 * sizeof(long)));
+            if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask,
+                        sizeof(mask) * 8) != 0)
+            {
+                perror("set_mempolicy(..):sr_sched.c::sr_sched_forwarder");
+                ret = -1;
+            }
+#endif /* _LINUX_ */
+        }
+    }
+
+    if (s->prio > 0 &&
+        sr_sched_fifo(pthread_self(), s->prio, "sr_sched_forwarder") != 0)
+    { ret = -1; }
+
+    return ret;
+} /* -- sr_sched_forwarder -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_sched_housekeeping(..)
+ * Scope: Global
+ *
+ * Place a background thread (the ARP timer, the capture writer) once it
+ * has been created.  It would otherwise inherit whatever its creator was
+ * given, so with -A but no -a it goes back to the CPUs the process started
+ * with.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_sched_housekeeping(struct sr_instance* sr, pthread_t thread)
+{
+    struct sr_sched* s;
+    struct sched_param param;
+    int err;
+
+    /* REQUIRES */
+    assert(sr);
+
+    s = &sr->sched;
+
+    if (s->arp_cpu >= 0)
+    { sr_sched_pin(thread, s->arp_cpu, "sr_sched_housekeeping"); }
+    else if (s->ncpus > 0 &&
+             (err = pthread_setaffinity_np(thread, sizeof(s->floating),
+                                           &s->floating)) != 0)
+    {
+        fprintf(stderr, "pthread_setaffinity_np(..):sr_sched.c::"
+                "sr_sched_housekeeping: %s\n", strerror(err));
+    }
+
+    if (s->prio > 1)
+    { sr_sched_fifo(thread, s->prio - 1, "sr_sched_housekeeping"); }
+    else if (s->prio == 1)
+    {
+        /* -- no room below the forwarders, stay time shared -- */
+        memset(&param, 0, sizeof(param));
+        pthread_setschedparam(thread, SCHED_OTHER, &param);
+    }
+} /* -- sr_sched_housekeeping -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_sched_start(..)
+ * Scope: Global
+ *
+ * Called once from main() before anything is allocated: lock memory if
+ * asked to and place the receive loop (the calling thread).
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_sched_start(struct sr_instance* sr)
+{
+    struct sr_sched* s;
+    int ret = 0;
+
+    /* REQUIRES */
+    assert(sr);
+
+    s = &sr->sched;
+
+    if (sched_getaffinity(0, sizeof(s->floating), &s->floating) != 0)
+    {
+        perror("sched_getaffinity(..):sr_sched.c::sr_sched_start");
+        CPU_ZERO(&s->floating);
+    }
+
+    if (s->mlock && mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+    {
+        perror("mlockall(..):sr_sched.c::sr_sched_start");
+        ret = -1;
+    }
+
+    if ((s->ncpus > 0 || s->prio > 0) && sr_sched_forwarder(sr, 0) != 0)
+    { ret = -1; }
+
+    return ret;
+} /* -- sr_sched_start -- */
@@ -0,0 +1,51 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_sched.h
+ *
+ * Description:
+ *
+ * CPU placement for the router's threads.
+ *
+ *  -A cpus   forwarding threads are pinned to this list ("0,2,4-7"): the
+ *            receive loop to the first CPU, -W worker i to the (i+1)th,
+ *            wrapping around.  Each one also prefers memory from its
+ *            CPU's NUMA node, so what it allocates and first touches (the
+ *            FIB, interface list and ARP state for the receive loop, which
+ *            is pinned before any of those exist) stays local.
+ *  -a cpu    the ARP timer and capture writer threads are pinned to this
+ *            CPU.  Without it they keep the CPUs the process started on.
+ *  -S prio   forwarding threads run SCHED_FIFO at prio, the ARP timer and
+ *            capture writer one below.
+ *  -M        mlockall() everything, current and future.
+ *
+ * Failures are reported and otherwise ignored; the router still runs,
+ * just not where it was asked to.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_SCHED_H
+#define SR_SCHED_H
+
+#include <pthread.h>
+#include <sched.h>
+
+#define SR_SCHED_MAX_CPUS 64
+
+struct sr_instance;
+
+struct sr_sched
+{
+    int ncpus;                  /* 0 = forwarding threads float */
+    int cpus[SR_SCHED_MAX_CPUS];
+    int arp_cpu;                /* -1 = ARP thread floats */
+    int prio;                   /* SCHED_FIFO priority, 0 = don't */
+    int mlock;
+    cpu_set_t floating;         /* affinity the process started with */
+};
+
+void sr_sched_init(struct sr_sched* );
+int  sr_sched_parse_cpus(struct sr_sched* , const char* list);
+int  sr_sched_start(struct sr_instance* );
+int  sr_sched_forwarder(struct sr_instance* , int idx);
+void sr_sched_housekeeping(struct sr_instance* , pthread_t );
+
+#endif /* -- SR_SCHED_H -- */
@@ -0,0 +1,289 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_shm.c
+ *
+ * Description:
+ *
+ * Shared memory region setup for both sides of the rings.  See sr_shm.h
+ * for the layout and sr_shm_comm.c for the backend sr runs on top of it.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sr_shm.h"
+
+#define SR_SHM_ALIGN(x) (((x) + SR_CACHELINE - 1) & ~(SR_CACHELINE - 1))
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_shm_map(..)
+ * Scope: Local
+ *
+ * Map the region behind 'fd'.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_shm_map(struct sr_shm* shm, int fd, size_t size)
+{
+    void* p;
+
+    p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        perror("mmap(..):sr_shm.c::sr_shm_map");
+        return -1;
+    }
+
+    shm->base = (uint8_t*)p;
+    shm->size = size;
+    shm->fd   = fd;
+    shm->rgn  = (struct sr_shm_region*)p;
+
+    return 0;
+} /* -- sr_shm_map -- */
+
+static void sr_shm_bind(struct sr_shm* shm, int router)
+{
+    struct sr_shm_region* rgn = shm->rgn;
+    int rx = router ? SR_SHM_TO_ROUTER : SR_SHM_FROM_ROUTER;
+    int tx = router ? SR_SHM_FROM_ROUTER : SR_SHM_TO_ROUTER;
+
+    shm->rx  = &rgn->ring[rx];
+    shm->rxd = (struct sr_shm_desc*)(shm->base + rgn->desc_off[rx]);
+    shm->tx  = &rgn->ring[tx];
+    shm->txd = (struct sr_shm_desc*)(shm->base + rgn->desc_off[tx]);
+    shm->tx_buf_off = rgn->buf_off[tx];
+    shm->slot_size  = rgn->slot_size;
+} /* -- sr_shm_bind -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_shm_check(..)
+ * Scope: Local
+ *
+ * The layout comes from the peer: check that the descriptor arrays and
+ * buffer areas of both directions lie inside the mapping, past the
+ * region header, and that the rings agree with nslots.  Returns 0 if
+ * they do.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_shm_check(struct sr_shm* shm)
+{
+    struct sr_shm_region* rgn = shm->rgn;
+    uint64_t nslots = rgn->nslots;
+    int d;
+
+    if (nslots == 0 || (nslots & (nslots - 1)) != 0 || rgn->slot_size == 0)
+    { return -1; }
+
+    for (d = 0; d < 2; d++)
+    {
+        if (rgn->desc_off[d] < sizeof(struct sr_shm_region) ||
+            rgn->desc_off[d] % sizeof(uint32_t) != 0 ||
+            rgn->desc_off[d] + nslots * sizeof(struct sr_shm_desc) >
+            shm->size)
+        { return -1; }
+        if (rgn->buf_off[d] < sizeof(struct sr_shm_region) ||
+            rgn->buf_off[d] + nslots * rgn->slot_size > shm->size)
+        { return -1; }
+        if (rgn->ring[d].size != nslots || rgn->ring[d].mask != nslots - 1)
+        { return -1; }
+    }
+    return 0;
+} /* -- sr_shm_check -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_shm_create(..)
+ * Scope: Global
+ *
+ * Create and lay out a region with 'nslots' (power of two) slots per
+ * direction.  With a name the region is a POSIX shm object, without one
+ * it is an anonymous memfd whose descriptor (shm->fd) can be inherited.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_shm_create(struct sr_shm* shm, const char* name, uint32_t nslots)
+{
+    struct sr_shm_region* rgn;
+    size_t size, off;
+    int fd, d;
+
+    /* REQUIRES */
+    assert(shm);
+
+    if (nslots == 0 || (nslots & (nslots - 1)) != 0)
+    {
+        fprintf(stderr, "sr_shm_create: slot count must be a power of two\n");
+        return -1;
+    }
+
+    memset(shm, 0, sizeof(*shm));
+
+    off  = SR_SHM_ALIGN(sizeof(struct sr_shm_region));
+    size = off + 2 * SR_SHM_ALIGN(nslots * sizeof(struct sr_shm_desc)) +
+           2 * (size_t)nslots * SR_SHM_SLOT_SIZE;
+
+    if (name)
+    {
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd < 0 && errno == EEXIST)
+        {
+            shm_unlink(name);
+            fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+        }
+        strncpy(shm->name, name, sizeof(shm->name) - 1);
+    }
+    else
+    { fd = memfd_create("sr_shm", 0); }
+
+    if (fd < 0)
+    {
+        perror("shm_open/memfd_create(..):sr_shm.c::sr_shm_create");
+        return -1;
+    }
+    if (ftruncate(fd, size) != 0)
+    {
+        perror("ftruncate(..):sr_shm.c::sr_shm_create");
+        close(fd);
+        return -1;
+    }
+    if (sr_shm_map(shm, fd, size) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    shm->owner = 1;
+
+    rgn = shm->rgn;
+    memset(rgn, 0, sizeof(*rgn));
+    rgn->version   = SR_SHM_VERSION;
+    rgn->size      = size;
+    rgn->nslots    = nslots;
+    rgn->slot_size = SR_SHM_SLOT_SIZE;
+
+    for (d = 0; d < 2; d++)
+    {
+        rgn->desc_off[d] = off;
+        off += SR_SHM_ALIGN(nslots * sizeof(struct sr_shm_desc));
+    }
+    for (d = 0; d < 2; d++)
+    {
+        rgn->buf_off[d] = off;
+        off += (size_t)nslots * SR_SHM_SLOT_SIZE;
+        sr_ring_init(&rgn->ring[d], nslots);
+    }
+
+    sr_shm_bind(shm, 0);
+
+    return 0;
+} /* -- sr_shm_create -- */
+
+/* make the region visible to sr, once the interfaces are added */
+void sr_shm_publish(struct sr_shm* shm)
+{
+    __atomic_store_n(&shm->rgn->magic, SR_SHM_MAGIC, __ATOMIC_RELEASE);
+} /* -- sr_shm_publish -- */
+
+int sr_shm_add_iface(struct sr_shm* shm, const char* name,
+                     const uint8_t* addr, uint32_t ip, uint32_t mask,
+                     uint32_t speed)
+{
+    struct sr_shm_iface* iface;
+
+    if (shm->rgn->nifaces >= SR_SHM_MAX_IFACES)
+    { return -1; }
+
+    iface = &shm->rgn->ifaces[shm->rgn->nifaces];
+    memset(iface, 0, sizeof(*iface));
+    strncpy(iface->name, name, SR_SHM_IFNAMELEN - 1);
+    memcpy(iface->addr, addr, 6);
+    iface->ip    = ip;
+    iface->mask  = mask;
+    iface->speed = speed;
+
+    return shm->rgn->nifaces++;
+} /* -- sr_shm_add_iface -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_shm_attach(..)
+ * Scope: Global
+ *
+ * Attach the router side to an existing region.  'spec' is either the
+ * shm object name (/name) or fd=N for an inherited descriptor.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_shm_attach(struct sr_shm* shm, const char* spec)
+{
+    struct stat st;
+    struct sr_shm_region* rgn;
+    int fd;
+
+    /* REQUIRES */
+    assert(shm);
+    assert(spec);
+
+    memset(shm, 0, sizeof(*shm));
+
+    if (strncmp(spec, "fd=", 3) == 0)
+    { fd = atoi(spec + 3); }
+    else
+    {
+        if ((fd = shm_open(spec, O_RDWR, 0)) < 0)
+        {
+            perror("shm_open(..):sr_shm.c::sr_shm_attach");
+            return -1;
+        }
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(struct sr_shm_region))
+    {
+        fprintf(stderr, "sr_shm_attach: %s is not a shm region\n", spec);
+        close(fd);
+        return -1;
+    }
+    if (sr_shm_map(shm, fd, st.st_size) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    rgn = shm->rgn;
+    if (__atomic_load_n(&rgn->magic, __ATOMIC_ACQUIRE) != SR_SHM_MAGIC ||
+        rgn->version != SR_SHM_VERSION || rgn->size != shm->size ||
+        rgn->nifaces > SR_SHM_MAX_IFACES || sr_shm_check(shm) != 0)
+    {
+        fprintf(stderr, "sr_shm_attach: bad or incompatible region %s\n", spec);
+        sr_shm_detach(shm);
+        return -1;
+    }
+
+    sr_shm_bind(shm, 1);
+    __atomic_store_n(&rgn->router_attached, 1, __ATOMIC_RELEASE);
+
+    return 0;
+} /* -- sr_shm_attach -- */
+
+void sr_shm_detach(struct sr_shm* shm)
+{
+    if (shm->base == 0)
+    { return; }
+
+    if (!shm->owner)
+    { __atomic_store_n(&shm->rgn->router_attached, 0, __ATOMIC_RELEASE); }
+    __atomic_store_n(&shm->rgn->closed, 1, __ATOMIC_RELEASE);
+
+    munmap(shm->base, shm->size);
+    close(shm->fd);
+    if (shm->owner && shm->name[0])
+    { shm_unlink(shm->name); }
+    shm->base = 0;
+} /* -- sr_shm_detach -- */
@@ -0,0 +1,150 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_shm.h
+ *
+ * Description:
+ *
+ * Shared memory transport.  sr and a co-located process (traffic
+ * generator, test harness, next function in a service chain) exchange
+ * frames through two single-producer/single-consumer rings in a
+ * shm_open() or memfd region:
+ *
+ *   +--------------------+  region header, interface table, ring indices
+ *   | sr_shm_region      |
+ *   +--------------------+
+ *   | descriptors  x2    |  one sr_shm_desc per ring slot
+ *   +--------------------+
+ *   | packet buffers x2  |  nslots * slot_size per direction
+ *   +--------------------+
+ *
+ * A descriptor holds the offset of its frame from the start of the
+ * region, so a producer may point it at any buffer of its own direction.
+ * By default slot i uses buffer i.  The data path makes no system calls;
+ * received frames are processed in place.
+ *
+ * The peer creates the region and describes the interfaces; sr attaches
+ * with "-B shm:/name" (or "-B shm:fd=N" for an inherited memfd).
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_SHM_H
+#define SR_SHM_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stddef.h>
+
+#include "sr_ring.h"
+
+#define SR_SHM_MAGIC        0x5352534d  /* "SRSM" */
+#define SR_SHM_VERSION      1
+#define SR_SHM_MAX_IFACES   16
+#define SR_SHM_IFNAMELEN    16
+#define SR_SHM_DEF_SLOTS    1024
+#define SR_SHM_SLOT_SIZE    2048
+
+/* ring directions */
+#define SR_SHM_TO_ROUTER    0
+#define SR_SHM_FROM_ROUTER  1
+
+struct sr_shm_iface
+{
+    char     name[SR_SHM_IFNAMELEN];
+    uint8_t  addr[6];
+    uint8_t  pad[2];
+    uint32_t ip;                /* nbo */
+    uint32_t mask;              /* nbo */
+    uint32_t speed;             /* Mbit/s, 0 = unknown */
+};
+
+struct sr_shm_desc
+{
+    uint32_t off;               /* frame offset from start of region */
+    uint16_t len;
+    uint16_t iface;             /* index into the interface table */
+};
+
+struct sr_shm_region
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;              /* bytes in the whole region */
+    uint32_t nslots;            /* per ring, power of two */
+    uint32_t slot_size;
+    uint32_t nifaces;
+    uint32_t router_attached;
+    uint32_t closed;            /* set by either side to end the session */
+    uint32_t desc_off[2];
+    uint32_t buf_off[2];
+    struct sr_shm_iface ifaces[SR_SHM_MAX_IFACES];
+    struct sr_ring ring[2];
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_shm
+ *
+ * One side's handle on a region.  rx/tx are the rings this side consumes
+ * and produces.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_shm
+{
+    uint8_t* base;
+    size_t   size;
+    int      fd;
+    int      owner;             /* created the region, unlinks it */
+    char     name[64];
+    struct sr_shm_region* rgn;
+    struct sr_ring*     rx;
+    struct sr_shm_desc* rxd;
+    struct sr_ring*     tx;
+    struct sr_shm_desc* txd;
+    uint32_t tx_buf_off;
+    uint32_t slot_size;         /* copied at bind, the peer can't change it */
+};
+
+/* -- setup: peer creates (name 0 = anonymous memfd), sr attaches -- */
+int  sr_shm_create(struct sr_shm* , const char* name, uint32_t nslots);
+int  sr_shm_add_iface(struct sr_shm* , const char* name,
+                      const uint8_t* addr, uint32_t ip, uint32_t mask,
+                      uint32_t speed);
+void sr_shm_publish(struct sr_shm* );
+int  sr_shm_attach(struct sr_shm* , const char* spec);
+void sr_shm_detach(struct sr_shm* );
+
+/* -- data path -- */
+
+/* frame buffer behind a descriptor, 0 if the descriptor is bogus */
+static __inline__ uint8_t* sr_shm_frame(struct sr_shm* shm,
+                                        struct sr_shm_desc* d)
+{
+    if ((size_t)d->off + d->len > shm->size)
+    { return 0; }
+    return shm->base + d->off;
+}
+
+/* i-th free tx slot: its descriptor, pointed at the slot's own buffer */
+static __inline__ struct sr_shm_desc* sr_shm_tx_desc(struct sr_shm* shm,
+                                                     uint32_t i)
+{
+    uint32_t slot = sr_ring_head_slot(shm->tx, i);
+    struct sr_shm_desc* d = &shm->txd[slot];
+
+    d->off = shm->tx_buf_off + slot * shm->slot_size;
+    return d;
+}
+
+/* i-th received descriptor */
+static __inline__ struct sr_shm_desc* sr_shm_rx_desc(struct sr_shm* shm,
+                                                     uint32_t i)
+{
+    return &shm->rxd[sr_ring_tail_slot(shm->rx, i)];
+}
+
+#endif /* -- SR_SHM_H -- */
@@ -0,0 +1,248 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_shm_comm.c
+ *
+ * Description:
+ *
+ * The "shm" packet I/O backend: sr's side of the shared memory rings set
+ * up by sr_shm.c.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include "sr_shm.h"
+#include "sr_backend.h"
+#include "sr_router.h"
+#include "sr_if.h"
+
+/* ----------------------------------------------------------------------------
+ * struct sr_shm_state
+ *
+ * sr side of the backend.  The interface count and names are copied out
+ * of the region at attach time so the peer can't change them under the
+ * router.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_shm_state
+{
+    struct sr_shm shm;
+    uint32_t rx_held;           /* frames handed out by the last rx_burst */
+    uint32_t nifaces;
+    char ifnames[SR_SHM_MAX_IFACES][sr_IFACE_NAMELEN];
+};
+
+/*-----------------------------------------------------------------------------
+ * shm backend operations
+ *---------------------------------------------------------------------------*/
+
+static int sr_shm_open(struct sr_instance* sr, const char* arg)
+{
+    struct sr_shm_state* st;
+
+    if (arg == 0 || *arg == 0)
+    {
+        fprintf(stderr, "shm backend expects /name or fd=N\n");
+        return -1;
+    }
+
+    st = (struct sr_shm_state*)calloc(1, sizeof(struct sr_shm_state));
+    assert(st);
+
+    if (sr_shm_attach(&st->shm, arg) != 0)
+    {
+        free(st);
+        return -1;
+    }
+    st->nifaces = st->shm.rgn->nifaces;
+
+    sr->backend_state = st;
+    return 0;
+} /* -- sr_shm_open -- */
+
+static int sr_shm_get_interfaces(struct sr_instance* sr)
+{
+    struct sr_shm_state* st = (struct sr_shm_state*)sr->backend_state;
+    struct sr_shm_region* rgn = st->shm.rgn;
+    int i;
+
+    for (i = 0; i < st->nifaces; i++)
+    {
+        memcpy(st->ifnames[i], rgn->ifaces[i].name, SR_SHM_IFNAMELEN);
+        st->ifnames[i][SR_SHM_IFNAMELEN - 1] = 0;
+
+        sr_add_interface(sr, st->ifnames[i]);
+        sr_set_ether_addr(sr, rgn->ifaces[i].addr);
+        sr_set_ether_ip(sr, rgn->ifaces[i].ip);
+        sr_set_ether_speed(sr, rgn->ifaces[i].speed);
+    }
+    /* -- so region index and interface id are the same thing -- */
+    assert(sr_if_count(sr) == st->nifaces);
+
+    printf("Router interfaces:\n");
+    sr_print_if_list(sr);
+
+    if (sr_verify_routing_table(sr) != 0)
+    {
+        fprintf(stderr,"Routing table not consistent with hardware\n");
+        return -1;
+    }
+    printf(" <-- Ready to process packets --> \n");
+
+    return st->nifaces;
+} /* -- sr_shm_get_interfaces -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_shm_rx_burst(..)
+ * Scope: Local
+ *
+ * Frames are used in place, so the slots of the previous burst are only
+ * given back to the peer here.  Busy polls while the ring is empty.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_shm_rx_burst(struct sr_instance* sr, struct sr_frame* frames,
+                           int max)
+{
+    struct sr_shm_state* st = (struct sr_shm_state*)sr->backend_state;
+    struct sr_shm* shm = &st->shm;
+    struct sr_shm_desc d;
+    unsigned int spins = 0;
+    uint32_t n, i;
+    int got = 0;
+
+    if (st->rx_held)
+    {
+        sr_ring_consume(shm->rx, st->rx_held);
+        st->rx_held = 0;
+    }
+
+    while ((n = sr_ring_count(shm->rx)) == 0)
+    {
+        if (__atomic_load_n(&shm->rgn->closed, __ATOMIC_ACQUIRE))
+        {
+            fprintf(stderr, "shm peer closed the session\n");
+            return -1;
+        }
+        sr_ring_relax(spins++);
+    }
+
+    if (n > max)
+    { n = max; }
+
+    for (i = 0; i < n; i++)
+    {
+        /* -- the peer owns the descriptor, read it exactly once -- */
+        d = *sr_shm_rx_desc(shm, i);
+        if (d.iface >= st->nifaces ||
+            (frames[got].buf = sr_shm_frame(shm, &d)) == 0)
+        { continue; } /* -- bogus descriptor, drop it -- */
+
+        frames[got].len   = d.len;
+        frames[got].iface = st->ifnames[d.iface];
+        frames[got].ifid  = d.iface;
+        got++;
+    }
+
+    st->rx_held = n;
+    return got;
+} /* -- sr_shm_rx_burst -- */
+
+static int sr_shm_ifindex(struct sr_instance* sr, struct sr_shm_state* st,
+                          const struct sr_frame* frame)
+{
+    struct sr_if* iface;
+
+    if (frame->ifid >= 0)
+    { return frame->ifid < st->nifaces ? frame->ifid : -1; }
+    iface = sr_get_interface(sr, frame->iface);
+    return iface ? iface->id : -1;
+} /* -- sr_shm_ifindex -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_shm_tx_burst(..)
+ * Scope: Local
+ *
+ * Copy frames into free tx slots and publish them with one index update.
+ * Waits for the peer if the ring is full.  Frames too big for a slot or
+ * for an interface the peer doesn't have are skipped; the return value
+ * counts only what went into the ring, so the caller books the rest as
+ * drops.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_shm_tx_burst(struct sr_instance* sr, struct sr_frame* frames,
+                           int n)
+{
+    struct sr_shm_state* st = (struct sr_shm_state*)sr->backend_state;
+    struct sr_shm* shm = &st->shm;
+    struct sr_shm_desc* d;
+    unsigned int spins = 0;
+    uint32_t space = 0, used = 0;
+    int i, ifindex, sent = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        if (frames[i].len > shm->slot_size ||
+            (ifindex = sr_shm_ifindex(sr, st, &frames[i])) < 0)
+        { continue; }
+
+        while (used == space)
+        {
+            if (used)
+            {
+                sr_ring_produce(shm->tx, used);
+                used = 0;
+            }
+            if ((space = sr_ring_free(shm->tx)) > 0)
+            { break; }
+            if (__atomic_load_n(&shm->rgn->closed, __ATOMIC_ACQUIRE))
+            { return -1; }
+            sr_ring_relax(spins++);
+        }
+
+        d = sr_shm_tx_desc(shm, used);
+        d->len   = frames[i].len;
+        d->iface = ifindex;
+        memcpy(shm->base + d->off, frames[i].buf, frames[i].len);
+        used++;
+        sent++;
+    }
+
+    if (used)
+    { sr_ring_produce(shm->tx, used); }
+
+    return sent;
+} /* -- sr_shm_tx_burst -- */
+
+static int sr_shm_poll_fd(struct sr_instance* sr)
+{
+    return -1;
+} /* -- sr_shm_poll_fd -- */
+
+static void sr_shm_close(struct sr_instance* sr)
+{
+    struct sr_shm_state* st = (struct sr_shm_state*)sr->backend_state;
+
+    if (st)
+    {
+        sr_shm_detach(&st->shm);
+        free(st);
+        sr->backend_state = 0;
+    }
+} /* -- sr_shm_close -- */
+
+struct sr_backend sr_shm_backend = {
+    "shm",
+    sr_shm_open,
+    sr_shm_rx_burst,
+    sr_shm_tx_burst,
+    0,
+    0,
+    sr_shm_get_interfaces,
+    sr_shm_poll_fd,
+    sr_shm_close
+};
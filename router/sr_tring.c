@@ -0,0 +1,64 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_tring.c
+ *
+ * Description:
+ *
+ * Per-thread ring registry, see sr_tring.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <assert.h>
+#include <pthread.h>
+
+#include "sr_tring.h"
+
+void sr_tring_init(struct sr_tring_set* s, void* (*create)(void))
+{
+    /* REQUIRES */
+    assert(s);
+    assert(create);
+
+    s->nrings = 0;
+    s->lost   = 0;
+    s->create = create;
+    pthread_mutex_init(&s->lock, 0);
+} /* -- sr_tring_init -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_tring_register(..)
+ * Scope: Global
+ *
+ * Slow path of sr_tring_get(): give the calling thread a ring of its own
+ * in s, or 0 once SR_MAX_THREADS threads have one, and remember the
+ * answer in m either way.
+ *
+ *---------------------------------------------------------------------------*/
+
+void* sr_tring_register(struct sr_tring_set* s, struct sr_tring_mine* m)
+{
+    void* r = 0;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->nrings < SR_MAX_THREADS && (r = s->create()) != 0)
+    {
+        m->index = s->nrings;
+        s->rings[s->nrings] = r;
+        __atomic_store_n(&s->nrings, s->nrings + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    m->set  = s;
+    m->ring = r;
+    return r;
+} /* -- sr_tring_register -- */
+
+/* -- once the producers and the consumer are done: free every ring -- */
+void sr_tring_destroy(struct sr_tring_set* s, void (*destroy)(void* ))
+{
+    int i;
+
+    for (i = 0; i < s->nrings; i++)
+    { destroy(s->rings[i]); }
+    s->nrings = 0;
+    pthread_mutex_destroy(&s->lock);
+} /* -- sr_tring_destroy -- */
@@ -0,0 +1,75 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_tring.h
+ *
+ * Description:
+ *
+ * Per-thread ring registry shared by capture, the event log and logging:
+ * every thread that produces gets its own single-producer ring (see
+ * sr_ring.h) the first time it asks, and one consumer thread walks all of
+ * them.  The user's create callback makes the ring, so it can be any
+ * struct; the registry only keeps the pointers.
+ *
+ * Registering takes the set's lock; after that a thread finds its ring in
+ * a __thread struct sr_tring_mine without one.  rings[] only grows, and
+ * nrings is published with release after the new entry is written, so the
+ * consumer can walk rings[0..sr_tring_count()) without the lock.  Past
+ * SR_MAX_THREADS a thread gets no ring and what it would have queued is
+ * counted in lost.
+ *
+ *   producer:  r = sr_tring_get(set, &mine);  0: counted in set->lost
+ *   consumer:  n = sr_tring_count(set); r = sr_tring_at(set, 0..n-1)
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_TRING_H
+#define SR_TRING_H
+
+#include <pthread.h>
+
+#include "sr_worker.h"
+
+struct sr_tring_set
+{
+    void* rings[SR_MAX_THREADS];
+    int nrings;                 /* published with release */
+    unsigned long lost;         /* from threads that got no ring */
+    pthread_mutex_t lock;
+    void* (*create)(void);      /* a new ring, called under lock */
+};
+
+/* -- the calling thread's ring in one set, kept in a __thread variable -- */
+struct sr_tring_mine
+{
+    const struct sr_tring_set* set;     /* 0 until registered */
+    void* ring;                         /* 0 if the set was full */
+    int index;                          /* in set->rings */
+};
+
+void  sr_tring_init(struct sr_tring_set* , void* (*create)(void));
+void* sr_tring_register(struct sr_tring_set* , struct sr_tring_mine* );
+void  sr_tring_destroy(struct sr_tring_set* , void (*destroy)(void* ));
+
+/* -- producer: this thread's ring, registering it on first use -- */
+static __inline__ void* sr_tring_get(struct sr_tring_set* s,
+                                     struct sr_tring_mine* m)
+{
+    void* r = m->set == s ? m->ring : sr_tring_register(s, m);
+
+    if (r == 0)
+    { __atomic_fetch_add(&s->lost, 1, __ATOMIC_RELAXED); }
+    return r;
+}
+
+/* -- consumer side -- */
+
+static __inline__ int sr_tring_count(struct sr_tring_set* s)
+{
+    return __atomic_load_n(&s->nrings, __ATOMIC_ACQUIRE);
+}
+
+static __inline__ void* sr_tring_at(struct sr_tring_set* s, int i)
+{
+    return s->rings[i];
+}
+
+#endif /* -- SR_TRING_H -- */
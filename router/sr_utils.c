@@ -4,22 +4,73 @@
 #include "sr_protocol.h"
 #include "sr_router.h"
 #include "sr_utils.h"
+#include "sr_cksum.h"
 
 
+/* the summing itself is done by whichever sr_cksum.c kernel suits the CPU */
 uint16_t cksum (const void *_data, int len) {
-  const uint8_t *data = _data;
-  uint32_t sum;
-
-  for (sum = 0;len >= 2; data += 2, len -= 2)
-    sum += data[0] << 8 | data[1];
-  if (len > 0)
-    sum += data[0] << 8;
-  while (sum > 0xffff)
-    sum = (sum >> 16) + (sum & 0xffff);
-  sum = htons (~sum);
+  uint16_t sum = ~sr_cksum_sum(_data, len);
   return sum ? sum : 0xffff;
 }
 
+/* data with its checksum field filled in sums to all ones if it's intact */
+int cksum_verify (const void *_data, int len) {
+  return sr_cksum_sum(_data, len) == 0xffff;
+}
+
+
+/* fold a 32 bit one's complement sum and finish it the way cksum() does */
+static uint16_t cksum_finish(uint32_t sum) {
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = ~sum & 0xffff;
+  return sum ? sum : 0xffff;
+}
+
+/* HC' = ~(~HC + ~m + m'), byte order doesn't matter as long as it's the same */
+uint16_t cksum_adjust16(uint16_t sum, uint16_t old, uint16_t new) {
+  return cksum_finish((uint16_t)~sum + (uint16_t)~old + (uint32_t)new);
+}
+
+uint16_t cksum_adjust32(uint16_t sum, uint32_t old, uint32_t new) {
+  return cksum_finish((uint16_t)~sum +
+                      (uint16_t)~(old >> 16) + (uint16_t)~old +
+                      (new >> 16) + (new & 0xffff));
+}
+
+uint16_t cksum_extend(uint16_t sum, const void *_data, int len) {
+  return cksum_finish((uint16_t)~sum + (uint32_t)sr_cksum_sum(_data, len));
+}
+
+/* ttl shares a 16 bit word with ip_p, tos with version/header length */
+void ip_set_ttl(sr_ip_hdr_t* ip_hdr, uint8_t ttl) {
+  uint16_t old, new;
+
+  memcpy(&old, &ip_hdr->ip_ttl, 2);
+  ip_hdr->ip_ttl = ttl;
+  memcpy(&new, &ip_hdr->ip_ttl, 2);
+  ip_hdr->ip_sum = cksum_adjust16(ip_hdr->ip_sum, old, new);
+}
+
+void ip_set_tos(sr_ip_hdr_t* ip_hdr, uint8_t tos) {
+  uint16_t old, new;
+  uint8_t* word = &ip_hdr->ip_tos - 1;
+
+  memcpy(&old, word, 2);
+  ip_hdr->ip_tos = tos;
+  memcpy(&new, word, 2);
+  ip_hdr->ip_sum = cksum_adjust16(ip_hdr->ip_sum, old, new);
+}
+
+void ip_set_src(sr_ip_hdr_t* ip_hdr, uint32_t ip_src) {
+  ip_hdr->ip_sum = cksum_adjust32(ip_hdr->ip_sum, ip_hdr->ip_src, ip_src);
+  ip_hdr->ip_src = ip_src;
+}
+
+void ip_set_dst(sr_ip_hdr_t* ip_hdr, uint32_t ip_dst) {
+  ip_hdr->ip_sum = cksum_adjust32(ip_hdr->ip_sum, ip_hdr->ip_dst, ip_dst);
+  ip_hdr->ip_dst = ip_dst;
+}
 
 uint16_t ethertype(uint8_t *buf) {
   sr_ethernet_hdr_t *ehdr = (sr_ethernet_hdr_t *)buf;
@@ -185,13 +236,7 @@ void print_hdrs(uint8_t *buf, uint32_t length) {
 }
 
 struct sr_if* is_ip_match_router_if(struct sr_instance* sr, uint32_t ip) {
-	struct sr_if* if_walker = sr->if_list;
-	while(if_walker) {
-		if(ip == if_walker->ip)
-			return if_walker;
-		if_walker = if_walker->next;
-	}
-	return if_walker;
+	return sr_get_interface_ip(sr, ip);
 }
 
 void prepare_icmp_t3_hdr(sr_icmp_t3_hdr_t* icmp_hdr, /* Borrowed */
@@ -29,6 +29,26 @@
 #define SR_UTILS_H
 
 uint16_t cksum(const void *_data, int len);
+/* 1 if data, checksum field included, has a good checksum */
+int cksum_verify(const void *_data, int len);
+
+/*
+    Incremental checksum update (RFC 1624, eqn. 3): the checksum 'sum' of
+    data in which the 16 or 32 bit field 'old' has become 'new'.  All
+    values as they sit in the packet (network byte order).  Like cksum()
+    the result is never 0x0000.
+*/
+uint16_t cksum_adjust16(uint16_t sum, uint16_t old, uint16_t new);
+uint16_t cksum_adjust32(uint16_t sum, uint32_t old, uint32_t new);
+/* checksum 'sum' after len more bytes, starting at an even offset, have
+   been appended to the data it covers */
+uint16_t cksum_extend(uint16_t sum, const void *_data, int len);
+
+/* rewrite an IPv4 header field, keeping ip_sum up to date */
+void ip_set_ttl(sr_ip_hdr_t* ip_hdr, uint8_t ttl);
+void ip_set_tos(sr_ip_hdr_t* ip_hdr, uint8_t tos);
+void ip_set_src(sr_ip_hdr_t* ip_hdr, uint32_t ip_src);
+void ip_set_dst(sr_ip_hdr_t* ip_hdr, uint32_t ip_dst);
 
 uint16_t ethertype(uint8_t *buf);
 uint8_t ip_protocol(uint8_t *buf);
@@ -36,20 +36,64 @@
 #include <arpa/inet.h>
 #include <sys/time.h>
 
-#include "sr_dumper.h"
+#include "sr_backend.h"
+#include "sr_mbuf.h"
 #include "sr_router.h"
 #include "sr_if.h"
+#include "sr_log.h"
 #include "sr_protocol.h"
 
 #include "sha1.h"
 #include "vnscommand.h"
 
-static void sr_log_packet(struct sr_instance* , uint8_t* , int );
-static int  sr_arp_req_not_for_us(struct sr_instance* sr,
-                                  uint8_t * packet /* lent */,
-                                  unsigned int len,
-                                  char* interface  /* lent */);
+#ifdef SR_IO_URING
+#include "sr_vns_uring.h"
+#endif /* SR_IO_URING */
+
+/* largest command we accept from the server */
+#define VNS_MAX_MSG     10000
+/* receive buffer, holds many commands so one recv() feeds a whole burst */
+#define VNS_RXBUF_SIZE  (256*1024)
+/* transmit staging buffer, a burst worth of replies goes out in one write */
+#define VNS_TXBUF_SIZE  (64*1024)
+/* extensions this client implements, see VNS_CAPS */
+#define VNS_CLIENT_CAPS VNS_CAP_PACKET_BATCH
+
+/* ----------------------------------------------------------------------------
+ * struct sr_vns_state
+ *
+ * Per instance state of the VNS backend: a buffered command reader.  Bytes
+ * [rxhead, rxtail) of rxbuf have been received but not yet parsed.  A
+ * packet batch is handed out a burst at a time; batch_* track what is
+ * left of it.
+ *
+ * Outgoing commands are staged in txbuf and written by sr_vns_tx_send().
+ * With io_uring the socket is read and written through 'uring' once the
+ * session is up, and the staging buffer is the ring's registered buffer.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_vns_state
+{
+    uint8_t* rxbuf;
+    unsigned int rxhead;
+    unsigned int rxtail;
+    uint8_t* batch_next;
+    uint8_t* batch_end;
+    uint32_t batch_left;
+    uint8_t* txbuf;
+    unsigned int txlen;
+    c_packet_batch* tx_batch;   /* open batch in the staging buffer */
+    uint32_t caps;              /* extensions agreed with the server */
+#ifdef SR_IO_URING
+    struct sr_vns_uring* uring;
+#endif /* SR_IO_URING */
+};
+
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd);
+static int sr_vns_tx_send(struct sr_instance* , struct sr_vns_state* );
+static int sr_vns_tx_msg(struct sr_instance* , struct sr_vns_state* ,
+                         const void* , unsigned int );
 
 /*-----------------------------------------------------------------------------
  * Method: sr_session_closed_help(..)
@@ -201,6 +245,8 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
             case HWSPEED:
                 /* Debug("Speed: %d\n",
                         ntohl(*((unsigned int*)hwinfo->mHWInfo[i].value))); */
+                sr_set_ether_speed(sr,
+                        ntohl(*((uint32_t*)hwinfo->mHWInfo[i].value)));
                 break;
             case HWSUBNET:
                 /* Debug("Subnet: %s\n",inet_ntoa(
@@ -319,132 +365,235 @@ int sr_handle_auth_status(struct sr_instance* sr, c_auth_status* status) {
 }
 
 /*-----------------------------------------------------------------------------
- * Method: sr_read_from_server(..)
- * Scope: global
+ * Method: sr_vns_get_state(..)
+ * Scope: Local
  *
- * Houses main while loop for communicating with the virtual router server.
+ * Return the VNS reader state, creating it on first use.
  *
  *---------------------------------------------------------------------------*/
 
-int sr_read_from_server(struct sr_instance* sr /* borrowed */)
+static struct sr_vns_state* sr_vns_get_state(struct sr_instance* sr)
 {
-    return sr_read_from_server_expect(sr, 0);
-}
+    struct sr_vns_state* st = (struct sr_vns_state*)sr->backend_state;
 
-int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
-{
-    int command, len;
-    unsigned char *buf = 0;
-    c_packet_ethernet_header* sr_pkt = 0;
-    int ret = 0, bytes_read = 0;
+    if (st == 0)
+    {
+        st = (struct sr_vns_state*)calloc(1, sizeof(struct sr_vns_state));
+        assert(st);
+        st->rxbuf = (uint8_t*)malloc(VNS_RXBUF_SIZE);
+        st->txbuf = (uint8_t*)malloc(VNS_TXBUF_SIZE);
+        assert(st->rxbuf && st->txbuf);
+        sr->backend_state = st;
+    }
+    return st;
+} /* -- sr_vns_get_state -- */
 
-    /* REQUIRES */
-    assert(sr);
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_fill(..)
+ * Scope: Local
+ *
+ * Append whatever the socket has to the receive buffer.  Only waits for
+ * data if 'block' is set.
+ *
+ * RETURN VALUES:
+ *
+ *  number of bytes read, 0 if nothing was available (or no room)
+ *  -1 on error or if the server went away
+ *
+ *---------------------------------------------------------------------------*/
 
-    /*---------------------------------------------------------------------------
-      Read a command from the server
-      -------------------------------------------------------------------------*/
+static int sr_vns_fill(struct sr_instance* sr, struct sr_vns_state* st,
+                       int block)
+{
+    int ret;
 
-    bytes_read = 0;
+    if (st->rxtail == VNS_RXBUF_SIZE)
+    { return 0; }
 
-    /* attempt to read the size of the incoming packet */
-    while( bytes_read < 4)
+#ifdef SR_IO_URING
+    if (st->uring)
     {
-        do
-        { /* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if((ret = recv(sr->sockfd,((uint8_t*)&len) + bytes_read,
-                            4 - bytes_read, 0)) == -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-
-                perror("recv(..):sr_client.c::sr_read_from_server");
-                return -1;
-            }
-            bytes_read += ret;
-        } while ( errno == EINTR); /* be mindful of signals */
-
+        ret = sr_vns_uring_recv(st->uring, st->rxbuf + st->rxtail,
+                                VNS_RXBUF_SIZE - st->rxtail, block);
+        if (ret > 0)
+        { st->rxtail += ret; }
+        return ret;
     }
+#endif /* SR_IO_URING */
 
-    len = ntohl(len);
+    do
+    { /* -- just in case SIGALRM breaks recv -- */
+        errno = 0; /* -- hacky glibc workaround -- */
+        ret = recv(sr->sockfd, st->rxbuf + st->rxtail,
+                   VNS_RXBUF_SIZE - st->rxtail, block ? 0 : MSG_DONTWAIT);
+    } while ( ret == -1 && errno == EINTR ); /* be mindful of signals */
 
-    if ( len > 10000 || len < 0 )
+    if (ret == 0)
     {
-        fprintf(stderr,"Error: command length to large %d\n",len);
-        close(sr->sockfd);
+        fprintf(stderr,"VNS server closed the connection\n");
         return -1;
     }
-
-    if((buf = malloc(len)) == 0)
+    if (ret == -1)
     {
-        fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
+        if (!block && (errno == EAGAIN || errno == EWOULDBLOCK))
+        { return 0; }
+        perror("recv(..):sr_vns_comm.c::sr_vns_fill");
         return -1;
     }
 
-    /* set first field of command since we've already read it */
-    *((int *)buf) = htonl(len);
+    st->rxtail += ret;
+    return ret;
+} /* -- sr_vns_fill -- */
+
+static void sr_vns_compact(struct sr_vns_state* st)
+{
+    if (st->rxhead == 0)
+    { return; }
+    memmove(st->rxbuf, st->rxbuf + st->rxhead, st->rxtail - st->rxhead);
+    st->rxtail -= st->rxhead;
+    st->rxhead = 0;
+} /* -- sr_vns_compact -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_next_msg(..)
+ * Scope: Local
+ *
+ * Return the next complete command in the receive buffer, reading more
+ * from the socket as needed.  The command stays in place in the buffer;
+ * 'may_compact' says whether earlier commands may be moved out of the way
+ * to make room (i.e. nothing handed out from the buffer is still in use).
+ *
+ * Returns 0 with *err clear if no command is available without blocking,
+ * 0 with *err set on error.
+ *
+ *---------------------------------------------------------------------------*/
+
+static uint8_t* sr_vns_next_msg(struct sr_instance* sr, int block,
+                                int may_compact, int* err)
+{
+    struct sr_vns_state* st = sr_vns_get_state(sr);
+    uint32_t len, type;
+    uint8_t* msg;
+    int ret;
 
-    bytes_read = 0;
+    *err = 0;
 
-    /* read the rest of the command */
-    while ( bytes_read < len - 4)
+    for (;;)
     {
-        do
-        {/* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if ((ret = read(sr->sockfd, buf+4+bytes_read, len - 4 - bytes_read)) ==
-                    -1)
+        /* -- is there a whole command buffered? -- */
+        if (st->rxtail - st->rxhead >= sizeof(c_base))
+        {
+            memcpy(&len, st->rxbuf + st->rxhead, 4);
+            len = ntohl(len);
+            memcpy(&type, st->rxbuf + st->rxhead + 4, 4);
+            type = ntohl(type);
+
+            if ( len > (type == VNS_PACKET_BATCH ? VNS_BATCH_MAX_LEN
+                                                 : VNS_MAX_MSG) ||
+                 len < sizeof(c_base) )
             {
-                if ( errno == EINTR )
-                { continue; }
-                fprintf(stderr,"Error: failed reading command body %d\n",ret);
+                fprintf(stderr,"Error: command length to large %d\n",len);
                 close(sr->sockfd);
-                return -1;
+                *err = 1;
+                return 0;
             }
-            bytes_read += ret;
-        } while (errno == EINTR); /* be mindful of signals */
-    }
 
-    /* My entry for most unreadable line of code - guido */
-    /* ... you win - mc                                  */
-    command = *(((int *)buf)+1) = ntohl(*(((int *)buf)+1));
+            if (st->rxtail - st->rxhead >= len)
+            {
+                msg = st->rxbuf + st->rxhead;
+                st->rxhead += len;
+                return msg;
+            }
+        }
 
-    /* make sure the command is what we expected if we were expecting something */
-    if(expected_cmd && command!=expected_cmd) {
-        if(command != VNSCLOSE) { /* VNSCLOSE is always ok */
-            fprintf(stderr, "Error: expected command %d but got %d\n", expected_cmd, command);
-            return -1;
+        if (st->rxtail == VNS_RXBUF_SIZE)
+        {
+            if (!may_compact)
+            { return 0; }
+            sr_vns_compact(st);
         }
+
+        if ((ret = sr_vns_fill(sr, st, block)) < 0)
+        {
+            *err = 1;
+            return 0;
+        }
+        if (ret == 0 && !block)
+        { return 0; }
     }
+} /* -- sr_vns_next_msg -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_dispatch(..)
+ * Scope: Local
+ *
+ * Handle one command from the server.  For VNSPACKET the frame is not
+ * processed here but described in 'frame' (whose buf is left 0 for every
+ * other command).  For VNS_PACKET_BATCH the frames are left for
+ * sr_vns_batch_frames().
+ *
+ * RETURN VALUES:
+ *
+ *  1 on success
+ *  0 if the server closed the session
+ *  -1 on error
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_dispatch(struct sr_instance* sr, uint8_t* buf,
+                           struct sr_frame* frame)
+{
+    struct sr_vns_state* st = sr_vns_get_state(sr);
+    c_caps caps;
+    int command, len;
+    int ret = 1;
+
+    len = ntohl(((c_base*)buf)->mLen);
+    command = ntohl(((c_base*)buf)->mType);
+
+    frame->buf = 0;
 
-    ret = 1;
     switch (command)
     {
         /* -------------        VNSPACKET     -------------------- */
 
         case VNSPACKET:
-            sr_pkt = (c_packet_ethernet_header *)buf;
-
-            /* -- check if it is an ARP to another router if so drop   -- */
-            if ( sr_arp_req_not_for_us(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base))) )
+            if ( len < sizeof(c_packet_header) )
             { break; }
+            frame->buf   = buf + sizeof(c_packet_header);
+            frame->len   = len - sizeof(c_packet_ethernet_header) +
+                           sizeof(struct sr_ethernet_hdr);
+            frame->iface = (char*)(buf + sizeof(c_base));
+            frame->ifid  = -1;
+            break;
 
-            /* -- log packet -- */
-            sr_log_packet(sr, buf + sizeof(c_packet_header),
-                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
+            /* -------------   VNS_PACKET_BATCH   -------------------- */
 
-            /* -- pass to router, student's code should take over here -- */
-            sr_handlepacket(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base)));
+        case VNS_PACKET_BATCH:
+            if ( len < sizeof(c_packet_batch) )
+            { break; }
+            st->batch_next = buf + sizeof(c_packet_batch);
+            st->batch_end  = buf + len;
+            st->batch_left = ntohl(((c_packet_batch*)buf)->mCount);
+            break;
 
+            /* -------------        VNS_CAPS       -------------------- */
+
+        case VNS_CAPS:
+            if ( len < sizeof(c_caps) )
+            { break; }
+            caps.mLen  = htonl(sizeof(c_caps));
+            caps.mType = htonl(VNS_CAPS);
+            caps.mCaps = htonl(ntohl(((c_caps*)buf)->mCaps) & VNS_CLIENT_CAPS);
+
+            /* -- answer first, the server may batch as soon as it hears -- */
+            pthread_mutex_lock(&(sr->tx_lock));
+            if (sr_vns_tx_msg(sr, st, &caps, sizeof(caps)) != 0)
+            { ret = -1; }
+            pthread_mutex_unlock(&(sr->tx_lock));
+            st->caps = ntohl(caps.mCaps);
+            if (st->caps & VNS_CAP_PACKET_BATCH)
+            { printf("Server supports packet batching\n"); }
             break;
 
             /* -------------        VNSCLOSE      -------------------- */
@@ -453,9 +602,6 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
             fprintf(stderr,"VNS server closed session.\n");
             fprintf(stderr,"Reason: %s\n",((c_close*)buf)->mErrorMessage);
             sr_session_closed_help();
-
-            if(buf)
-            { free(buf); }
             return 0;
             break;
 
@@ -501,167 +647,514 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
     }/* -- switch -- */
 
-    if(buf)
-    { free(buf); }
     return ret;
-}/* -- sr_read_from_server -- */
+} /* -- sr_vns_dispatch -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_ether_addrs_match_interface(..)
+ * Method: sr_vns_batch_frames(..)
  * Scope: Local
  *
- * Make sure ethernet addresses are sane so we don't muck uo the system.
+ * Describe up to 'max' frames of the current packet batch.  A malformed
+ * entry drops the rest of the batch.
  *
- *----------------------------------------------------------------------------*/
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_batch_frames(struct sr_vns_state* st,
+                               struct sr_frame* frames, int max)
+{
+    c_packet_batch_entry* e;
+    uint32_t flen;
+    int n = 0;
+
+    while (n < max && st->batch_left > 0)
+    {
+        e = (c_packet_batch_entry*)st->batch_next;
+        if (st->batch_end - st->batch_next < (long)sizeof(*e))
+        { break; }
+        flen = ntohl(e->mLen);
+        if (flen < sizeof(struct sr_ethernet_hdr) ||
+            flen > st->batch_end - st->batch_next - sizeof(*e))
+        { break; }
+
+        frames[n].buf   = st->batch_next + sizeof(*e);
+        frames[n].len   = flen;
+        frames[n].iface = e->mInterfaceName;
+        frames[n].ifid  = -1;
+        n++;
+
+        st->batch_next += sizeof(*e) + flen;
+        st->batch_left--;
+    }
+
+    if (n < max && st->batch_left > 0)
+    {
+        SR_WARN(SR_MOD_CORE, "Dropping %u frames of a malformed packet batch",
+                st->batch_left);
+        st->batch_left = 0;
+    }
+
+    return n;
+} /* -- sr_vns_batch_frames -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_from_server(..)
+ * Scope: global
+ *
+ * Read and handle a single command from the virtual router server.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_read_from_server(struct sr_instance* sr /* borrowed */)
+{
+    return sr_read_from_server_expect(sr, 0);
+}
 
-static int
-sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
-                                uint8_t* buf, /* borrowed */
-                                const char* name /* borrowed */ )
+int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
 {
-    struct sr_ethernet_hdr* ether_hdr = 0;
-    struct sr_if* iface = 0;
+    struct sr_frame frame;
+    uint8_t* buf;
+    int command, ret, err;
 
-    /* -- REQUIRES -- */
+    /* REQUIRES */
     assert(sr);
-    assert(buf);
-    assert(name);
 
-    ether_hdr = (struct sr_ethernet_hdr*)buf;
-    iface = sr_get_interface(sr, name);
+    if ((buf = sr_vns_next_msg(sr, 1, 1, &err)) == 0)
+    { return -1; }
 
-    if ( iface == 0 ){
-        fprintf( stderr, "** Error, interface %s, does not exist\n", name);
-        return 0;
+    command = ntohl(((c_base*)buf)->mType);
+
+    /* make sure the command is what we expected if we were expecting something */
+    if(expected_cmd && command!=expected_cmd) {
+        if(command != VNSCLOSE) { /* VNSCLOSE is always ok */
+            fprintf(stderr, "Error: expected command %d but got %d\n", expected_cmd, command);
+            return -1;
+        }
     }
 
-    if ( memcmp( ether_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN) != 0 ){
-        fprintf( stderr, "** Error, source address does not match interface\n");
-        return 0;
+    ret = sr_vns_dispatch(sr, buf, &frame);
+    if (ret == 1 && frame.buf)
+    { sr_backend_input(sr, &frame); }
+    while (ret == 1 && sr_vns_batch_frames(sr_vns_get_state(sr), &frame, 1))
+    { sr_backend_input(sr, &frame); }
+
+    return ret;
+}/* -- sr_read_from_server -- */
+
+/*-----------------------------------------------------------------------------
+ * VNS backend operations
+ *---------------------------------------------------------------------------*/
+
+/* arg is server:port */
+static int sr_vns_open(struct sr_instance* sr, const char* arg)
+{
+    char server[256];
+    const char* colon;
+    unsigned int len;
+
+    if (arg == 0 || (colon = strrchr(arg, ':')) == 0)
+    {
+        fprintf(stderr, "vns backend expects server:port\n");
+        return -1;
     }
 
-    /* TODO */
-    /* Check destination, hardware address.  If it is private (i.e. destined
-     * to a virtual interface) ensure it is going to the correct topology
-     * Note: This check should really be done server side ...
-     */
+    len = colon - arg;
+    if (len >= sizeof(server))
+    { len = sizeof(server) - 1; }
+    memcpy(server, arg, len);
+    server[len] = 0;
+
+    sr_vns_get_state(sr);
+
+    if (sr_connect_to_server(sr, (unsigned short)atoi(colon + 1), server) != 0)
+    { return -1; }
 
-    return 1;
+#ifdef SR_IO_URING
+    /* -- the handshake is done, the rest goes through the rings -- */
+    sr_vns_get_state(sr)->uring = sr_vns_uring_open(sr->sockfd);
+#endif /* SR_IO_URING */
 
-} /* -- sr_ether_addrs_match_interface -- */
+    return 0;
+} /* -- sr_vns_open -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_send_packet(..)
- * Scope: Global
+ * Method: sr_vns_rx_burst(..)
+ * Scope: Local
  *
- * Send a packet (ethernet header included!) of length 'len' to the server
- * to be injected onto the wire.
+ * Frames point straight into the receive buffer, so the buffer is only
+ * compacted at the start of a burst, once the previous burst is done with
+ * and no batch is half handed out.  Waits for the first command only;
+ * after that takes whatever one recv() already delivered.
  *
  *---------------------------------------------------------------------------*/
 
-int sr_send_packet(struct sr_instance* sr /* borrowed */,
-                         uint8_t* buf /* borrowed */ ,
-                         unsigned int len,
-                         const char* iface /* borrowed */)
+static int sr_vns_rx_burst(struct sr_instance* sr, struct sr_frame* frames,
+                           int max)
 {
-    c_packet_header *sr_pkt;
-    unsigned int total_len =  len + (sizeof(c_packet_header));
+    struct sr_vns_state* st = sr_vns_get_state(sr);
+    uint8_t* buf;
+    int n = 0, err, ret;
 
-    /* REQUIRES */
-    assert(sr);
-    assert(buf);
-    assert(iface);
+    if (st->batch_left)
+    { n = sr_vns_batch_frames(st, frames, max); }
+    else
+    { sr_vns_compact(st); }
 
-    /* don't waste my time ... */
-    if ( len < sizeof(struct sr_ethernet_hdr) ){
-        fprintf(stderr , "** Error: packet is wayy to short \n");
-        return -1;
+    while (n < max)
+    {
+        buf = sr_vns_next_msg(sr, n == 0, n == 0, &err);
+        if (buf == 0)
+        {
+            if (err)
+            { return n ? n : -1; }
+            break;
+        }
+
+        ret = sr_vns_dispatch(sr, buf, &frames[n]);
+        if (ret != 1)
+        { return n ? n : -1; }
+        if (frames[n].buf)
+        { n++; }
+        n += sr_vns_batch_frames(st, frames + n, max - n);
     }
 
-    /* Create packet */
-    sr_pkt = (c_packet_header *)malloc(len +
-            sizeof(c_packet_header));
-    assert(sr_pkt);
-    sr_pkt->mLen  = htonl(total_len);
-    sr_pkt->mType = htonl(VNSPACKET);
-    strncpy(sr_pkt->mInterfaceName,iface,16);
-    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
-            buf,len);
+    return n;
+} /* -- sr_vns_rx_burst -- */
 
-    /* -- log packet -- */
-    sr_log_packet(sr,buf,len);
+/* current end of the staging buffer and the room after it */
+static uint8_t* sr_vns_tx_tail(struct sr_vns_state* st, unsigned int* room)
+{
+#ifdef SR_IO_URING
+    if (st->uring)
+    { return sr_vns_uring_tx_tail(st->uring, room); }
+#endif /* SR_IO_URING */
 
-    if ( ! sr_ether_addrs_match_interface( sr, buf, iface) ){
-        fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
-        free ( sr_pkt );
-        return -1;
+    *room = VNS_TXBUF_SIZE - st->txlen;
+    return st->txbuf + st->txlen;
+} /* -- sr_vns_tx_tail -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_tx_space(..)
+ * Scope: Local
+ *
+ * Where the next 'len' bytes of outgoing commands go, sending what is
+ * staged first if they don't fit.  Nothing is staged until
+ * sr_vns_tx_commit().  Returns 0 on error.
+ *
+ *---------------------------------------------------------------------------*/
+
+static uint8_t* sr_vns_tx_space(struct sr_instance* sr,
+                                struct sr_vns_state* st, unsigned int len)
+{
+    unsigned int room;
+    uint8_t* p;
+
+    p = sr_vns_tx_tail(st, &room);
+    if (room < len)
+    {
+        if (sr_vns_tx_send(sr, st) != 0)
+        { return 0; }
+        p = sr_vns_tx_tail(st, &room);
     }
 
-    if( write(sr->sockfd, sr_pkt, total_len) < total_len ){
-        fprintf(stderr, "Error writing packet\n");
-        free(sr_pkt);
-        return -1;
+    return room < len ? 0 : p;
+} /* -- sr_vns_tx_space -- */
+
+static void sr_vns_tx_commit(struct sr_vns_state* st, unsigned int len)
+{
+#ifdef SR_IO_URING
+    if (st->uring)
+    {
+        sr_vns_uring_tx_commit(st->uring, len);
+        return;
     }
+#endif /* SR_IO_URING */
+
+    st->txlen += len;
+} /* -- sr_vns_tx_commit -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_tx_send(..)
+ * Scope: Local
+ *
+ * Write out everything staged.  Called with sr->tx_lock held.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_tx_send(struct sr_instance* sr, struct sr_vns_state* st)
+{
+    unsigned int off = 0;
+    int ret;
+
+    st->tx_batch = 0;
 
-    free(sr_pkt);
+#ifdef SR_IO_URING
+    if (st->uring)
+    { return sr_vns_uring_flush(st->uring); }
+#endif /* SR_IO_URING */
 
+    while (off < st->txlen)
+    {
+        if ((ret = send(sr->sockfd, st->txbuf + off, st->txlen - off, 0)) < 0)
+        {
+            if (errno == EINTR)
+            { continue; }
+            perror("send(..):sr_vns_comm.c::sr_vns_tx_send");
+            st->txlen = 0;
+            return -1;
+        }
+        off += ret;
+    }
+
+    st->txlen = 0;
     return 0;
-} /* -- sr_send_packet -- */
+} /* -- sr_vns_tx_send -- */
+
+/* stage a control command and send it right away unless in a burst */
+static int sr_vns_tx_msg(struct sr_instance* sr, struct sr_vns_state* st,
+                         const void* msg, unsigned int len)
+{
+    uint8_t* p;
+
+    st->tx_batch = 0;
+    if ((p = sr_vns_tx_space(sr, st, len)) == 0)
+    { return -1; }
+    memcpy(p, msg, len);
+    sr_vns_tx_commit(st, len);
+
+    return sr->tx_defer ? 0 : sr_vns_tx_send(sr, st);
+} /* -- sr_vns_tx_msg -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_log_packet()
+ * Method: sr_vns_tx_frame(..)
  * Scope: Local
  *
+ * Stage one frame: appended to the open packet batch if the server agreed
+ * to batches, as its own VNSPACKET otherwise.
+ *
  *---------------------------------------------------------------------------*/
 
-void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
+static int sr_vns_tx_frame(struct sr_instance* sr, struct sr_vns_state* st,
+                           struct sr_frame* f)
 {
-    struct pcap_pkthdr h;
-    int size;
+    c_packet_header* hdr;
+    c_packet_batch_entry* e;
+    c_packet_batch* b;
+    unsigned int need, room;
+    uint8_t* p;
 
-    /* REQUIRES */
-    assert(sr);
+    if (!(st->caps & VNS_CAP_PACKET_BATCH))
+    {
+        need = sizeof(c_packet_header) + f->len;
+        if ((p = sr_vns_tx_space(sr, st, need)) == 0)
+        { return -1; }
+
+        hdr = (c_packet_header*)p;
+        hdr->mLen  = htonl(need);
+        hdr->mType = htonl(VNSPACKET);
+        strncpy(hdr->mInterfaceName, f->iface, 16);
+        memcpy(p + sizeof(c_packet_header), f->buf, f->len);
+        sr_vns_tx_commit(st, need);
+        return 0;
+    }
 
-    if(!sr->logfile)
-    {return; }
+    need = sizeof(c_packet_batch_entry) + f->len;
 
-    size = min(PACKET_DUMP_SIZE, len);
+    /* -- close the open batch if this frame doesn't fit in it -- */
+    if ((b = st->tx_batch) != 0)
+    {
+        sr_vns_tx_tail(st, &room);
+        if (ntohl(b->mLen) + need > VNS_BATCH_MAX_LEN || room < need)
+        { b = st->tx_batch = 0; }
+    }
 
-    gettimeofday(&h.ts, 0);
-    h.caplen = size;
-    h.len = (size < PACKET_DUMP_SIZE) ? size : PACKET_DUMP_SIZE;
+    if (b == 0)
+    {
+        if (sizeof(c_packet_batch) + need > VNS_BATCH_MAX_LEN ||
+            (p = sr_vns_tx_space(sr, st, sizeof(c_packet_batch) + need)) == 0)
+        { return -1; }
+
+        b = (c_packet_batch*)p;
+        b->mLen   = htonl(sizeof(c_packet_batch));
+        b->mType  = htonl(VNS_PACKET_BATCH);
+        b->mCount = 0;
+        sr_vns_tx_commit(st, sizeof(c_packet_batch));
+        st->tx_batch = b;
+    }
+
+    /* -- room was checked above, this can't flush the batch header -- */
+    p = sr_vns_tx_tail(st, &room);
+    e = (c_packet_batch_entry*)p;
+    strncpy(e->mInterfaceName, f->iface, 16);
+    e->mLen = htonl(f->len);
+    memcpy(p + sizeof(c_packet_batch_entry), f->buf, f->len);
+    sr_vns_tx_commit(st, need);
 
-    sr_dump(sr->logfile, &h, buf);
-    fflush(sr->logfile);
-} /* -- sr_log_packet -- */
+    b->mLen   = htonl(ntohl(b->mLen) + need);
+    b->mCount = htonl(ntohl(b->mCount) + 1);
+
+    return 0;
+} /* -- sr_vns_tx_frame -- */
 
 /*-----------------------------------------------------------------------------
- * Method: sr_arp_req_not_for_us()
+ * Method: sr_vns_tx_burst(..)
  * Scope: Local
  *
+ * Stage the frames and, unless a receive burst is in progress, send them.
+ * During a burst everything the router sends goes out in one write (and
+ * one packet batch) from sr_vns_flush().
+ *
  *---------------------------------------------------------------------------*/
 
-int  sr_arp_req_not_for_us(struct sr_instance* sr,
-                           uint8_t * packet /* lent */,
-                           unsigned int len,
-                           char* interface  /* lent */)
+static int sr_vns_tx_burst(struct sr_instance* sr, struct sr_frame* frames,
+                           int n)
 {
-    struct sr_if* iface = sr_get_interface(sr, interface);
-    struct sr_ethernet_hdr* e_hdr = 0;
-    struct sr_arp_hdr*       a_hdr = 0;
+    struct sr_vns_state* st = sr_vns_get_state(sr);
+    int i;
 
-    if (len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr) )
-    { return 0; }
+    for (i = 0; i < n; i++)
+    {
+        if (sr_vns_tx_frame(sr, st, &frames[i]) != 0)
+        { break; }
+    }
 
-    assert(iface);
+    if (!sr->tx_defer && sr_vns_tx_send(sr, st) != 0)
+    { return -1; }
 
-    e_hdr = (struct sr_ethernet_hdr*)packet;
-    a_hdr = (struct sr_arp_hdr*)(packet + sizeof(struct sr_ethernet_hdr));
+    return i ? i : -1;
+} /* -- sr_vns_tx_burst -- */
 
-    if ( (e_hdr->ether_type == htons(ethertype_arp)) &&
-            (a_hdr->ar_op      == htons(arp_op_request))   &&
-            (a_hdr->ar_tip     != iface->ip ) )
-    { return 1; }
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_tx_mbuf(..)
+ * Scope: Local
+ *
+ * Outside a burst, with nothing staged and no packet batches, the
+ * VNSPACKET header goes in the mbuf's headroom and the frame is sent from
+ * where it was built.  Otherwise it is staged like any other.
+ *
+ *---------------------------------------------------------------------------*/
 
+static int sr_vns_tx_mbuf(struct sr_instance* sr, struct sr_mbuf* m,
+                          const char* iface)
+{
+    struct sr_vns_state* st = sr_vns_get_state(sr);
+    struct sr_frame frame;
+    c_packet_header* hdr;
+    unsigned int off = 0;
+    int ret;
+
+    if (sr->tx_defer || st->txlen != 0 || (st->caps & VNS_CAP_PACKET_BATCH) ||
+#ifdef SR_IO_URING
+        st->uring ||
+#endif /* SR_IO_URING */
+        sr_mbuf_headroom(m) < sizeof(c_packet_header))
+    {
+        frame.buf   = sr_mbuf_data(m);
+        frame.len   = m->len;
+        frame.iface = (char*)iface;
+        frame.ifid  = -1;
+        return sr_vns_tx_burst(sr, &frame, 1) == 1 ? 0 : -1;
+    }
+
+    hdr = (c_packet_header*)sr_mbuf_prepend(m, sizeof(c_packet_header));
+    hdr->mLen  = htonl(m->len);
+    hdr->mType = htonl(VNSPACKET);
+    strncpy(hdr->mInterfaceName, iface, 16);
+
+    while (off < m->len)
+    {
+        if ((ret = send(sr->sockfd, (uint8_t*)hdr + off, m->len - off, 0)) < 0)
+        {
+            if (errno == EINTR)
+            { continue; }
+            perror("send(..):sr_vns_comm.c::sr_vns_tx_mbuf");
+            return -1;
+        }
+        off += ret;
+    }
     return 0;
-} /* -- sr_arp_req_not_for_us -- */
+} /* -- sr_vns_tx_mbuf -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_get_interfaces(..)
+ * Scope: Local
+ *
+ * The server sends VNSHWINFO once the topology is open.  Nothing can be
+ * routed before that, so any frame that shows up early is dropped.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_get_interfaces(struct sr_instance* sr)
+{
+    struct sr_frame frame;
+    struct sr_if* if_walker;
+    uint8_t* buf;
+    int err, n = 0;
+
+    while (sr->if_list == 0)
+    {
+        if ((buf = sr_vns_next_msg(sr, 1, 1, &err)) == 0)
+        { return -1; }
+        if (sr_vns_dispatch(sr, buf, &frame) != 1)
+        { return -1; }
+        sr_vns_get_state(sr)->batch_left = 0;
+    }
+
+    for (if_walker = sr->if_list; if_walker; if_walker = if_walker->next)
+    { n++; }
+    return n;
+} /* -- sr_vns_get_interfaces -- */
+
+static int sr_vns_flush(struct sr_instance* sr)
+{
+    return sr_vns_tx_send(sr, sr_vns_get_state(sr));
+} /* -- sr_vns_flush -- */
+
+static int sr_vns_poll_fd(struct sr_instance* sr)
+{
+#ifdef SR_IO_URING
+    struct sr_vns_state* st = (struct sr_vns_state*)sr->backend_state;
+
+    if (st && st->uring)
+    { return sr_vns_uring_poll_fd(st->uring); }
+#endif /* SR_IO_URING */
+
+    return sr->sockfd;
+} /* -- sr_vns_poll_fd -- */
+
+static void sr_vns_close(struct sr_instance* sr)
+{
+    struct sr_vns_state* st = (struct sr_vns_state*)sr->backend_state;
+
+#ifdef SR_IO_URING
+    if (st && st->uring)
+    {
+        sr_vns_uring_close(st->uring);
+        st->uring = 0;
+    }
+#endif /* SR_IO_URING */
+
+    if (sr->sockfd >= 0)
+    {
+        close(sr->sockfd);
+        sr->sockfd = -1;
+    }
+    if (st)
+    {
+        free(st->rxbuf);
+        free(st->txbuf);
+        free(st);
+        sr->backend_state = 0;
+    }
+} /* -- sr_vns_close -- */
+
+struct sr_backend sr_vns_backend = {
+    "vns",
+    sr_vns_open,
+    sr_vns_rx_burst,
+    sr_vns_tx_burst,
+    sr_vns_tx_mbuf,
+    sr_vns_flush,
+    sr_vns_get_interfaces,
+    sr_vns_poll_fd,
+    sr_vns_close
+};
@@ -0,0 +1,621 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_vns_uring.c
+ *
+ * Description:
+ *
+ * io_uring socket I/O for the VNS backend, see sr_vns_uring.h.  Talks to
+ * the kernel with the raw system calls so there is no liburing
+ * dependency.
+ *
+ * Two rings are used so neither needs a lock of its own: the receive ring
+ * is only touched by the thread in sr_backend_run(), the transmit ring
+ * only under sr->tx_lock.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "sr_vns_uring.h"
+
+#define UR_ENTRIES      64
+#define UR_RX_BUFS      64              /* power of two */
+#define UR_RX_BUFSZ     (16*1024)
+#define UR_RX_BGID      0
+#define UR_TX_BUFS      2
+#define UR_TX_BUFSZ     (256*1024)
+
+/* completion tags */
+#define UR_RECV         1
+#define UR_SEND         2
+
+/* ----------------------------------------------------------------------------
+ * struct sr_uring
+ *
+ * One mapped io_uring instance.  sqe_tail is our copy of the submission
+ * tail; entries between the kernel's head and it are still unsubmitted.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_uring
+{
+    int fd;
+    uint8_t* ring;
+    size_t ring_sz;
+    struct io_uring_sqe* sqes;
+    size_t sqes_sz;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_array;
+    unsigned  sq_mask;
+    unsigned  sqe_tail;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned  cq_mask;
+    struct io_uring_cqe* cqes;
+};
+
+struct sr_vns_uring
+{
+    int sock;
+
+    /* -- receive -- */
+    struct sr_uring rx;
+    struct io_uring_buf_ring* br;
+    uint8_t* rxbufs;
+    uint16_t br_tail;
+    int armed;                  /* multishot recv is outstanding */
+    int dead;                   /* peer closed or error, sticky */
+    int cur_bid;                /* provided buffer being drained */
+    unsigned int cur_off;
+    unsigned int cur_len;
+
+    /* -- transmit -- */
+    struct sr_uring tx;
+    uint8_t* txbuf[UR_TX_BUFS];
+    unsigned int txlen[UR_TX_BUFS];
+    int txcur;                  /* buffer being filled */
+    int inflight;               /* buffer being written, -1 if none */
+    unsigned int inflight_off;
+};
+
+/*-----------------------------------------------------------------------------
+ * Ring plumbing
+ *---------------------------------------------------------------------------*/
+
+static int sr_uring_setup(struct sr_uring* q, unsigned entries)
+{
+    struct io_uring_params p;
+    uint8_t* sq;
+
+    memset(q, 0, sizeof(*q));
+    memset(&p, 0, sizeof(p));
+
+    if ((q->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+    { return -1; }
+
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        close(q->fd);
+        errno = ENOSYS;
+        return -1;
+    }
+
+    q->ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    if (p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe) > q->ring_sz)
+    { q->ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe); }
+
+    q->ring = mmap(0, q->ring_sz, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, q->fd, IORING_OFF_SQ_RING);
+    if (q->ring == MAP_FAILED)
+    {
+        close(q->fd);
+        return -1;
+    }
+
+    q->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    q->sqes = mmap(0, q->sqes_sz, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, q->fd, IORING_OFF_SQES);
+    if (q->sqes == MAP_FAILED)
+    {
+        munmap(q->ring, q->ring_sz);
+        close(q->fd);
+        return -1;
+    }
+
+    sq = q->ring;
+    q->sq_head  = (unsigned*)(sq + p.sq_off.head);
+    q->sq_tail  = (unsigned*)(sq + p.sq_off.tail);
+    q->sq_array = (unsigned*)(sq + p.sq_off.array);
+    q->sq_mask  = *(unsigned*)(sq + p.sq_off.ring_mask);
+    q->sqe_tail = *q->sq_tail;
+    q->cq_head  = (unsigned*)(sq + p.cq_off.head);
+    q->cq_tail  = (unsigned*)(sq + p.cq_off.tail);
+    q->cq_mask  = *(unsigned*)(sq + p.cq_off.ring_mask);
+    q->cqes     = (struct io_uring_cqe*)(sq + p.cq_off.cqes);
+
+    return 0;
+} /* -- sr_uring_setup -- */
+
+static void sr_uring_teardown(struct sr_uring* q)
+{
+    if (q->ring == 0)
+    { return; }
+    munmap(q->sqes, q->sqes_sz);
+    munmap(q->ring, q->ring_sz);
+    close(q->fd);
+    q->ring = 0;
+} /* -- sr_uring_teardown -- */
+
+/* next free sqe, cleared, 0 if the submission queue is full */
+static struct io_uring_sqe* sr_uring_get_sqe(struct sr_uring* q)
+{
+    struct io_uring_sqe* sqe;
+    unsigned idx;
+
+    if (q->sqe_tail - __atomic_load_n(q->sq_head, __ATOMIC_ACQUIRE) >
+        q->sq_mask)
+    { return 0; }
+
+    idx = q->sqe_tail & q->sq_mask;
+    sqe = &q->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    q->sq_array[idx] = idx;
+    q->sqe_tail++;
+    __atomic_store_n(q->sq_tail, q->sqe_tail, __ATOMIC_RELEASE);
+
+    return sqe;
+} /* -- sr_uring_get_sqe -- */
+
+/* submit whatever is queued and wait for 'wait' completions */
+static int sr_uring_enter(struct sr_uring* q, unsigned wait)
+{
+    unsigned pending;
+    int ret;
+
+    do
+    {
+        pending = q->sqe_tail - __atomic_load_n(q->sq_head, __ATOMIC_ACQUIRE);
+        ret = syscall(__NR_io_uring_enter, q->fd, pending, wait,
+                      wait ? IORING_ENTER_GETEVENTS : 0, 0, 0);
+    } while (ret < 0 && errno == EINTR); /* be mindful of signals */
+
+    return ret < 0 ? -1 : 0;
+} /* -- sr_uring_enter -- */
+
+static struct io_uring_cqe* sr_uring_peek(struct sr_uring* q)
+{
+    unsigned head = *q->cq_head;
+
+    if (head == __atomic_load_n(q->cq_tail, __ATOMIC_ACQUIRE))
+    { return 0; }
+    return &q->cqes[head & q->cq_mask];
+} /* -- sr_uring_peek -- */
+
+static void sr_uring_advance(struct sr_uring* q)
+{
+    __atomic_store_n(q->cq_head, *q->cq_head + 1, __ATOMIC_RELEASE);
+} /* -- sr_uring_advance -- */
+
+/*-----------------------------------------------------------------------------
+ * Receive
+ *---------------------------------------------------------------------------*/
+
+/* hand provided buffer 'bid' back to the kernel */
+static void sr_vns_uring_recycle(struct sr_vns_uring* u, int bid)
+{
+    struct io_uring_buf* b = &u->br->bufs[u->br_tail & (UR_RX_BUFS - 1)];
+
+    b->addr = (uint64_t)(uintptr_t)(u->rxbufs + bid * UR_RX_BUFSZ);
+    b->len  = UR_RX_BUFSZ;
+    b->bid  = bid;
+    u->br_tail++;
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+} /* -- sr_vns_uring_recycle -- */
+
+static int sr_vns_uring_arm(struct sr_vns_uring* u)
+{
+    struct io_uring_sqe* sqe;
+
+    if ((sqe = sr_uring_get_sqe(&u->rx)) == 0)
+    { return -1; }
+
+    sqe->opcode    = IORING_OP_RECV;
+    sqe->fd        = u->sock;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = UR_RX_BGID;
+    sqe->user_data = UR_RECV;
+    u->armed = 1;
+
+    return 0;
+} /* -- sr_vns_uring_arm -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_uring_reap(..)
+ * Scope: Local
+ *
+ * Take one receive completion off the ring.
+ *
+ * RETURN VALUES:
+ *
+ *  1 if a buffer of data is now ready to drain
+ *  0 if the ring was empty or the completion carried no data
+ *  -1 if the server went away or recv failed
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_uring_reap(struct sr_vns_uring* u)
+{
+    struct io_uring_cqe* cqe;
+    int res;
+    unsigned flags;
+
+    if ((cqe = sr_uring_peek(&u->rx)) == 0)
+    { return 0; }
+
+    res   = cqe->res;
+    flags = cqe->flags;
+    sr_uring_advance(&u->rx);
+
+    if (!(flags & IORING_CQE_F_MORE))
+    { u->armed = 0; } /* -- multishot ended, rearmed on the next wait -- */
+
+    if (res > 0 && (flags & IORING_CQE_F_BUFFER))
+    {
+        u->cur_bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        u->cur_off = 0;
+        u->cur_len = res;
+        return 1;
+    }
+
+    if (res == 0)
+    {
+        fprintf(stderr,"VNS server closed the connection\n");
+        return -1;
+    }
+    if (res == -ENOBUFS)
+    { return 0; } /* -- ran out of provided buffers, just rearm -- */
+
+    errno = -res;
+    perror("recv(..):sr_vns_uring.c::sr_vns_uring_reap");
+    return -1;
+} /* -- sr_vns_uring_reap -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_uring_recv(..)
+ * Scope: Global
+ *
+ * Copy up to 'room' bytes of the stream into 'buf'.  Waits for data only
+ * if 'block' is set and nothing at all is ready.
+ *
+ * RETURN VALUES:
+ *
+ *  number of bytes copied, 0 if none were ready
+ *  -1 on error or if the server went away
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_vns_uring_recv(struct sr_vns_uring* u, uint8_t* buf,
+                      unsigned int room, int block)
+{
+    unsigned int copied = 0, c;
+    int ret, entered = 0;
+
+    /* REQUIRES */
+    assert(u);
+    assert(buf);
+
+    while (copied < room)
+    {
+        if (u->cur_len)
+        {
+            c = u->cur_len < room - copied ? u->cur_len : room - copied;
+            memcpy(buf + copied,
+                   u->rxbufs + u->cur_bid * UR_RX_BUFSZ + u->cur_off, c);
+            copied     += c;
+            u->cur_off += c;
+            u->cur_len -= c;
+            if (u->cur_len == 0)
+            { sr_vns_uring_recycle(u, u->cur_bid); }
+            continue;
+        }
+
+        if (u->dead)
+        { break; }
+
+        if ((ret = sr_vns_uring_reap(u)) < 0)
+        {
+            u->dead = 1;
+            break;
+        }
+        if (ret > 0)
+        { continue; }
+
+        /* -- nothing left on the completion queue -- */
+        if (copied || (entered && !block))
+        { break; }
+
+        if (!u->armed && sr_vns_uring_arm(u) != 0)
+        {
+            u->dead = 1;
+            break;
+        }
+        if (sr_uring_enter(&u->rx, block ? 1 : 0) != 0)
+        {
+            perror("io_uring_enter(..):sr_vns_uring.c::sr_vns_uring_recv");
+            u->dead = 1;
+            break;
+        }
+        entered = 1;
+    }
+
+    if (copied == 0 && u->dead)
+    { return -1; }
+    return copied;
+} /* -- sr_vns_uring_recv -- */
+
+int sr_vns_uring_poll_fd(struct sr_vns_uring* u)
+{
+    return u->rx.fd;
+} /* -- sr_vns_uring_poll_fd -- */
+
+/*-----------------------------------------------------------------------------
+ * Transmit
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_uring_write(struct sr_vns_uring* u)
+{
+    struct io_uring_sqe* sqe;
+    int b = u->inflight;
+
+    if ((sqe = sr_uring_get_sqe(&u->tx)) == 0)
+    { return -1; }
+
+    sqe->opcode    = IORING_OP_WRITE_FIXED;
+    sqe->fd        = u->sock;
+    sqe->addr      = (uint64_t)(uintptr_t)(u->txbuf[b] + u->inflight_off);
+    sqe->len       = u->txlen[b] - u->inflight_off;
+    sqe->buf_index = b;
+    sqe->user_data = UR_SEND;
+
+    return sr_uring_enter(&u->tx, 0);
+} /* -- sr_vns_uring_write -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_uring_tx_wait(..)
+ * Scope: Local
+ *
+ * Wait for the buffer in flight to be written completely, resubmitting
+ * the remainder after short writes.  Writes to a stream must not overlap,
+ * so this runs before every new write.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_vns_uring_tx_wait(struct sr_vns_uring* u)
+{
+    struct io_uring_cqe* cqe;
+    int res;
+
+    while (u->inflight >= 0)
+    {
+        if ((cqe = sr_uring_peek(&u->tx)) == 0)
+        {
+            if (sr_uring_enter(&u->tx, 1) != 0)
+            {
+                perror("io_uring_enter(..):sr_vns_uring.c::sr_vns_uring_tx_wait");
+                return -1;
+            }
+            continue;
+        }
+
+        res = cqe->res;
+        sr_uring_advance(&u->tx);
+
+        if (res < 0 && res != -EINTR && res != -EAGAIN)
+        {
+            errno = -res;
+            perror("write(..):sr_vns_uring.c::sr_vns_uring_tx_wait");
+            u->txlen[u->inflight] = 0;
+            u->inflight = -1;
+            return -1;
+        }
+        if (res > 0)
+        { u->inflight_off += res; }
+
+        if (u->inflight_off < u->txlen[u->inflight])
+        {
+            if (sr_vns_uring_write(u) != 0)
+            { return -1; }
+            continue;
+        }
+
+        u->txlen[u->inflight] = 0;
+        u->inflight = -1;
+    }
+
+    return 0;
+} /* -- sr_vns_uring_tx_wait -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_uring_flush(..)
+ * Scope: Global
+ *
+ * Start writing the buffer being filled and switch to the other one.
+ * Returns without waiting for the write to complete.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_vns_uring_flush(struct sr_vns_uring* u)
+{
+    /* REQUIRES */
+    assert(u);
+
+    if (u->txlen[u->txcur] == 0)
+    { return 0; }
+
+    if (sr_vns_uring_tx_wait(u) != 0)
+    { return -1; }
+
+    u->inflight = u->txcur;
+    u->inflight_off = 0;
+    u->txcur = (u->txcur + 1) % UR_TX_BUFS;
+
+    if (sr_vns_uring_write(u) != 0)
+    {
+        perror("io_uring_enter(..):sr_vns_uring.c::sr_vns_uring_flush");
+        u->txlen[u->inflight] = 0;
+        u->inflight = -1;
+        return -1;
+    }
+    return 0;
+} /* -- sr_vns_uring_flush -- */
+
+uint8_t* sr_vns_uring_tx_tail(struct sr_vns_uring* u, unsigned int* room)
+{
+    /* REQUIRES */
+    assert(u);
+    assert(room);
+
+    *room = UR_TX_BUFSZ - u->txlen[u->txcur];
+    return u->txbuf[u->txcur] + u->txlen[u->txcur];
+} /* -- sr_vns_uring_tx_tail -- */
+
+void sr_vns_uring_tx_commit(struct sr_vns_uring* u, unsigned int len)
+{
+    /* REQUIRES */
+    assert(u);
+    assert(u->txlen[u->txcur] + len <= UR_TX_BUFSZ);
+
+    u->txlen[u->txcur] += len;
+} /* -- sr_vns_uring_tx_commit -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_uring_open(..)
+ * Scope: Global
+ *
+ * Set up both rings on a connected socket and arm the multishot recv.
+ * Any failure means the kernel can't do it our way: clean up and return
+ * 0 so the caller keeps using plain socket calls.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_vns_uring* sr_vns_uring_open(int sockfd)
+{
+    struct sr_vns_uring* u;
+    struct io_uring_buf_reg reg;
+    struct io_uring_cqe* cqe;
+    struct iovec iov[UR_TX_BUFS];
+    const char* what;
+    int i;
+
+    u = (struct sr_vns_uring*)calloc(1, sizeof(struct sr_vns_uring));
+    assert(u);
+    u->sock = sockfd;
+    u->inflight = -1;
+
+    what = "io_uring_setup";
+    if (sr_uring_setup(&u->rx, UR_ENTRIES) != 0)
+    { goto fail; }
+    if (sr_uring_setup(&u->tx, UR_ENTRIES) != 0)
+    { goto fail; }
+
+    /* -- provided buffers for recv -- */
+    what = "IORING_REGISTER_PBUF_RING";
+    u->br = mmap(0, UR_RX_BUFS * sizeof(struct io_uring_buf),
+                 PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    u->rxbufs = mmap(0, UR_RX_BUFS * UR_RX_BUFSZ, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (u->br == MAP_FAILED || u->rxbufs == MAP_FAILED)
+    { goto fail; }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = (uint64_t)(uintptr_t)u->br;
+    reg.ring_entries = UR_RX_BUFS;
+    reg.bgid         = UR_RX_BGID;
+    if (syscall(__NR_io_uring_register, u->rx.fd, IORING_REGISTER_PBUF_RING,
+                &reg, 1) != 0)
+    { goto fail; }
+    for (i = 0; i < UR_RX_BUFS; i++)
+    { sr_vns_uring_recycle(u, i); }
+
+    /* -- registered buffers for send -- */
+    what = "IORING_REGISTER_BUFFERS";
+    for (i = 0; i < UR_TX_BUFS; i++)
+    {
+        u->txbuf[i] = mmap(0, UR_TX_BUFSZ, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (u->txbuf[i] == MAP_FAILED)
+        { goto fail; }
+        iov[i].iov_base = u->txbuf[i];
+        iov[i].iov_len  = UR_TX_BUFSZ;
+    }
+    if (syscall(__NR_io_uring_register, u->tx.fd, IORING_REGISTER_BUFFERS,
+                iov, UR_TX_BUFS) != 0)
+    { goto fail; }
+
+    /* -- kernels without multishot recv fail the request right away -- */
+    what = "multishot recv";
+    if (sr_vns_uring_arm(u) != 0 || sr_uring_enter(&u->rx, 0) != 0)
+    { goto fail; }
+    if ((cqe = sr_uring_peek(&u->rx)) != 0 && cqe->res == -EINVAL)
+    {
+        errno = EINVAL;
+        goto fail;
+    }
+
+    return u;
+
+fail:
+    fprintf(stderr, "io_uring unavailable (%s: %s), using plain socket I/O\n",
+            what, strerror(errno));
+    sr_vns_uring_close(u);
+    return 0;
+} /* -- sr_vns_uring_open -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_vns_uring_close(..)
+ * Scope: Global
+ *
+ * Finish any pending write and release everything.  The socket itself
+ * belongs to the caller.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_vns_uring_close(struct sr_vns_uring* u)
+{
+    int i;
+
+    if (u == 0)
+    { return; }
+
+    if (u->tx.ring)
+    {
+        sr_vns_uring_flush(u);
+        sr_vns_uring_tx_wait(u);
+    }
+
+    /* -- closing the rings cancels the recv and drops registrations -- */
+    sr_uring_teardown(&u->rx);
+    sr_uring_teardown(&u->tx);
+
+    if (u->br && u->br != MAP_FAILED)
+    { munmap(u->br, UR_RX_BUFS * sizeof(struct io_uring_buf)); }
+    if (u->rxbufs && u->rxbufs != MAP_FAILED)
+    { munmap(u->rxbufs, UR_RX_BUFS * UR_RX_BUFSZ); }
+    for (i = 0; i < UR_TX_BUFS; i++)
+    {
+        if (u->txbuf[i] && u->txbuf[i] != MAP_FAILED)
+        { munmap(u->txbuf[i], UR_TX_BUFSZ); }
+    }
+    free(u);
+} /* -- sr_vns_uring_close -- */
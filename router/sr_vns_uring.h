@@ -0,0 +1,45 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_vns_uring.h
+ *
+ * Description:
+ *
+ * io_uring socket I/O for the VNS backend (build with "make IO_URING=1").
+ *
+ * Receive is a single multishot recv armed once; the kernel picks buffers
+ * from a provided-buffer ring and posts a completion per chunk, so a busy
+ * router makes one io_uring_enter() per wait instead of one recv() per
+ * fill.  Transmit appends VNS commands to one of two registered buffers
+ * and sends it with a single WRITE_FIXED when the receive burst is done,
+ * while the other buffer fills.
+ *
+ * sr_vns_uring_open() returns 0 when the kernel can't do any of this
+ * (no io_uring, io_uring disabled, no provided-buffer rings or no
+ * multishot recv) and the caller carries on with plain socket calls.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_VNS_URING_H
+#define SR_VNS_URING_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+struct sr_vns_uring;
+
+struct sr_vns_uring* sr_vns_uring_open(int sockfd);
+void     sr_vns_uring_close(struct sr_vns_uring* );
+
+/* readable when receive completions are waiting */
+int      sr_vns_uring_poll_fd(struct sr_vns_uring* );
+
+/* like recv() into buf, but returns 0 (not -1/EAGAIN) if !block and idle */
+int      sr_vns_uring_recv(struct sr_vns_uring* , uint8_t* buf,
+                           unsigned int room, int block);
+
+/* -- outgoing stream: write at tail (room bytes free), then commit -- */
+uint8_t* sr_vns_uring_tx_tail(struct sr_vns_uring* , unsigned int* room);
+void     sr_vns_uring_tx_commit(struct sr_vns_uring* , unsigned int len);
+int      sr_vns_uring_flush(struct sr_vns_uring* );
+
+#endif /* -- SR_VNS_URING_H -- */
@@ -0,0 +1,370 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_worker.c
+ *
+ * Description:
+ *
+ * Worker pool, see sr_worker.h.
+ *
+ * The receive thread copies a whole burst into the worker queues and only
+ * then publishes, one release store per worker per burst.  An idle worker
+ * spins for a while and then sleeps on a condition variable; the receive
+ * thread only touches the mutex when it sees the worker's sleeping flag,
+ * so a busy pool never takes a lock on the data path.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <arpa/inet.h>
+
+#include "sr_worker.h"
+#include "sr_backend.h"
+#include "sr_event.h"
+#include "sr_ring.h"
+#include "sr_neigh.h"
+#include "sr_mbuf.h"
+#include "sr_sched.h"
+#include "sr_router.h"
+#include "sr_protocol.h"
+
+#define SR_WORKER_SLOTS      1024           /* per worker, power of two */
+#define SR_WORKER_FRAME_MAX  2048
+#define SR_WORKER_SPINS      2048           /* empty polls before sleeping */
+
+struct sr_worker_slot
+{
+    unsigned int len;
+    char iface[sr_IFACE_NAMELEN];
+    int ifid;
+    uint8_t buf[SR_WORKER_FRAME_MAX];
+};
+
+struct sr_worker
+{
+    struct sr_ring ring;
+    struct sr_worker_slot* slots;
+    struct sr_instance* sr;
+    struct sr_workers* pool;
+    int id;
+    pthread_t thread;
+
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int sleeping;               /* set by the worker under lock */
+
+    uint32_t pending;           /* filled, not yet produced (rx only) */
+    unsigned long full;         /* dropped on a full queue (rx only) */
+    unsigned long packets;      /* worker only */
+};
+
+struct sr_workers
+{
+    int n;
+    int stop;
+    struct sr_worker* w[SR_MAX_WORKERS];
+};
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_worker_hash(..)
+ * Scope: Local
+ *
+ * Hash of the IPv4 5-tuple, or of the addresses alone for fragments and
+ * protocols without ports.  Symmetric, so both directions of a flow go to
+ * the same worker.  Everything that isn't IPv4 goes to worker 0.
+ *
+ *---------------------------------------------------------------------------*/
+
+static uint32_t sr_worker_hash(const uint8_t* buf, unsigned int len)
+{
+    const struct sr_ip_hdr* ip;
+    const uint8_t* l4;
+    uint32_t a, b = 0;
+    unsigned int hl;
+
+    if (len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr) ||
+        ((const struct sr_ethernet_hdr*)buf)->ether_type != htons(ethertype_ip))
+    { return 0; }
+
+    ip = (const struct sr_ip_hdr*)(buf + sizeof(struct sr_ethernet_hdr));
+    hl = ip->ip_hl * 4;
+    a  = ip->ip_src + ip->ip_dst;
+
+    if ((ip->ip_p == ip_protocol_tcp || ip->ip_p == ip_protocol_udp) &&
+        !(ip->ip_off & htons(IP_MF | IP_OFFMASK)) &&
+        len >= sizeof(struct sr_ethernet_hdr) + hl + 4)
+    {
+        l4 = (const uint8_t*)ip + hl;
+        b  = ((l4[0] << 8) | l4[1]) + ((l4[2] << 8) | l4[3]);
+    }
+    b |= (uint32_t)ip->ip_p << 17;
+
+    a = a * 0x9e3779b1 ^ b * 0x85ebca6b;
+    return a ^ (a >> 15);
+} /* -- sr_worker_hash -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_worker_main(..)
+ * Scope: Local
+ *
+ *---------------------------------------------------------------------------*/
+
+static void sr_worker_sleep(struct sr_worker* w)
+{
+    pthread_mutex_lock(&w->lock);
+    w->sleeping = 1;
+    /* -- pairs with the fence in sr_workers_dispatch -- */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    while (sr_ring_count(&w->ring) == 0 &&
+           !__atomic_load_n(&w->pool->stop, __ATOMIC_ACQUIRE))
+    { pthread_cond_wait(&w->wake, &w->lock); }
+    w->sleeping = 0;
+    pthread_mutex_unlock(&w->lock);
+} /* -- sr_worker_sleep -- */
+
+static void* sr_worker_main(void* arg)
+{
+    struct sr_worker* w = (struct sr_worker*)arg;
+    struct sr_instance* sr = w->sr;
+    struct sr_worker_slot* slot;
+    struct sr_frame frames[SR_BURST_SIZE];
+    unsigned int spins = 0;
+    uint32_t n, i;
+
+    sr_sched_forwarder(sr, w->id + 1);
+    if (sr_neigh_bind(sr) != 0)
+    { fprintf(stderr, "worker %d: sharing the first ARP replica\n", w->id); }
+
+    while (1)
+    {
+        if ((n = sr_ring_count(&w->ring)) == 0)
+        {
+            if (__atomic_load_n(&w->pool->stop, __ATOMIC_ACQUIRE))
+            { break; }
+            if (++spins < SR_WORKER_SPINS)
+            { sr_ring_relax(spins); }
+            else
+            {
+                sr_worker_sleep(w);
+                spins = 0;
+            }
+            continue;
+        }
+        spins = 0;
+        if (n > SR_BURST_SIZE)
+        { n = SR_BURST_SIZE; }
+
+        /* -- same tx batching as the single threaded receive loop -- */
+        if (sr->backend->flush)
+        {
+            pthread_mutex_lock(&(sr->tx_lock));
+            sr->tx_defer = 1;
+            pthread_mutex_unlock(&(sr->tx_lock));
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            slot = &w->slots[sr_ring_tail_slot(&w->ring, i)];
+            frames[i].buf   = slot->buf;
+            frames[i].len   = slot->len;
+            frames[i].iface = slot->iface;
+            frames[i].ifid  = slot->ifid;
+        }
+        sr_backend_input_burst(sr, frames, n);
+        sr_ring_consume(&w->ring, n);
+        w->packets += n;
+
+        /* -- ARP replies handled by another worker -- */
+        sr_neigh_poll(sr);
+
+        if (sr->backend->flush)
+        { sr_backend_flush(sr); }
+    }
+
+    sr_mbuf_cache_flush();
+    return 0;
+} /* -- sr_worker_main -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_workers_dispatch(..)
+ * Scope: Global
+ *
+ * Receive thread: spread a burst over the workers.  Frames that don't fit
+ * in their worker's queue are dropped.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_workers_dispatch(struct sr_instance* sr, struct sr_frame* frames,
+                         int n)
+{
+    struct sr_workers* pool;
+    struct sr_worker* w;
+    struct sr_worker_slot* slot;
+    int i;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(sr->workers);
+
+    pool = sr->workers;
+
+    for (i = 0; i < n; i++)
+    {
+        w = pool->w[sr_worker_hash(frames[i].buf, frames[i].len) % pool->n];
+
+        if (frames[i].len > SR_WORKER_FRAME_MAX ||
+            w->pending >= sr_ring_free(&w->ring))
+        {
+            w->full++;
+            SR_STAT_INC(sr, drops);
+            SR_EVENT(sr, SR_EV_DROP, SR_DROP_QUEUE_FULL, frames[i].buf,
+                     frames[i].len, frames[i].iface);
+            continue;
+        }
+
+        slot = &w->slots[sr_ring_head_slot(&w->ring, w->pending++)];
+        slot->len = frames[i].len;
+        strncpy(slot->iface, frames[i].iface, sr_IFACE_NAMELEN);
+        slot->ifid = frames[i].ifid;
+        memcpy(slot->buf, frames[i].buf, frames[i].len);
+    }
+
+    for (i = 0; i < pool->n; i++)
+    {
+        w = pool->w[i];
+        if (w->pending == 0)
+        { continue; }
+
+        sr_ring_produce(&w->ring, w->pending);
+        w->pending = 0;
+
+        /* -- pairs with the fence in sr_worker_sleep -- */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&w->sleeping, __ATOMIC_RELAXED))
+        {
+            pthread_mutex_lock(&w->lock);
+            pthread_cond_signal(&w->wake);
+            pthread_mutex_unlock(&w->lock);
+        }
+    }
+} /* -- sr_workers_dispatch -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_workers_start(..)
+ * Scope: Global
+ *
+ * Start nworkers threads; sr_backend_run() dispatches to them from then
+ * on.  Returns 0 on success, -1 on error.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_workers_start(struct sr_instance* sr, int nworkers)
+{
+    struct sr_workers* pool;
+    struct sr_worker* w;
+    int i;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(sr->backend);
+
+    if (nworkers < 1 || nworkers > SR_MAX_WORKERS)
+    {
+        fprintf(stderr, "Number of workers must be 1 to %d\n",
+                SR_MAX_WORKERS);
+        return -1;
+    }
+
+    pool = (struct sr_workers*)calloc(1, sizeof(struct sr_workers));
+    assert(pool);
+
+    for (i = 0; i < nworkers; i++)
+    {
+        if (posix_memalign((void**)&w, SR_CACHELINE,
+                           sizeof(struct sr_worker)) != 0)
+        { w = 0; }
+        assert(w);
+        memset(w, 0, sizeof(struct sr_worker));
+
+        w->slots = (struct sr_worker_slot*)malloc(SR_WORKER_SLOTS *
+                                             sizeof(struct sr_worker_slot));
+        assert(w->slots);
+        sr_ring_init(&w->ring, SR_WORKER_SLOTS);
+        w->sr   = sr;
+        w->pool = pool;
+        w->id   = i;
+        pthread_mutex_init(&w->lock, 0);
+        pthread_cond_init(&w->wake, 0);
+        pool->w[i] = w;
+    }
+    pool->n = nworkers;
+
+    for (i = 0; i < nworkers; i++)
+    {
+        if (pthread_create(&pool->w[i]->thread, 0, sr_worker_main,
+                           pool->w[i]) != 0)
+        {
+            perror("pthread_create(..):sr_worker.c::sr_workers_start");
+            /* -- let the ones already running exit -- */
+            pool->n = i;
+            sr->workers = pool;
+            sr_workers_stop(sr);
+            return -1;
+        }
+    }
+
+    sr->workers = pool;
+    printf("Forwarding with %d worker thread%s\n", nworkers,
+           nworkers > 1 ? "s" : "");
+    return 0;
+} /* -- sr_workers_start -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_workers_stop(..)
+ * Scope: Global
+ *
+ * Let the workers drain their queues, then join and free them.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_workers_stop(struct sr_instance* sr)
+{
+    struct sr_workers* pool;
+    struct sr_worker* w;
+    int i;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if ((pool = sr->workers) == 0)
+    { return; }
+
+    __atomic_store_n(&pool->stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < pool->n; i++)
+    {
+        w = pool->w[i];
+        pthread_mutex_lock(&w->lock);
+        pthread_cond_signal(&w->wake);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, 0);
+
+        fprintf(stderr, "worker %d: %lu frames, %lu dropped on a full queue\n",
+                w->id, w->packets, w->full);
+    }
+
+    /* -- includes workers that were set up but never started -- */
+    for (i = 0; i < SR_MAX_WORKERS && pool->w[i]; i++)
+    {
+        w = pool->w[i];
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->wake);
+        free(w->slots);
+        free(w);
+    }
+
+    free(pool);
+    sr->workers = 0;
+} /* -- sr_workers_stop -- */
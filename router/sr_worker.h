@@ -0,0 +1,37 @@
+/*-----------------------------------------------------------------------------
+ * File: sr_worker.h
+ *
+ * Description:
+ *
+ * Worker pool ("-W n").  The receive loop stops calling sr_handlepacket()
+ * itself; instead each frame is copied into the queue of one of n worker
+ * threads, picked by a hash of its IPv4 5-tuple, and the workers run the
+ * router.  All frames of a flow land on the same worker, so per-flow
+ * order is kept while different flows are forwarded in parallel.
+ *
+ * The queues are SPSC rings (sr_ring.h): the receive thread is the only
+ * producer, each worker the only consumer of its own.  The FIB and
+ * interface list are read-only once the router is up and shared as is;
+ * each worker looks neighbors up in its own ARP replica (sr_neigh.h).  Frames sent by a worker
+ * are batched per receive burst just like the single threaded loop does.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_WORKER_H
+#define SR_WORKER_H
+
+struct sr_instance;
+struct sr_frame;
+
+#define SR_MAX_WORKERS 32
+
+/* -- threads that may send, capture, log or record events: the workers,
+ *    the receive loop, the ARP timeout thread, the QoS pacer and the
+ *    capture, event and log writers -- */
+#define SR_MAX_THREADS (SR_MAX_WORKERS + 6)
+
+int  sr_workers_start(struct sr_instance* , int nworkers);
+void sr_workers_dispatch(struct sr_instance* , struct sr_frame* , int n);
+void sr_workers_stop(struct sr_instance* );
+
+#endif /* -- SR_WORKER_H -- */
@@ -197,4 +197,38 @@ typedef struct
 }__attribute__ ((__packed__)) c_auth_status;
 
 
+/* ******* Extensions ******** */
+#define VNS_CAPS          1024
+#define VNS_PACKET_BATCH  2048
+
+/* capability bits */
+#define VNS_CAP_PACKET_BATCH  0x00000001
+
+/* capabilities: a server that knows about extensions offers them right
+ * after VNSHWINFO, a client answers with the subset it will use.  Neither
+ * side uses an extension the other has not agreed to, and old clients
+ * ignore the offer. */
+typedef struct
+{
+    uint32_t mLen;
+    uint32_t mType;
+    uint32_t mCaps;
+}__attribute__ ((__packed__)) c_caps;
+
+/* packet batch: mCount frames, each preceded by a c_packet_batch_entry */
+#define VNS_BATCH_MAX_LEN (64*1024)
+
+typedef struct
+{
+    uint32_t mLen;
+    uint32_t mType;
+    uint32_t mCount;
+}__attribute__ ((__packed__)) c_packet_batch;
+
+typedef struct
+{
+    char     mInterfaceName[16];
+    uint32_t mLen;         /* frame bytes that follow */
+}__attribute__ ((__packed__)) c_packet_batch_entry;
+
 #endif  /* __VNSCOMMAND_H */